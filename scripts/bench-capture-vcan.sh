@@ -0,0 +1,86 @@
+#!/bin/bash
+
+# script is using for measuring whether canbus-app logs every frame of a fully
+# loaded bus; it prints sent/logged/lost per run and exits 1 when a run lost
+# frames. no results are recorded in the tree, and vcan only covers the
+# software path, not a real controller.
+# vcan has no bitrate, so cangen is paced to the frame rate of a 100% loaded
+# 500 kbit/s and 1 Mbit/s bus (extended id, 8 data bytes, no stuff bits) and
+# of a CAN FD bus with 500 kbit/s arbitration and 2 Mbit/s data phase
+# (extended id, 64 data bytes with BRS, ~8x the payload bytes/s).
+# usage: sudo ./bench-capture-vcan.sh [seconds-per-run]
+
+APP="$(cd "$(dirname "$0")/.." && pwd)/build/bin/canbus-app"
+IFACE="vcan0"
+DURATION="${1:-20}"
+FRAME_BITS=131
+# FD frame: bits sent at the arbitration rate / at the data rate
+FD_ARB_BITS=68
+FD_DATA_BITS=608
+FD_BITRATE=500000
+FD_DBITRATE=2000000
+
+if ! command -v cangen &> /dev/null; then
+	echo "cangen not found, install can-utils"
+	exit 1
+fi
+
+if ! ip link show $IFACE &> /dev/null; then
+	modprobe vcan
+	ip link add dev $IFACE type vcan
+	ip link set $IFACE txqueuelen 10000
+	ip link set up $IFACE
+fi
+# CAN FD frames need the 72 byte MTU
+ip link set $IFACE down
+ip link set $IFACE mtu 72
+ip link set up $IFACE
+
+WORKDIR=$(mktemp -d)
+cd $WORKDIR
+STATUS=0
+
+for BITRATE in 500000 1000000; do
+	FPS=$((BITRATE / FRAME_BITS))
+	COUNT=$((FPS * DURATION))
+	GAP=$(awk "BEGIN { printf \"%.4f\", 1000 / $FPS }")
+
+	rm -f canlog_*.asc
+	$APP -i $IFACE -n > app.log &
+	APP_PID=$!
+	sleep 1
+
+	cangen $IFACE -e -L 8 -I i -D i -g $GAP -n $COUNT
+	sleep 1
+	kill -TERM $APP_PID
+	wait $APP_PID
+
+	LOGGED=$(grep -h -c " Rx " canlog_*.asc | awk '{ s += $1 } END { print s + 0 }')
+	echo "bitrate=$BITRATE target=${FPS} frames/s sent=$COUNT logged=$LOGGED lost=$((COUNT - LOGGED))"
+	grep "Capture summary" app.log
+	[ "$LOGGED" -eq "$COUNT" ] || STATUS=1
+done
+
+FRAME_US=$(awk "BEGIN { print $FD_ARB_BITS * 1e6 / $FD_BITRATE + $FD_DATA_BITS * 1e6 / $FD_DBITRATE }")
+FPS=$(awk "BEGIN { printf \"%d\", 1e6 / $FRAME_US }")
+COUNT=$((FPS * DURATION))
+GAP=$(awk "BEGIN { printf \"%.4f\", $FRAME_US / 1000 }")
+
+rm -f canlog_*.asc
+$APP -i $IFACE -n > app.log &
+APP_PID=$!
+sleep 1
+
+cangen $IFACE -f -b -e -L 64 -I i -D i -g $GAP -n $COUNT
+sleep 1
+kill -TERM $APP_PID
+wait $APP_PID
+
+LOGGED=$(grep -h -c " CANFD .* Rx " canlog_*.asc | awk '{ s += $1 } END { print s + 0 }')
+echo "fd bitrate=$FD_BITRATE/$FD_DBITRATE target=${FPS} frames/s ($((FPS * 64)) bytes/s) sent=$COUNT logged=$LOGGED lost=$((COUNT - LOGGED))"
+grep "Capture summary" app.log
+[ "$LOGGED" -eq "$COUNT" ] || STATUS=1
+
+cd - > /dev/null
+rm -rf $WORKDIR
+exit $STATUS
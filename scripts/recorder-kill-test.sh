@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# script is using for checking that the flight recorder loses no committed
+# frame when canbus-app is killed with SIGKILL. cangen sends a known number
+# of frames on vcan0, the app is killed without any chance to flush and the
+# recorder file is dumped and counted.
+# usage: sudo ./recorder-kill-test.sh [frames]
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+APP="$ROOT/build/bin/canbus-app"
+DUMP="$ROOT/build/bin/host/recorder-dump"
+IFACE="vcan0"
+COUNT="${1:-100000}"
+
+if ! command -v cangen &> /dev/null; then
+	echo "cangen not found, install can-utils"
+	exit 1
+fi
+
+if ! ip link show $IFACE &> /dev/null; then
+	modprobe vcan
+	ip link add dev $IFACE type vcan
+	ip link set $IFACE txqueuelen 10000
+	ip link set up $IFACE
+fi
+
+WORKDIR=$(mktemp -d)
+cd $WORKDIR
+
+$APP -i $IFACE -n -R canrec.bin -M $((COUNT * 2)) > app.log &
+APP_PID=$!
+sleep 1
+
+cangen $IFACE -e -L 8 -I i -D i -g 0.05 -n $COUNT
+sleep 1
+kill -KILL $APP_PID
+wait $APP_PID 2> /dev/null
+
+$DUMP -o recorded.asc canrec.bin
+RECORDED=$(grep -c " Rx " recorded.asc)
+echo "sent=$COUNT recorded=$RECORDED"
+
+cd - > /dev/null
+rm -rf $WORKDIR
+
+[ "$RECORDED" -eq "$COUNT" ]
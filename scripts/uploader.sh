@@ -10,7 +10,9 @@ REMOTE_DIR="/home/iwave-tcu/canlogs"
 
 mkdir -p "$LOG_DIR" "$SENT_DIR"
 
-for file in "$LOG_DIR"/*.asc; do
+# canbus-app -U "$LOG_DIR" only renames complete segments into place;
+# event segments (-E) go first, sent ones are gone before the later globs
+for file in "$LOG_DIR"/event-* "$LOG_DIR"/*.asc "$LOG_DIR"/*.blf "$LOG_DIR"/*.cdl "$LOG_DIR"/*.gz; do
 	[ -e "$file" ] || continue
 
 	echo "Uploading $file ..."
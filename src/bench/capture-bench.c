@@ -0,0 +1,216 @@
+/*
+	Capture merge order without CAN hardware: the socket calls of
+	cyber-capture.o are wrapped at link time, each channel is an eventfd
+	that always polls ready and recvmmsg() hands out scripted frames once
+	the simulated clock has passed their stamp. The clock, which is also
+	what CLOCK_REALTIME reads, moves 300 us per epoll round and 40 us per
+	read, so frames land on a channel after its read and before the next
+	channel's.
+	Channel 0 averages 35 frames a round with a burst of 400 every 50
+	rounds, so its batches are partial with bursts that come back full
+	with more queued behind them; channels 1 and 2 are sparse. Every
+	frame has to arrive exactly once, in stamp order across all channels.
+	usage: capture-bench [frames on channel 0]
+*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/can.h>
+#include "../include/cyber-capture.h"
+
+#define BENCH_CHANNELS			3
+#define BENCH_ROUND_US			300
+#define BENCH_READ_US			40
+#define BENCH_BASE_SEC			1700000000
+
+struct bench_channel {
+	int fd;
+	uint64_t *us;			// stamps, in receive order
+	uint32_t count;
+	uint32_t read;			// handed out by recvmmsg()
+	uint32_t delivered;
+	uint64_t fullBatches;
+};
+
+static struct bench_channel bench[BENCH_CHANNELS];
+static int opened;
+static uint64_t nowUs;
+static uint64_t lastUs;
+static uint64_t total;
+static uint64_t delivered;
+static uint64_t outOfOrder;
+
+int __real_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
+int __real_clock_gettime(clockid_t clock, struct timespec *ts);
+
+int __wrap_socket(int domain, int type, int protocol)
+{
+	if (domain != PF_CAN || opened >= BENCH_CHANNELS)
+	{
+		errno = EAFNOSUPPORT;
+		return -1;
+	}
+	bench[opened].fd = eventfd(1, EFD_NONBLOCK);
+	return bench[opened++].fd;
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+
+	va_start(ap, request);
+	struct ifreq *ifr = va_arg(ap, struct ifreq *);
+	va_end(ap);
+	ifr->ifr_ifindex = 1;
+	return 0;
+}
+
+int __wrap_bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+	return 0;
+}
+
+int __wrap_setsockopt(int fd, int level, int name, const void *value, socklen_t len)
+{
+	return 0;
+}
+
+int __wrap_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	nowUs += BENCH_ROUND_US;
+	return __real_epoll_wait(epfd, events, maxevents, 0);
+}
+
+int __wrap_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	if (clock != CLOCK_REALTIME)
+		return __real_clock_gettime(clock, ts);
+	ts->tv_sec = BENCH_BASE_SEC + nowUs / 1000000;
+	ts->tv_nsec = nowUs % 1000000 * 1000;
+	return 0;
+}
+
+int __wrap_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags,
+	struct timespec *timeout)
+{
+	struct bench_channel *b = NULL;
+	unsigned int n = 0;
+
+	nowUs += BENCH_READ_US;
+	for (int i = 0; i < opened; i++)
+	{
+		if (bench[i].fd == fd)
+			b = &bench[i];
+	}
+	for (; n < vlen && b->read < b->count && b->us[b->read] <= nowUs; n++, b->read++)
+	{
+		struct msghdr *msg = &msgs[n].msg_hdr;
+		struct canfd_frame *frame = msg->msg_iov[0].iov_base;
+		struct timespec ts = { BENCH_BASE_SEC + b->us[b->read] / 1000000,
+			b->us[b->read] % 1000000 * 1000 };
+
+		memset(frame, 0, sizeof(*frame));
+		frame->can_id = 0x100 + (b - bench);
+		frame->len = 8;
+		memcpy(frame->data, &b->read, sizeof(b->read));
+		msgs[n].msg_len = CAN_MTU;
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SO_TIMESTAMPNS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(ts));
+		memcpy(CMSG_DATA(cmsg), &ts, sizeof(ts));
+		msg->msg_controllen = CMSG_SPACE(sizeof(ts));
+	}
+	if (n == 0)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	if (n == vlen)
+		b->fullBatches++;
+	return n;
+}
+
+static void checkFrame(const struct canfd_frame *frame, int channel, const struct timespec *ts)
+{
+	struct bench_channel *b = &bench[channel];
+	uint64_t us = (uint64_t)(ts->tv_sec - BENCH_BASE_SEC) * 1000000 + ts->tv_nsec / 1000;
+	uint32_t seq;
+
+	memcpy(&seq, frame->data, sizeof(seq));
+	if (seq != b->delivered || us < lastUs)
+	{
+		if (outOfOrder++ == 0)
+			printf("OUT OF ORDER: channel %d frame %u at %llu us after %llu us, "
+				"expected frame %u\n", channel, seq, (unsigned long long)us,
+				(unsigned long long)lastUs, b->delivered);
+	}
+	b->delivered = seq + 1;
+	lastUs = us;
+	if (++delivered == total)
+		captureStop();
+}
+
+// every burstEvery frames, burst frames 1 us apart
+static void script(struct bench_channel *b, uint32_t count, uint32_t minUs, uint32_t maxUs,
+	uint32_t burstEvery, uint32_t burst)
+{
+	uint64_t us = BENCH_ROUND_US;
+
+	b->us = malloc(count * sizeof(*b->us));
+	b->count = count;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		us += burstEvery && i % burstEvery < burst ? 1 : minUs + rand() % (maxUs - minUs + 1);
+		b->us[i] = us;
+	}
+	total += count;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+	char iface[IFNAMSIZ];
+	struct capture_stats st;
+
+	if (frames == 0)
+		return 1;
+	srand(1);
+	// 10..14 us apart, a round is 420 us with the reads
+	script(&bench[0], frames, 10, 14, 2000, 400);
+	for (int i = 1; i < BENCH_CHANNELS; i++)
+		script(&bench[i], frames / 20, 20, 380, 0, 0);
+
+	for (int i = 0; i < BENCH_CHANNELS; i++)
+	{
+		snprintf(iface, sizeof(iface), "bench%d", i);
+		if (captureOpen(iface, i) != 0)
+			return 1;
+	}
+	if (captureRun(checkFrame) != 0)
+		return 1;
+	captureGetStats(-1, &st);
+	captureClose();
+
+	if (outOfOrder != 0 || delivered != total || st.frames != total)
+	{
+		printf("FAILED: %llu of %llu frames delivered, %llu out of order\n",
+			(unsigned long long)delivered, (unsigned long long)total,
+			(unsigned long long)outOfOrder);
+		return 1;
+	}
+	printf("merge ok: %llu frames on %d channels in stamp order, %llu full batches on "
+		"channel 0, %llu reads\n", (unsigned long long)total, BENCH_CHANNELS,
+		(unsigned long long)bench[0].fullBatches, (unsigned long long)st.batches);
+	for (int i = 0; i < BENCH_CHANNELS; i++)
+		free(bench[i].us);
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+	Compares the compact delta log with the ASC text canbus-app writes
+	for the frames of a BLF file: size ratio, encode and decode ns/frame.
+	The decoded frames are checked against the input, with a capture gap
+	record after every BENCH_GAP_EVERY frames.
+	usage: cdl-bench file.blf [rounds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include "../include/cyber-blf-reader.h"
+#include "../include/cyber-asc.h"
+#include "../include/cyber-cdl.h"
+
+#define BENCH_GAP_EVERY			1000
+
+struct frame_list {
+	struct blf_frame *frames;
+	size_t count;
+	size_t capacity;
+};
+
+static uint8_t *outBuffer;
+static size_t outUsed;
+static size_t outSize;
+
+static int collectFrame(const struct blf_frame *f, void *arg)
+{
+	struct frame_list *l = arg;
+
+	if (l->count == l->capacity)
+	{
+		size_t capacity = l->capacity ? l->capacity * 2 : 65536;
+		struct blf_frame *frames = realloc(l->frames, capacity * sizeof(*frames));
+		if (frames == NULL)
+			return -1;
+		l->frames = frames;
+		l->capacity = capacity;
+	}
+	l->frames[l->count++] = *f;
+	return 0;
+}
+
+static int memoryOutput(const void *data, size_t len)
+{
+	if (outUsed + len > outSize)
+		return -1;
+	memcpy(outBuffer + outUsed, data, len);
+	outUsed += len;
+	return 0;
+}
+
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void frameTime(const struct timespec *start, uint64_t ns, struct timespec *ts)
+{
+	ns += start->tv_nsec;
+	ts->tv_sec = start->tv_sec + ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+// gapEvery 0: frames only
+static int encode(struct cdl_writer *w, const struct frame_list *l, const struct timespec *start,
+	size_t gapEvery)
+{
+	outUsed = 0;
+	if (cdlWriterStart(w, start) != 0)
+		return -1;
+	for (size_t i = 0; i < l->count; i++)
+	{
+		const struct blf_frame *f = &l->frames[i];
+		struct timespec ts;
+
+		frameTime(start, f->ns, &ts);
+		if (cdlAddFrame(w, &ts, f->channel, f->canId, f->flags, f->len, f->data) != 0)
+			return -1;
+		if (gapEvery != 0 && (i + 1) % gapEvery == 0 &&
+			cdlAddGap(w, &ts, f->channel, i + 1, (i + 1) / gapEvery) != 0)
+			return -1;
+	}
+	return cdlFlushBlock(w);
+}
+
+struct verify_state {
+	const struct frame_list *list;
+	size_t next;
+	size_t gaps;
+	size_t mismatches;
+};
+
+static int verifyFrame(const struct cdl_frame *f, void *arg)
+{
+	struct verify_state *v = arg;
+	const struct blf_frame *o;
+
+	if (f->flags & CDL_FRAME_GAP)
+	{
+		// follows the frame it was stamped with
+		o = &v->list->frames[v->next - 1];
+		if (v->next % BENCH_GAP_EVERY != 0 ||
+			f->ns != (int64_t)(o->ns / CDL_TICK_NS * CDL_TICK_NS) || f->channel != o->channel || f->socketLost != v->next ||
+			f->ringLost != v->next / BENCH_GAP_EVERY)
+			v->mismatches++;
+		v->gaps++;
+		return 0;
+	}
+
+	o = &v->list->frames[v->next++];
+	if (f->ns != (int64_t)(o->ns / CDL_TICK_NS * CDL_TICK_NS) || f->channel != o->channel ||
+		f->canId != o->canId || f->flags != o->flags || f->len != o->len ||
+		memcmp(f->data, o->data, o->len) != 0)
+		v->mismatches++;
+	return 0;
+}
+
+static int countFrame(const struct cdl_frame *f, void *arg)
+{
+	(*(uint64_t *)arg) += f->len;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct frame_list list = { 0 };
+	struct blf_reader reader;
+	struct cdl_writer writer;
+	struct cdl_decode_info info;
+	struct verify_state verify = { &list, 0, 0, 0 };
+	int rounds = argc > 2 ? atoi(argv[2]) : 20;
+	uint64_t ascBytes = 0;
+	uint64_t sink = 0;
+	char line[ASC_LINE_MAX];
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s file.blf [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	if (blfReaderOpen(&reader, argv[1]) != 0)
+		return 1;
+	if (blfReaderRun(&reader, BLF_READER_THREADS, collectFrame, &list) != 0 || list.count == 0)
+	{
+		printf("No frames read from %s\n", argv[1]);
+		blfReaderClose(&reader);
+		return 1;
+	}
+	struct timespec start = reader.start;
+	blfReaderClose(&reader);
+
+	// the ASC segment canbus-app would write, header included
+	time_t base = start.tv_sec;
+	ascBytes = snprintf(line, sizeof(line),
+		"date,%sbase hex timestamps absolute\nno interval events logged\n", ctime(&base));
+	for (size_t i = 0; i < list.count; i++)
+	{
+		const struct blf_frame *f = &list.frames[i];
+		if (f->flags & BLF_FRAME_FD)
+			ascBytes += ascFormatFdFrame(line, f->ns / 1000000000, f->ns % 1000000000,
+				f->channel, f->canId, "Rx", f->flags & BLF_FRAME_BRS,
+				f->flags & BLF_FRAME_ESI, f->len, f->data);
+		else
+			ascBytes += ascFormatFrame(line, f->ns / 1000000000, f->ns % 1000000000,
+				f->channel, f->canId, "Rx", f->len, f->data);
+	}
+
+	outSize = CDL_FILE_HEADER_SIZE + (list.count + list.count / BENCH_GAP_EVERY) *
+		(CDL_RECORD_MAX + CDL_BLOCK_HEADER_SIZE);
+	outBuffer = malloc(outSize);
+	if (outBuffer == NULL || cdlWriterInit(&writer, memoryOutput) != 0)
+		return 1;
+
+	// round trip with gap records first, the timed rounds leave the plain segment
+	if (encode(&writer, &list, &start, BENCH_GAP_EVERY) != 0 ||
+		cdlDecode(outBuffer, outUsed, verifyFrame, &verify, &info) != 0 ||
+		verify.next != list.count || verify.gaps != list.count / BENCH_GAP_EVERY ||
+		info.gaps != verify.gaps || verify.mismatches != 0)
+	{
+		printf("Round trip FAILED: %s, %zu of %zu frames, %zu gaps, %zu mismatches\n",
+			cdlErrorString(info.error), verify.next, list.count, verify.gaps,
+			verify.mismatches);
+		return 1;
+	}
+
+	double t0 = nowNs();
+	for (int r = 0; r < rounds; r++)
+	{
+		if (encode(&writer, &list, &start, 0) != 0)
+		{
+			printf("Encoding failed\n");
+			return 1;
+		}
+	}
+	double encodeNs = (nowNs() - t0) / ((double)rounds * list.count);
+
+	t0 = nowNs();
+	for (int r = 0; r < rounds; r++)
+		cdlDecode(outBuffer, outUsed, countFrame, &sink, &info);
+	double decodeNs = (nowNs() - t0) / ((double)rounds * list.count);
+
+	// reference: the same segment through the segment worker's gzip
+	uLongf gzLen = compressBound(outUsed);
+	uint8_t *gz = malloc(gzLen);
+	if (gz != NULL && compress2(gz, &gzLen, outBuffer, outUsed, 6) != Z_OK)
+		gzLen = 0;
+
+	printf("%zu frames, %u blocks\n", list.count, info.blocks);
+	printf("ASC  %10llu bytes  %6.1f bytes/frame\n", (unsigned long long)ascBytes,
+		(double)ascBytes / list.count);
+	printf("CDL  %10zu bytes  %6.1f bytes/frame  %5.1fx smaller than ASC\n", outUsed,
+		(double)outUsed / list.count, (double)ascBytes / outUsed);
+	if (gzLen > 0)
+		printf("CDL+zlib %6lu bytes  %6.1f bytes/frame  %5.1fx smaller than ASC\n",
+			(unsigned long)gzLen, (double)gzLen / list.count, (double)ascBytes / gzLen);
+	printf("encode %.1f ns/frame, decode %.1f ns/frame (%d rounds), round trip ok\n",
+		encodeNs, decodeNs, rounds);
+
+	free(gz);
+	free(outBuffer);
+	free(list.frames);
+	cdlWriterFree(&writer);
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*
+	Decoded signals/s of the DBC decoder. Without a DBC argument a
+	J1939-like database of 300 messages is generated (Intel and Motorola,
+	signed, multiplexed and CAN FD messages). Every decoded value is
+	checked against a bit-by-bit reference decoder first.
+	usage: dbc-bench [file.dbc] [frames]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include "../include/cyber-dbc.h"
+#include "dbc-reference.h"
+
+#define BENCH_MESSAGES			300
+#define BENCH_MUX_MESSAGES		20
+#define BENCH_FD_MESSAGES		10
+#define BENCH_ROUNDS			10
+
+struct bench_frame {
+	uint32_t canId;
+	uint8_t len;
+	uint8_t data[CANFD_MAX_DLEN];
+};
+
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+	Writes signals of 1..16 bits (up to 32 for FD messages) from bit
+	firstBit on until the payload is full. Motorola start bits are the
+	MSB in sawtooth numbering.
+*/
+static int writeSignals(FILE *fp, int msg, int firstBit, int bytes, const char *mux,
+	int bigEndian)
+{
+	static const double factors[] = { 1, 0.1, 0.125, 0.5, 0.05, 2 };
+	int bit = firstBit;
+	int n = 0;
+
+	while (1)
+	{
+		int length = 1 + rand() % (bytes > 8 ? 32 : 16);
+		if (bit + length > bytes * 8)
+			break;
+
+		// linear MSB-first position of the first bit -> sawtooth start bit
+		int start = bigEndian ? (bit / 8) * 8 + 7 - bit % 8 : bit;
+		int isSigned = length > 4 && rand() % 3 == 0;
+		fprintf(fp, " SG_ S%d_%d%s : %d|%d@%c%c (%g,%d) [0|0] \"\" Vector__XXX\n",
+			msg, n, mux, start, length, bigEndian ? '0' : '1', isSigned ? '-' : '+',
+			factors[rand() % 6], rand() % 3 == 0 ? -40 : 0);
+		bit += length;
+		n++;
+	}
+	return n;
+}
+
+static int generateDbc(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+	int signals = 0;
+
+	if (fp == NULL)
+		return -1;
+
+	fprintf(fp, "VERSION \"\"\n\nNS_ :\n\nBS_:\n\nBU_: ECU\n\n");
+	srand(7);
+	for (int i = 0; i < BENCH_MESSAGES; i++)
+	{
+		// priority 6, PDU2 PGNs 0xFF00.., source addresses 0x00..
+		uint32_t id = 0x18000000 | ((0xFF00 + i / 4) << 8) | (i % 4) * 0x11;
+		int fd = i >= BENCH_MESSAGES - BENCH_FD_MESSAGES;
+		int bytes = fd ? 64 : 8;
+		int bigEndian = i % 3 == 0;
+
+		fprintf(fp, "BO_ %u M%d: %d ECU\n", id | CAN_EFF_FLAG, i, bytes);
+		if (i < BENCH_MUX_MESSAGES)
+		{
+			fprintf(fp, " SG_ Mux%d M : %d|8@%c+ (1,0) [0|3] \"\" Vector__XXX\n", i,
+				bigEndian ? 7 : 0, bigEndian ? '0' : '1');
+			for (int v = 0; v < 4; v++)
+			{
+				char mux[8];
+				snprintf(mux, sizeof(mux), " m%d", v);
+				signals += 1 + writeSignals(fp, i * 10 + v, 8, bytes, mux, bigEndian);
+			}
+		}
+		else
+			signals += writeSignals(fp, i, 0, bytes, "", bigEndian);
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+	return signals;
+}
+
+static int checkParity(struct dbc *db, const struct bench_frame *frames, int count)
+{
+	static struct dbc_value values[DBC_MAX_MESSAGE_SIGNALS];
+	uint64_t checked = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		const struct bench_frame *f = &frames[i];
+		int n = dbcDecodeFrame(db, f->canId, f->data, f->len, values);
+
+		for (int k = 0; k < n; k++)
+		{
+			double ref = referenceDecode(db, values[k].signal, f->data);
+			if (memcmp(&ref, &values[k].value, sizeof(ref)) != 0 &&
+				!(ref != ref && values[k].value != values[k].value))
+			{
+				printf("MISMATCH %s.%s: %.17g != reference %.17g\n",
+					db->messages[db->info[values[k].signal].message].name,
+					db->info[values[k].signal].name, values[k].value, ref);
+				return -1;
+			}
+			checked++;
+		}
+	}
+	printf("parity ok: %llu values match the bit-by-bit decoder\n",
+		(unsigned long long)checked);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct dbc_value values[DBC_MAX_MESSAGE_SIGNALS];
+	char path[] = "/tmp/dbc-bench-XXXXXX";
+	const char *dbcPath = argc > 1 ? argv[1] : NULL;
+	int count = argc > 2 ? atoi(argv[2]) : 1000000;
+	struct bench_frame *frames;
+	struct dbc db;
+	double sink = 0;
+
+	if (dbcPath == NULL)
+	{
+		int fd = mkstemp(path);
+		if (fd < 0)
+			return 1;
+		close(fd);
+		generateDbc(path);
+		dbcPath = path;
+	}
+	if (dbcLoad(&db, dbcPath) != 0)
+		return 1;
+	if (dbcPath == path)
+		unlink(path);
+	if (db.messageCount == 0)
+		return 1;
+
+	frames = malloc(count * sizeof(*frames));
+	if (frames == NULL)
+		return 1;
+	srand(1);
+	for (int i = 0; i < count; i++)
+	{
+		const struct dbc_message *m = &db.messages[rand() % db.messageCount];
+		struct bench_frame *f = &frames[i];
+
+		f->canId = m->id;
+		f->len = m->dlc > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : m->dlc;
+		for (int k = 0; k < CANFD_MAX_DLEN; k++)
+			f->data[k] = rand();
+		// multiplexed frames cycle through the defined values
+		if (m->groupCount > 0)
+		{
+			const struct dbc_signal *s = &db.signals[m->mux];
+			uint64_t v = db.groups[m->firstGroup + rand() % m->groupCount].value;
+			int bit = db.info[m->mux].startBit;
+			for (int b = 0; b < s->length; b++)
+			{
+				int shift = (s->flags & DBC_SIGNAL_BIG_ENDIAN) ? s->length - 1 - b : b;
+				uint8_t mask = 1 << (bit % 8);
+				f->data[bit / 8] = (f->data[bit / 8] & ~mask) | (((v >> shift) & 1) << (bit % 8));
+				if (s->flags & DBC_SIGNAL_BIG_ENDIAN)
+					bit = bit % 8 == 0 ? bit + 15 : bit - 1;
+				else
+					bit++;
+			}
+		}
+	}
+
+	if (checkParity(&db, frames, count < 100000 ? count : 100000) != 0)
+		return 1;
+
+	memset(&db.stats, 0, sizeof(db.stats));
+	double t0 = nowNs();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			int n = dbcDecodeFrame(&db, frames[i].canId, frames[i].data, frames[i].len, values);
+			if (n > 0)
+				sink += values[n - 1].value;
+		}
+	}
+	double ns = nowNs() - t0;
+
+	printf("%u messages, %u signals, %d frames x %d rounds\n", db.messageCount,
+		db.signalCount, count, BENCH_ROUNDS);
+	printf("%.1f ns/frame, %.2f ns/signal, %.1f M signals/s, %.2f M frames/s\n",
+		ns / db.stats.frames, ns / db.stats.signals, db.stats.signals / ns * 1e3,
+		db.stats.frames / ns * 1e3);
+	printf("(checksum %g)\n", sink);
+
+	free(frames);
+	dbcFree(&db);
+	return 0;
+}
@@ -0,0 +1,181 @@
+/*
+	Generated decoders (dbc-gen, built from $(DBC)) against the table
+	driven cyber-dbc.c decoder on the same DBC. Every value of both is
+	checked bit for bit against the bit-by-bit reference decoder before
+	anything is timed.
+	usage: dbc-gen-bench file.dbc [frames]	(the DBC the build used)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/can.h>
+#include "../include/cyber-dbc.h"
+#include "dbc-decode.h"
+#include "dbc-reference.h"
+
+#define BENCH_ROUNDS			10
+#define BENCH_SHORT_EVERY		16	// every 16th frame is cut short
+
+struct bench_frame {
+	uint32_t canId;
+	uint8_t len;
+	uint8_t data[CANFD_MAX_DLEN];
+};
+
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void setMux(const struct dbc *db, const struct dbc_message *m, struct bench_frame *f)
+{
+	const struct dbc_signal *s = &db->signals[m->mux];
+	uint64_t v = db->groups[m->firstGroup + rand() % m->groupCount].value;
+	int bit = db->info[m->mux].startBit;
+
+	for (int b = 0; b < s->length; b++)
+	{
+		int shift = (s->flags & DBC_SIGNAL_BIG_ENDIAN) ? s->length - 1 - b : b;
+		uint8_t mask = 1 << (bit % 8);
+		f->data[bit / 8] = (f->data[bit / 8] & ~mask) | (((v >> shift) & 1) << (bit % 8));
+		if (s->flags & DBC_SIGNAL_BIG_ENDIAN)
+			bit = bit % 8 == 0 ? bit + 15 : bit - 1;
+		else
+			bit++;
+	}
+}
+
+static int sameValue(double a, double b)
+{
+	return memcmp(&a, &b, sizeof(a)) == 0 || (a != a && b != b);
+}
+
+static int checkParity(struct dbc *db, const struct bench_frame *frames, int count)
+{
+	static struct dbc_value table[DBC_MAX_MESSAGE_SIGNALS];
+	static struct dbc_value gen[DBC_MAX_MESSAGE_SIGNALS];
+	uint64_t checked = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		const struct bench_frame *f = &frames[i];
+		int n = dbcDecodeFrame(db, f->canId, f->data, f->len, table);
+		int g = dbcGenDecode(f->canId, f->data, f->len, gen);
+
+		if (n != g)
+		{
+			printf("MISMATCH id 0x%X len %u: %d values, generated %d\n",
+				f->canId & CAN_EFF_MASK, f->len, n, g);
+			return -1;
+		}
+		for (int k = 0; k < n; k++)
+		{
+			double ref = referenceDecode(db, table[k].signal, f->data);
+			if (gen[k].signal != table[k].signal || !sameValue(gen[k].value, ref) ||
+				!sameValue(table[k].value, ref))
+			{
+				printf("MISMATCH %s: table %.17g generated %.17g (%s) reference %.17g\n",
+					dbcGenSignalNames[table[k].signal], table[k].value, gen[k].value,
+					dbcGenSignalNames[gen[k].signal], ref);
+				return -1;
+			}
+			checked++;
+		}
+	}
+	printf("parity ok: %llu values, generated == table == bit-by-bit reference\n",
+		(unsigned long long)checked);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct dbc_value values[DBC_MAX_MESSAGE_SIGNALS];
+	int count = argc > 2 ? atoi(argv[2]) : 1000000;
+	struct bench_frame *frames;
+	struct dbc db;
+	double sink = 0;
+	uint64_t signals = 0;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s file.dbc [frames]\n", argv[0]);
+		return 1;
+	}
+	if (dbcLoad(&db, argv[1]) != 0)
+		return 1;
+	if (db.messageCount != DBC_GEN_MESSAGES || db.signalCount != DBC_GEN_SIGNALS)
+	{
+		printf("%s is not the DBC the decoders were generated from\n", argv[1]);
+		return 1;
+	}
+
+	frames = malloc(count * sizeof(*frames));
+	if (frames == NULL)
+		return 1;
+	srand(1);
+	for (int i = 0; i < count; i++)
+	{
+		const struct dbc_message *m = &db.messages[rand() % db.messageCount];
+		struct bench_frame *f = &frames[i];
+
+		f->canId = m->id;
+		f->len = m->dlc > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : m->dlc;
+		for (int k = 0; k < CANFD_MAX_DLEN; k++)
+			f->data[k] = rand();
+		if (m->groupCount > 0)
+			setMux(&db, m, f);
+		// the parity run also covers frames shorter than the DBC says
+		if (i % BENCH_SHORT_EVERY == 0 && i < 100000)
+			f->len = rand() % (f->len + 1);
+	}
+
+	if (checkParity(&db, frames, count < 100000 ? count : 100000) != 0)
+		return 1;
+	for (int i = 0; i < count; i++)
+	{
+		const struct dbc_message *m = dbcFindMessage(&db, frames[i].canId);
+		frames[i].len = m->dlc > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : m->dlc;
+	}
+
+	double t0 = nowNs();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			int n = dbcDecodeFrame(&db, frames[i].canId, frames[i].data, frames[i].len, values);
+			signals += n;
+			if (n > 0)
+				sink += values[n - 1].value;
+		}
+	}
+	double tableNs = nowNs() - t0;
+
+	t0 = nowNs();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			int n = dbcGenDecode(frames[i].canId, frames[i].data, frames[i].len, values);
+			if (n > 0)
+				sink += values[n - 1].value;
+		}
+	}
+	double genNs = nowNs() - t0;
+
+	double frameCount = (double)count * BENCH_ROUNDS;
+	printf("%u messages, %u signals, %d frames x %d rounds, %.1f signals/frame\n",
+		db.messageCount, db.signalCount, count, BENCH_ROUNDS, signals / frameCount);
+	printf("table     %6.1f ns/frame  %6.1f M signals/s\n", tableNs / frameCount,
+		signals / tableNs * 1e3);
+	printf("generated %6.1f ns/frame  %6.1f M signals/s  (%.1fx)\n", genNs / frameCount,
+		signals / genNs * 1e3, tableNs / genNs);
+	printf("(checksum %g)\n", sink);
+
+	free(frames);
+	dbcFree(&db);
+	return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef DBC_REFERENCE_H
+#define DBC_REFERENCE_H
+
+#include <string.h>
+#include "../include/cyber-dbc.h"
+
+/*
+	Walks the bits one at a time, the way the DBC format describes them.
+*/
+static inline double referenceDecode(const struct dbc *db, uint32_t index, const uint8_t *data)
+{
+	const struct dbc_signal *s = &db->signals[index];
+	int bit = db->info[index].startBit;
+	uint64_t raw = 0;
+	double value;
+
+	for (int i = 0; i < s->length; i++)
+	{
+		if (s->flags & DBC_SIGNAL_BIG_ENDIAN)
+		{
+			raw = (raw << 1) | ((data[bit / 8] >> (bit % 8)) & 1);
+			bit = bit % 8 == 0 ? bit + 15 : bit - 1;
+		}
+		else
+		{
+			raw |= (uint64_t)((data[bit / 8] >> (bit % 8)) & 1) << i;
+			bit++;
+		}
+	}
+
+	if (s->flags & DBC_SIGNAL_FLOAT)
+	{
+		uint32_t v32 = raw;
+		float f;
+		memcpy(&f, &v32, sizeof(f));
+		value = f;
+	}
+	else if (s->flags & DBC_SIGNAL_DOUBLE)
+		memcpy(&value, &raw, sizeof(value));
+	else if ((s->flags & DBC_SIGNAL_SIGNED) && s->length < 64 && (raw >> (s->length - 1)))
+		value = (double)(int64_t)(raw | (~0ULL << s->length));
+	else if (s->flags & DBC_SIGNAL_SIGNED)
+		value = (double)(int64_t)raw;
+	else
+		value = (double)raw;
+	return value * s->factor + s->offset;
+}
+
+#endif // DBC_REFERENCE_H
@@ -0,0 +1,522 @@
+/*
+	J1939 TP reassembly under load: rounds of BENCH_CONCURRENT BAM and
+	RTS/CTS transfers on five channels, their frames interleaved at
+	random with other traffic. Some transfers are aborted, lose a packet
+	(and time out) or see packets twice. Every reassembled PGN is checked
+	against what was sent and every counter against the expected one,
+	then the same frames are replayed for timing. The pool is sized
+	above BENCH_CONCURRENT; a last check overruns it on purpose.
+	Finally a BAM DM1 at TP priority 7 is decoded against the DBC, which
+	lists DM1_BCM at priority 6, with the table and generated decoders.
+	usage: j1939-bench [rounds] [file.dbc]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/can.h>
+#include "../include/cyber-j1939.h"
+#include "../include/cyber-dbc.h"
+#include "dbc-decode.h"
+
+#define BENCH_CHANNELS			5
+#define BENCH_CONCURRENT		240
+#define BENCH_POOL			256
+#define BENCH_FRAME_NS			20000		// 20 us per frame, all channels
+#define BENCH_CTS_WINDOW		16
+#define BENCH_SESSION_FRAMES		560		// RTS, 16 CTS, EOMA, 255 DT twice at most
+#define BENCH_DM1_ID			0x98FECA30u	// DM1_BCM in tcu.dbc, priority 6
+
+#define FATE_COMPLETE			0
+#define FATE_DUPLICATES			1
+#define FATE_ABORT			2		// RTS/CTS only
+#define FATE_LOST			3		// one packet never sent, times out
+
+struct bench_frame {
+	uint64_t ns;
+	uint32_t canId;
+	uint8_t channel;
+	uint8_t len;
+	uint8_t data[8];
+};
+
+struct bench_session {
+	uint32_t pgn;
+	uint16_t size;
+	uint8_t channel;
+	uint8_t sa;
+	uint8_t da;
+	uint8_t mode;
+	int fate;
+	int completed;
+	uint8_t data[J1939_MAX_DATA];
+
+	struct bench_frame frames[BENCH_SESSION_FRAMES];
+	int count;
+	int next;
+};
+
+struct bench_expect {
+	uint64_t completed;
+	uint64_t aborted;
+	uint64_t timeouts;
+	uint64_t duplicates;
+	uint64_t bytes;
+	uint64_t other;			// non-TP frames
+};
+
+static struct bench_session sessions[BENCH_CONCURRENT];
+static uint16_t lookup[BENCH_CHANNELS * 256 * 256];	// (channel, sa, da) -> session + 1
+static uint64_t mismatches;
+static uint64_t callbacks;
+
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct bench_frame *addFrame(struct bench_session *s, uint32_t canId)
+{
+	struct bench_frame *f = &s->frames[s->count++];
+
+	f->canId = canId | CAN_EFF_FLAG;
+	f->channel = s->channel;
+	f->len = 8;
+	return f;
+}
+
+static void controlFrame(struct bench_session *s, int fromReceiver, uint8_t control,
+	uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4)
+{
+	uint8_t from = fromReceiver ? s->da : s->sa;
+	uint8_t to = fromReceiver ? s->sa : s->da;
+	struct bench_frame *f = addFrame(s, 0x1CEC0000 | to << 8 | from);
+
+	f->data[0] = control;
+	f->data[1] = b1;
+	f->data[2] = b2;
+	f->data[3] = b3;
+	f->data[4] = b4;
+	f->data[5] = s->pgn;
+	f->data[6] = s->pgn >> 8;
+	f->data[7] = s->pgn >> 16;
+}
+
+static void dataFrame(struct bench_session *s, int seq)
+{
+	struct bench_frame *f = addFrame(s, 0x1CEB0000 | s->da << 8 | s->sa);
+	int offset = (seq - 1) * 7;
+
+	f->data[0] = seq;
+	memset(f->data + 1, 0xFF, 7);
+	memcpy(f->data + 1, s->data + offset, s->size - offset < 7 ? s->size - offset : 7);
+}
+
+/*
+	Session k of a round: every (channel, sa) has one BAM and one RTS/CTS
+	transfer, so lookups walk chains of two.
+*/
+static void buildSession(struct bench_session *s, int k, int round, struct bench_expect *e)
+{
+	int packets;
+	int lost = 0;
+	int abortAfter = 0;
+
+	s->channel = k % BENCH_CHANNELS;
+	s->sa = (k / BENCH_CHANNELS) % (BENCH_CONCURRENT / BENCH_CHANNELS / 2) + round * 3;
+	s->mode = k < BENCH_CONCURRENT / 2 ? J1939_MODE_BAM : J1939_MODE_CMDT;
+	s->da = s->mode == J1939_MODE_BAM ? J1939_ADDRESS_GLOBAL : 0xE0 + rand() % 16;
+	s->pgn = s->mode == J1939_MODE_BAM ? 0xFE00 + rand() % 0x100 : 0xEF00;
+	s->size = 9 + rand() % (J1939_MAX_DATA - 8);
+	s->completed = 0;
+	s->count = 0;
+	s->next = 0;
+	for (int i = 0; i < s->size; i++)
+		s->data[i] = rand();
+	packets = (s->size + 6) / 7;
+
+	int r = rand() % 20;
+	s->fate = r < 14 ? FATE_COMPLETE : r < 17 ? FATE_DUPLICATES : r < 18 ? FATE_LOST :
+		s->mode == J1939_MODE_CMDT ? FATE_ABORT : FATE_LOST;
+	if (s->fate == FATE_LOST)
+		lost = 1 + rand() % packets;
+	if (s->fate == FATE_ABORT)
+		abortAfter = rand() % packets;
+
+	if (s->mode == J1939_MODE_BAM)
+		controlFrame(s, 0, J1939_TP_BAM, s->size, s->size >> 8, packets, 0xFF);
+	else
+		controlFrame(s, 0, J1939_TP_RTS, s->size, s->size >> 8, packets, BENCH_CTS_WINDOW);
+
+	for (int seq = 1; seq <= packets; seq++)
+	{
+		if (s->fate == FATE_ABORT && seq == abortAfter + 1)
+		{
+			controlFrame(s, rand() % 2, J1939_TP_ABORT, 3, 0xFF, 0xFF, 0xFF);
+			e->aborted++;
+			return;
+		}
+		if (s->mode == J1939_MODE_CMDT && (seq - 1) % BENCH_CTS_WINDOW == 0)
+		{
+			int window = packets - seq + 1 < BENCH_CTS_WINDOW ? packets - seq + 1 : BENCH_CTS_WINDOW;
+			controlFrame(s, 1, J1939_TP_CTS, window, seq, 0xFF, 0xFF);
+		}
+		if (seq == lost)
+			continue;
+		dataFrame(s, seq);
+		// a resent packet; the last one would arrive after completion
+		if (s->fate == FATE_DUPLICATES && seq < packets && rand() % 8 == 0)
+		{
+			dataFrame(s, seq);
+			e->duplicates++;
+		}
+	}
+
+	if (s->fate == FATE_LOST)
+	{
+		e->timeouts++;
+		return;
+	}
+	if (s->mode == J1939_MODE_CMDT)
+		controlFrame(s, 1, J1939_TP_EOMA, s->size, s->size >> 8, packets, 0xFF);
+	e->completed++;
+	e->bytes += s->size;
+}
+
+static void checkComplete(const struct j1939_message *msg, void *arg)
+{
+	uint16_t i = lookup[(msg->channel * 256 + msg->sa) * 256 + msg->da];
+	struct bench_session *s = i ? &sessions[i - 1] : NULL;
+
+	callbacks++;
+	if (s == NULL || s->completed || msg->pgn != s->pgn || msg->len != s->size ||
+		msg->mode != s->mode || (s->fate != FATE_COMPLETE && s->fate != FATE_DUPLICATES) ||
+		memcmp(msg->data, s->data, s->size) != 0)
+	{
+		if (mismatches++ == 0)
+			printf("MISMATCH channel %d SA %02X DA %02X PGN %X len %u\n", msg->channel,
+				msg->sa, msg->da, msg->pgn, msg->len);
+		return;
+	}
+	s->completed = 1;
+}
+
+static void countComplete(const struct j1939_message *msg, void *arg)
+{
+	callbacks++;
+}
+
+static void toTimespec(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+/*
+	Interleaves the frames of all sessions of a round in random order,
+	keeping each session's own order; every 10th frame is other traffic.
+*/
+static size_t interleave(struct bench_frame *out, uint64_t *ns, struct bench_expect *e)
+{
+	static int live[BENCH_CONCURRENT];
+	int liveCount = BENCH_CONCURRENT;
+	size_t n = 0;
+
+	for (int i = 0; i < BENCH_CONCURRENT; i++)
+		live[i] = i;
+
+	while (liveCount > 0)
+	{
+		if (n % 10 == 9)
+		{
+			struct bench_frame *f = &out[n++];
+			f->ns = (*ns += BENCH_FRAME_NS);
+			f->canId = CAN_EFF_FLAG | 0x0CF00400 | (rand() % 8);
+			f->channel = rand() % BENCH_CHANNELS;
+			f->len = 8;
+			memset(f->data, rand(), 8);
+			e->other++;
+			continue;
+		}
+
+		int r = rand() % liveCount;
+		struct bench_session *s = &sessions[live[r]];
+		out[n] = s->frames[s->next++];
+		out[n++].ns = (*ns += BENCH_FRAME_NS);
+		if (s->next == s->count)
+			live[r] = live[--liveCount];
+	}
+	return n;
+}
+
+static int checkStats(const struct bench_expect *e, uint64_t sessionsStarted, uint64_t other)
+{
+	struct j1939_stats st;
+
+	j1939GetStats(&st);
+	if (st.completed != e->completed || st.aborted != e->aborted ||
+		st.timeouts != e->timeouts || st.duplicates != e->duplicates ||
+		st.bytes != e->bytes || st.started != sessionsStarted || st.noSession != 0 ||
+		st.invalid != 0 || st.orphans != 0 || st.active != 0 || other != e->other ||
+		callbacks != e->completed || mismatches != 0)
+	{
+		printf("FAILED: expected completed=%llu aborted=%llu timeouts=%llu duplicates=%llu "
+			"other=%llu, got other=%llu callbacks=%llu mismatches=%llu\n",
+			(unsigned long long)e->completed, (unsigned long long)e->aborted,
+			(unsigned long long)e->timeouts, (unsigned long long)e->duplicates,
+			(unsigned long long)e->other, (unsigned long long)other,
+			(unsigned long long)callbacks, (unsigned long long)mismatches);
+		j1939PrintStats();
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	More announcements than the pool holds: the rest is counted, not
+	tracked, and everything tracked times out.
+*/
+static int checkExhaustion(void)
+{
+	struct j1939_stats st;
+	struct timespec ts = { 1000, 0 };
+	uint8_t data[8] = { J1939_TP_BAM, 20, 0, 3, 0xFF, 0xCA, 0xFE, 0x00 };
+	int announced = 0;
+
+	j1939Init(BENCH_POOL, countComplete, NULL);
+	for (int channel = 0; channel < BENCH_CHANNELS; channel++)
+	{
+		for (int sa = 0; sa < 60; sa++, announced++)
+			j1939Frame(&ts, channel, CAN_EFF_FLAG | 0x1CECFF00 | sa, 8, data);
+	}
+	j1939GetStats(&st);
+	if (st.active != BENCH_POOL || st.noSession != (uint64_t)announced - BENCH_POOL)
+	{
+		printf("FAILED: pool overrun, active=%u no-session=%llu\n", st.active,
+			(unsigned long long)st.noSession);
+		return -1;
+	}
+	ts.tv_sec += 2;
+	j1939Tick(&ts);
+	j1939GetStats(&st);
+	if (st.active != 0 || st.timeouts != BENCH_POOL)
+	{
+		printf("FAILED: pool not drained, active=%u timeouts=%llu\n", st.active,
+			(unsigned long long)st.timeouts);
+		return -1;
+	}
+	printf("pool overrun ok: %d announced, %d tracked, %llu counted as no-session\n",
+		announced, BENCH_POOL, (unsigned long long)st.noSession);
+	return 0;
+}
+
+static struct dbc dm1Dbc;
+static int dm1Result;
+
+static double signalValue(const struct dbc_value *values, int n, const char *signal)
+{
+	int index = dbcFindSignal(&dm1Dbc, "DM1_BCM", signal);
+
+	for (int i = 0; i < n; i++)
+	{
+		if ((int)values[i].signal == index)
+			return values[i].value;
+	}
+	return -1;
+}
+
+static void dm1Complete(const struct j1939_message *msg, void *arg)
+{
+	static struct dbc_value values[DBC_MAX_MESSAGE_SIGNALS];
+	static struct dbc_value generated[DBC_MAX_MESSAGE_SIGNALS];
+	uint32_t canId = j1939CanId(msg);
+	const struct dbc_message *m = dbcFindPgn(&dm1Dbc, canId);
+
+	if (m == NULL || m->id != BENCH_DM1_ID || dbcFindMessage(&dm1Dbc, canId) != NULL)
+	{
+		printf("FAILED: DM1 %08X found as %s\n", canId, m ? m->name : "nothing");
+		return;
+	}
+	int n = dbcDecode(&dm1Dbc, m, msg->data, msg->len > 8 ? 8 : msg->len, values);
+	if (signalValue(values, n, "AmberWarningLampStatus") != 1 ||
+		signalValue(values, n, "DTC1_SPN_Low") != 190 || signalValue(values, n, "DTC1_FMI") != 3 ||
+		signalValue(values, n, "DTC1_OccurenceCount") != 5)
+	{
+		printf("FAILED: DM1 decoded wrong, %d values\n", n);
+		return;
+	}
+
+	// the built-in decoders come from $(DBC), which need not list DM1_BCM
+	uint32_t genId = dbcGenFindPgn(canId);
+	if (genId != 0 && (genId != BENCH_DM1_ID ||
+		dbcGenDecode(genId, msg->data, msg->len, generated) != n ||
+		memcmp(generated, values, n * sizeof(*values)) != 0))
+	{
+		printf("FAILED: generated DM1 decode, id %08X\n", genId);
+		return;
+	}
+	dm1Result = genId ? 2 : 1;
+}
+
+/*
+	Two DTCs, 10 bytes in two packets: amber lamp, SPN 190 FMI 3 seen
+	5 times, SPN 110 FMI 1.
+*/
+static int checkDm1(const char *path)
+{
+	static const uint8_t dm1[10] = { 0x04, 0xFF, 0xBE, 0x00, 0x03, 0x05, 0x6E, 0x00, 0x01, 0x02 };
+	uint8_t cm[8] = { J1939_TP_BAM, sizeof(dm1), 0, 2, 0xFF, 0xCA, 0xFE, 0x00 };
+	struct timespec ts = { 1000, 0 };
+
+	if (dbcLoad(&dm1Dbc, path) != 0)
+		return -1;
+	j1939Init(BENCH_POOL, dm1Complete, NULL);
+	dm1Result = 0;
+	j1939Frame(&ts, 0, CAN_EFF_FLAG | 0x1CECFF30, 8, cm);
+	for (int seq = 1; seq <= 2; seq++)
+	{
+		uint8_t dt[8];
+		memset(dt, 0xFF, sizeof(dt));
+		dt[0] = seq;
+		memcpy(dt + 1, dm1 + (seq - 1) * 7, seq == 1 ? 7 : sizeof(dm1) - 7);
+		ts.tv_nsec += 50000000;
+		j1939Frame(&ts, 0, CAN_EFF_FLAG | 0x1CEBFF30, 8, dt);
+	}
+	dbcFree(&dm1Dbc);
+	if (dm1Result == 0)
+		return -1;
+	printf("DM1 ok: BAM at priority 7 decoded as DM1_BCM by the %s\n",
+		dm1Result == 2 ? "table and generated decoders" : "table decoder");
+	return 0;
+}
+
+/*
+	Feeds all frames; between rounds the clock jumps 2 s, which times
+	out the transfers that lost a packet.
+*/
+static uint64_t replay(const struct bench_frame *frames, const size_t *roundEnd, int rounds)
+{
+	uint64_t other = 0;
+	size_t i = 0;
+
+	for (int r = 0; r < rounds; r++)
+	{
+		struct timespec ts;
+		for (; i < roundEnd[r]; i++)
+		{
+			const struct bench_frame *f = &frames[i];
+			toTimespec(f->ns, &ts);
+			if (!j1939Frame(&ts, f->channel, f->canId, f->len, f->data))
+				other++;
+		}
+		toTimespec(frames[i - 1].ns + 2000000000ULL, &ts);
+		j1939Tick(&ts);
+	}
+	return other;
+}
+
+int main(int argc, char *argv[])
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 40;
+	struct bench_frame *frames = NULL;
+	size_t capacity = 0;
+	size_t *roundEnd;
+	struct bench_expect e;
+	uint64_t ns = 1000000000000ULL;
+	uint64_t other;
+	size_t count = 0;
+
+	if (rounds <= 0)
+		return 1;
+	roundEnd = malloc(rounds * sizeof(*roundEnd));
+	if (roundEnd == NULL)
+		return 1;
+	memset(&e, 0, sizeof(e));
+	srand(1);
+
+	if (j1939Init(BENCH_POOL, checkComplete, NULL) != 0)
+		return 1;
+
+	// sessions[] only holds one round, so the checked run goes round by round
+	for (int r = 0; r < rounds; r++)
+	{
+		size_t first = count;
+		struct timespec ts;
+
+		size_t needed = 0;
+
+		memset(lookup, 0, sizeof(lookup));
+		for (int k = 0; k < BENCH_CONCURRENT; k++)
+		{
+			struct bench_session *s = &sessions[k];
+			buildSession(s, k, r, &e);
+			lookup[(s->channel * 256 + s->sa) * 256 + s->da] = k + 1;
+			needed += s->count;
+		}
+		needed = count + needed * 10 / 9 + 16;
+		if (needed > capacity)
+		{
+			capacity = needed * 2;
+			frames = realloc(frames, capacity * sizeof(*frames));
+			if (frames == NULL)
+				return 1;
+		}
+		count += interleave(frames + count, &ns, &e);
+		roundEnd[r] = count;
+
+		for (size_t i = first; i < count; i++)
+		{
+			const struct bench_frame *f = &frames[i];
+			toTimespec(f->ns, &ts);
+			j1939Frame(&ts, f->channel, f->canId, f->len, f->data);
+		}
+		ns += 2000000000ULL;
+		toTimespec(ns, &ts);
+		j1939Tick(&ts);
+	}
+
+	other = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (((frames[i].canId >> 16) & 0xFF) != J1939_PF_TP_CM &&
+			((frames[i].canId >> 16) & 0xFF) != J1939_PF_TP_DT)
+			other++;
+	}
+	if (checkStats(&e, (uint64_t)rounds * BENCH_CONCURRENT, other) != 0)
+		return 1;
+
+	struct j1939_stats st;
+	j1939GetStats(&st);
+	printf("reassembly ok: %d sessions, %llu completed, %llu aborted, %llu timed out, "
+		"%llu duplicates, high-water %u of %d\n", rounds * BENCH_CONCURRENT,
+		(unsigned long long)e.completed, (unsigned long long)e.aborted,
+		(unsigned long long)e.timeouts, (unsigned long long)e.duplicates,
+		st.highWater, BENCH_POOL);
+
+	// timed replay, the callback only counts
+	j1939Init(BENCH_POOL, countComplete, NULL);
+	callbacks = 0;
+	double t0 = nowNs();
+	other = replay(frames, roundEnd, rounds);
+	double elapsed = nowNs() - t0;
+	j1939GetStats(&st);
+	if (st.completed != e.completed || other != e.other)
+	{
+		printf("FAILED: replay completed %llu\n", (unsigned long long)st.completed);
+		return 1;
+	}
+	printf("%zu frames (%llu TP), %.1f ns/frame, %.1f M frames/s, %.1f MB/s reassembled\n",
+		count, (unsigned long long)st.frames, elapsed / count, count / elapsed * 1e3,
+		st.bytes / elapsed * 1e3);
+
+	if (checkExhaustion() != 0 || checkDm1(argc > 2 ? argv[2] : "../dbc/tcu.dbc") != 0)
+		return 1;
+
+	j1939Free();
+	free(frames);
+	free(roundEnd);
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*
+	Capture latency sampling on a real pipeline: a capture thread stamps
+	frames as received and pushes them through the ring in bursts of 64
+	every millisecond, the main thread logs them like the canbus-app
+	writer, to ASC and to CDL segments in a temporary directory. Every
+	sample has to complete once its frame is written, every stage has to
+	count all of them and the stages add up to the total. A block written
+	while a frame is logged has to move the flushed frame count on, for
+	CDL as for ASC, without waiting for the durability flush. Prints the
+	stage percentiles and, from a tight loop, the cost per frame on the
+	capture side and per sample on the writer side.
+	usage: latency-bench [seconds per run]
+*/
+
+#include <glob.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/cyber-canbus.h"
+#include "../include/cyber-ring.h"
+#include "../include/cyber-logfile.h"
+#include "../include/cyber-latency.h"
+
+#define BENCH_BURST			64
+#define BENCH_BURST_US			1000
+#define BENCH_RING_SLOTS		32768
+
+static struct can_ring ring;
+static int producing;
+static uint64_t produced;
+static uint32_t benchSeconds = 2;
+static uint64_t blockWrites;
+static uint64_t stalledWrites;		// block writes that flushed no frame
+
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *captureThread(void *arg)
+{
+	uint64_t bursts = (uint64_t)benchSeconds * 1000000 / BENCH_BURST_US;
+
+	for (uint64_t b = 0; b < bursts; b++)
+	{
+		for (int i = 0; i < BENCH_BURST; i++)
+		{
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			struct can_record *rec = ringReserve(&ring);
+			if (rec == NULL)
+				continue;
+			rec->ts = ts;
+			rec->channel = 1;
+			rec->sample = latencyRead(&ts);
+			memset(&rec->frame, 0, sizeof(rec->frame));
+			rec->frame.can_id = 0x100 + i;
+			rec->frame.len = 8;
+			memcpy(rec->frame.data, &produced, sizeof(produced));
+			ringCommit(&ring);
+			produced++;
+		}
+		usleep(BENCH_BURST_US);
+	}
+	__atomic_store_n(&producing, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+// the log writer thread of canbus-app, without the decoders
+static void writer(void)
+{
+	while (1)
+	{
+		struct can_record *rec = ringPeek(&ring);
+		if (rec == NULL)
+		{
+			if (!__atomic_load_n(&producing, __ATOMIC_ACQUIRE) && ringPeek(&ring) == NULL)
+				break;
+			logFileTick();
+			latencyFlushed(logFileFlushedFrames());
+			usleep(LOG_WRITER_IDLE_US);
+			continue;
+		}
+		struct log_stats before, ls;
+		logFileGetStats(&before);
+		logFileLogMessage(&rec->ts, rec->frame.can_id, "Rx", rec->channel, 0,
+			rec->frame.len, rec->frame.data);
+		logFileGetStats(&ls);
+		if (ls.writes != before.writes)
+		{
+			blockWrites++;
+			if (ls.flushedFrames == before.flushedFrames)
+				stalledWrites++;
+		}
+		if (rec->sample != 0)
+			latencyFormatted(rec->sample, ls.frames);
+		ringRelease(&ring);
+		latencyFlushed(logFileFlushedFrames());
+	}
+}
+
+static int run(int format, const char *exportPath)
+{
+	struct log_config cfg;
+	struct latency_stats st;
+	pthread_t capture;
+
+	logFileDefaultConfig(&cfg);
+	cfg.format = format;
+	if (ringInit(&ring, BENCH_RING_SLOTS) != 0 || latencyInit(exportPath, LATENCY_SAMPLE_EVERY) != 0 ||
+		logFileInit(&cfg) != 0)
+		return -1;
+
+	producing = 1;
+	produced = 0;
+	blockWrites = 0;
+	stalledWrites = 0;
+	pthread_create(&capture, NULL, captureThread, NULL);
+	writer();
+	pthread_join(capture, NULL);
+	logFileDeinit();
+	latencyFlushed(logFileFlushedFrames());
+	ringFree(&ring);
+
+	latencyGetStats(&st);
+	uint64_t expected = (produced + LATENCY_SAMPLE_EVERY - 1) / LATENCY_SAMPLE_EVERY;
+	uint64_t parts = 0;
+	int ok = st.pending == 0 && st.samples + st.skipped == expected;
+	for (int i = 0; i < LATENCY_STAGES; i++)
+	{
+		ok &= latencyStage(i)->count == st.samples;
+		if (i != LATENCY_STAGE_TOTAL)
+			parts += latencyStage(i)->sumUs;
+	}
+	// each stage truncates to whole us
+	uint64_t total = latencyStage(LATENCY_STAGE_TOTAL)->sumUs;
+	ok &= total >= parts && total <= parts + 3 * st.samples;
+	ok &= stalledWrites == 0;
+	if (!ok || latencyExport(exportPath) != 0)
+	{
+		printf("FAILED: %llu samples, %llu skipped, %u pending, expected %llu; "
+			"stages sum to %llu us, total %llu us; %llu of %llu block writes flushed "
+			"no frame\n", (unsigned long long)st.samples,
+			(unsigned long long)st.skipped, st.pending, (unsigned long long)expected,
+			(unsigned long long)parts, (unsigned long long)total,
+			(unsigned long long)stalledWrites, (unsigned long long)blockWrites);
+		return -1;
+	}
+
+	printf("%s ok: %llu frames, %llu samples complete, stages add up, %llu block writes\n",
+		format == LOG_FORMAT_CDL ? "cdl" : "asc", (unsigned long long)produced,
+		(unsigned long long)st.samples, (unsigned long long)blockWrites);
+	latencyPrintStats();
+	return 0;
+}
+
+/*
+	As many frames as fill every slot once, so no sample is skipped.
+*/
+static void overhead(const char *exportPath)
+{
+	static uint32_t taken[LATENCY_SLOTS];
+	uint32_t frames = LATENCY_SAMPLE_EVERY * LATENCY_SLOTS;
+	uint32_t count = 0;
+	struct timespec ts;
+
+	latencyInit(exportPath, LATENCY_SAMPLE_EVERY);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	double t0 = nowNs();
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		uint32_t sample = latencyRead(&ts);
+		if (sample != 0)
+			taken[count++] = sample;
+	}
+	double t1 = nowNs();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		latencyFormatted(taken[i], i + 1);
+		latencyFlushed(i + 1);
+	}
+	double t2 = nowNs();
+
+	printf("1 in %d sampled: %.1f ns/frame on the capture side, %.1f ns/sample on the writer "
+		"side\n", LATENCY_SAMPLE_EVERY, (t1 - t0) / frames, (t2 - t1) / count);
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/latency-bench-XXXXXX";
+	char exportPath[64];
+	glob_t g;
+
+	if (argc > 1)
+		benchSeconds = strtoul(argv[1], NULL, 0);
+	if (benchSeconds == 0 || mkdtemp(dir) == NULL || chdir(dir) != 0)
+		return 1;
+	snprintf(exportPath, sizeof(exportPath), "%s/latency.json", dir);
+
+	int ret = run(LOG_FORMAT_ASC, exportPath) || run(LOG_FORMAT_CDL, exportPath);
+	if (ret == 0)
+		overhead(exportPath);
+
+	if (glob("*", 0, NULL, &g) == 0)
+	{
+		for (size_t i = 0; i < g.gl_pathc; i++)
+			unlink(g.gl_pathv[i]);
+		globfree(&g);
+	}
+	rmdir(dir);
+	return ret ? 1 : 0;
+}
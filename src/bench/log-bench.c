@@ -0,0 +1,134 @@
+/*
+	Sustained throughput of the log writer outputs: write(), io_uring
+	into preallocated segments and io_uring with O_DIRECT. Latency is
+	taken over the logFileLogMessage() calls that issued a block write,
+	which is what the writer thread waits for.
+	usage: log-bench [directory] [MB per run]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/cyber-logfile.h"
+
+#define BENCH_SEGMENT_SIZE		(64 * 1024 * 1024)
+#define BENCH_DEFAULT_MB		512
+
+static const char *outputNames[] = { "write", "uring", "direct" };
+
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void removeSegments(uint32_t count)
+{
+	char name[64];
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		snprintf(name, sizeof(name), LOG_FILE_NAME_FORMAT, i, "asc");
+		unlink(name);
+	}
+}
+
+static int runOutput(int output, uint64_t target)
+{
+	struct log_config cfg;
+	struct log_stats ls;
+	struct timespec ts;
+	uint8_t data[8];
+	size_t maxSamples = target / (LOG_BLOCK_SIZE / 2) + 16;
+	double *samples = malloc(maxSamples * sizeof(*samples));
+	size_t count = 0;
+	uint64_t writes = 0;
+
+	if (samples == NULL)
+		return -1;
+
+	logFileDefaultConfig(&cfg);
+	cfg.output = output;
+	cfg.sizeLimit = BENCH_SEGMENT_SIZE;
+	// no time based flushes, only full blocks
+	cfg.flushIntervalMs = 1000000;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	double t0 = nowNs();
+	if (logFileInit(&cfg) != 0)
+	{
+		free(samples);
+		return -1;
+	}
+
+	for (uint32_t i = 0; ; i++)
+	{
+		ts.tv_nsec += 100000;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_nsec -= 1000000000;
+			ts.tv_sec++;
+		}
+		memcpy(data, &i, sizeof(i));
+		memcpy(data + 4, &i, sizeof(i));
+
+		double c0 = nowNs();
+		logFileLogMessage(&ts, 0x18FF0000 | (i & 0xFF), "Rx", 1 + i % 5, 0, 8, data);
+		double c1 = nowNs();
+
+		// calls that did I/O take microseconds, so the stats are only
+		// looked at for slow calls and every 1024th frame
+		if ((i & 0x3FF) != 0 && c1 - c0 < 2000)
+			continue;
+		logFileGetStats(&ls);
+		if (ls.writes != writes && count < maxSamples)
+			samples[count++] = c1 - c0;
+		writes = ls.writes;
+		if (ls.bytes >= target)
+			break;
+	}
+
+	logFileDeinit();
+	double elapsed = (nowNs() - t0) / 1e9;
+	logFileGetStats(&ls);
+	removeSegments(ls.segments);
+
+	qsort(samples, count, sizeof(*samples), compareDouble);
+	printf("%-7s %8.1f MB/s  writes=%-6llu p50=%6.1f us  p99=%7.1f us  max=%8.1f us\n",
+		outputNames[output], ls.bytes / elapsed / 1e6, (unsigned long long)ls.writes,
+		count ? samples[count / 2] / 1e3 : 0, count ? samples[count * 99 / 100] / 1e3 : 0,
+		count ? samples[count - 1] / 1e3 : 0);
+
+	free(samples);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = argc > 1 ? argv[1] : ".";
+	uint64_t mb = argc > 2 ? strtoull(argv[2], NULL, 0) : BENCH_DEFAULT_MB;
+
+	if (chdir(dir) != 0)
+	{
+		perror(dir);
+		return 1;
+	}
+
+	printf("ASC, %llu MB per run, %d MB segments, in %s\n",
+		(unsigned long long)mb, BENCH_SEGMENT_SIZE >> 20, dir);
+	for (int output = LOG_OUTPUT_WRITE; output <= LOG_OUTPUT_DIRECT; output++)
+	{
+		if (runOutput(output, mb * 1000000) != 0)
+			return 1;
+	}
+	return 0;
+}
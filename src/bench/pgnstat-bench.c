@@ -0,0 +1,277 @@
+/*
+	Per-frame cost of the PGN/SA accounting. 300 J1939 keys on three
+	channels send with fixed cycle times from 10 ms to 1 s; the frames
+	are counted once with the reporter thread writing a summary every
+	10 ms and once without it. The closed windows are checked against
+	the schedule: exact frame counts, min = avg = max = the cycle time,
+	zero jitter and the totals. Snapshots taken while another thread
+	counts have to be consistent rows: bytes and cycle sums that match
+	the frame and cycle counts.
+	usage: pgnstat-bench [seconds of bus time]
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include "../include/cyber-pgnstat.h"
+
+#define BENCH_KEYS			300
+#define BENCH_CHANNELS			3
+#define BENCH_REPORT_ROUNDS		100	// passes over the frames with the reporter on
+#define BENCH_CONCURRENT_ROUNDS		20	// passes over the frames while snapshotting
+
+struct bench_frame {
+	uint64_t ns;
+	uint32_t canId;
+	uint8_t channel;
+	uint8_t len;
+	uint16_t key;
+};
+
+struct bench_key {
+	uint32_t canId;
+	uint8_t channel;
+	uint8_t len;
+	uint32_t cycleUs;
+	uint64_t frames;
+	uint64_t secondHalf;
+};
+
+static struct bench_key keys[BENCH_KEYS];
+static struct pgnstat_row rows[PGNSTAT_MAX_KEYS];
+static const struct bench_frame *feedFrames;
+static size_t feedCount;
+static int feeding;
+
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compareTime(const void *a, const void *b)
+{
+	const struct bench_frame *x = a;
+	const struct bench_frame *y = b;
+	return x->ns < y->ns ? -1 : x->ns > y->ns ? 1 : x->key - y->key;
+}
+
+static void feed(const struct bench_frame *frames, size_t from, size_t to)
+{
+	for (size_t i = from; i < to; i++)
+	{
+		struct timespec ts = { frames[i].ns / 1000000000, frames[i].ns % 1000000000 };
+		pgnStatFrame(&ts, frames[i].channel, frames[i].canId, frames[i].len);
+	}
+}
+
+static const struct bench_key *findKey(const struct pgnstat_row *r)
+{
+	for (int k = 0; k < BENCH_KEYS; k++)
+	{
+		uint32_t pgn = (keys[k].canId >> 8) & 0x3FFFF;
+		if (((pgn >> 8) & 0xFF) < 240)
+			pgn &= 0x3FF00;
+		if (keys[k].channel == r->channel && pgn == r->pgn &&
+			(keys[k].canId & 0xFF) == r->sa && !r->standard)
+			return &keys[k];
+	}
+	return NULL;
+}
+
+/*
+	Counts the first half, closes that window, counts the rest and
+	checks the window of the second half.
+*/
+static int checkWindows(const struct bench_frame *frames, size_t count)
+{
+	size_t half = count / 2;
+	uint32_t n;
+
+	pgnStatInit();
+	feed(frames, 0, half);
+	pgnStatSnapshot(rows, PGNSTAT_MAX_KEYS);
+	feed(frames, half, count);
+	n = pgnStatSnapshot(rows, PGNSTAT_MAX_KEYS);
+
+	if (n != BENCH_KEYS)
+	{
+		printf("FAILED: %u keys, expected %d\n", n, BENCH_KEYS);
+		return -1;
+	}
+	for (uint32_t i = 0; i < n; i++)
+	{
+		const struct pgnstat_row *r = &rows[i];
+		const struct bench_key *k = findKey(r);
+		const struct pgnstat_window *w = &r->window;
+
+		// every frame of the second half has its predecessor, the first in the first half
+		if (k == NULL || r->totalFrames != k->frames || w->frames != k->secondHalf ||
+			w->cycles != w->frames || w->minUs != k->cycleUs || w->maxUs != k->cycleUs ||
+			w->sumUs != (uint64_t)k->cycleUs * w->cycles ||
+			w->sumSqUs != (uint64_t)k->cycleUs * k->cycleUs * w->cycles ||
+			r->totalBytes != k->frames * k->len)
+		{
+			printf("FAILED: channel %u pgn %05X sa %02X frames %u cycles %u min %u max %u\n",
+				r->channel, r->pgn, r->sa, w->frames, w->cycles, w->minUs, w->maxUs);
+			return -1;
+		}
+	}
+	printf("windows ok: %u keys, frame counts, cycle min/max/sum and totals exact\n", n);
+	return 0;
+}
+
+static void *feedThread(void *arg)
+{
+	for (int r = 0; r < BENCH_CONCURRENT_ROUNDS; r++)
+		feed(feedFrames, 0, feedCount);
+	__atomic_store_n(&feeding, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+	Every key sends len 8 frames at a fixed cycle, so a row whose bytes
+	or cycle sum do not match its counts was copied half updated.
+*/
+static int checkConcurrent(const struct bench_frame *frames, size_t count)
+{
+	uint64_t snapshots = 0, torn = 0;
+	pthread_t thread;
+
+	pgnStatInit();
+	feedFrames = frames;
+	feedCount = count;
+	feeding = 1;
+	if (pthread_create(&thread, NULL, feedThread, NULL) != 0)
+		return -1;
+	while (__atomic_load_n(&feeding, __ATOMIC_ACQUIRE))
+	{
+		uint32_t n = pgnStatSnapshot(rows, PGNSTAT_MAX_KEYS);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			const struct bench_key *k = findKey(&rows[i]);
+			const struct pgnstat_window *w = &rows[i].window;
+			if (k == NULL || w->bytes != w->frames * k->len || w->cycles > w->frames ||
+				w->sumUs != (uint64_t)k->cycleUs * w->cycles ||
+				rows[i].totalBytes != rows[i].totalFrames * k->len)
+				torn++;
+		}
+		snapshots++;
+	}
+	pthread_join(thread, NULL);
+
+	if (torn != 0)
+	{
+		printf("FAILED: %llu torn rows in %llu snapshots\n", (unsigned long long)torn,
+			(unsigned long long)snapshots);
+		return -1;
+	}
+	printf("concurrent ok: %llu snapshots while counting, no torn rows\n",
+		(unsigned long long)snapshots);
+	return 0;
+}
+
+static int checkOverflow(void)
+{
+	struct timespec ts = { 1, 0 };
+	uint32_t n;
+
+	pgnStatInit();
+	for (uint32_t sa = 0; sa < 256; sa++)
+	{
+		for (uint32_t pgn = 0xFF00; pgn < 0xFF08; pgn++)
+			pgnStatFrame(&ts, 0, CAN_EFF_FLAG | 0x18000000 | pgn << 8 | sa, 8);
+	}
+	n = pgnStatSnapshot(rows, PGNSTAT_MAX_KEYS);
+	if (n != PGNSTAT_MAX_KEYS)
+	{
+		printf("FAILED: table holds %u keys after overflow\n", n);
+		return -1;
+	}
+	printf("overflow ok: %d keys offered, %u kept\n", 256 * 8, n);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : 60;
+	static const uint32_t cycles[] = { 10000, 20000, 50000, 100000, 250000, 500000, 1000000 };
+	char path[] = "/tmp/pgnstat-bench-XXXXXX";
+	struct bench_frame *frames;
+	size_t count = 0;
+	size_t capacity = 0;
+
+	if (seconds <= 0)
+		return 1;
+	srand(3);
+	for (int k = 0; k < BENCH_KEYS; k++)
+	{
+		struct bench_key *key = &keys[k];
+		// PDU2 broadcast PGNs, every 10th a PDU1 one with a destination
+		if (k % 10 == 0)
+			key->canId = CAN_EFF_FLAG | 0x18000000 | (0xE0 + (k / 10) % 16) << 16 | 0x03 << 8 | (k & 0xFF);
+		else
+			key->canId = CAN_EFF_FLAG | 0x18000000 | (0xF000 + k) << 8 | (k % 8) * 0x11;
+		key->channel = k % BENCH_CHANNELS;
+		key->len = 8;
+		key->cycleUs = cycles[rand() % 7];
+		capacity += (uint64_t)seconds * 1000000 / key->cycleUs + 1;
+	}
+
+	frames = malloc(capacity * sizeof(*frames));
+	if (frames == NULL)
+		return 1;
+	for (int k = 0; k < BENCH_KEYS; k++)
+	{
+		uint64_t phase = (uint64_t)(rand() % 1000) * 1000;
+		for (uint64_t t = phase; t < (uint64_t)seconds * 1000000000; t += keys[k].cycleUs * 1000ULL)
+		{
+			struct bench_frame *f = &frames[count++];
+			f->ns = 1000000000000ULL + t;
+			f->canId = keys[k].canId;
+			f->channel = keys[k].channel;
+			f->len = keys[k].len;
+			f->key = k;
+			keys[k].frames++;
+		}
+	}
+	qsort(frames, count, sizeof(*frames), compareTime);
+	for (size_t i = count / 2; i < count; i++)
+		keys[frames[i].key].secondHalf++;
+
+	if (checkWindows(frames, count) != 0 || checkOverflow() != 0 ||
+		checkConcurrent(frames, count) != 0)
+		return 1;
+
+	pgnStatInit();
+	double t0 = nowNs();
+	feed(frames, 0, count);
+	double plain = nowNs() - t0;
+
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	close(fd);
+	pgnStatInit();
+	pgnStatStart(path, 10);
+	t0 = nowNs();
+	for (int r = 0; r < BENCH_REPORT_ROUNDS; r++)
+		feed(frames, 0, count);
+	double reported = nowNs() - t0;
+	pgnStatStop();
+	pgnStatPrintStats();
+	unlink(path);
+
+	printf("%zu frames of %d keys (%d s bus time, %.0f frames/s)\n", count, BENCH_KEYS,
+		seconds, (double)count / seconds);
+	printf("%.1f ns/frame, %.1f ns/frame with the reporter writing every 10 ms\n",
+		plain / count, reported / ((double)count * BENCH_REPORT_ROUNDS));
+
+	free(frames);
+	return 0;
+}
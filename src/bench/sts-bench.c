@@ -0,0 +1,279 @@
+/*
+	Signal time series against gzip on ASC for the same traffic. Every
+	message of the DBC is sent with a fixed cycle time (10 ms to 1 s)
+	and up to 200 us of jitter, payload bytes drift slowly and byte 7
+	carries a counter. The frames are decoded once; the decoded samples
+	go through the STS writer, the frames through the ASC formatter and
+	zlib at the segment worker's level. Every sample is checked after an
+	STS round trip before the sizes and the CPU per sample are printed.
+	usage: sts-bench file.dbc [seconds of bus time]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <linux/can.h>
+#include "../include/cyber-sts.h"
+#include "../include/cyber-asc.h"
+
+#define BENCH_GZIP_LEVEL		6	// SEGMENT_GZIP_LEVEL
+#define BENCH_START_SEC			1700000000	// ASC times are relative to it
+
+struct bench_frame {
+	struct timespec ts;
+	uint32_t canId;
+	uint8_t len;
+	uint8_t data[8];
+	uint32_t firstValue;		// into values
+	uint16_t valueCount;
+};
+
+struct check_state {
+	const struct sts_sample *samples;	// grouped by signal, in time order
+	uint32_t *next;				// per signal cursor into samples
+	const uint32_t *end;
+	uint64_t mismatches;
+};
+
+static uint8_t *stsBuffer;
+static size_t stsUsed;
+static size_t stsCapacity;
+
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compareTime(const void *a, const void *b)
+{
+	const struct bench_frame *x = a;
+	const struct bench_frame *y = b;
+	if (x->ts.tv_sec != y->ts.tv_sec)
+		return x->ts.tv_sec < y->ts.tv_sec ? -1 : 1;
+	return x->ts.tv_nsec < y->ts.tv_nsec ? -1 : x->ts.tv_nsec > y->ts.tv_nsec;
+}
+
+static int collectBlock(const void *data, size_t len)
+{
+	if (stsUsed + len > stsCapacity)
+	{
+		size_t capacity = stsCapacity ? stsCapacity * 2 : 1 << 20;
+		uint8_t *p = realloc(stsBuffer, capacity);
+		if (p == NULL)
+			return -1;
+		stsBuffer = p;
+		stsCapacity = capacity;
+	}
+	memcpy(stsBuffer + stsUsed, data, len);
+	stsUsed += len;
+	return 0;
+}
+
+static int checkSample(const struct sts_sample *s, void *arg)
+{
+	struct check_state *c = arg;
+	const struct sts_sample *expected;
+
+	if (c->next[s->signal] == c->end[s->signal])
+	{
+		c->mismatches++;
+		return 0;
+	}
+	expected = &c->samples[c->next[s->signal]++];
+	if (s->tick != expected->tick || memcmp(&s->value, &expected->value, sizeof(double)) != 0)
+	{
+		if (c->mismatches++ == 0)
+			printf("MISMATCH signal %u at %lld: %g, expected %g at %lld\n", s->signal,
+				(long long)s->tick, s->value, expected->value, (long long)expected->tick);
+	}
+	return 0;
+}
+
+/*
+	Decodes the STS output and compares it per signal with the samples
+	that went in.
+*/
+static int checkRoundTrip(const struct dbc *db, const struct bench_frame *frames, size_t count,
+	const struct dbc_value *values, uint64_t total)
+{
+	struct sts_sample *grouped = malloc(total * sizeof(*grouped));
+	uint32_t *next = calloc(db->signalCount + 1, sizeof(uint32_t));
+	uint32_t *end = calloc(db->signalCount + 1, sizeof(uint32_t));
+	struct check_state c = { grouped, next, end, 0 };
+	struct sts_decode_info info;
+	int status = 0;
+
+	if (grouped == NULL || next == NULL || end == NULL)
+		return -1;
+
+	// counting sort by signal keeps the time order within a signal
+	for (uint64_t i = 0; i < total; i++)
+		end[values[i].signal + 1]++;
+	for (uint32_t s = 0; s < db->signalCount; s++)
+		end[s + 1] += end[s];
+	memcpy(next, end, (db->signalCount + 1) * sizeof(uint32_t));
+	for (size_t i = 0; i < count; i++)
+	{
+		const struct bench_frame *f = &frames[i];
+		for (uint32_t k = 0; k < f->valueCount; k++)
+		{
+			const struct dbc_value *v = &values[f->firstValue + k];
+			struct sts_sample *s = &grouped[next[v->signal]++];
+			s->signal = v->signal;
+			s->tick = (int64_t)f->ts.tv_sec * (1000000000 / STS_TICK_NS) + f->ts.tv_nsec / STS_TICK_NS;
+			s->value = v->value;
+		}
+	}
+	memcpy(next, end, db->signalCount * sizeof(uint32_t));
+	c.end = end + 1;
+
+	if (stsDecode(stsBuffer, stsUsed, checkSample, &c, &info) != 0 || info.damaged != 0)
+	{
+		printf("FAILED: %s at offset %zu, %u damaged blocks\n", stsErrorString(info.error),
+			info.errorOffset, info.damaged);
+		status = -1;
+	}
+	else if (c.mismatches != 0 || info.samples != total)
+	{
+		printf("FAILED: %llu mismatches, %llu of %llu samples decoded\n",
+			(unsigned long long)c.mismatches, (unsigned long long)info.samples,
+			(unsigned long long)total);
+		status = -1;
+	}
+	else
+		printf("round trip ok: %llu samples in %u chunks, times and value bits exact\n",
+			(unsigned long long)info.samples, info.chunks);
+
+	free(grouped);
+	free(next);
+	free(end);
+	return status;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t cyclesMs[] = { 10, 20, 50, 100, 1000 };
+	int seconds = argc > 2 ? atoi(argv[2]) : 300;
+	struct bench_frame *frames;
+	struct dbc_value *values;
+	struct sts_writer w;
+	struct dbc db;
+	size_t count = 0, capacity = 0;
+	uint64_t total = 0;
+
+	if (argc < 2 || seconds <= 0)
+	{
+		printf("usage: %s file.dbc [seconds]\n", argv[0]);
+		return 1;
+	}
+	if (dbcLoad(&db, argv[1]) != 0 || db.messageCount == 0)
+		return 1;
+
+	srand(7);
+	for (uint32_t m = 0; m < db.messageCount; m++)
+		capacity += (uint64_t)seconds * 1000 / cyclesMs[m % 5] + 1;
+	frames = malloc(capacity * sizeof(*frames));
+	if (frames == NULL)
+		return 1;
+	for (uint32_t m = 0; m < db.messageCount; m++)
+	{
+		uint64_t cycle = cyclesMs[m % 5] * 1000000ULL;
+		uint8_t data[8];
+
+		for (int b = 0; b < 8; b++)
+			data[b] = rand();
+		for (uint64_t t = (rand() % 1000) * 10000ULL; t < (uint64_t)seconds * 1000000000; t += cycle)
+		{
+			struct bench_frame *f = &frames[count++];
+			uint64_t ns = BENCH_START_SEC * 1000000000ULL + t + rand() % 200000;
+
+			for (int b = 0; b < 7; b++)
+			{
+				if (rand() % 16 == 0)
+					data[b] += rand() % 2 ? 1 : -1;
+			}
+			data[7] = (data[7] & 0xF0) | ((data[7] + 1) & 0x0F);
+			f->ts.tv_sec = ns / 1000000000;
+			f->ts.tv_nsec = ns % 1000000000;
+			f->canId = db.messages[m].id;
+			f->len = db.messages[m].dlc > 8 ? 8 : db.messages[m].dlc;
+			memcpy(f->data, data, sizeof(data));
+		}
+	}
+	qsort(frames, count, sizeof(*frames), compareTime);
+
+	size_t valueCapacity = count * 16;
+	values = malloc(valueCapacity * sizeof(*values));
+	for (size_t i = 0; i < count && values != NULL; i++)
+	{
+		if (total + DBC_MAX_MESSAGE_SIGNALS > valueCapacity)
+		{
+			valueCapacity *= 2;
+			values = realloc(values, valueCapacity * sizeof(*values));
+			if (values == NULL)
+				break;
+		}
+		int n = dbcDecodeFrame(&db, frames[i].canId, frames[i].data, frames[i].len, values + total);
+		frames[i].firstValue = total;
+		frames[i].valueCount = n > 0 ? n : 0;
+		total += frames[i].valueCount;
+	}
+	if (values == NULL)
+		return 1;
+
+	// signal time series of the decoded values
+	if (stsWriterInit(&w, db.signalCount, collectBlock) != 0)
+		return 1;
+	double t0 = nowNs();
+	for (size_t i = 0; i < count; i++)
+	{
+		stsTick(&w, &frames[i].ts);
+		stsAdd(&w, &frames[i].ts, values + frames[i].firstValue, frames[i].valueCount);
+	}
+	stsFlush(&w);
+	double stsNs = nowNs() - t0;
+	stsPrintStats(&w);
+	if (checkRoundTrip(&db, frames, count, values, total) != 0)
+		return 1;
+
+	// ASC text of the frames, compressed as the segment worker does
+	char *asc = malloc(count * 128);
+	size_t ascUsed = 0;
+	if (asc == NULL)
+		return 1;
+	t0 = nowNs();
+	for (size_t i = 0; i < count; i++)
+		ascUsed += ascFormatFrame(asc + ascUsed, frames[i].ts.tv_sec - BENCH_START_SEC,
+			frames[i].ts.tv_nsec, 1,
+			frames[i].canId, "Rx", frames[i].len, frames[i].data);
+	double formatNs = nowNs() - t0;
+	uLongf gzLen = compressBound(ascUsed);
+	uint8_t *gz = malloc(gzLen);
+	t0 = nowNs();
+	if (gz == NULL || compress2(gz, &gzLen, (uint8_t *)asc, ascUsed, BENCH_GZIP_LEVEL) != Z_OK)
+		return 1;
+	double gzipNs = nowNs() - t0;
+
+	printf("%zu frames, %llu samples of %u signals (%d s bus time)\n", count,
+		(unsigned long long)total, db.signalCount, seconds);
+	printf("sts:      %zu bytes, %.2f bytes/sample, %.1f ns/sample\n", stsUsed,
+		(double)stsUsed / total, stsNs / total);
+	printf("asc+gzip: %lu bytes, %.2f bytes/sample, %.1f ns/sample (format %.1f + gzip %.1f)\n",
+		(unsigned long)gzLen, (double)gzLen / total, (formatNs + gzipNs) / total,
+		formatNs / total, gzipNs / total);
+	printf("sts is %.1fx smaller and %.1fx cheaper (ASC text %zu bytes)\n",
+		(double)gzLen / stsUsed, (formatNs + gzipNs) / stsNs, ascUsed);
+
+	stsWriterFree(&w);
+	dbcFree(&db);
+	free(frames);
+	free(values);
+	free(asc);
+	free(gz);
+	free(stsBuffer);
+	return 0;
+}
@@ -0,0 +1,367 @@
+/*
+	Inter-arrival histograms and bus load. The bucket function is checked
+	against its inverse for every gap up to 2^25 us, the worst case frame
+	times against known bit counts. 200 ids on a classic and a CAN FD
+	channel then send with cycle times from 10 ms to 1 s and a jitter of
+	10 %; every histogram, min, max and frame count has to match the
+	gaps that were sent, the snapshot percentiles the exact ones within
+	a bucket and the load the frame times over the bus time. Prints
+	ns/frame with and without the reporter writing every 10 ms.
+	usage: timing-bench [seconds of bus time]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include "../include/cyber-canbus.h"
+#include "../include/cyber-timing.h"
+
+#define BENCH_IDS			200
+#define BENCH_BITRATE			500000
+#define BENCH_DBITRATE			2000000
+#define BENCH_CLASSIC			1	// channel numbers
+#define BENCH_FD			2
+#define BENCH_ROUNDS			20
+
+struct bench_frame {
+	uint64_t us;
+	uint32_t canId;
+	uint8_t channel;
+	uint8_t flags;
+	uint8_t len;
+	uint8_t key;
+};
+
+struct bench_key {
+	uint32_t canId;
+	uint8_t channel;
+	uint32_t cycleUs;
+	uint32_t *gaps;
+	uint32_t gapCount;
+	uint32_t buckets[TIMING_BUCKETS];
+};
+
+static struct bench_key keys[BENCH_IDS];
+static const uint8_t fdLengths[] = { 8, 12, 16, 20, 24, 32, 48, 64 };
+
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compareTime(const void *a, const void *b)
+{
+	const struct bench_frame *x = a;
+	const struct bench_frame *y = b;
+	return x->us < y->us ? -1 : x->us > y->us ? 1 : x->key - y->key;
+}
+
+static int compareGap(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void feed(const struct bench_frame *frames, size_t count, uint64_t offsetUs)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t us = frames[i].us + offsetUs;
+		struct timespec ts = { us / 1000000, us % 1000000 * 1000 };
+		timingFrame(&ts, frames[i].channel, frames[i].canId, frames[i].flags, frames[i].len);
+	}
+}
+
+static void setChannels(void)
+{
+	timingInit();
+	timingSetChannel(BENCH_CLASSIC, BENCH_BITRATE, 0);
+	timingSetChannel(BENCH_FD, BENCH_BITRATE, BENCH_DBITRATE);
+}
+
+static int checkBuckets(void)
+{
+	uint32_t last = 0;
+
+	for (uint32_t us = 0; us < 1u << 25; us++)
+	{
+		uint32_t b = timingBucket(us);
+		uint32_t low = timingBucketLow(b);
+		uint32_t high = b + 1 < TIMING_BUCKETS ? timingBucketLow(b + 1) : UINT32_MAX;
+
+		if (b < last || b >= TIMING_BUCKETS || us < low || us >= high ||
+			(b + 1 < TIMING_BUCKETS && (high - low) * TIMING_SUB_BUCKETS > (low > 16 ? low : 16)))
+		{
+			printf("FAILED: %u us in bucket %u [%u, %u)\n", us, b, low, high);
+			return -1;
+		}
+		last = b;
+	}
+	printf("buckets ok: %d buckets, at most 1/%d wide up to %u us\n", TIMING_BUCKETS,
+		TIMING_SUB_BUCKETS, timingBucketLow(TIMING_BUCKETS - 1));
+	return 0;
+}
+
+/*
+	Worst case bit counts: classic 8 bytes 135 (standard) and 160
+	(extended), 0 bytes 55 and 80. CAN FD 64 bytes standard with BRS: 33
+	bits at 500 kbit/s and 679 at 2 Mbit/s.
+*/
+static int checkFrameTimes(void)
+{
+	struct {
+		int channel;
+		uint32_t canId;
+		uint8_t flags;
+		uint8_t len;
+		uint32_t ns;
+	} cases[] = {
+		{ BENCH_CLASSIC, 0x123, 0, 8, 135 * 2000 },
+		{ BENCH_CLASSIC, 0x123 | CAN_EFF_FLAG, 0, 8, 160 * 2000 },
+		{ BENCH_CLASSIC, 0x123, 0, 0, 55 * 2000 },
+		{ BENCH_CLASSIC, 0x123 | CAN_EFF_FLAG, 0, 0, 80 * 2000 },
+		{ BENCH_CLASSIC, 0x123 | CAN_RTR_FLAG, 0, 8, 55 * 2000 },
+		{ BENCH_FD, 0x123, CANFD_FDF | CANFD_BRS, 64, 33 * 2000 + 679 * 500 },
+		{ BENCH_FD, 0x123, CANFD_FDF, 64, (33 + 679) * 2000 },
+	};
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		uint32_t ns = timingFrameNs(cases[i].channel, cases[i].canId, cases[i].flags,
+			cases[i].len);
+		if (ns != cases[i].ns)
+		{
+			printf("FAILED: frame time of %x flags %x len %u: %u ns, expected %u\n",
+				cases[i].canId, cases[i].flags, cases[i].len, ns, cases[i].ns);
+			return -1;
+		}
+	}
+	printf("frame times ok: 8 byte standard frame %u us at %d bit/s\n",
+		timingFrameNs(BENCH_CLASSIC, 0x123, 0, 8) / 1000, BENCH_BITRATE);
+	return 0;
+}
+
+static size_t buildFrames(struct bench_frame **out, uint32_t seconds)
+{
+	static const uint32_t cycles[] = { 10000, 20000, 50000, 100000, 200000, 1000000 };
+	uint64_t endUs = (uint64_t)seconds * 1000000;
+	size_t count = 0, cap = 0;
+	struct bench_frame *frames = NULL;
+	uint32_t seed = 1;
+
+	for (int k = 0; k < BENCH_IDS; k++)
+	{
+		struct bench_key *key = &keys[k];
+		key->channel = k % 2 ? BENCH_FD : BENCH_CLASSIC;
+		key->canId = k % 3 ? (0x18F00000 + k) | CAN_EFF_FLAG : 0x100 + k;
+		key->cycleUs = cycles[k % 6];
+		key->gaps = malloc((endUs / (key->cycleUs - key->cycleUs / 10) + 1) * sizeof(uint32_t));
+		key->gapCount = 0;
+		memset(key->buckets, 0, sizeof(key->buckets));
+
+		for (uint64_t us = 1000 + k * 7; us < endUs; )
+		{
+			if (count == cap)
+			{
+				cap = cap ? cap * 2 : 65536;
+				frames = realloc(frames, cap * sizeof(*frames));
+			}
+			struct bench_frame *f = &frames[count++];
+			f->us = us;
+			f->canId = key->canId;
+			f->channel = key->channel;
+			f->key = k;
+			seed = seed * 1103515245 + 12345;
+			if (key->channel == BENCH_FD)
+			{
+				f->flags = CANFD_FDF | (k % 8 != 3 ? CANFD_BRS : 0);
+				f->len = fdLengths[(seed >> 16) % sizeof(fdLengths)];
+			}
+			else
+			{
+				f->flags = 0;
+				f->len = (seed >> 16) % 9;
+			}
+
+			seed = seed * 1103515245 + 12345;
+			uint32_t jitter = key->cycleUs / 10;
+			uint32_t gap = key->cycleUs - jitter + (seed >> 8) % (2 * jitter + 1);
+			if (us + gap < endUs)
+			{
+				key->gaps[key->gapCount++] = gap;
+				key->buckets[timingBucket(gap)]++;
+			}
+			us += gap;
+		}
+	}
+
+	qsort(frames, count, sizeof(*frames), compareTime);
+	*out = frames;
+	return count;
+}
+
+static int checkIds(void)
+{
+	for (int k = 0; k < BENCH_IDS; k++)
+	{
+		struct bench_key *key = &keys[k];
+		const struct timing_id *e = timingFind(key->channel, key->canId);
+		uint32_t min = UINT32_MAX, max = 0;
+
+		for (uint32_t i = 0; i < key->gapCount; i++)
+		{
+			min = key->gaps[i] < min ? key->gaps[i] : min;
+			max = key->gaps[i] > max ? key->gaps[i] : max;
+		}
+		if (e == NULL || e->frames != key->gapCount + 1 || e->gaps != key->gapCount ||
+			e->minUs != min || e->maxUs != max ||
+			memcmp(e->buckets, key->buckets, sizeof(key->buckets)) != 0)
+		{
+			printf("FAILED: id %x on channel %u: frames %llu gaps %llu min %u max %u, "
+				"expected %u %u %u %u\n", key->canId, key->channel,
+				e ? (unsigned long long)e->frames : 0, e ? (unsigned long long)e->gaps : 0,
+				e ? e->minUs : 0, e ? e->maxUs : 0, key->gapCount + 1, key->gapCount, min, max);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+	Reads back p50/p99 per id and the load per channel. A percentile is
+	the upper edge of its bucket, so it is at least the exact one and at
+	most a bucket above it.
+*/
+static int checkSnapshot(const char *path, double busySec[2])
+{
+	FILE *fp = fopen(path, "r");
+	char line[8192];
+	int ids = 0, channels = 0;
+
+	if (fp == NULL)
+	{
+		printf("FAILED: no snapshot %s\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		const char *p = line;
+		unsigned channel, id, p50, p99, bitrate;
+		char ext;
+		double load;
+
+		while ((p = strstr(p, "{\"channel\":")) != NULL)
+		{
+			if (sscanf(p, "{\"channel\":%u,\"bitrate\":%u", &channel, &bitrate) == 2 &&
+				sscanf(strstr(p, "\"load\""), "\"load\":%lf", &load) == 1)
+			{
+				double expected = busySec[channel == BENCH_FD];
+				if (load < expected - 1e-4 || load > expected + 1e-4)
+				{
+					printf("FAILED: channel %u load %.4f, expected %.4f\n", channel, load,
+						expected);
+					goto fail;
+				}
+				channels++;
+			}
+			else if (sscanf(p, "{\"channel\":%u,\"id\":\"%X%c", &channel, &id, &ext) == 3 &&
+				sscanf(strstr(p, "\"p50_us\""), "\"p50_us\":%u,\"p99_us\":%u", &p50, &p99) == 2)
+			{
+				uint32_t canId = id | (ext == 'x' ? CAN_EFF_FLAG : 0);
+				struct bench_key *key = NULL;
+				for (int k = 0; k < BENCH_IDS && key == NULL; k++)
+				{
+					if (keys[k].canId == canId && keys[k].channel == channel)
+						key = &keys[k];
+				}
+				if (key == NULL || key->gapCount == 0)
+					goto fail;
+
+				qsort(key->gaps, key->gapCount, sizeof(uint32_t), compareGap);
+				uint32_t exact50 = key->gaps[(key->gapCount - 1) / 2];
+				uint32_t exact99 = key->gaps[(uint32_t)(0.99 * key->gapCount + 0.999999) - 1];
+				if (p50 < exact50 || p99 < exact99 ||
+					timingBucket(p50) != timingBucket(exact50) ||
+					timingBucket(p99) != timingBucket(exact99))
+				{
+					printf("FAILED: id %x p50 %u p99 %u, exact %u %u\n", canId, p50, p99,
+						exact50, exact99);
+					goto fail;
+				}
+				ids++;
+			}
+			p++;
+		}
+	}
+	fclose(fp);
+	if (ids != BENCH_IDS || channels != 2)
+	{
+		printf("FAILED: snapshot has %d ids and %d channels\n", ids, channels);
+		return -1;
+	}
+	printf("snapshot ok: %d ids, percentiles within their bucket, load %.1f %% and %.1f %%\n",
+		ids, busySec[0] * 100, busySec[1] * 100);
+	return 0;
+
+fail:
+	fclose(fp);
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t seconds = argc > 1 ? strtoul(argv[1], NULL, 0) : 60;
+	char path[] = "/tmp/timing-bench-XXXXXX";
+	struct bench_frame *frames;
+	struct timing_stats st;
+	double busy[2] = { 0, 0 };
+	int fd = mkstemp(path);
+
+	if (fd < 0 || seconds == 0)
+		return 1;
+	close(fd);
+
+	setChannels();
+	if (checkBuckets() != 0 || checkFrameTimes() != 0)
+		return 1;
+
+	size_t count = buildFrames(&frames, seconds);
+	for (size_t i = 0; i < count; i++)
+	{
+		busy[frames[i].channel == BENCH_FD] += timingFrameNs(frames[i].channel,
+			frames[i].canId, frames[i].flags, frames[i].len) / 1e9 / seconds;
+	}
+
+	double t0 = nowNs();
+	feed(frames, count, 0);
+	double plain = nowNs() - t0;
+	if (checkIds() != 0 || timingWriteSnapshot(path, seconds) != 0 ||
+		checkSnapshot(path, busy) != 0)
+		return 1;
+	printf("ids ok: histograms, min, max and frames of %d ids match the gaps sent\n", BENCH_IDS);
+
+	// later rounds continue the timestamps, so the gaps stay the same
+	setChannels();
+	timingStart(path, 10);
+	t0 = nowNs();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		feed(frames, count, (uint64_t)r * seconds * 1000000);
+	double reported = nowNs() - t0;
+	timingStop();
+	timingGetStats(&st);
+	timingPrintStats();
+	unlink(path);
+
+	printf("%zu frames: %.1f ns/frame, %.1f ns/frame with %u snapshots written\n", count,
+		plain / count, reported / (count * BENCH_ROUNDS), st.snapshots);
+	for (int k = 0; k < BENCH_IDS; k++)
+		free(keys[k].gaps);
+	free(frames);
+	return 0;
+}
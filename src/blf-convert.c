@@ -0,0 +1,211 @@
+/*
+	blf-convert: turn a BLF log into ASC, CSV or candump text.
+	usage: blf-convert [-f asc|csv|candump] [-j threads] [-o out] input.blf
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include "include/cyber-blf-reader.h"
+#include "include/cyber-asc.h"
+
+#define CONVERT_OUTPUT_BUFFER		(1 * 1024 * 1024)
+
+enum convert_format {
+	FORMAT_ASC,
+	FORMAT_CSV,
+	FORMAT_CANDUMP,
+};
+
+struct convert_state {
+	FILE *out;
+	enum convert_format format;
+	struct timespec start;
+	uint64_t bytes;
+};
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+static char *putHexBytes(char *p, const uint8_t *data, int len, char sep)
+{
+	for (int i = 0; i < len; i++)
+	{
+		if (sep && i > 0)
+			*p++ = sep;
+		*p++ = hexDigits[data[i] >> 4];
+		*p++ = hexDigits[data[i] & 0xF];
+	}
+	return p;
+}
+
+static int writeFrame(const struct blf_frame *f, void *arg)
+{
+	struct convert_state *s = arg;
+	char line[ASC_LINE_MAX];
+	uint32_t id = f->canId & (f->canId & CAN_EFF_FLAG ? CAN_EFF_MASK : CAN_SFF_MASK);
+	int len = 0;
+
+	switch (s->format)
+	{
+	case FORMAT_ASC:
+		// same layout as cyber-logfile.c: the id keeps CAN_EFF_FLAG
+		if (f->flags & BLF_FRAME_FD)
+			len = ascFormatFdFrame(line, f->ns / 1000000000, f->ns % 1000000000, f->channel,
+				f->canId, f->flags & BLF_FRAME_TX ? "Tx" : "Rx", f->flags & BLF_FRAME_BRS,
+				f->flags & BLF_FRAME_ESI, f->len, f->data);
+		else
+			len = ascFormatFrame(line, f->ns / 1000000000, f->ns % 1000000000, f->channel,
+				f->canId & ~CAN_RTR_FLAG, f->flags & BLF_FRAME_TX ? "Tx" : "Rx", f->len, f->data);
+		break;
+	case FORMAT_CSV:
+	{
+		char *p = line + snprintf(line, sizeof(line), "%llu.%06llu,%d,%X,%d,%d,",
+			(unsigned long long)(f->ns / 1000000000),
+			(unsigned long long)(f->ns % 1000000000 / 1000),
+			f->channel, id, (f->canId & CAN_EFF_FLAG) != 0, f->len);
+		p = putHexBytes(p, f->data, f->len, ' ');
+		*p++ = '\n';
+		len = p - line;
+		break;
+	}
+	case FORMAT_CANDUMP:
+	{
+		uint64_t ns = f->ns + s->start.tv_nsec;
+		char *p = line + snprintf(line, sizeof(line),
+			(f->canId & CAN_EFF_FLAG) ? "(%lld.%06llu) can%d %08X#" : "(%lld.%06llu) can%d %03X#",
+			(long long)(s->start.tv_sec + ns / 1000000000),
+			(unsigned long long)(ns % 1000000000 / 1000), f->channel - 1, id);
+		if (f->canId & CAN_RTR_FLAG)
+		{
+			*p++ = 'R';
+		}
+		else
+		{
+			if (f->flags & BLF_FRAME_FD)
+			{
+				*p++ = '#';
+				*p++ = hexDigits[(f->flags & BLF_FRAME_BRS ? CANFD_BRS : 0) |
+					(f->flags & BLF_FRAME_ESI ? CANFD_ESI : 0)];
+			}
+			p = putHexBytes(p, f->data, f->len, 0);
+		}
+		*p++ = '\n';
+		len = p - line;
+		break;
+	}
+	}
+
+	if (fwrite(line, 1, len, s->out) != (size_t)len)
+		return -1;
+	s->bytes += len;
+	return 0;
+}
+
+static void writeHeader(struct convert_state *s)
+{
+	time_t base = s->start.tv_sec;
+
+	if (s->format == FORMAT_ASC)
+		fprintf(s->out, "date,%sbase hex timestamps absolute\nno interval events logged\n",
+			ctime(&base));
+	else if (s->format == FORMAT_CSV)
+		fprintf(s->out, "timestamp,channel,id,extended,dlc,data\n");
+}
+
+static double elapsedSince(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f asc|csv|candump] [-j threads] [-o out] input.blf\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct convert_state state = { .out = stdout, .format = FORMAT_ASC };
+	struct blf_reader reader;
+	struct timespec t0;
+	const char *outPath = NULL;
+	int threads = BLF_READER_THREADS;
+	int status = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:j:o:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'f':
+			if (strcmp(optarg, "asc") == 0)
+				state.format = FORMAT_ASC;
+			else if (strcmp(optarg, "csv") == 0)
+				state.format = FORMAT_CSV;
+			else if (strcmp(optarg, "candump") == 0)
+				state.format = FORMAT_CANDUMP;
+			else
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'o':
+			outPath = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (blfReaderOpen(&reader, argv[optind]) != 0)
+		return 1;
+
+	if (outPath != NULL)
+	{
+		state.out = fopen(outPath, "w");
+		if (state.out == NULL)
+		{
+			perror(outPath);
+			blfReaderClose(&reader);
+			return 1;
+		}
+	}
+	setvbuf(state.out, NULL, _IOFBF, CONVERT_OUTPUT_BUFFER);
+
+	state.start = reader.start;
+	writeHeader(&state);
+
+	if (blfReaderRun(&reader, threads, writeFrame, &state) != 0)
+	{
+		fprintf(stderr, "Conversion failed\n");
+		status = 1;
+	}
+	if (fclose(state.out) != 0)
+		status = 1;
+
+	double elapsed = elapsedSince(&t0);
+	fprintf(stderr, "Converted %llu frames from %u containers (%llu objects, %llu bytes skipped) "
+		"in %.3f s, %.1f MB/s in, %.1f MB/s out\n",
+		(unsigned long long)reader.stats.frames, reader.stats.containers,
+		(unsigned long long)reader.stats.objects, (unsigned long long)reader.stats.skipped,
+		elapsed, reader.mapLen / elapsed / 1e6, state.bytes / elapsed / 1e6);
+
+	blfReaderClose(&reader);
+	return status;
+}
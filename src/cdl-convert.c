@@ -0,0 +1,159 @@
+/*
+	cdl-convert: turn a compact delta log (canbus-app -o cdl) into the
+	ASC text canbus-app would have written for the same frames.
+	usage: cdl-convert [-o out.asc] input.cdl
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "include/cyber-cdl.h"
+#include "include/cyber-asc.h"
+
+#define CONVERT_OUTPUT_BUFFER		(1 * 1024 * 1024)
+
+struct convert_state {
+	FILE *out;
+	const struct cdl_decode_info *info;	// start time is set before the first frame
+	int header;
+	uint64_t bytes;
+};
+
+static void writeHeader(struct convert_state *s)
+{
+	time_t base = s->info->start.tv_sec;
+
+	fprintf(s->out, "date,%sbase hex timestamps absolute\nno interval events logged\n",
+		ctime(&base));
+	s->header = 1;
+}
+
+// the comment lines canbus-app writes for a capture gap in ASC
+static int writeGap(struct convert_state *s, const struct cdl_frame *f)
+{
+	int64_t sec = f->ns / 1000000000;
+	long usec = f->ns % 1000000000 / 1000;
+	int len = 0;
+
+	if (f->socketLost != 0)
+		len += fprintf(s->out, "// %lld.%06ld CAN %d: %u frames lost, socket receive queue "
+			"overflow\n", (long long)sec, usec, f->channel, f->socketLost);
+	if (f->ringLost != 0)
+		len += fprintf(s->out, "// %lld.%06ld CAN %d: %u frames lost, capture ring full\n",
+			(long long)sec, usec, f->channel, f->ringLost);
+	if (ferror(s->out))
+		return -1;
+	s->bytes += len;
+	return 0;
+}
+
+static int writeFrame(const struct cdl_frame *f, void *arg)
+{
+	struct convert_state *s = arg;
+	char line[ASC_LINE_MAX];
+	int len;
+
+	if (!s->header)
+		writeHeader(s);
+	if (f->flags & CDL_FRAME_GAP)
+		return writeGap(s, f);
+	if (f->flags & CDL_FRAME_FD)
+		len = ascFormatFdFrame(line, f->ns / 1000000000, f->ns % 1000000000, f->channel,
+			f->canId, f->flags & CDL_FRAME_TX ? "Tx" : "Rx", f->flags & CDL_FRAME_BRS,
+			f->flags & CDL_FRAME_ESI, f->len, f->data);
+	else
+		len = ascFormatFrame(line, f->ns / 1000000000, f->ns % 1000000000, f->channel,
+			f->canId, f->flags & CDL_FRAME_TX ? "Tx" : "Rx", f->len, f->data);
+
+	if (fwrite(line, 1, len, s->out) != (size_t)len)
+		return -1;
+	s->bytes += len;
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-o out.asc] input.cdl\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct cdl_decode_info info;
+	struct convert_state state = { .out = stdout, .info = &info };
+	struct stat st;
+	const char *outPath = NULL;
+	const uint8_t *map;
+	int status = 0;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "o:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o':
+			outPath = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	if (st.st_size < CDL_FILE_HEADER_SIZE)
+	{
+		fprintf(stderr, "%s: not a CDL file\n", argv[optind]);
+		close(fd);
+		return 1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+	madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+	if (outPath != NULL && (state.out = fopen(outPath, "w")) == NULL)
+	{
+		perror(outPath);
+		munmap((void *)map, st.st_size);
+		return 1;
+	}
+	setvbuf(state.out, NULL, _IOFBF, CONVERT_OUTPUT_BUFFER);
+
+	if (cdlDecode(map, st.st_size, writeFrame, &state, &info) != 0)
+	{
+		fprintf(stderr, "%s: %s at offset %zu\n", argv[optind],
+			cdlErrorString(info.error), info.errorOffset);
+		status = 1;
+	}
+	else if (!state.header)
+		writeHeader(&state);
+	if (fclose(state.out) != 0)
+		status = 1;
+
+	if (info.gaps != 0)
+		fprintf(stderr, "%llu capture gaps\n", (unsigned long long)info.gaps);
+	fprintf(stderr, "%llu frames in %u blocks, %lld bytes -> %llu bytes ASC (%.1fx)\n",
+		(unsigned long long)info.frames, info.blocks, (long long)st.st_size,
+		(unsigned long long)state.bytes, st.st_size ? (double)state.bytes / st.st_size : 0);
+
+	munmap((void *)map, st.st_size);
+	return status;
+}
@@ -0,0 +1,343 @@
+/*
+	Windowed signal aggregation for upload.
+	Decoded values only update the shortest window (min, max, sum, last
+	and count per signal). When it closes it is folded into the longer
+	ones with one contiguous loop per field over all signals, which the
+	compiler vectorizes (the object is built with -O3), and every window
+	that ends is handed to the output as one AGG1 record with an entry
+	per signal that had samples. Window boundaries are aligned to the
+	frame clock, so the windows of all vehicles line up. Runs on the log
+	writer thread only.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/cyber-agg.h"
+
+static struct agg_window windows[AGG_MAX_WINDOWS];
+static int windowCount;
+static uint32_t signalCount;
+static uint8_t *record;
+static aggOutput output;
+static struct agg_stats stats;
+
+static uint64_t toNs(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void putLe32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void putFloat(uint8_t *p, double v)
+{
+	float f = v;
+	uint32_t bits;
+
+	memcpy(&bits, &f, sizeof(bits));
+	putLe32(p, bits);
+}
+
+static void alignWindow(struct agg_window *w, uint64_t now)
+{
+	uint64_t length = (uint64_t)w->lengthMs * 1000000;
+
+	w->start = now - now % length;
+	w->end = w->start + length;
+}
+
+static void resetWindow(struct agg_window *w)
+{
+	double *restrict min = w->min;
+	double *restrict max = w->max;
+	double *restrict sum = w->sum;
+	uint32_t *restrict count = w->count;
+	uint32_t n = signalCount;
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		min[i] = INFINITY;
+		max[i] = -INFINITY;
+		sum[i] = 0;
+		count[i] = 0;
+	}
+}
+
+static void foldWindow(const struct agg_window *src, struct agg_window *dst)
+{
+	const double *restrict sMin = src->min;
+	const double *restrict sMax = src->max;
+	const double *restrict sSum = src->sum;
+	const double *sLast = src->last;
+	const uint32_t *restrict sCount = src->count;
+	double *restrict dMin = dst->min;
+	double *restrict dMax = dst->max;
+	double *restrict dSum = dst->sum;
+	double *dLast = dst->last;
+	uint32_t *restrict dCount = dst->count;
+	// a local bound, a store through dCount could change signalCount
+	uint32_t n = signalCount;
+
+	// one loop per field: mixing the double compares with the 32-bit
+	// counts in one loop keeps GCC from vectorizing it
+	for (uint32_t i = 0; i < n; i++)
+		dMin[i] = sMin[i] < dMin[i] ? sMin[i] : dMin[i];
+	for (uint32_t i = 0; i < n; i++)
+		dMax[i] = sMax[i] > dMax[i] ? sMax[i] : dMax[i];
+	for (uint32_t i = 0; i < n; i++)
+		dSum[i] += sSum[i];
+	for (uint32_t i = 0; i < n; i++)
+		dCount[i] += sCount[i];
+	// last is never reset, so an empty src still has the right one
+	memcpy(dLast, sLast, n * sizeof(*dLast));
+}
+
+static void emitWindow(const struct agg_window *w)
+{
+	uint8_t *p = record + AGG_RECORD_HEADER_SIZE;
+	uint64_t startUs = w->start / 1000;
+	uint32_t entries = 0;
+
+	for (uint32_t i = 0; i < signalCount; i++)
+	{
+		if (w->count[i] == 0)
+			continue;
+		putLe32(p, i);
+		putLe32(p + 4, w->count[i]);
+		putFloat(p + 8, w->min[i]);
+		putFloat(p + 12, w->max[i]);
+		putFloat(p + 16, w->sum[i] / w->count[i]);
+		putFloat(p + 20, w->last[i]);
+		p += AGG_ENTRY_SIZE;
+		entries++;
+	}
+	// silent windows cost nothing on the uplink
+	if (entries == 0)
+		return;
+
+	memcpy(record, AGG_RECORD_SIGNATURE, 4);
+	putLe32(record + 4, w->lengthMs);
+	putLe32(record + 8, startUs);
+	putLe32(record + 12, startUs >> 32);
+	putLe32(record + 16, entries);
+	putLe32(record + 20, 0);
+
+	size_t len = p - record;
+	if (output != NULL && output(record, len) != 0)
+		printf("Aggregation record output failed\n");
+	stats.records++;
+	stats.bytes += len;
+}
+
+/*
+	The shortest window has ended: it goes out, is folded into the
+	longer ones and those that have ended go out too.
+*/
+static void advance(uint64_t now)
+{
+	struct agg_window *base = &windows[0];
+	struct timespec t0, t1;
+
+	emitWindow(base);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 1; i < windowCount; i++)
+	{
+		struct agg_window *w = &windows[i];
+		foldWindow(base, w);
+		if (w->end <= now)
+		{
+			emitWindow(w);
+			resetWindow(w);
+			alignWindow(w, now);
+		}
+	}
+	resetWindow(base);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	alignWindow(base, now);
+
+	stats.rollups++;
+	stats.rollupNs += (t1.tv_sec - t0.tv_sec) * 1000000000 + (t1.tv_nsec - t0.tv_nsec);
+}
+
+/*
+	windows are lengths in seconds, "1,10,60"; every one has to be a
+	multiple of the shortest.
+*/
+int aggInit(uint32_t signals, const char *list, aggOutput out)
+{
+	uint32_t lengths[AGG_MAX_WINDOWS];
+	char copy[64];
+	char *save = NULL;
+	int n = 0;
+
+	aggFree();
+	snprintf(copy, sizeof(copy), "%s", list ? list : AGG_DEFAULT_WINDOWS);
+	for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+	{
+		uint32_t seconds = strtoul(tok, NULL, 0);
+		int k = n;
+
+		if (seconds == 0 || n == AGG_MAX_WINDOWS)
+		{
+			printf("Invalid aggregation windows: %s (up to %d lengths in seconds)\n", list,
+				AGG_MAX_WINDOWS);
+			return -1;
+		}
+		// sorted insert, the shortest window comes first
+		while (k > 0 && lengths[k - 1] > seconds * 1000)
+		{
+			lengths[k] = lengths[k - 1];
+			k--;
+		}
+		lengths[k] = seconds * 1000;
+		n++;
+	}
+	for (int i = 1; i < n; i++)
+	{
+		if (lengths[i] % lengths[0] != 0 || lengths[i] == lengths[i - 1])
+		{
+			printf("Invalid aggregation windows: %s, %u s is no multiple of %u s\n", list,
+				lengths[i] / 1000, lengths[0] / 1000);
+			return -1;
+		}
+	}
+	if (n == 0 || signals == 0)
+		return -1;
+
+	signalCount = signals;
+	windowCount = n;
+	for (int i = 0; i < n; i++)
+	{
+		struct agg_window *w = &windows[i];
+		w->lengthMs = lengths[i];
+		w->start = w->end = 0;
+		w->min = malloc(signals * sizeof(double));
+		w->max = malloc(signals * sizeof(double));
+		w->sum = malloc(signals * sizeof(double));
+		w->last = calloc(signals, sizeof(double));
+		w->count = malloc(signals * sizeof(uint32_t));
+		if (w->min == NULL || w->max == NULL || w->sum == NULL || w->last == NULL ||
+			w->count == NULL)
+			goto fail;
+		resetWindow(w);
+	}
+	record = malloc(AGG_RECORD_HEADER_SIZE + (size_t)signals * AGG_ENTRY_SIZE);
+	if (record == NULL)
+		goto fail;
+
+	output = out;
+	memset(&stats, 0, sizeof(stats));
+	return 0;
+
+fail:
+	printf("Aggregation allocation failed: %u signals\n", signals);
+	aggFree();
+	return -1;
+}
+
+/*
+	values as dbcDecode() leaves them; NaN values (float signals) are
+	skipped.
+*/
+void aggUpdate(const struct timespec *ts, const struct dbc_value *values, int count)
+{
+	struct agg_window *base = &windows[0];
+	uint64_t now = toNs(ts);
+
+	if (now >= base->end)
+	{
+		if (base->end == 0)
+		{
+			for (int i = 0; i < windowCount; i++)
+				alignWindow(&windows[i], now);
+		}
+		else
+			advance(now);
+	}
+
+	double *min = base->min;
+	double *max = base->max;
+	for (int k = 0; k < count; k++)
+	{
+		uint32_t i = values[k].signal;
+		double v = values[k].value;
+
+		if (i >= signalCount || v != v)
+			continue;
+		min[i] = v < min[i] ? v : min[i];
+		max[i] = v > max[i] ? v : max[i];
+		base->sum[i] += v;
+		base->last[i] = v;
+		base->count[i]++;
+	}
+	stats.samples += count;
+}
+
+/*
+	Closes windows while no values arrive; now has to be on the clock
+	of the frame timestamps.
+*/
+void aggTick(const struct timespec *now)
+{
+	uint64_t ns = toNs(now);
+
+	if (windowCount > 0 && windows[0].end != 0 && ns >= windows[0].end)
+		advance(ns);
+}
+
+/*
+	At exit: the windows still open go out as they are.
+*/
+void aggFlush(void)
+{
+	if (windowCount == 0 || windows[0].end == 0)
+		return;
+
+	emitWindow(&windows[0]);
+	for (int i = 1; i < windowCount; i++)
+	{
+		foldWindow(&windows[0], &windows[i]);
+		emitWindow(&windows[i]);
+		resetWindow(&windows[i]);
+	}
+	resetWindow(&windows[0]);
+}
+
+void aggGetStats(struct agg_stats *out)
+{
+	*out = stats;
+}
+
+void aggPrintStats(void)
+{
+	printf("Aggregation summary: samples=%llu records=%llu bytes=%llu rollups=%llu "
+		"avg rollup=%.1f us\n", (unsigned long long)stats.samples,
+		(unsigned long long)stats.records, (unsigned long long)stats.bytes,
+		(unsigned long long)stats.rollups,
+		stats.rollups ? stats.rollupNs / 1000.0 / stats.rollups : 0.0);
+}
+
+void aggFree(void)
+{
+	for (int i = 0; i < AGG_MAX_WINDOWS; i++)
+	{
+		struct agg_window *w = &windows[i];
+		free(w->min);
+		free(w->max);
+		free(w->sum);
+		free(w->last);
+		free(w->count);
+		memset(w, 0, sizeof(*w));
+	}
+	free(record);
+	record = NULL;
+	windowCount = 0;
+	signalCount = 0;
+}
@@ -0,0 +1,197 @@
+/*
+	ASC line formatter.
+	Renders one frame line in a single pass into a caller buffer using
+	lookup tables and integer arithmetic only. The output is the same as
+	"%.6f %d %X %s d %d" followed by " %02X" per data byte and a newline.
+	CAN FD frames use the CANFD record of the Vector ASC format.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <linux/can.h>
+#include "include/cyber-asc.h"
+
+// fast path only while 0.5 ulp of the old double stays below 1 ns
+#define ASC_FAST_SEC_LIMIT		(1 << 21)
+
+// CANFD record flags: EDL, BRS, ESI
+#define ASC_FD_FLAG_EDL			0x1000
+#define ASC_FD_FLAG_BRS			0x2000
+#define ASC_FD_FLAG_ESI			0x4000
+
+static const char hexPairs[512] =
+	"000102030405060708090A0B0C0D0E0F"
+	"101112131415161718191A1B1C1D1E1F"
+	"202122232425262728292A2B2C2D2E2F"
+	"303132333435363738393A3B3C3D3E3F"
+	"404142434445464748494A4B4C4D4E4F"
+	"505152535455565758595A5B5C5D5E5F"
+	"606162636465666768696A6B6C6D6E6F"
+	"707172737475767778797A7B7C7D7E7F"
+	"808182838485868788898A8B8C8D8E8F"
+	"909192939495969798999A9B9C9D9E9F"
+	"A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+	"B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+	"C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+	"D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+	"E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+	"F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+static const char hexDigits[16] = {
+	'0', '1', '2', '3', '4', '5', '6', '7',
+	'8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+};
+
+static char *putDecimal(char *p, uint64_t value)
+{
+	char tmp[20];
+	int n = 0;
+
+	do
+	{
+		tmp[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+
+	while (n > 0)
+		*p++ = tmp[--n];
+	return p;
+}
+
+static char *putHex(char *p, uint32_t value)
+{
+	int shift = 28;
+
+	while (shift > 0 && ((value >> shift) & 0xF) == 0)
+		shift -= 4;
+	for (; shift >= 0; shift -= 4)
+		*p++ = hexDigits[(value >> shift) & 0xF];
+	return p;
+}
+
+static char *putMicros(char *p, uint64_t us)
+{
+	uint32_t frac = us % 1000000;
+
+	p = putDecimal(p, us / 1000000);
+	*p++ = '.';
+	for (int i = 5; i >= 0; i--)
+	{
+		p[i] = '0' + frac % 10;
+		frac /= 10;
+	}
+	return p + 6;
+}
+
+static char *putData(char *p, const uint8_t *data, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		const char *hex = &hexPairs[data[i] * 2];
+		p[0] = ' ';
+		p[1] = hex[0];
+		p[2] = hex[1];
+		p += 3;
+	}
+	return p;
+}
+
+static char *putTime(char *p, int64_t sec, long nsec)
+{
+	int64_t ns = sec * 1000000000 + nsec;
+
+	if (ns >= 0 && sec < ASC_FAST_SEC_LIMIT && ns % 1000 != 500)
+	{
+		p = putMicros(p, ns / 1000 + (ns % 1000 > 500));
+	}
+	else
+	{
+		// negative offsets and exact half microseconds round like printf
+		p += snprintf(p, ASC_LINE_MAX, "%.6f", sec + nsec / 1e9);
+	}
+	return p;
+}
+
+static char *putChannel(char *p, int channel)
+{
+	if (channel >= 0)
+		return putDecimal(p, channel);
+	return p + snprintf(p, 16, "%d", channel);
+}
+
+/*
+	sec/nsec is the offset from the log base, nsec may be negative. out
+	must hold ASC_LINE_MAX bytes; returns the line length, newline included.
+*/
+int ascFormatFrame(char *out, int64_t sec, long nsec, int channel, uint32_t id,
+	const char *dir, uint8_t dlc, const uint8_t *data)
+{
+	char *p = putTime(out, sec, nsec);
+
+	*p++ = ' ';
+	p = putChannel(p, channel);
+	*p++ = ' ';
+	p = putHex(p, id);
+	*p++ = ' ';
+	while (*dir != '\0')
+		*p++ = *dir++;
+	*p++ = ' ';
+	*p++ = 'd';
+	*p++ = ' ';
+	p = putDecimal(p, dlc);
+	p = putData(p, data, dlc);
+	*p++ = '\n';
+
+	return p - out;
+}
+
+static uint8_t lenToDlc(uint8_t len)
+{
+	if (len <= 8)
+		return len;
+	if (len <= 24)
+		return 8 + (len - 5) / 4;	// 12, 16, 20, 24 -> 9..12
+	return len <= 32 ? 13 : len <= 48 ? 14 : 15;
+}
+
+/*
+	"<time> CANFD <ch> <dir> <id> <brs> <esi> <dlc> <len> <data>
+	<duration> <bits> <flags> <crc> <4 x bit timing>". Duration, bit
+	count, crc and bit timing are not known here and written as 0. id is
+	a can_id: an extended one is written as its 29 bits with an "x".
+*/
+int ascFormatFdFrame(char *out, int64_t sec, long nsec, int channel, uint32_t id,
+	const char *dir, int brs, int esi, uint8_t len, const uint8_t *data)
+{
+	static const char tail[] = " 0 0 0 0 0\n";
+	uint32_t flags = ASC_FD_FLAG_EDL | (brs ? ASC_FD_FLAG_BRS : 0) | (esi ? ASC_FD_FLAG_ESI : 0);
+	char *p = putTime(out, sec, nsec);
+
+	if (len > 64)
+		len = 64;
+
+	memcpy(p, " CANFD ", 7);
+	p = putChannel(p + 7, channel);
+	*p++ = ' ';
+	while (*dir != '\0')
+		*p++ = *dir++;
+	*p++ = ' ';
+	p = putHex(p, id & (id & CAN_EFF_FLAG ? CAN_EFF_MASK : CAN_SFF_MASK));
+	if (id & CAN_EFF_FLAG)
+		*p++ = 'x';
+	*p++ = ' ';
+	*p++ = brs ? '1' : '0';
+	*p++ = ' ';
+	*p++ = esi ? '1' : '0';
+	*p++ = ' ';
+	*p++ = hexDigits[lenToDlc(len)];
+	*p++ = ' ';
+	p = putDecimal(p, len);
+	p = putData(p, data, len);
+	memcpy(p, " 0 0 ", 5);
+	p = putHex(p + 5, flags);
+	memcpy(p, tail, sizeof(tail) - 1);
+	p += sizeof(tail) - 1;
+
+	return p - out;
+}
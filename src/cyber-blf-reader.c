@@ -0,0 +1,560 @@
+/*
+	Streaming BLF reader.
+	The file is mmapped and its top level objects are indexed without
+	copying. LOG_CONTAINERs are inflated ahead of the walker on a small
+	thread pool, the walker then decodes the objects in file order and
+	hands CAN frames out through a bounded reorder heap, so frames come
+	out in timestamp order. Messages go to stderr since the converters
+	write their output to stdout.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <linux/can.h>
+#include "include/cyber-blf-reader.h"
+
+#define CHUNK_PENDING		0
+#define CHUNK_BUSY		1
+#define CHUNK_READY		2
+#define CHUNK_FAILED		3
+
+static uint16_t getLe16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t getLe32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t getLe64(const uint8_t *p)
+{
+	return getLe32(p) | ((uint64_t)getLe32(p + 4) << 32);
+}
+
+static void getSystemTime(const uint8_t *p, struct timespec *ts)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = getLe16(p) - 1900;
+	tm.tm_mon = getLe16(p + 2) - 1;
+	tm.tm_mday = getLe16(p + 6);
+	tm.tm_hour = getLe16(p + 8);
+	tm.tm_min = getLe16(p + 10);
+	tm.tm_sec = getLe16(p + 12);
+	tm.tm_isdst = -1;
+	ts->tv_sec = mktime(&tm);
+	ts->tv_nsec = getLe16(p + 14) * 1000000L;
+}
+
+static int addChunk(struct blf_reader *r, const uint8_t *src, uint32_t srcLen,
+	uint32_t len, int method)
+{
+	if (r->chunkCount == r->chunkCapacity)
+	{
+		uint32_t grow = r->chunkCapacity ? r->chunkCapacity * 2 : 256;
+		struct blf_chunk *chunks = realloc(r->chunks, grow * sizeof(*chunks));
+		if (chunks == NULL)
+			return -1;
+		r->chunks = chunks;
+		r->chunkCapacity = grow;
+	}
+
+	struct blf_chunk *c = &r->chunks[r->chunkCount++];
+	memset(c, 0, sizeof(*c));
+	c->src = src;
+	c->srcLen = srcLen;
+	c->len = len;
+	c->method = method;
+	c->state = method == BLF_COMPRESSION_NONE ? CHUNK_READY : CHUNK_PENDING;
+	return 0;
+}
+
+/*
+	Top level objects are containers in practice; anything else is kept
+	as a stored chunk that points straight into the mapping.
+*/
+static int indexObjects(struct blf_reader *r)
+{
+	size_t pos = getLe32(r->map + 4);
+
+	while (pos + BLF_OBJ_HEADER_BASE_SIZE <= r->mapLen)
+	{
+		const uint8_t *obj = r->map + pos;
+		uint32_t size = getLe32(obj + 8);
+		size_t total;
+
+		if (memcmp(obj, BLF_OBJ_SIGNATURE, 4) != 0 || size < BLF_OBJ_HEADER_BASE_SIZE ||
+			pos + size > r->mapLen)
+		{
+			// truncated tail of a file that was not closed cleanly
+			r->stats.skipped += r->mapLen - pos;
+			break;
+		}
+		// the last object may end the file without its padding
+		total = size + size % 4;
+		if (total > r->mapLen - pos)
+			total = r->mapLen - pos;
+
+		if (getLe32(obj + 12) == BLF_OBJ_LOG_CONTAINER && size >= BLF_CONTAINER_HEADER_SIZE)
+		{
+			if (addChunk(r, obj + BLF_CONTAINER_HEADER_SIZE, size - BLF_CONTAINER_HEADER_SIZE,
+				getLe32(obj + 24), getLe16(obj + 16)) != 0)
+				return -1;
+			r->stats.containers++;
+		}
+		else if (addChunk(r, obj, total, total, BLF_COMPRESSION_NONE) != 0)
+		{
+			return -1;
+		}
+
+		pos += total;
+	}
+
+	return 0;
+}
+
+int blfReaderOpen(struct blf_reader *r, const char *path)
+{
+	struct stat st;
+
+	memset(r, 0, sizeof(*r));
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	r->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (r->fd < 0)
+	{
+		fprintf(stderr, "BLF open failed: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(r->fd, &st) != 0 || st.st_size < BLF_FILE_HEADER_SIZE)
+	{
+		fprintf(stderr, "BLF file too short: %s\n", path);
+		goto fail;
+	}
+
+	r->mapLen = st.st_size;
+	r->map = mmap(NULL, r->mapLen, PROT_READ, MAP_PRIVATE, r->fd, 0);
+	if (r->map == MAP_FAILED)
+	{
+		fprintf(stderr, "BLF mmap failed: %s\n", strerror(errno));
+		r->map = NULL;
+		goto fail;
+	}
+	madvise((void *)r->map, r->mapLen, MADV_SEQUENTIAL);
+
+	if (memcmp(r->map, BLF_FILE_SIGNATURE, 4) != 0 ||
+		getLe32(r->map + 4) > r->mapLen)
+	{
+		fprintf(stderr, "Not a BLF file: %s\n", path);
+		goto fail;
+	}
+	getSystemTime(r->map + 40, &r->start);
+
+	if (indexObjects(r) != 0)
+	{
+		fprintf(stderr, "BLF index allocation failed\n");
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	blfReaderClose(r);
+	return -1;
+}
+
+static void inflateChunk(struct blf_chunk *c)
+{
+	uLongf len = c->len;
+
+	c->buf = malloc(c->len ? c->len : 1);
+	if (c->buf == NULL)
+	{
+		c->state = CHUNK_FAILED;
+		return;
+	}
+
+	if (c->method != BLF_COMPRESSION_ZLIB ||
+		uncompress(c->buf, &len, c->src, c->srcLen) != Z_OK || len != c->len)
+	{
+		free(c->buf);
+		c->buf = NULL;
+		c->state = CHUNK_FAILED;
+		return;
+	}
+	c->state = CHUNK_READY;
+}
+
+/*
+	Workers inflate the next pending container as long as it is within
+	window containers of the walker, so memory stays bounded.
+*/
+static void *inflateWorker(void *arg)
+{
+	struct blf_reader *r = arg;
+
+	pthread_mutex_lock(&r->lock);
+	while (!r->stop)
+	{
+		while (r->nextJob < r->chunkCount &&
+			r->chunks[r->nextJob].state != CHUNK_PENDING)
+			r->nextJob++;
+
+		if (r->nextJob >= r->chunkCount)
+			break;
+		if (r->nextJob >= r->consumed + r->window)
+		{
+			pthread_cond_wait(&r->cond, &r->lock);
+			continue;
+		}
+
+		struct blf_chunk *c = &r->chunks[r->nextJob++];
+		c->state = CHUNK_BUSY;
+		pthread_mutex_unlock(&r->lock);
+
+		inflateChunk(c);
+
+		pthread_mutex_lock(&r->lock);
+		pthread_cond_broadcast(&r->cond);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+static int heapBefore(const struct blf_frame *a, const struct blf_frame *b)
+{
+	return a->ns < b->ns || (a->ns == b->ns && a->seq < b->seq);
+}
+
+static int heapPop(struct blf_reader *r, blfFrameCallback cb, void *arg)
+{
+	struct blf_frame *h = r->heap;
+	int ret = cb(&h[0], arg);
+	size_t i = 0;
+
+	h[0] = h[--r->heapLen];
+	while (1)
+	{
+		size_t l = 2 * i + 1, m = i;
+		if (l < r->heapLen && heapBefore(&h[l], &h[m]))
+			m = l;
+		if (l + 1 < r->heapLen && heapBefore(&h[l + 1], &h[m]))
+			m = l + 1;
+		if (m == i)
+			break;
+		struct blf_frame t = h[i];
+		h[i] = h[m];
+		h[m] = t;
+		i = m;
+	}
+	return ret;
+}
+
+static int heapPush(struct blf_reader *r, const struct blf_frame *f,
+	blfFrameCallback cb, void *arg)
+{
+	struct blf_frame *h = r->heap;
+	int ret = 0;
+
+	if (r->heapLen == BLF_REORDER_WINDOW)
+		ret = heapPop(r, cb, arg);
+
+	size_t i = r->heapLen++;
+	h[i] = *f;
+	while (i > 0 && heapBefore(&h[i], &h[(i - 1) / 2]))
+	{
+		struct blf_frame t = h[i];
+		h[i] = h[(i - 1) / 2];
+		h[(i - 1) / 2] = t;
+		i = (i - 1) / 2;
+	}
+	return ret;
+}
+
+static int decodeObject(struct blf_reader *r, const uint8_t *obj, uint32_t size,
+	blfFrameCallback cb, void *arg)
+{
+	uint16_t headerSize = getLe16(obj + 4);
+	uint32_t type = getLe32(obj + 12);
+	const uint8_t *p = obj + headerSize;
+	struct blf_frame f;
+	uint32_t id;
+
+	r->stats.objects++;
+	if (headerSize < BLF_OBJ_HEADER_V1_SIZE || headerSize > size)
+		return 0;
+
+	uint64_t ts = getLe64(obj + 24);
+	f.ns = (getLe32(obj + 16) & BLF_OBJ_FLAG_TIME_TEN_MICS) ? ts * 10000 : ts;
+	f.seq = r->seq++;
+	f.flags = 0;
+
+	switch (type)
+	{
+	case BLF_OBJ_CAN_MESSAGE:
+	case BLF_OBJ_CAN_MESSAGE2:
+		if (size < headerSize + 16u)
+			return 0;
+		f.channel = getLe16(p);
+		f.len = p[3] > 8 ? 8 : p[3];
+		id = getLe32(p + 4);
+		if (p[2] & BLF_CAN_MSG_FLAG_TX)
+			f.flags |= BLF_FRAME_TX;
+		f.canId = (p[2] & BLF_CAN_MSG_FLAG_RTR) ? CAN_RTR_FLAG : 0;
+		memcpy(f.data, p + 8, f.len);
+		break;
+	case BLF_OBJ_CAN_FD_MESSAGE:
+		if (size < headerSize + 84u)
+			return 0;
+		f.channel = getLe16(p);
+		f.len = p[14] > 64 ? 64 : p[14];
+		id = getLe32(p + 4);
+		if (p[2] & BLF_CAN_MSG_FLAG_TX)
+			f.flags |= BLF_FRAME_TX;
+		if (p[13] & 0x1)
+			f.flags |= BLF_FRAME_FD;
+		if (p[13] & 0x2)
+			f.flags |= BLF_FRAME_BRS;
+		if (p[13] & 0x4)
+			f.flags |= BLF_FRAME_ESI;
+		f.canId = 0;
+		memcpy(f.data, p + 20, f.len);
+		break;
+	case BLF_OBJ_CAN_FD_MESSAGE_64:
+	{
+		if (size < headerSize + 40u)
+			return 0;
+		uint32_t fdFlags = getLe32(p + 12);
+		f.channel = p[0];
+		f.len = p[2] > 64 ? 64 : p[2];
+		if (size < headerSize + 40u + f.len)
+			return 0;
+		id = getLe32(p + 4);
+		if (p[34])
+			f.flags |= BLF_FRAME_TX;
+		if (fdFlags & BLF_CANFD_FLAG_EDL)
+			f.flags |= BLF_FRAME_FD;
+		if (fdFlags & BLF_CANFD_FLAG_BRS)
+			f.flags |= BLF_FRAME_BRS;
+		if (fdFlags & BLF_CANFD_FLAG_ESI)
+			f.flags |= BLF_FRAME_ESI;
+		f.canId = 0;
+		memcpy(f.data, p + 40, f.len);
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	if (id & BLF_CAN_ID_EXTENDED)
+		f.canId |= CAN_EFF_FLAG | (id & CAN_EFF_MASK);
+	else
+		f.canId |= id & CAN_SFF_MASK;
+
+	r->stats.frames++;
+	return heapPush(r, &f, cb, arg);
+}
+
+static int carryAppend(struct blf_reader *r, const uint8_t *data, size_t len)
+{
+	if (r->carryLen + len > r->carrySize)
+	{
+		size_t size = r->carrySize ? r->carrySize : 4096;
+		while (size < r->carryLen + len)
+			size *= 2;
+		uint8_t *carry = realloc(r->carry, size);
+		if (carry == NULL)
+			return -1;
+		r->carry = carry;
+		r->carrySize = size;
+	}
+	memcpy(r->carry + r->carryLen, data, len);
+	r->carryLen += len;
+	return 0;
+}
+
+/*
+	Objects may straddle container boundaries; the pieces of such an
+	object are collected in carry until it is complete.
+*/
+static int walkChunk(struct blf_reader *r, const uint8_t *data, size_t len,
+	blfFrameCallback cb, void *arg)
+{
+	size_t pos = 0;
+
+	while (pos < len)
+	{
+		if (r->carryLen > 0 || len - pos < BLF_OBJ_HEADER_BASE_SIZE)
+		{
+			size_t need = r->carryNeed ? r->carryNeed : BLF_OBJ_HEADER_BASE_SIZE;
+			size_t n = need - r->carryLen;
+			if (n > len - pos)
+				n = len - pos;
+			if (carryAppend(r, data + pos, n) != 0)
+				return -1;
+			pos += n;
+			if (r->carryLen < need)
+				continue;
+
+			if (r->carryNeed == 0)
+			{
+				uint32_t size = getLe32(r->carry + 8);
+				if (memcmp(r->carry, BLF_OBJ_SIGNATURE, 4) != 0 ||
+					size < BLF_OBJ_HEADER_BASE_SIZE)
+				{
+					r->stats.skipped += r->carryLen;
+					r->carryLen = 0;
+					continue;
+				}
+				r->carryNeed = size + size % 4;
+				continue;
+			}
+
+			int ret = decodeObject(r, r->carry, getLe32(r->carry + 8), cb, arg);
+			r->carryLen = 0;
+			r->carryNeed = 0;
+			if (ret != 0)
+				return ret;
+			continue;
+		}
+
+		const uint8_t *obj = data + pos;
+		uint32_t size = getLe32(obj + 8);
+		if (memcmp(obj, BLF_OBJ_SIGNATURE, 4) != 0 || size < BLF_OBJ_HEADER_BASE_SIZE)
+		{
+			// resync on the next object signature
+			const uint8_t *next = memmem(obj + 1, len - pos - 1, BLF_OBJ_SIGNATURE, 4);
+			size_t skip = next ? (size_t)(next - obj) : len - pos;
+			r->stats.skipped += skip;
+			pos += skip;
+			continue;
+		}
+
+		size_t total = size + size % 4;
+		if (total > len - pos)
+		{
+			r->carryNeed = total;
+			if (carryAppend(r, obj, len - pos) != 0)
+				return -1;
+			break;
+		}
+
+		int ret = decodeObject(r, obj, size, cb, arg);
+		if (ret != 0)
+			return ret;
+		pos += total;
+	}
+
+	return 0;
+}
+
+/*
+	After the last chunk: an object that only misses its padding, as
+	the last one of a file may, is decoded, anything shorter is a
+	truncated tail.
+*/
+static int finishCarry(struct blf_reader *r, blfFrameCallback cb, void *arg)
+{
+	int ret = 0;
+
+	if (r->carryNeed > 0 && r->carryLen >= getLe32(r->carry + 8))
+		ret = decodeObject(r, r->carry, getLe32(r->carry + 8), cb, arg);
+	else
+		r->stats.skipped += r->carryLen;
+	r->carryLen = 0;
+	r->carryNeed = 0;
+	return ret;
+}
+
+int blfReaderRun(struct blf_reader *r, int threads, blfFrameCallback cb, void *arg)
+{
+	pthread_t workers[64];
+	int ret = 0;
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > 64)
+		threads = 64;
+
+	r->heap = malloc(BLF_REORDER_WINDOW * sizeof(*r->heap));
+	if (r->heap == NULL)
+		return -1;
+	r->window = threads * BLF_READER_WINDOW;
+
+	for (int i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, inflateWorker, r);
+
+	for (uint32_t i = 0; i < r->chunkCount && ret == 0; i++)
+	{
+		struct blf_chunk *c = &r->chunks[i];
+
+		pthread_mutex_lock(&r->lock);
+		while (c->state == CHUNK_PENDING || c->state == CHUNK_BUSY)
+			pthread_cond_wait(&r->cond, &r->lock);
+		pthread_mutex_unlock(&r->lock);
+
+		if (c->state == CHUNK_FAILED)
+		{
+			fprintf(stderr, "BLF container %u could not be inflated\n", i);
+			r->stats.skipped += c->srcLen;
+		}
+		else
+		{
+			ret = walkChunk(r, c->buf ? c->buf : c->src, c->len, cb, arg);
+			r->stats.uncompressed += c->len;
+		}
+
+		free(c->buf);
+		c->buf = NULL;
+
+		pthread_mutex_lock(&r->lock);
+		r->consumed = i + 1;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+
+	pthread_mutex_lock(&r->lock);
+	r->stop = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	for (int i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+
+	if (ret == 0)
+		ret = finishCarry(r, cb, arg);
+	while (ret == 0 && r->heapLen > 0)
+		ret = heapPop(r, cb, arg);
+
+	return ret;
+}
+
+void blfReaderClose(struct blf_reader *r)
+{
+	if (r->chunks != NULL)
+	{
+		for (uint32_t i = 0; i < r->chunkCount; i++)
+			free(r->chunks[i].buf);
+		free(r->chunks);
+	}
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	if (r->map != NULL)
+		munmap((void *)r->map, r->mapLen);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r->carry);
+	free(r->heap);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
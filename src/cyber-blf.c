@@ -0,0 +1,275 @@
+/*
+	Vector BLF writer.
+	Encodes CAN_MESSAGE2 / CAN_FD_MESSAGE_64 objects and packs them into
+	zlib compressed LOG_CONTAINER objects, like CANalyzer does.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <linux/can.h>
+#include "include/cyber-blf.h"
+
+#define BLF_APPLICATION_ID		5
+#define BLF_CAN_MESSAGE2_SIZE		(BLF_OBJ_HEADER_V1_SIZE + 24)
+#define BLF_CAN_FD_MESSAGE_64_SIZE	(BLF_OBJ_HEADER_V1_SIZE + 40)
+#define BLF_APP_TEXT_SIZE		(BLF_OBJ_HEADER_V1_SIZE + 16)
+#define BLF_OBJ_MAX_SIZE		(BLF_CAN_FD_MESSAGE_64_SIZE + 64 + 4)
+#define BLF_TEXT_MAX			6144	// a reassembled J1939 PGN in hex
+
+static void putLe16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void putLe32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void putLe64(uint8_t *p, uint64_t v)
+{
+	putLe32(p, (uint32_t)v);
+	putLe32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void putSystemTime(uint8_t *p, const struct timespec *ts)
+{
+	struct tm tm;
+	time_t sec = ts->tv_sec;
+
+	localtime_r(&sec, &tm);
+	putLe16(p, tm.tm_year + 1900);
+	putLe16(p + 2, tm.tm_mon + 1);
+	putLe16(p + 4, tm.tm_wday);
+	putLe16(p + 6, tm.tm_mday);
+	putLe16(p + 8, tm.tm_hour);
+	putLe16(p + 10, tm.tm_min);
+	putLe16(p + 12, tm.tm_sec);
+	putLe16(p + 14, ts->tv_nsec / 1000000);
+}
+
+static uint8_t lenToDlc(uint8_t len)
+{
+	static const uint8_t fdLens[] = { 12, 16, 20, 24, 32, 48, 64 };
+
+	if (len <= 8)
+		return len;
+	for (int i = 0; i < 7; i++)
+	{
+		if (len <= fdLens[i])
+			return 9 + i;
+	}
+	return 15;
+}
+
+static uint64_t nsSinceStart(const struct blf_writer *w, const struct timespec *ts)
+{
+	int64_t ns = (int64_t)(ts->tv_sec - w->start.tv_sec) * 1000000000 +
+		(ts->tv_nsec - w->start.tv_nsec);
+	return ns > 0 ? ns : 0;
+}
+
+/*
+	Writes the base + V1 object header and returns the object body.
+*/
+static uint8_t *beginObject(struct blf_writer *w, uint32_t type, uint32_t size,
+	const struct timespec *ts)
+{
+	uint8_t *p = w->container + w->used;
+
+	memcpy(p, BLF_OBJ_SIGNATURE, 4);
+	putLe16(p + 4, BLF_OBJ_HEADER_V1_SIZE);
+	putLe16(p + 6, 1);
+	putLe32(p + 8, size);
+	putLe32(p + 12, type);
+	putLe32(p + 16, BLF_OBJ_FLAG_TIME_ONE_NANS);
+	putLe16(p + 20, 0);
+	putLe16(p + 22, 0);
+	putLe64(p + 24, nsSinceStart(w, ts));
+
+	return p + BLF_OBJ_HEADER_V1_SIZE;
+}
+
+static int endObject(struct blf_writer *w, uint32_t size, const struct timespec *ts)
+{
+	uint32_t padding = size % 4;
+
+	memset(w->container + w->used + size, 0, padding);
+	w->used += size + padding;
+	w->objectCount++;
+	w->last = *ts;
+
+	if (w->used >= BLF_CONTAINER_SIZE)
+		return blfFlushContainer(w);
+	return 0;
+}
+
+/*
+	Deflates up to BLF_CONTAINER_SIZE bytes into one LOG_CONTAINER. An
+	object that crosses the boundary continues in the next container.
+*/
+static int emitContainer(struct blf_writer *w, size_t len)
+{
+	uLongf zlen = w->zbufSize - BLF_CONTAINER_HEADER_SIZE;
+	uint8_t *p = w->zbuf;
+	uint8_t pad[4] = { 0, 0, 0, 0 };
+
+	if (compress2(p + BLF_CONTAINER_HEADER_SIZE, &zlen, w->container, len, w->level) != Z_OK)
+	{
+		printf("BLF container compression failed\n");
+		return -1;
+	}
+
+	uint32_t size = BLF_CONTAINER_HEADER_SIZE + zlen;
+	memcpy(p, BLF_OBJ_SIGNATURE, 4);
+	putLe16(p + 4, BLF_OBJ_HEADER_BASE_SIZE);
+	putLe16(p + 6, 1);
+	putLe32(p + 8, size);
+	putLe32(p + 12, BLF_OBJ_LOG_CONTAINER);
+	putLe16(p + 16, BLF_COMPRESSION_ZLIB);
+	memset(p + 18, 0, 6);
+	putLe32(p + 24, len);
+	putLe32(p + 28, 0);
+
+	if (w->out(p, size) != 0 || w->out(pad, size % 4) != 0)
+		return -1;
+
+	w->uncompressedSize += BLF_CONTAINER_HEADER_SIZE + len;
+	return 0;
+}
+
+int blfWriterInit(struct blf_writer *w, int level, blfOutput out)
+{
+	memset(w, 0, sizeof(*w));
+	w->out = out;
+	w->level = level;
+	w->container = malloc(BLF_CONTAINER_SIZE + BLF_OBJ_MAX_SIZE + BLF_TEXT_MAX);
+	w->zbufSize = BLF_CONTAINER_HEADER_SIZE + compressBound(BLF_CONTAINER_SIZE);
+	w->zbuf = malloc(w->zbufSize);
+	if (w->container == NULL || w->zbuf == NULL)
+	{
+		printf("BLF writer allocation failed\n");
+		blfWriterFree(w);
+		return -1;
+	}
+	return 0;
+}
+
+void blfWriterStart(struct blf_writer *w, const struct timespec *start)
+{
+	// SYSTEMTIME has millisecond resolution, keep object offsets exact
+	w->start.tv_sec = start->tv_sec;
+	w->start.tv_nsec = start->tv_nsec / 1000000 * 1000000;
+	w->last = w->start;
+	w->used = 0;
+	w->uncompressedSize = BLF_FILE_HEADER_SIZE;
+	w->objectCount = 0;
+}
+
+int blfAddCanFrame(struct blf_writer *w, const struct timespec *ts, int channel,
+	uint32_t canId, int flags, uint8_t len, const uint8_t *data)
+{
+	uint32_t id = canId & CAN_EFF_MASK;
+	uint8_t *p;
+	uint32_t size;
+
+	if (canId & CAN_EFF_FLAG)
+		id |= BLF_CAN_ID_EXTENDED;
+	if (len > CANFD_MAX_DLEN)
+		len = CANFD_MAX_DLEN;
+
+	if (flags & BLF_FRAME_FD)
+	{
+		uint32_t fdFlags = BLF_CANFD_FLAG_EDL;
+		if (flags & BLF_FRAME_BRS)
+			fdFlags |= BLF_CANFD_FLAG_BRS;
+		if (flags & BLF_FRAME_ESI)
+			fdFlags |= BLF_CANFD_FLAG_ESI;
+
+		size = BLF_CAN_FD_MESSAGE_64_SIZE + len;
+		p = beginObject(w, BLF_OBJ_CAN_FD_MESSAGE_64, size, ts);
+		memset(p, 0, 40);
+		p[0] = channel;
+		p[1] = lenToDlc(len);
+		p[2] = len;
+		putLe32(p + 4, id);
+		putLe32(p + 12, fdFlags);
+		p[34] = (flags & BLF_FRAME_TX) ? 1 : 0;
+		memcpy(p + 40, data, len);
+	}
+	else
+	{
+		size = BLF_CAN_MESSAGE2_SIZE;
+		p = beginObject(w, BLF_OBJ_CAN_MESSAGE2, size, ts);
+		memset(p, 0, 24);
+		putLe16(p, channel);
+		p[2] = (flags & BLF_FRAME_TX) ? BLF_CAN_MSG_FLAG_TX : 0;
+		if (canId & CAN_RTR_FLAG)
+			p[2] |= BLF_CAN_MSG_FLAG_RTR;
+		p[3] = len;
+		putLe32(p + 4, id);
+		memcpy(p + 8, data, len > 8 ? 8 : len);
+	}
+
+	return endObject(w, size, ts);
+}
+
+int blfAddText(struct blf_writer *w, const struct timespec *ts, const char *text)
+{
+	size_t len = strnlen(text, BLF_TEXT_MAX - 1);
+	uint32_t size = BLF_APP_TEXT_SIZE + len + 1;
+	uint8_t *p = beginObject(w, BLF_OBJ_APP_TEXT, size, ts);
+
+	memset(p, 0, 16);
+	putLe32(p + 8, len + 1);
+	memcpy(p + 16, text, len);
+	p[16 + len] = '\0';
+
+	return endObject(w, size, ts);
+}
+
+int blfFlushContainer(struct blf_writer *w)
+{
+	while (w->used > 0)
+	{
+		size_t len = w->used > BLF_CONTAINER_SIZE ? BLF_CONTAINER_SIZE : w->used;
+		if (emitContainer(w, len) != 0)
+			return -1;
+		memmove(w->container, w->container + len, w->used - len);
+		w->used -= len;
+	}
+	return 0;
+}
+
+void blfBuildHeader(const struct blf_writer *w, uint64_t fileSize,
+	uint8_t header[BLF_FILE_HEADER_SIZE])
+{
+	memset(header, 0, BLF_FILE_HEADER_SIZE);
+	memcpy(header, BLF_FILE_SIGNATURE, 4);
+	putLe32(header + 4, BLF_FILE_HEADER_SIZE);
+	header[8] = BLF_APPLICATION_ID;
+	// binary log format version 2.6.8.1
+	header[12] = 2;
+	header[13] = 6;
+	header[14] = 8;
+	header[15] = 1;
+	putLe64(header + 16, fileSize);
+	putLe64(header + 24, w->uncompressedSize);
+	putLe32(header + 32, w->objectCount);
+	putSystemTime(header + 40, &w->start);
+	putSystemTime(header + 56, &w->last);
+}
+
+void blfWriterFree(struct blf_writer *w)
+{
+	free(w->container);
+	free(w->zbuf);
+	w->container = NULL;
+	w->zbuf = NULL;
+}
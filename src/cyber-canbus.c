@@ -3,171 +3,994 @@
 	author: metin.onal@cyberwhiz.co.uk
 */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <pthread.h>
 #include "include/cyber-canbus.h"
+#include "include/cyber-capture.h"
+#include "include/cyber-ring.h"
+#include "include/cyber-logfile.h"
+#include "include/cyber-blf.h"
+#include "include/cyber-segment.h"
+#include "include/cyber-recorder.h"
+#include "include/cyber-filter.h"
+#include "include/cyber-change.h"
+#include "include/cyber-dbc.h"
+#include "include/cyber-j1939.h"
+#include "include/cyber-pgnstat.h"
+#include "include/cyber-agg.h"
+#include "include/cyber-sts.h"
+#include "include/cyber-trigger.h"
+#include "include/cyber-timing.h"
+#include "include/cyber-latency.h"
+#include "dbc-decode.h"
+#include "include/libcommon/common.h"
 
-static FILE *logfile = NULL;
-static struct timespec ts_start;
-static int fileIndex = 0;
+static struct can_ring ring;
+static int writerRunning = 0;
+static int ignitionMonitor = 1;
+static struct recorder recorder;
+static int recorderEnabled = 0;
+static int changeOnly = 0;
+static struct dbc dbc;
+static int dbcEnabled = 0;
+static int dbcBuiltin = 0;	// -D builtin: decoders generated from $(DBC) at build time
+static struct dbc_value dbcValues[DBC_MAX_MESSAGE_SIGNALS];
+static int j1939Enabled = 0;
+static char j1939Text[J1939_TEXT_MAX];
+static int accountingEnabled = 0;
+static int aggEnabled = 0;
+static int aggFd = -1;
+static struct sts_writer series;
+static int seriesEnabled = 0;
+static int seriesFd = -1;
+static int triggerEnabled = 0;
+static int timingEnabled = 0;
+static int latencyEnabled = 0;
 
-void rotateLogFile()
+/*
+	Frames of a channel lost before the ring, held on the capture thread
+	until a gap marker for them gets into the ring right before the
+	channel's next frame: the socket's overflow count and the ring's own
+	drops.
+*/
+struct channel_gap {
+	int channel;
+	uint32_t socketLost;
+	uint32_t ringLost;
+};
+
+static struct channel_gap gaps[CAN_MAX_CHANNELS];
+static int gapChannels = 0;
+static int gapsPending = 0;		// channels with lost frames not marked yet
+
+static struct channel_gap *findGap(int channel)
 {
-	if (logfile != NULL)
-	{	
-		fclose(logfile);
-		logfile = NULL;
+	for (int i = 0; i < gapChannels; i++)
+	{
+		if (gaps[i].channel == channel)
+			return &gaps[i];
 	}
+	if (gapChannels == CAN_MAX_CHANNELS)
+		return NULL;
+	memset(&gaps[gapChannels], 0, sizeof(gaps[gapChannels]));
+	gaps[gapChannels].channel = channel;
+	return &gaps[gapChannels++];
+}
 
-	int ret = 0;
-	char filename[64];
-	ret = snprintf(filename, sizeof(filename), "canlog_%03d.asc", fileIndex++);
-	if (ret < 0 || ret >= sizeof(filename))
+static void addGap(int channel, uint32_t socketLost, uint32_t ringLost)
+{
+	struct channel_gap *g = findGap(channel);
+	if (g == NULL)
+		return;
+
+	if (g->socketLost == 0 && g->ringLost == 0)
+		gapsPending++;
+	g->socketLost += socketLost;
+	g->ringLost += ringLost;
+}
+
+// 0 when channel has no lost frames left to mark
+static int commitGap(int channel, const struct timespec *ts)
+{
+	struct channel_gap *g = findGap(channel);
+	if (g == NULL || (g->socketLost == 0 && g->ringLost == 0))
+		return 0;
+
+	struct can_record *rec = ringReserve(&ring);
+	if (rec == NULL)
+		return -1;
+
+	rec->ts = *ts;
+	rec->channel = channel | RING_CHANNEL_GAP;
+	rec->sample = 0;
+	rec->frame.can_id = g->socketLost;
+	memcpy(rec->frame.data, &g->ringLost, sizeof(g->ringLost));
+	ringCommit(&ring);
+	g->socketLost = g->ringLost = 0;
+	gapsPending--;
+	return 0;
+}
+
+/*
+	Runs on the capture thread: only copies the frame into the ring, all
+	formatting and file I/O happen on the log writer thread.
+*/
+void canRxCallback(const struct canfd_frame *frame, int channel,
+	const struct timespec *ts)
+{
+	if (accountingEnabled)
+		pgnStatFrame(ts, channel, frame->can_id, frame->len);
+	if (timingEnabled)
+		timingFrame(ts, channel, frame->can_id, frame->flags, frame->len);
+
+	// before the ring, so frames the ring drops are still recorded
+	if (recorderEnabled)
+		recorderWrite(&recorder, ts, channel, frame);
+
+	// the marker goes first, a frame behind a missing marker is a gap too
+	struct can_record *rec = NULL;
+	if (gapsPending == 0 || commitGap(channel, ts) == 0)
+		rec = ringReserve(&ring);
+	if (rec == NULL)
 	{
-		printf("Log file name generation failed\n");
-		exit(1);
+		addGap(channel, 0, 1);
+		return;
 	}
 
-	logfile = fopen(filename, "w");
-	if (logfile == NULL)
+	uint8_t len = frame->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->len;
+	rec->ts = *ts;
+	rec->channel = channel;
+	rec->sample = latencyEnabled ? latencyRead(ts) : 0;
+	memcpy(&rec->frame, frame, offsetof(struct canfd_frame, data) + len);
+	rec->frame.len = len;
+	ringCommit(&ring);
+}
+
+/*
+	Capture thread, right before the frame stamped ts: the gap marker
+	goes through the ring with that frame, so it lands in the log
+	exactly where the frames are missing.
+*/
+static void canDropCallback(int channel, uint32_t dropped, const struct timespec *ts)
+{
+	addGap(channel, dropped, 0);
+}
+
+static void printRingStats(const char *prefix)
+{
+	struct ring_stats rs;
+	ringGetStats(&ring, &rs);
+	printf("%s: occupancy=%u high-water=%u size=%u dropped=%llu\n", prefix,
+		rs.occupancy, rs.highWater, rs.size, (unsigned long long)rs.drops);
+}
+
+/*
+	Ignition off means power may go away soon, so everything buffered is
+	written and synced right away.
+*/
+static void checkIgnition(int *lastState)
+{
+	int state = ignition_pin_status();
+	if (state == 0 && *lastState == 1)
 	{
-		printf("Log file open failed: %s\n", filename);
-		exit(1);
+		printf("Ignition off, flushing log file\n");
+		logFileFlush(1);
+		if (recorderEnabled)
+			recorderSync(&recorder, 1);
 	}
+	if (state == 0 || state == 1)
+		*lastState = state;
+}
 
+/*
+	Once per second from the writer thread, busy or idle, so a ring that
+	never runs empty does not hide an ignition off.
+*/
+static time_t secondTick(time_t last, int *ignition)
+{
 	time_t now = time(NULL);
-	fprintf(logfile, "date,%s", ctime(&now));
-	fprintf(logfile, "base hex timestamps absolute\n");
-	fprintf(logfile, "no interval events logged\n");
-	fflush(logfile);
 
-	clock_gettime(CLOCK_REALTIME, &ts_start);
+	if (now != last)
+	{
+		if (ignitionMonitor)
+			checkIgnition(ignition);
+		// start writeback of the recorder pages, without waiting
+		if (recorderEnabled)
+			recorderSync(&recorder, 0);
+	}
+	return now;
+}
+
+// decoded values are left in dbcValues for the signal consumers
+static void decodeSignals(const struct timespec *ts, uint32_t canId, const uint8_t *data,
+	uint8_t len)
+{
+	int n = -1;
+
+	if (dbcBuiltin)
+	{
+		n = dbcGenDecode(canId, data, len, dbcValues);
+		if (n < 0)
+			dbc.stats.unknown++;
+		else
+		{
+			dbc.stats.frames++;
+			dbc.stats.signals += n;
+		}
+	}
+	else if (dbcEnabled)
+		n = dbcDecodeFrame(&dbc, canId, data, len, dbcValues);
+
+	if (aggEnabled && n > 0)
+		aggUpdate(ts, dbcValues, n);
+	if (seriesEnabled && n > 0)
+	{
+		stsTick(&series, ts);
+		stsAdd(&series, ts, dbcValues, n);
+	}
+	if (triggerEnabled && n > 0)
+		trgSignals(ts, dbcValues, n);
 }
 
-int logFileInit(const char *filename)
+// "Message.Signal" of a -e trigger rule to its signal index
+static int findSignal(const char *name)
 {
-	logfile = fopen(filename, "w");
-	if (logfile == NULL)
+	char message[DBC_NAME_MAX];
+	const char *dot = strchr(name, '.');
+
+	if (dbcBuiltin)
 	{
-		printf("Log file open failed: %s\n", filename);
+		for (int i = 0; i < DBC_GEN_SIGNALS; i++)
+		{
+			if (strcmp(dbcGenSignalNames[i], name) == 0)
+				return i;
+		}
 		return -1;
 	}
+	if (!dbcEnabled || dot == NULL || dot - name >= DBC_NAME_MAX)
+		return -1;
+	snprintf(message, sizeof(message), "%.*s", (int)(dot - name), name);
+	return dbcFindSignal(&dbc, message, dot + 1);
+}
 
-	clock_gettime(CLOCK_REALTIME, &ts_start);
+// appends AGG1 records to the -G file, the uploader picks them up from there
+static int aggWrite(const void *data, size_t len)
+{
+	return write(aggFd, data, len) == (ssize_t)len ? 0 : -1;
+}
 
-	time_t now = time(NULL);
-	fprintf(logfile, "date,%s", ctime(&now));
-	fprintf(logfile, "base hex timestamps absolute\n");
-	fprintf(logfile, "no interval events logged\n");
-	fflush(logfile);
+static int seriesWrite(const void *data, size_t len)
+{
+	return write(seriesFd, data, len) == (ssize_t)len ? 0 : -1;
+}
 
-	return 0;
+/*
+	-G and -S append to a plain file next to the log; both need the
+	signals of a DBC.
+*/
+static int openSignalOutput(const char *path, const char *what)
+{
+	int fd;
+
+	if (!dbcEnabled)
+	{
+		printf("%s needs a DBC (-D)\n", what);
+		return -1;
+	}
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		printf("%s output open failed: %s: %s\n", what, path, strerror(errno));
+	return fd;
 }
 
-void logFileLogMessage(uint32_t id, const char *dir, int channel,
-	uint8_t dlc, const uint8_t *data)
+/*
+	A reassembled multi-packet PGN goes to the decoder under the id a
+	single frame of that PGN would have, and into the log as a text
+	event next to its TP fragments.
+*/
+static void j1939Complete(const struct j1939_message *msg, void *arg)
 {
-	if (logfile == NULL)
-		return;
-	
-	struct timespec ts_now;
-	clock_gettime(CLOCK_REALTIME, &ts_now);
-	double timestamp = (ts_now.tv_sec - ts_start.tv_sec) +
-		(ts_now.tv_nsec - ts_start.tv_nsec) / 1e9;
-	fprintf(logfile, "%.6f %d %X %s d %d", timestamp, channel, id, dir, dlc);
-	for (int i = 0; i < dlc; i++)
+	if (dbcEnabled)
 	{
-		fprintf(logfile, " %02X", data[i]);
+		// the DBC lists the PGN at its own priority, not the TP.CM one
+		uint32_t canId = j1939CanId(msg);
+		uint32_t dbcId = 0;
+		if (dbcBuiltin)
+			dbcId = dbcGenFindPgn(canId);
+		else
+		{
+			const struct dbc_message *m = dbcFindPgn(&dbc, canId);
+			if (m != NULL)
+				dbcId = m->id;
+		}
+		decodeSignals(&msg->ts, dbcId ? dbcId : canId, msg->data,
+			msg->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : msg->len);
 	}
-	fprintf(logfile, "\n");
-	fflush(logfile);
 
-	long pos = ftell(logfile);
-	if (pos >= CAN_LOG_FILE_SIZE_LIMIT)
+	j1939FormatMessage(j1939Text, sizeof(j1939Text), msg);
+	logFileLogText(&msg->ts, j1939Text);
+}
+
+static void *logWriterThread(void *arg)
+{
+	time_t lastReport = time(NULL);
+	time_t lastIgnition = 0;
+	int ignition = -1;
+	uint32_t sinceTick = 0;
+
+	while (1)
 	{
-		rotateLogFile();
+		struct can_record *rec = ringPeek(&ring);
+		if (rec == NULL)
+		{
+			if (!__atomic_load_n(&writerRunning, __ATOMIC_ACQUIRE) &&
+				ringPeek(&ring) == NULL)
+				break;
+
+			logFileTick();
+			sinceTick = 0;
+			if (latencyEnabled)
+			{
+				latencyFlushed(logFileFlushedFrames());
+				latencyTick();
+			}
+
+			if (j1939Enabled || aggEnabled || seriesEnabled || triggerEnabled)
+			{
+				struct timespec ts;
+				clock_gettime(CLOCK_REALTIME, &ts);
+				if (j1939Enabled)
+					j1939Tick(&ts);
+				// windows close and chunks go out on a quiet bus too
+				if (aggEnabled)
+					aggTick(&ts);
+				if (seriesEnabled)
+					stsTick(&series, &ts);
+				if (triggerEnabled)
+					trgTick(&ts);
+			}
+
+			time_t now = lastIgnition = secondTick(lastIgnition, &ignition);
+			if (now - lastReport >= CAPTURE_STATS_INTERVAL_SEC)
+			{
+				printRingStats("Ring");
+				lastReport = now;
+			}
+			usleep(LOG_WRITER_IDLE_US);
+			continue;
+		}
+
+		if (rec->channel & RING_CHANNEL_GAP)
+		{
+			uint32_t ringLost;
+
+			memcpy(&ringLost, rec->frame.data, sizeof(ringLost));
+			logFileLogGap(&rec->ts, rec->channel & ~RING_CHANNEL_GAP, rec->frame.can_id,
+				ringLost);
+			ringRelease(&ring);
+			continue;
+		}
+
+		if (dbcEnabled)
+			decodeSignals(&rec->ts, rec->frame.can_id, rec->frame.data, rec->frame.len);
+
+		int logged = !changeOnly || changeCheck(&rec->ts, rec->channel, rec->frame.can_id,
+			rec->frame.flags, rec->frame.len, rec->frame.data);
+		if (logged)
+			logFileLogMessage(&rec->ts, rec->frame.can_id, "Rx", rec->channel,
+				rec->frame.flags, rec->frame.len, rec->frame.data);
+		if (rec->sample != 0)
+		{
+			struct log_stats ls;
+			logFileGetStats(&ls);
+			latencyFormatted(rec->sample, logged ? ls.frames : 0);
+		}
+
+		// after the fragment, so a completed PGN is logged behind its last packet
+		if (j1939Enabled)
+			j1939Frame(&rec->ts, rec->channel, rec->frame.can_id, rec->frame.len,
+				rec->frame.data);
+		if (triggerEnabled)
+			trgFrame(&rec->ts, rec->channel, &rec->frame);
+		ringRelease(&ring);
+
+		// a ring that never runs empty must not hold off the time flush
+		if (++sinceTick >= LOG_WRITER_TICK_RECORDS)
+		{
+			logFileTick();
+			sinceTick = 0;
+			lastIgnition = secondTick(lastIgnition, &ignition);
+			if (latencyEnabled)
+				latencyTick();
+		}
+		if (latencyEnabled)
+			latencyFlushed(logFileFlushedFrames());
 	}
+
+	return NULL;
+}
+
+static void signalHandler(int sig)
+{
+	if (sig == SIGUSR1)
+		latencyRequestExport();
+	else
+		captureStop();
 }
 
-void logFileDeinit(void)
+/*
+	Parses "can0,can1@250000,vcan0:3,can2@500000/2000000" into channels.
+	Without ":N" the channel number is the interface number + 1 (can0 -> 1),
+	as in CANalyzer. "/rate" sets the CAN FD data bitrate.
+*/
+static int parseChannels(char *list, int bitrate, int dbitrate,
+	struct canbus_channel *chans)
 {
-	if (logfile != NULL)
+	int count = 0;
+	char *save = NULL;
+
+	for (char *tok = strtok_r(list, ",", &save); tok != NULL;
+		tok = strtok_r(NULL, ",", &save))
 	{
-		fclose(logfile);
-		logfile = NULL;
+		if (count >= CAN_MAX_CHANNELS)
+		{
+			printf("Too many CAN interfaces, max %d\n", CAN_MAX_CHANNELS);
+			return -1;
+		}
+
+		struct canbus_channel *ch = &chans[count];
+		char *num = strchr(tok, ':');
+		if (num != NULL)
+			*num++ = '\0';
+		char *drate = strchr(tok, '/');
+		if (drate != NULL)
+			*drate++ = '\0';
+		char *rate = strchr(tok, '@');
+		if (rate != NULL)
+			*rate++ = '\0';
+
+		if (*tok == '\0' || strlen(tok) >= sizeof(ch->iface))
+		{
+			printf("Invalid CAN interface: %s\n", tok);
+			return -1;
+		}
+		snprintf(ch->iface, sizeof(ch->iface), "%s", tok);
+		ch->bitrate = rate != NULL ? atoi(rate) : bitrate;
+		ch->dbitrate = drate != NULL ? atoi(drate) : dbitrate;
+
+		if (num != NULL)
+		{
+			char *end;
+			long n = strtol(num, &end, 10);
+			ch->channel = *num != '\0' && *end == '\0' && n >= 1 && n <= CAN_CHANNEL_MAX ? n : -1;
+		}
+		else
+		{
+			const char *digits = tok + strlen(tok);
+			while (digits > tok && digits[-1] >= '0' && digits[-1] <= '9')
+				digits--;
+			long n = *digits != '\0' ? strtol(digits, NULL, 10) : count;
+			ch->channel = n < CAN_CHANNEL_MAX ? n + 1 : -1;
+		}
+		// the accounting and timing tables have a row per channel number
+		if (ch->channel < 1 || ch->channel > CAN_CHANNEL_MAX)
+		{
+			printf("Invalid channel for %s, 1..%d\n", ch->iface, CAN_CHANNEL_MAX);
+			return -1;
+		}
+		count++;
 	}
+
+	return count;
 }
 
-void canRxCallback(const struct canfd_frame *frame, int channel)
+static void printUsage(const char *prog)
 {
-	const char *dir = "Rx";
-	logFileLogMessage(frame->can_id, dir, channel, frame->len, frame->data);
+	printf("Usage: %s [options]\n", prog);
+	printf("Options:\n");
+	printf("  -i <list>      CAN interfaces, iface[@bitrate[/dbitrate]][:channel],...\n");
+	printf("                 (default: %s, channel = interface number + 1, 1..%d)\n", CAN_INTERFACE,
+		CAN_CHANNEL_MAX);
+	printf("  -d <dbitrate>  CAN FD with this data bitrate on all interfaces (e.g. %d)\n", CAN_FD_DBITRATE);
+	printf("  -f <file>      CAN ID allow/deny rules per interface\n");
+	printf("  -D <file>      Decode the signals of every frame with this DBC file\n");
+	printf("                 (builtin = the decoders generated from the DBC at build time)\n");
+	printf("  -J <sessions>  Reassemble J1939 TP (BAM, RTS/CTS) transfers into the log and\n");
+	printf("                 the DBC decoder, with a pool of <sessions> (0 = %d)\n", J1939_DEFAULT_SESSIONS);
+	printf("  -G <file>      Append min/max/mean/last of the decoded signals per window to <file>\n");
+	printf("                 (needs -D; <file>@%s sets the window lengths in s)\n", AGG_DEFAULT_WINDOWS);
+	printf("  -S <file>      Append the decoded signals to <file> as compressed time series (needs -D)\n");
+	printf("  -E <dir>       Write every frame from %d s before to %d s after a trigger into a\n",
+		TRIGGER_DEFAULT_PRE_SEC, TRIGGER_DEFAULT_POST_SEC);
+	printf("                 CDL event segment in <dir>, uploaded first with -U\n");
+	printf("                 (<dir>@pre,post[,frames] sets the windows and the history size)\n");
+	printf("  -e <rule>      Event trigger, repeatable: Message.Signal>value, Message.Signal<value,\n");
+	printf("                 Message.Signal~ (value changed, e.g. a new DTC in DM1) or accel>g\n");
+	printf("                 (accelerometer beyond gravity, in g)\n");
+	printf("  -A <file>      Rewrite per-PGN/source address traffic stats into <file> every second\n");
+	printf("  -H <file>      Rewrite per-ID inter-arrival histograms and per-channel bus load\n");
+	printf("                 into <file> as JSON every %d s (<file>@s sets the interval)\n",
+		TIMING_INTERVAL_MS / 1000);
+	printf("  -L <file>      Sample 1 in %d frames for the receive, read, format and write\n",
+		LATENCY_SAMPLE_EVERY);
+	printf("                 latencies, written to <file> as JSON on SIGUSR1 and at exit\n");
+	printf("                 (<file>@n samples 1 in n)\n");
+	printf("  -b <bitrate>   Default bitrate in bps (default: %d)\n", CAN_BITRATE);
+	printf("  -r <slots>     Capture ring size in frames (default: %d)\n", RING_DEFAULT_SLOTS);
+	printf("  -o <format>    Log format, asc, blf or cdl (default: asc)\n");
+	printf("  -C <ms>        Change-only: log a frame only when its payload changes or\n");
+	printf("                 <ms> passed since the last logged one (0 = no heartbeat)\n");
+	printf("  -W <output>    Log output, write, uring or direct (io_uring + O_DIRECT) (default: write)\n");
+	printf("  -s <bytes>     Rotate log segments at this file size (default: %d)\n", CAN_LOG_FILE_SIZE_LIMIT);
+	printf("  -z <level>     zlib level of BLF containers (default: %d)\n", BLF_COMPRESSION_LEVEL);
+	printf("  -F <ms>        Flush buffered log lines at least every <ms> (default: %d)\n", LOG_FLUSH_INTERVAL_MS);
+	printf("  -B <bytes>     Flush once <bytes> are buffered (default: block size)\n");
+	printf("  -U <dir>       Move closed segments into <dir> from a background worker\n");
+	printf("  -g <level>     gzip level for -U, 0 moves segments uncompressed (default: %d)\n", SEGMENT_GZIP_LEVEL);
+	printf("  -R <file>      Flight recorder: keep the last frames in a mmapped ring file\n");
+	printf("  -M <records>   Flight recorder size in frames (default: %d)\n", RECORDER_DEFAULT_RECORDS);
+	printf("  -N             Do not flush on ignition off\n");
+	printf("  -n             Interface is already up (e.g. vcan), skip can_init()\n");
+	printf("  -t             Use controller receive timestamps where the driver has them,\n");
+	printf("                 moved onto the system clock (default: kernel software stamps)\n");
+	printf("  -h             Show this help message\n");
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
 	int ret = 0;
-	struct canfd_frame frame;
+	int opt = 0;
+	char ifaceList[128] = CAN_INTERFACE;
+	struct canbus_channel chans[CAN_MAX_CHANNELS];
+	int chanCount = 0;
+	int chanInit = 0;
+	int bitrate = CAN_BITRATE;
+	int dbitrate = 0;
+	int skipInit = 0;
+	int status = 0;
+	uint32_t ringSlots = RING_DEFAULT_SLOTS;
+	pthread_t writer;
+	struct log_config logConfig;
+	const char *uploadDir = NULL;
+	int gzipLevel = SEGMENT_GZIP_LEVEL;
+	const char *recorderPath = NULL;
+	const char *filterPath = NULL;
+	const char *dbcPath = NULL;
+	uint32_t j1939Sessions = 0;
+	const char *accountingPath = NULL;
+	char *timingPath = NULL;
+	uint32_t timingIntervalMs = TIMING_INTERVAL_MS;
+	char *latencyPath = NULL;
+	uint32_t latencyEvery = LATENCY_SAMPLE_EVERY;
+	char *aggPath = NULL;
+	const char *aggWindows = AGG_DEFAULT_WINDOWS;
+	const char *seriesPath = NULL;
+	char *eventDir = NULL;
+	const char *triggerRules[TRIGGER_MAX_RULES];
+	int triggerRuleCount = 0;
+	uint32_t eventPre = TRIGGER_DEFAULT_PRE_SEC;
+	uint32_t eventPost = TRIGGER_DEFAULT_POST_SEC;
+	uint32_t eventFrames = TRIGGER_DEFAULT_FRAMES;
+	uint64_t recorderRecords = RECORDER_DEFAULT_RECORDS;
 
-	printf("CAN interface init: %s, bitrate=%d\n", CAN_INTERFACE, CAN_BITRATE);
+	logFileDefaultConfig(&logConfig);
 
-	ret = can_init(CAN_INTERFACE, CAN_BITRATE);
-	if (ret != 0)
+	while ((opt = getopt(argc, argv, "i:d:f:D:J:A:H:L:G:S:E:e:b:r:o:C:W:s:z:F:B:U:g:R:M:Nnth")) != -1)
 	{
-		printf("CAN init failed, ret=0x%x\n", ret);
+		switch (opt)
+		{
+		case 'i':
+			snprintf(ifaceList, sizeof(ifaceList), "%s", optarg);
+			break;
+		case 'd':
+			dbitrate = atoi(optarg);
+			break;
+		case 'f':
+			filterPath = optarg;
+			break;
+		case 'D':
+			dbcPath = optarg;
+			break;
+		case 'A':
+			accountingPath = optarg;
+			break;
+		case 'H':
+			timingPath = optarg;
+			if (strchr(optarg, '@') != NULL)
+			{
+				timingIntervalMs = strtod(strchr(optarg, '@') + 1, NULL) * 1000;
+				*strchr(optarg, '@') = '\0';
+			}
+			break;
+		case 'L':
+			latencyPath = optarg;
+			if (strchr(optarg, '@') != NULL)
+			{
+				latencyEvery = strtoul(strchr(optarg, '@') + 1, NULL, 0);
+				*strchr(optarg, '@') = '\0';
+			}
+			break;
+		case 'G':
+			aggPath = optarg;
+			if (strchr(optarg, '@') != NULL)
+			{
+				aggWindows = strchr(optarg, '@') + 1;
+				*strchr(optarg, '@') = '\0';
+			}
+			break;
+		case 'S':
+			seriesPath = optarg;
+			break;
+		case 'E':
+			eventDir = optarg;
+			if (strchr(optarg, '@') != NULL)
+			{
+				sscanf(strchr(optarg, '@') + 1, "%u,%u,%u", &eventPre, &eventPost, &eventFrames);
+				*strchr(optarg, '@') = '\0';
+			}
+			break;
+		case 'e':
+			if (triggerRuleCount == TRIGGER_MAX_RULES)
+			{
+				printf("At most %d triggers\n", TRIGGER_MAX_RULES);
+				return -1;
+			}
+			triggerRules[triggerRuleCount++] = optarg;
+			break;
+		case 'J':
+			j1939Enabled = 1;
+			j1939Sessions = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bitrate = atoi(optarg);
+			break;
+		case 'r':
+			ringSlots = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			if (strcmp(optarg, "blf") == 0)
+				logConfig.format = LOG_FORMAT_BLF;
+			else if (strcmp(optarg, "cdl") == 0)
+				logConfig.format = LOG_FORMAT_CDL;
+			else if (strcmp(optarg, "asc") == 0)
+				logConfig.format = LOG_FORMAT_ASC;
+			else
+			{
+				printUsage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'C':
+			changeOnly = 1;
+			changeInit(strtoul(optarg, NULL, 0));
+			break;
+		case 'W':
+			if (strcmp(optarg, "write") == 0)
+				logConfig.output = LOG_OUTPUT_WRITE;
+			else if (strcmp(optarg, "uring") == 0)
+				logConfig.output = LOG_OUTPUT_URING;
+			else if (strcmp(optarg, "direct") == 0)
+				logConfig.output = LOG_OUTPUT_DIRECT;
+			else
+			{
+				printUsage(argv[0]);
+				return -1;
+			}
+			break;
+		case 's':
+			logConfig.sizeLimit = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			logConfig.compressionLevel = atoi(optarg);
+			break;
+		case 'F':
+			logConfig.flushIntervalMs = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			logConfig.flushBytes = strtoul(optarg, NULL, 0);
+			break;
+		case 'U':
+			uploadDir = optarg;
+			break;
+		case 'g':
+			gzipLevel = atoi(optarg);
+			break;
+		case 'R':
+			recorderPath = optarg;
+			break;
+		case 'M':
+			recorderRecords = strtoull(optarg, NULL, 0);
+			break;
+		case 'N':
+			ignitionMonitor = 0;
+			break;
+		case 'n':
+			skipInit = 1;
+			break;
+		case 't':
+			captureSetHwStamps(1);
+			break;
+		case 'h':
+		default:
+			printUsage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+
+	chanCount = parseChannels(ifaceList, bitrate, dbitrate, chans);
+	if (chanCount <= 0)
+	{
+		printUsage(argv[0]);
 		return -1;
 	}
-	printf("CAN init success\n");
 
-	char filename[64];
-	ret = snprintf(filename, sizeof(filename), "canlog_%03d.asc", fileIndex++);
-	if (ret < 0 || ret >= sizeof(filename))
+	if (filterPath != NULL && filterLoad(filterPath) != 0)
 	{
-		printf("Log file name generation failed\n");
-		exit(1);
+		return -1;
 	}
 
-	ret = logFileInit(filename);
-	if (ret != 0)
+	if (dbcPath != NULL && strcmp(dbcPath, "builtin") == 0)
 	{
-		logFileDeinit();
-		printf("Log file init failed\n");
+		printf("DBC: %d messages, %d signals compiled in\n", DBC_GEN_MESSAGES, DBC_GEN_SIGNALS);
+		dbcBuiltin = 1;
+		dbcEnabled = 1;
+	}
+	else if (dbcPath != NULL)
+	{
+		if (dbcLoad(&dbc, dbcPath) != 0)
+			return -1;
+		dbcEnabled = 1;
+	}
+
+	uint32_t signalCount = dbcBuiltin ? DBC_GEN_SIGNALS : dbc.signalCount;
+	if (aggPath != NULL)
+	{
+		if ((aggFd = openSignalOutput(aggPath, "Aggregation")) < 0 ||
+			aggInit(signalCount, aggWindows, aggWrite) != 0)
+			return -1;
+		aggEnabled = 1;
+	}
+	if (seriesPath != NULL)
+	{
+		if ((seriesFd = openSignalOutput(seriesPath, "Signal series")) < 0 ||
+			stsWriterInit(&series, signalCount, seriesWrite) != 0)
+			return -1;
+		seriesEnabled = 1;
+	}
+
+	if (triggerRuleCount > 0 && eventDir == NULL)
+	{
+		printf("Triggers need an event directory (-E)\n");
 		return -1;
 	}
-	printf("Log file init success\n");
+	if (eventDir != NULL)
+	{
+		if (trgInit(eventDir, eventPre, eventPost, eventFrames) != 0)
+			return -1;
+		for (int i = 0; i < triggerRuleCount; i++)
+		{
+			if (trgAddRule(triggerRules[i], findSignal) != 0)
+				return -1;
+		}
+		triggerEnabled = 1;
+	}
 
-	while (1)
+	if (j1939Enabled && j1939Init(j1939Sessions, j1939Complete, NULL) != 0)
 	{
-		memset(&frame, 0, sizeof(frame));
+		return -1;
+	}
+
+	if (latencyPath != NULL && latencyInit(latencyPath, latencyEvery) == 0)
+		latencyEnabled = 1;
 
-		ret = can_read(CAN_INTERFACE, &frame);
-		if (ret > 0)
+	if (ringInit(&ring, ringSlots) != 0)
+	{
+		return -1;
+	}
+
+	if (recorderPath != NULL)
+	{
+		if (recorderOpen(&recorder, recorderPath, recorderRecords) != 0)
 		{
-			logFileLogMessage(frame.can_id, "Rx", 1, frame.len, frame.data);
+			ringFree(&ring);
+			return -1;
 		}
-		else if (ret < 0)
+		recorderEnabled = 1;
+	}
+
+	for (chanInit = 0; chanInit < chanCount && !skipInit; chanInit++)
+	{
+		struct canbus_channel *ch = &chans[chanInit];
+		if (ch->dbitrate > 0)
 		{
-			if (ret == CAN_READ_TIMEOUT_ERR_CODE)
-			{
-				continue;
-			}
-			else
-			{
-				printf("CAN read error, ret=0x%x\n", ret);
-				break;
-			}
+			printf("CAN FD interface init: %s, bitrate=%d, dbitrate=%d\n",
+				ch->iface, ch->bitrate, ch->dbitrate);
+			ret = can_fd_init(ch->iface, ch->bitrate, ch->dbitrate, CAN_FD_TXQUEUELEN);
+		}
+		else
+		{
+			printf("CAN interface init: %s, bitrate=%d\n", ch->iface, ch->bitrate);
+			ret = can_init(ch->iface, ch->bitrate);
 		}
-		usleep(1000);
+		if (ret != 0)
+		{
+			printf("CAN init failed, ret=0x%x\n", ret);
+			status = -1;
+			goto deinit;
+		}
+		printf("CAN init success\n");
 	}
 
-	logFileDeinit();
+	for (int i = 0; i < chanCount; i++)
+	{
+		ret = captureOpen(chans[i].iface, chans[i].channel);
+		if (ret != 0)
+		{
+			printf("Capture open failed: %s\n", chans[i].iface);
+			status = -1;
+			goto close;
+		}
+	}
+
+	if (uploadDir != NULL && segmentWorkerStart(uploadDir, gzipLevel) != 0)
+	{
+		status = -1;
+		goto close;
+	}
 
-	ret = can_deinit(CAN_INTERFACE);
+	ret = logFileInit(&logConfig);
 	if (ret != 0)
 	{
-		printf("CAN deinit failed, ret=0x%x\n", ret);
-		return -1;
+		logFileDeinit();
+		segmentWorkerStop();
+		printf("Log file init failed\n");
+		status = -1;
+		goto close;
 	}
+	printf("Log file init success\n");
 
-	printf("CAN deinit success\n");
-	return 0;
-}
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signalHandler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	writerRunning = 1;
+	ret = pthread_create(&writer, NULL, logWriterThread, NULL);
+	if (ret != 0)
+	{
+		printf("Log writer thread create failed, ret=%d\n", ret);
+		logFileDeinit();
+		segmentWorkerStop();
+		status = -1;
+		goto close;
+	}
+
+	// without the accelerometer the signal triggers still work
+	if (triggerEnabled)
+		trgStart();
+
+	// accounting is a diagnostic, capture goes on without it
+	if (accountingPath != NULL && pgnStatInit() == 0 &&
+		pgnStatStart(accountingPath, PGNSTAT_INTERVAL_MS) == 0)
+		accountingEnabled = 1;
+	if (timingPath != NULL && timingInit() == 0)
+	{
+		for (int i = 0; i < chanCount; i++)
+			timingSetChannel(chans[i].channel, chans[i].bitrate, chans[i].dbitrate);
+		if (timingStart(timingPath, timingIntervalMs) == 0)
+			timingEnabled = 1;
+	}
+
+	captureSetDropCallback(canDropCallback);
+	ret = captureRun(canRxCallback);
+	if (accountingEnabled)
+		pgnStatStop();
+	if (timingEnabled)
+		timingStop();
+	if (ret != 0)
+	{
+		printf("Capture stopped on error\n");
+		status = -1;
+	}
+
+	// the writer drains whatever is left in the ring before it exits
+	__atomic_store_n(&writerRunning, 0, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	// a running event keeps what was captured, ahead of the last log segment
+	if (triggerEnabled)
+		trgStop();
+
+	capturePrintStats();
+	filterPrintStats();
+	printRingStats("Ring summary");
+
+	// SIGINT/SIGTERM end up here: the final block is written and synced
+	logFileDeinit();
+
+	struct log_stats ls;
+	logFileGetStats(&ls);
+	printf("Log summary: frames=%llu bytes=%llu writes=%llu segments=%u\n",
+		(unsigned long long)ls.frames, (unsigned long long)ls.bytes,
+		(unsigned long long)ls.writes, ls.segments);
+	if (latencyEnabled)
+	{
+		// the last block is out now
+		latencyFlushed(logFileFlushedFrames());
+		latencyExport(latencyPath);
+		latencyPrintStats();
+	}
+	if (changeOnly)
+		changePrintStats();
+	if (dbcEnabled)
+		dbcPrintStats(&dbc);
+	if (j1939Enabled)
+		j1939PrintStats();
+	if (accountingEnabled)
+		pgnStatPrintStats();
+	if (timingEnabled)
+		timingPrintStats();
+	if (aggEnabled)
+	{
+		// the windows still open are written too
+		aggFlush();
+		aggPrintStats();
+	}
+	if (seriesEnabled)
+	{
+		stsFlush(&series);
+		stsPrintStats(&series);
+	}
+	if (triggerEnabled)
+		trgPrintStats();
+
+	// waits until the last segment is in the upload directory
+	segmentWorkerStop();
+	if (uploadDir != NULL)
+	{
+		struct segment_stats ss;
+		segmentGetStats(&ss);
+		printf("Upload summary: segments=%u failed=%u bytes=%llu->%llu max rotation=%llu us\n",
+			ss.segments, ss.failed, (unsigned long long)ss.inBytes,
+			(unsigned long long)ss.outBytes, (unsigned long long)ss.maxRotateUs);
+	}
+
+close:
+	captureClose();
 
+deinit:
+	for (int i = 0; i < chanInit && !skipInit; i++)
+	{
+		ret = can_deinit(chans[i].iface);
+		if (ret != 0)
+		{
+			printf("CAN deinit failed, ret=0x%x\n", ret);
+			status = -1;
+			continue;
+		}
+		printf("CAN deinit success\n");
+	}
+
+	if (recorderEnabled)
+	{
+		recorderEnabled = 0;
+		recorderSync(&recorder, 1);
+		recorderClose(&recorder);
+	}
+
+	ringFree(&ring);
+	dbcFree(&dbc);
+	j1939Free();
+	aggFree();
+	if (aggFd >= 0)
+		close(aggFd);
+	stsWriterFree(&series);
+	trgFree();
+	if (seriesFd >= 0)
+		close(seriesFd);
+	return status;
+}
@@ -0,0 +1,636 @@
+/*
+	Batched CAN capture engine.
+	Drains every configured raw CAN socket with recvmmsg() from one epoll
+	loop and only sleeps when all of them are empty. Each round's batches
+	are merged by kernel receive time before they reach the callback;
+	frames newer than what a full batch may still have queued behind it,
+	or than the start of the round, wait for a later round.
+*/
+
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <linux/net_tstamp.h>
+#include "include/cyber-capture.h"
+#include "include/cyber-canbus.h"
+#include "include/cyber-filter.h"
+
+// SCM_TIMESTAMPING carries three timespecs: software, legacy, raw hardware,
+// SO_RXQ_OVFL the socket's drop counter
+#define CAPTURE_CMSG_SIZE	(CMSG_SPACE(3 * sizeof(struct timespec)) + \
+				CMSG_SPACE(sizeof(uint32_t)))
+
+struct capture_channel {
+	int sock;
+	int channel;
+	char iface[IFNAMSIZ];
+	uint64_t ifDropsBase;
+	uint64_t ifPacketsBase;
+	uint32_t socketDrops;		// last SO_RXQ_OVFL counter seen
+	struct filter_set *filter;
+	struct capture_stats stats;
+
+	// hardware stamps onto CLOCK_REALTIME: smallest software - hardware gap
+	int64_t hwOffsetNs;		// of the last full window, valid once hwWindows > 1
+	int64_t hwWindowMinNs;		// of the current window
+	int64_t hwWindowStartNs;
+	int64_t hwLastNs;
+	uint32_t hwWindows;
+
+	// current batch, filled by recvmmsg() and consumed by the merge
+	int count;
+	int next;
+	struct timespec stamps[CAPTURE_BATCH_SIZE];
+	uint32_t drops[CAPTURE_BATCH_SIZE];	// counter when the frame was queued
+	struct canfd_frame frames[CAPTURE_BATCH_SIZE];
+	struct iovec iovecs[CAPTURE_BATCH_SIZE];
+	struct mmsghdr msgs[CAPTURE_BATCH_SIZE];
+	char cmsgBufs[CAPTURE_BATCH_SIZE][CAPTURE_CMSG_SIZE];
+	int queued;			// the socket may hold more: the batch is full
+	int fresh;			// first frame read this round
+};
+
+static struct capture_channel channels[CAPTURE_MAX_CHANNELS];
+static int channelCount = 0;
+static int epfd = -1;
+static volatile sig_atomic_t running = 0;
+static struct timespec ts_open;
+static uint64_t idlePolls = 0;
+static captureDropCallback dropCallback = NULL;
+static int hwStamps = 0;
+
+static uint64_t readIfStat(const char *iface, const char *name)
+{
+	char path[96];
+	unsigned long long value = 0;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s", iface, name);
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+	if (fscanf(fp, "%llu", &value) != 1)
+		value = 0;
+	fclose(fp);
+	return value;
+}
+
+/*
+	Prefer SO_TIMESTAMPING, with the controller stamp too when asked for,
+	fall back to SO_TIMESTAMPNS on older kernels.
+*/
+static void enableTimestamps(int sock)
+{
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	int on = 1;
+
+	if (hwStamps)
+		flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0)
+		return;
+
+	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0)
+		return;
+
+	printf("Capture: no kernel receive timestamps, using read time\n");
+}
+
+static int64_t stampNs(const struct timespec *ts)
+{
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/*
+	The controller clock is free running or offset from CLOCK_REALTIME,
+	so its stamp is moved by the smallest gap to the software stamp of
+	the same frame, which only adds interrupt latency: the one of the
+	last full second, or of this one while it is smaller. Drift is
+	followed within two seconds; a stamp never goes back on a channel.
+*/
+static void hwToRealtime(struct capture_channel *ch, const struct timespec *hw,
+	const struct timespec *sw, struct timespec *ts)
+{
+	int64_t swNs = stampNs(sw);
+	int64_t gap = swNs - stampNs(hw);
+
+	if (ch->hwWindows == 0 || swNs - ch->hwWindowStartNs >= 1000000000)
+	{
+		ch->hwOffsetNs = ch->hwWindowMinNs;
+		ch->hwWindowMinNs = gap;
+		ch->hwWindowStartNs = swNs;
+		ch->hwWindows++;
+	}
+	else if (gap < ch->hwWindowMinNs)
+	{
+		ch->hwWindowMinNs = gap;
+	}
+
+	int64_t offset = ch->hwWindows > 1 && ch->hwOffsetNs < ch->hwWindowMinNs ?
+		ch->hwOffsetNs : ch->hwWindowMinNs;
+	int64_t ns = stampNs(hw) + offset;
+	if (ns < ch->hwLastNs)
+		ns = ch->hwLastNs;
+	ch->hwLastNs = ns;
+	ts->tv_sec = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+/*
+	The kernel only attaches the SO_RXQ_OVFL counter once the socket has
+	dropped something, so *drops keeps its value without one.
+*/
+static int messageControl(struct capture_channel *ch, struct msghdr *msg,
+	struct timespec *ts, uint32_t *drops)
+{
+	int stamped = 0;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+		cmsg = CMSG_NXTHDR(msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SO_RXQ_OVFL)
+		{
+			memcpy(drops, CMSG_DATA(cmsg), sizeof(*drops));
+		}
+		else if (stamped)
+		{
+			continue;
+		}
+		else if (cmsg->cmsg_type == SO_TIMESTAMPING)
+		{
+			struct timespec stamps[3];
+			memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+			int sw = stamps[0].tv_sec != 0 || stamps[0].tv_nsec != 0;
+			// the software stamp is the reference the hardware one is moved by
+			if (sw && (stamps[2].tv_sec != 0 || stamps[2].tv_nsec != 0))
+			{
+				hwToRealtime(ch, &stamps[2], &stamps[0], ts);
+				ch->stats.hwStamps++;
+				stamped = 1;
+			}
+			else if (sw)
+			{
+				*ts = stamps[0];
+				ch->stats.swStamps++;
+				stamped = 1;
+			}
+		}
+		else if (cmsg->cmsg_type == SO_TIMESTAMPNS)
+		{
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(*ts));
+			ch->stats.swStamps++;
+			stamped = 1;
+		}
+	}
+
+	return stamped ? 0 : -1;
+}
+
+static double elapsedSince(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int stampBefore(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+int captureOpen(const char *iface, int channel)
+{
+	struct ifreq ifr;
+	struct sockaddr_can addr;
+	struct epoll_event ev;
+	int rcvbuf = CAPTURE_RCVBUF_SIZE;
+
+	if (channelCount >= CAPTURE_MAX_CHANNELS)
+	{
+		printf("Capture: too many channels, max %d\n", CAPTURE_MAX_CHANNELS);
+		return -1;
+	}
+
+	if (epfd < 0)
+	{
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd < 0)
+		{
+			printf("Capture epoll create failed: %s\n", strerror(errno));
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts_open);
+	}
+
+	struct capture_channel *ch = &channels[channelCount];
+	memset(ch, 0, sizeof(*ch));
+
+	ch->sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (ch->sock < 0)
+	{
+		printf("Capture socket open failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", iface);
+	if (ioctl(ch->sock, SIOCGIFINDEX, &ifr) < 0)
+	{
+		printf("Capture interface not found: %s\n", iface);
+		goto fail;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	if (bind(ch->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		printf("Capture socket bind failed: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	// SO_RCVBUFFORCE needs CAP_NET_ADMIN, fall back to the rmem_max capped one
+	if (setsockopt(ch->sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+		setsockopt(ch->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	fcntl(ch->sock, F_SETFL, fcntl(ch->sock, F_GETFL) | O_NONBLOCK);
+	enableTimestamps(ch->sock);
+
+	// frames lost to a full receive queue are otherwise only holes in the log
+	int on = 1;
+	if (setsockopt(ch->sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0)
+		printf("Capture: no socket drop counter on %s\n", iface);
+
+	// FD frames are only delivered to sockets that ask for them
+	int fd = 1;
+	if (setsockopt(ch->sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &fd, sizeof(fd)) < 0)
+		printf("Capture: no CAN FD support on %s\n", iface);
+
+	// a failed kernel filter only costs CPU, filterCheck() still applies it
+	ch->filter = filterFind(iface);
+	if (ch->filter != NULL)
+		filterApply(ch->filter, ch->sock);
+
+	for (int i = 0; i < CAPTURE_BATCH_SIZE; i++)
+	{
+		ch->iovecs[i].iov_base = &ch->frames[i];
+		ch->iovecs[i].iov_len = sizeof(ch->frames[i]);
+		ch->msgs[i].msg_hdr.msg_iov = &ch->iovecs[i];
+		ch->msgs[i].msg_hdr.msg_iovlen = 1;
+		ch->msgs[i].msg_hdr.msg_control = ch->cmsgBufs[i];
+		ch->msgs[i].msg_hdr.msg_controllen = sizeof(ch->cmsgBufs[i]);
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = channelCount;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, ch->sock, &ev) < 0)
+	{
+		printf("Capture epoll add failed: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	snprintf(ch->iface, sizeof(ch->iface), "%s", iface);
+	ch->channel = channel;
+	ch->ifDropsBase = readIfStat(iface, "rx_dropped");
+	ch->ifPacketsBase = readIfStat(iface, "rx_packets");
+	channelCount++;
+	return 0;
+
+fail:
+	close(ch->sock);
+	ch->sock = -1;
+	return -1;
+}
+
+/*
+	Frames held back move to the front of the batch and the read fills
+	the rest.
+*/
+static int readBatch(struct capture_channel *ch)
+{
+	int kept = ch->count - ch->next;
+
+	if (kept > 0 && ch->next > 0)
+	{
+		memmove(ch->stamps, ch->stamps + ch->next, kept * sizeof(ch->stamps[0]));
+		memmove(ch->drops, ch->drops + ch->next, kept * sizeof(ch->drops[0]));
+		memmove(ch->frames, ch->frames + ch->next, kept * sizeof(ch->frames[0]));
+	}
+	ch->count = ch->fresh = kept;
+	ch->next = 0;
+	if (kept == CAPTURE_BATCH_SIZE)
+		return 0;
+
+	int n = recvmmsg(ch->sock, ch->msgs + kept, CAPTURE_BATCH_SIZE - kept, MSG_DONTWAIT, NULL);
+	if (n < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		printf("Capture read failed on %s: %s\n", ch->iface, strerror(errno));
+		return -1;
+	}
+
+	struct timespec ts_read = { 0, 0 };
+	uint32_t drops = kept > 0 ? ch->drops[kept - 1] : ch->socketDrops;
+	for (int i = kept; i < kept + n; i++)
+	{
+		int ret = messageControl(ch, &ch->msgs[i].msg_hdr, &ch->stamps[i], &drops);
+		ch->drops[i] = drops;
+		if (ret != 0)
+		{
+			if (ts_read.tv_sec == 0)
+				clock_gettime(CLOCK_REALTIME, &ts_read);
+			ch->stamps[i] = ts_read;
+			ch->stats.userStamps++;
+		}
+		ch->msgs[i].msg_hdr.msg_controllen = sizeof(ch->cmsgBufs[i]);
+
+		// the read size tells FD from classic; older kernels leave FDF unset
+		if (ch->msgs[i].msg_len == CANFD_MTU)
+			ch->frames[i].flags |= CANFD_FDF;
+		else
+			ch->frames[i].flags = 0;
+	}
+
+	ch->count = kept + n;
+	if (n > 0)
+		ch->stats.batches++;
+	return n;
+}
+
+/*
+	Every channel batch is already in receive order, so a k-way merge on
+	the batch heads gives one time-ordered stream. A channel that may
+	have more frames queued has none older than its batch's last one:
+	frames after the oldest such last stamp stay in their batch for the
+	next round. A frame can also land on a socket right after its read
+	and before another channel's: frames read this round and stamped
+	after roundStart wait one round. Returns the frames held back.
+*/
+static int deliverMerged(captureCallback cb, const struct timespec *roundStart)
+{
+	struct timespec watermark = { 0, 0 };
+	int limited = 0;
+	int held = 0;
+
+	for (int i = 0; i < channelCount; i++)
+	{
+		struct capture_channel *ch = &channels[i];
+		if (ch->queued && ch->count > 0 &&
+			(!limited || stampBefore(&ch->stamps[ch->count - 1], &watermark)))
+		{
+			watermark = ch->stamps[ch->count - 1];
+			limited = 1;
+		}
+	}
+
+	while (1)
+	{
+		struct capture_channel *first = NULL;
+
+		for (int i = 0; i < channelCount; i++)
+		{
+			struct capture_channel *ch = &channels[i];
+			if (ch->next >= ch->count)
+				continue;
+			const struct timespec *ts = &ch->stamps[ch->next];
+			if ((limited && stampBefore(&watermark, ts)) ||
+				(ch->next >= ch->fresh && stampBefore(roundStart, ts)))
+				continue;
+			if (first == NULL || stampBefore(ts, &first->stamps[first->next]))
+				first = ch;
+		}
+
+		if (first == NULL)
+		{
+			for (int i = 0; i < channelCount; i++)
+				held += channels[i].count - channels[i].next;
+			break;
+		}
+
+		// the counter moved: that many frames were dropped right before this one
+		uint32_t dropped = first->drops[first->next] - first->socketDrops;
+		if (dropped != 0)
+		{
+			first->socketDrops += dropped;
+			first->stats.socketDrops += dropped;
+			if (dropCallback != NULL)
+				dropCallback(first->channel, dropped, &first->stamps[first->next]);
+		}
+
+		// classic frames arrive as CAN_MTU, len overlays can_dlc
+		struct canfd_frame *frame = &first->frames[first->next];
+		if (first->filter != NULL && !filterCheck(first->filter, frame))
+		{
+			first->stats.userFiltered++;
+		}
+		else
+		{
+			cb(frame, first->channel, &first->stamps[first->next]);
+			first->stats.frames++;
+		}
+		first->next++;
+	}
+	return held;
+}
+
+int captureRun(captureCallback cb)
+{
+	struct epoll_event events[CAPTURE_MAX_CHANNELS];
+	struct timespec ts_report;
+	uint64_t framesReported = 0;
+	int busy = 0;
+	int held = 0;
+
+	if (channelCount == 0)
+		return -1;
+
+	running = 1;
+	clock_gettime(CLOCK_MONOTONIC, &ts_report);
+
+	while (running)
+	{
+		/*
+			Every frame stamped before roundStart is queued by the time
+			epoll looks, so its socket is read this round.
+		*/
+		struct timespec roundStart;
+		clock_gettime(CLOCK_REALTIME, &roundStart);
+
+		// while frames keep coming only ask epoll which sockets are ready
+		int n = epoll_wait(epfd, events, CAPTURE_MAX_CHANNELS,
+			busy ? 0 : CAPTURE_POLL_TIMEOUT_MS);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			printf("Capture epoll wait failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		int ready[CAPTURE_MAX_CHANNELS] = { 0 };
+		for (int i = 0; i < n; i++)
+			ready[events[i].data.u32] = 1;
+
+		/*
+			One whose batch was full is read even when epoll did not report
+			it, a read that leaves room is what releases the others.
+		*/
+		int frames = 0;
+		for (int i = 0; i < channelCount; i++)
+		{
+			struct capture_channel *ch = &channels[i];
+			ch->fresh = ch->count;
+			if (!ready[i] && !ch->queued)
+				continue;
+			int got = readBatch(ch);
+			if (got < 0)
+				return -1;
+			ch->queued = ch->count == CAPTURE_BATCH_SIZE;
+			frames += got;
+		}
+
+		if (frames > 0 || held > 0)
+			held = deliverMerged(cb, &roundStart);
+		else if (!busy)
+			idlePolls++;
+		busy = frames > 0 || held > 0;
+
+		double dt = elapsedSince(&ts_report);
+		if (dt >= CAPTURE_STATS_INTERVAL_SEC)
+		{
+			struct capture_stats total;
+			captureGetStats(-1, &total);
+			printf("Capture: %.0f frames/s, %llu frames, %llu dropped, %llu socket overflow\n",
+				(total.frames - framesReported) / dt,
+				(unsigned long long)total.frames,
+				(unsigned long long)total.ifDrops,
+				(unsigned long long)total.socketDrops);
+			framesReported = total.frames;
+			clock_gettime(CLOCK_MONOTONIC, &ts_report);
+		}
+	}
+
+	return 0;
+}
+
+/*
+	Set before captureOpen(): use controller receive stamps where the
+	driver has them, moved onto CLOCK_REALTIME. Off, every frame has the
+	kernel software stamp, one clock for all channels.
+*/
+void captureSetHwStamps(int on)
+{
+	hwStamps = on;
+}
+
+/*
+	Set before captureRun(); called on the capture thread ahead of the
+	first frame after a socket overflow.
+*/
+void captureSetDropCallback(captureDropCallback cb)
+{
+	dropCallback = cb;
+}
+
+void captureStop(void)
+{
+	running = 0;
+}
+
+int captureChannelCount(void)
+{
+	return channelCount;
+}
+
+/*
+	index -1 sums all channels.
+*/
+void captureGetStats(int index, struct capture_stats *out)
+{
+	memset(out, 0, sizeof(*out));
+
+	for (int i = 0; i < channelCount; i++)
+	{
+		struct capture_channel *ch = &channels[i];
+		if (index >= 0 && index != i)
+			continue;
+
+		if (ch->sock >= 0)
+		{
+			ch->stats.ifDrops = readIfStat(ch->iface, "rx_dropped") - ch->ifDropsBase;
+			// estimate, rx_packets also counts frames still queued
+			uint64_t received = ch->stats.frames + ch->stats.userFiltered;
+			uint64_t packets = readIfStat(ch->iface, "rx_packets") - ch->ifPacketsBase;
+			if (ch->filter != NULL && packets > received)
+				ch->stats.kernelFiltered = packets - received;
+		}
+
+		out->frames += ch->stats.frames;
+		out->batches += ch->stats.batches;
+		out->ifDrops += ch->stats.ifDrops;
+		out->socketDrops += ch->stats.socketDrops;
+		out->kernelFiltered += ch->stats.kernelFiltered;
+		out->userFiltered += ch->stats.userFiltered;
+		out->hwStamps += ch->stats.hwStamps;
+		out->swStamps += ch->stats.swStamps;
+		out->userStamps += ch->stats.userStamps;
+	}
+
+	if (index < 0)
+		out->polls = idlePolls;
+}
+
+void capturePrintStats(void)
+{
+	struct capture_stats s;
+	double elapsed = elapsedSince(&ts_open);
+
+	for (int i = 0; i < channelCount; i++)
+	{
+		captureGetStats(i, &s);
+		printf("Capture %s (channel %d): frames=%llu dropped=%llu overflow=%llu",
+			channels[i].iface, channels[i].channel,
+			(unsigned long long)s.frames, (unsigned long long)s.ifDrops,
+			(unsigned long long)s.socketDrops);
+		if (channels[i].filter != NULL)
+			printf(" filtered: kernel=%llu user=%llu",
+				(unsigned long long)s.kernelFiltered, (unsigned long long)s.userFiltered);
+		printf("\n");
+	}
+
+	captureGetStats(-1, &s);
+	printf("Capture summary: frames=%llu dropped=%llu overflow=%llu batches=%llu "
+		"elapsed=%.3f s rate=%.0f frames/s\n",
+		(unsigned long long)s.frames, (unsigned long long)s.ifDrops,
+		(unsigned long long)s.socketDrops,
+		(unsigned long long)s.batches, elapsed,
+		elapsed > 0 ? s.frames / elapsed : 0.0);
+	printf("Capture timestamps: hw=%llu sw=%llu read=%llu\n",
+		(unsigned long long)s.hwStamps, (unsigned long long)s.swStamps,
+		(unsigned long long)s.userStamps);
+}
+
+void captureClose(void)
+{
+	for (int i = 0; i < channelCount; i++)
+	{
+		if (channels[i].sock >= 0)
+		{
+			close(channels[i].sock);
+			channels[i].sock = -1;
+		}
+	}
+	channelCount = 0;
+
+	if (epfd >= 0)
+	{
+		close(epfd);
+		epfd = -1;
+	}
+}
@@ -0,0 +1,544 @@
+/*
+	Compact delta log writer and decoder, see cyber-cdl.h for the format.
+	The writer runs on the log writer thread of canbus-app and never
+	allocates after cdlWriterInit(); the decoder works on a complete
+	file in memory, cdl-convert mmaps it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "include/cyber-cdl.h"
+
+static void putLe16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void putLe32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void putLe64(uint8_t *p, uint64_t v)
+{
+	putLe32(p, (uint32_t)v);
+	putLe32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t getLe32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t getLe64(const uint8_t *p)
+{
+	return getLe32(p) | ((uint64_t)getLe32(p + 4) << 32);
+}
+
+static uint8_t *putVarint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static int getVarint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	const uint8_t *q = *p;
+	uint64_t value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (q == end)
+			return -1;
+		value |= (uint64_t)(*q & 0x7F) << shift;
+		if (!(*q++ & 0x80))
+		{
+			*v = value;
+			*p = q;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int64_t ticksSinceStart(const struct cdl_writer *w, const struct timespec *ts)
+{
+	int64_t ns = (int64_t)(ts->tv_sec - w->start.tv_sec) * 1000000000 +
+		(ts->tv_nsec - w->start.tv_nsec);
+	// floor, so frames just before the start keep their order
+	return ns >= 0 ? ns / CDL_TICK_NS : -((-ns + CDL_TICK_NS - 1) / CDL_TICK_NS);
+}
+
+/*
+	Returns the dictionary entry of (channel, id), adding it when it is
+	new, or NULL when the dictionary is full.
+*/
+static struct cdl_entry *lookup(struct cdl_writer *w, int channel, uint32_t id,
+	uint32_t *index, int *isNew)
+{
+	uint32_t slot = ((id ^ ((uint32_t)channel << 29)) * 0x9E3779B1u) >> (32 - CDL_TABLE_BITS);
+
+	for (int probe = 0; probe < CDL_TABLE_SIZE; probe++)
+	{
+		uint16_t *s = &w->slots[(slot + probe) & (CDL_TABLE_SIZE - 1)];
+		if (*s == 0)
+		{
+			if (w->count == CDL_MAX_IDS)
+				return NULL;
+			struct cdl_entry *e = &w->entries[w->count];
+			memset(e, 0, sizeof(*e));
+			e->id = id;
+			e->channel = channel;
+			*index = w->count++;
+			*s = w->count;
+			*isNew = 1;
+			return e;
+		}
+
+		struct cdl_entry *e = &w->entries[*s - 1];
+		if (e->id == id && e->channel == channel)
+		{
+			*index = *s - 1;
+			*isNew = 0;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+int cdlWriterInit(struct cdl_writer *w, cdlOutput out)
+{
+	memset(w, 0, sizeof(*w));
+	w->out = out;
+	w->block = malloc(CDL_BLOCK_HEADER_SIZE + CDL_BLOCK_SIZE + CDL_RECORD_MAX);
+	w->entries = malloc(CDL_MAX_IDS * sizeof(struct cdl_entry));
+	if (w->block == NULL || w->entries == NULL)
+	{
+		printf("CDL writer allocation failed\n");
+		cdlWriterFree(w);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	Starts a segment: the dictionary is emptied and the file header goes
+	to the output.
+*/
+int cdlWriterStart(struct cdl_writer *w, const struct timespec *start)
+{
+	uint8_t header[CDL_FILE_HEADER_SIZE];
+
+	w->start = *start;
+	w->lastTick = 0;
+	w->used = 0;
+	w->frames = 0;
+	w->count = 0;
+	memset(w->slots, 0, sizeof(w->slots));
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, CDL_FILE_SIGNATURE, 4);
+	putLe16(header + 4, CDL_VERSION);
+	putLe16(header + 6, CDL_FILE_HEADER_SIZE);
+	putLe32(header + 8, CDL_TICK_NS);
+	putLe64(header + 16, start->tv_sec);
+	putLe32(header + 24, start->tv_nsec);
+	return w->out(header, sizeof(header));
+}
+
+int cdlAddFrame(struct cdl_writer *w, const struct timespec *ts, int channel,
+	uint32_t canId, int flags, uint8_t len, const uint8_t *data)
+{
+	uint8_t *p = w->block + CDL_BLOCK_HEADER_SIZE + w->used;
+	uint8_t *tag = p++;
+	int64_t tick = ticksSinceStart(w, ts);
+	uint64_t delta = zigzag(tick - w->lastTick);
+	struct cdl_entry *e;
+	uint32_t index;
+	int isNew;
+
+	if (len > 64)
+		len = 64;
+	w->lastTick = tick;
+
+	e = lookup(w, channel, canId, &index, &isNew);
+	if (e == NULL)
+	{
+		*tag = CDL_TAG_RAW;
+		p = putVarint(p, channel);
+		p = putVarint(p, canId);
+		p = putVarint(p, delta);
+		*p++ = len;
+		*p++ = flags;
+		memcpy(p, data, len);
+		p += len;
+	}
+	else
+	{
+		uint8_t t = 0;
+		uint8_t diff[64];
+		uint64_t mask = 0;
+		int n = 0;
+
+		if (isNew)
+		{
+			t = CDL_TAG_NEW | CDL_TAG_LEN | CDL_TAG_FLAGS;
+			p = putVarint(p, channel);
+			p = putVarint(p, canId);
+		}
+		else
+		{
+			p = putVarint(p, index);
+			if (len != e->len)
+				t |= CDL_TAG_LEN;
+			if (flags != e->flags)
+				t |= CDL_TAG_FLAGS;
+		}
+		p = putVarint(p, delta);
+		if (t & CDL_TAG_LEN)
+			*p++ = len;
+		if (t & CDL_TAG_FLAGS)
+			*p++ = flags;
+
+		// bytes past the old length are zero in the entry
+		for (int i = 0; i < len; i++)
+		{
+			uint8_t x = data[i] ^ e->data[i];
+			if (x)
+			{
+				mask |= 1ULL << i;
+				diff[n++] = x;
+			}
+		}
+
+		if (mask == 0)
+			t |= CDL_TAG_SAME;
+		else
+		{
+			if (len <= 8)
+				*p++ = mask;
+			else
+				p = putVarint(p, mask);
+			memcpy(p, diff, n);
+			p += n;
+		}
+		*tag = t;
+
+		memcpy(e->data, data, len);
+		if (e->len > len)
+			memset(e->data + len, 0, e->len - len);
+		e->len = len;
+		e->flags = flags;
+	}
+
+	w->used = p - (w->block + CDL_BLOCK_HEADER_SIZE);
+	w->frames++;
+	if (w->used >= CDL_BLOCK_SIZE)
+		return cdlFlushBlock(w);
+	return 0;
+}
+
+/*
+	Records that frames of channel were lost before ts, the decoder hands
+	it to the callback as a CDL_FRAME_GAP frame.
+*/
+int cdlAddGap(struct cdl_writer *w, const struct timespec *ts, int channel,
+	uint32_t socketLost, uint32_t ringLost)
+{
+	uint8_t *p = w->block + CDL_BLOCK_HEADER_SIZE + w->used;
+	int64_t tick = ticksSinceStart(w, ts);
+
+	*p++ = CDL_TAG_GAP;
+	p = putVarint(p, channel);
+	p = putVarint(p, zigzag(tick - w->lastTick));
+	p = putVarint(p, socketLost);
+	p = putVarint(p, ringLost);
+	w->lastTick = tick;
+
+	w->used = p - (w->block + CDL_BLOCK_HEADER_SIZE);
+	w->frames++;
+	if (w->used >= CDL_BLOCK_SIZE)
+		return cdlFlushBlock(w);
+	return 0;
+}
+
+int cdlFlushBlock(struct cdl_writer *w)
+{
+	uint8_t *payload = w->block + CDL_BLOCK_HEADER_SIZE;
+	int ret;
+
+	if (w->used == 0)
+		return 0;
+
+	memcpy(w->block, CDL_BLOCK_SIGNATURE, 4);
+	putLe32(w->block + 4, w->used);
+	putLe32(w->block + 8, w->frames);
+	putLe32(w->block + 12, crc32(0, payload, w->used));
+	ret = w->out(w->block, CDL_BLOCK_HEADER_SIZE + w->used);
+
+	w->used = 0;
+	w->frames = 0;
+	return ret;
+}
+
+void cdlWriterFree(struct cdl_writer *w)
+{
+	free(w->block);
+	free(w->entries);
+	w->block = NULL;
+	w->entries = NULL;
+}
+
+/*
+	Decodes one record into f, returns -1 on a malformed record.
+*/
+static int decodeRecord(const uint8_t **pp, const uint8_t *end, struct cdl_entry *entries,
+	uint32_t *count, int64_t *tick, uint32_t tickNs, struct cdl_frame *f)
+{
+	const uint8_t *p = *pp;
+	uint64_t channel, id, delta, index;
+	struct cdl_entry *e;
+	uint8_t tag, len;
+
+	if (p == end)
+		return -1;
+	tag = *p++;
+
+	if (tag == CDL_TAG_GAP)
+	{
+		uint64_t socketLost, ringLost;
+
+		if (getVarint(&p, end, &channel) != 0 || getVarint(&p, end, &delta) != 0 ||
+			getVarint(&p, end, &socketLost) != 0 || getVarint(&p, end, &ringLost) != 0)
+			return -1;
+		f->channel = channel;
+		f->canId = 0;
+		f->flags = CDL_FRAME_GAP;
+		f->len = 0;
+		f->socketLost = socketLost;
+		f->ringLost = ringLost;
+	}
+	else if (tag & CDL_TAG_RAW)
+	{
+		if (getVarint(&p, end, &channel) != 0 || getVarint(&p, end, &id) != 0 ||
+			getVarint(&p, end, &delta) != 0 || end - p < 2)
+			return -1;
+		len = p[0];
+		f->flags = p[1];
+		p += 2;
+		if (len > 64 || end - p < len)
+			return -1;
+		f->channel = channel;
+		f->canId = id;
+		f->len = len;
+		memcpy(f->data, p, len);
+		p += len;
+	}
+	else
+	{
+		if (tag & CDL_TAG_NEW)
+		{
+			if (*count == CDL_MAX_IDS || getVarint(&p, end, &channel) != 0 ||
+				getVarint(&p, end, &id) != 0)
+				return -1;
+			e = &entries[(*count)++];
+			memset(e, 0, sizeof(*e));
+			e->channel = channel;
+			e->id = id;
+		}
+		else
+		{
+			if (getVarint(&p, end, &index) != 0 || index >= *count)
+				return -1;
+			e = &entries[index];
+		}
+		if (getVarint(&p, end, &delta) != 0)
+			return -1;
+
+		len = e->len;
+		if (tag & CDL_TAG_LEN)
+		{
+			if (p == end || *p > 64)
+				return -1;
+			len = *p++;
+		}
+		if (tag & CDL_TAG_FLAGS)
+		{
+			if (p == end)
+				return -1;
+			e->flags = *p++;
+		}
+
+		if (!(tag & CDL_TAG_SAME))
+		{
+			uint64_t mask;
+			if (len <= 8)
+			{
+				if (p == end)
+					return -1;
+				mask = *p++;
+			}
+			else if (getVarint(&p, end, &mask) != 0)
+				return -1;
+			if (len < 64 && (mask >> len) != 0)
+				return -1;
+
+			for (; mask != 0; mask &= mask - 1)
+			{
+				if (p == end)
+					return -1;
+				e->data[__builtin_ctzll(mask)] ^= *p++;
+			}
+		}
+		if (e->len > len)
+			memset(e->data + len, 0, e->len - len);
+		e->len = len;
+
+		f->channel = e->channel;
+		f->canId = e->id;
+		f->flags = e->flags;
+		f->len = len;
+		memcpy(f->data, e->data, len);
+	}
+
+	*tick += unzigzag(delta);
+	f->ns = *tick * tickNs;
+	*pp = p;
+	return 0;
+}
+
+/*
+	Decodes a whole CDL file from memory and hands every frame to cb.
+	Returns 0, or -1 with info->error set when the file is damaged; the
+	frames before the damaged block have been delivered then.
+*/
+int cdlDecode(const uint8_t *buf, size_t len, cdlFrameCallback cb, void *arg,
+	struct cdl_decode_info *info)
+{
+	struct cdl_entry *entries;
+	struct cdl_frame frame;
+	uint32_t count = 0;
+	int64_t tick = 0;
+	size_t off;
+
+	memset(info, 0, sizeof(*info));
+	if (len < CDL_FILE_HEADER_SIZE || memcmp(buf, CDL_FILE_SIGNATURE, 4) != 0 ||
+		(buf[6] | (buf[7] << 8)) < CDL_FILE_HEADER_SIZE)
+	{
+		info->error = CDL_ERROR_HEADER;
+		return -1;
+	}
+	info->tickNs = getLe32(buf + 8);
+	info->start.tv_sec = (int64_t)getLe64(buf + 16);
+	info->start.tv_nsec = getLe32(buf + 24);
+	off = buf[6] | (buf[7] << 8);
+
+	entries = malloc(CDL_MAX_IDS * sizeof(struct cdl_entry));
+	if (entries == NULL)
+	{
+		info->error = CDL_ERROR_RECORD;
+		return -1;
+	}
+
+	while (off < len && info->error == 0)
+	{
+		if (len - off < CDL_BLOCK_HEADER_SIZE)
+		{
+			info->error = CDL_ERROR_TRUNCATED;
+			break;
+		}
+
+		const uint8_t *h = buf + off;
+		uint32_t payloadLen = getLe32(h + 4);
+		uint32_t frames = getLe32(h + 8);
+		if (memcmp(h, CDL_BLOCK_SIGNATURE, 4) != 0)
+		{
+			info->error = CDL_ERROR_HEADER;
+			break;
+		}
+		if (payloadLen > len - off - CDL_BLOCK_HEADER_SIZE)
+		{
+			info->error = CDL_ERROR_TRUNCATED;
+			break;
+		}
+
+		const uint8_t *p = h + CDL_BLOCK_HEADER_SIZE;
+		const uint8_t *end = p + payloadLen;
+		if (crc32(0, p, payloadLen) != getLe32(h + 12))
+		{
+			info->error = CDL_ERROR_CHECKSUM;
+			break;
+		}
+
+		for (uint32_t i = 0; i < frames; i++)
+		{
+			if (decodeRecord(&p, end, entries, &count, &tick, info->tickNs, &frame) != 0)
+			{
+				info->error = CDL_ERROR_RECORD;
+				break;
+			}
+			if (cb(&frame, arg) != 0)
+			{
+				info->error = CDL_ERROR_CALLBACK;
+				break;
+			}
+			if (frame.flags & CDL_FRAME_GAP)
+				info->gaps++;
+			else
+				info->frames++;
+		}
+		if (info->error == 0 && p != end)
+			info->error = CDL_ERROR_RECORD;
+		if (info->error != 0)
+			break;
+
+		info->blocks++;
+		off += CDL_BLOCK_HEADER_SIZE + payloadLen;
+	}
+
+	if (info->error != 0)
+		info->errorOffset = off;
+	free(entries);
+	return info->error != 0 ? -1 : 0;
+}
+
+const char *cdlErrorString(int error)
+{
+	switch (error)
+	{
+	case 0:
+		return "ok";
+	case CDL_ERROR_HEADER:
+		return "bad header";
+	case CDL_ERROR_TRUNCATED:
+		return "truncated block";
+	case CDL_ERROR_CHECKSUM:
+		return "block checksum mismatch";
+	case CDL_ERROR_RECORD:
+		return "malformed record";
+	case CDL_ERROR_CALLBACK:
+		return "stopped by callback";
+	}
+	return "unknown error";
+}
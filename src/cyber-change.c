@@ -0,0 +1,140 @@
+/*
+	Change-only logging.
+	Cyclic frames mostly repeat their payload, so only the first frame
+	of an id, frames whose payload, length or flags differ from the last
+	one seen and one frame per heartbeat interval are written. Runs on
+	the log writer thread only.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/cyber-change.h"
+
+static struct change_entry table[CHANGE_TABLE_SIZE];
+static struct change_stats stats;
+static uint64_t heartbeatNs = (uint64_t)CHANGE_HEARTBEAT_MS * 1000000;
+
+static uint64_t payloadKey(const uint8_t *data, uint8_t len)
+{
+	uint64_t key = 0;
+
+	if (len <= sizeof(key))
+	{
+		memcpy(&key, data, len);
+		return key;
+	}
+
+	// FNV-1a over the FD payload
+	key = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < len; i++)
+		key = (key ^ data[i]) * 0x100000001b3ULL;
+	return key;
+}
+
+static struct change_entry *lookup(int channel, uint32_t id)
+{
+	uint32_t slot = ((id ^ ((uint32_t)channel << 29)) * 0x9E3779B1u) >> (32 - CHANGE_TABLE_BITS);
+
+	for (int probe = 0; probe < CHANGE_TABLE_SIZE; probe++)
+	{
+		struct change_entry *e = &table[(slot + probe) & (CHANGE_TABLE_SIZE - 1)];
+		if (e->channel == 0)
+		{
+			if (stats.ids == CHANGE_MAX_IDS)
+				return NULL;
+			e->id = id;
+			e->channel = channel;
+			e->seen = 0;
+			stats.ids++;
+			return e;
+		}
+		if (e->id == id && e->channel == channel)
+			return e;
+	}
+	return NULL;
+}
+
+void changeInit(uint32_t heartbeatMs)
+{
+	memset(table, 0, sizeof(table));
+	memset(&stats, 0, sizeof(stats));
+	heartbeatNs = (uint64_t)heartbeatMs * 1000000;
+}
+
+/*
+	Returns 1 when the frame has to be logged. heartbeat 0 turns the
+	heartbeat off.
+*/
+int changeCheck(const struct timespec *ts, int channel, uint32_t id, uint8_t flags,
+	uint8_t len, const uint8_t *data)
+{
+	uint64_t now = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+	uint64_t payload = payloadKey(data, len);
+	// channel 0 marks a free slot
+	struct change_entry *e = lookup(channel + 1, id);
+
+	stats.frames++;
+	if (e == NULL)
+	{
+		stats.overflow++;
+		stats.written++;
+		return 1;
+	}
+
+	e->seen++;
+	if (e->seen > 1 && e->payload == payload && e->len == len && e->flags == flags)
+	{
+		if (heartbeatNs == 0 || now - e->lastWritten < heartbeatNs)
+			return 0;
+		stats.heartbeats++;
+	}
+
+	e->payload = payload;
+	e->len = len;
+	e->flags = flags;
+	e->lastWritten = now;
+	e->written++;
+	stats.written++;
+	return 1;
+}
+
+void changeGetStats(struct change_stats *out)
+{
+	*out = stats;
+}
+
+static int compareSeen(const void *a, const void *b)
+{
+	const struct change_entry *x = *(const struct change_entry * const *)a;
+	const struct change_entry *y = *(const struct change_entry * const *)b;
+	return x->seen < y->seen ? 1 : x->seen > y->seen ? -1 : 0;
+}
+
+void changePrintStats(void)
+{
+	static const struct change_entry *sorted[CHANGE_MAX_IDS];
+	uint32_t n = 0;
+
+	printf("Change-only summary: frames=%llu written=%llu heartbeats=%llu ids=%u "
+		"overflow=%llu reduction=%.1f:1\n",
+		(unsigned long long)stats.frames, (unsigned long long)stats.written,
+		(unsigned long long)stats.heartbeats, stats.ids,
+		(unsigned long long)stats.overflow,
+		stats.written ? (double)stats.frames / stats.written : 0.0);
+
+	for (int i = 0; i < CHANGE_TABLE_SIZE && n < CHANGE_MAX_IDS; i++)
+	{
+		if (table[i].channel != 0)
+			sorted[n++] = &table[i];
+	}
+	qsort(sorted, n, sizeof(sorted[0]), compareSeen);
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		const struct change_entry *e = sorted[i];
+		printf("  channel %d id %X: seen=%u written=%u reduction=%.1f:1\n",
+			e->channel - 1, e->id, e->seen, e->written,
+			e->written ? (double)e->seen / e->written : 0.0);
+	}
+}
@@ -0,0 +1,614 @@
+/*
+	DBC signal decoder.
+	dbcLoad() parses the BO_, SG_ and SIG_VALTYPE_ lines of a DBC file
+	and compiles every signal into a flat dbc_signal record: the byte
+	to load a 64-bit word from, the shift and the length. A decode is
+	then one unaligned load, a byte swap for Motorola signals, a shift
+	and a mask per signal, without walking bits. Simple multiplexing is
+	supported: the multiplexor selects one signal range per value
+	(extended multiplexing, "m1M", is decoded as plain m1).
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/can.h>
+#include "include/cyber-dbc.h"
+
+#define DBC_INDEPENDENT_ID		0x40000000	// VECTOR__INDEPENDENT_SIG_MSG
+
+struct parsed_signal {
+	struct dbc_signal sig;
+	struct dbc_signal_info info;
+	int isMux;
+	uint32_t order;
+};
+
+struct parse_state {
+	const char *path;
+	int line;
+	struct dbc_message *messages;
+	uint32_t messageCount;
+	uint32_t messageCapacity;
+	struct parsed_signal *signals;
+	uint32_t signalCount;
+	uint32_t signalCapacity;
+	int skipMessage;		// signals of the current BO_ are dropped
+};
+
+static inline uint64_t loadLe64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static int growArray(void **array, uint32_t *capacity, uint32_t count, size_t size)
+{
+	if (count < *capacity)
+		return 0;
+
+	uint32_t n = *capacity ? *capacity * 2 : 256;
+	void *p = realloc(*array, n * size);
+	if (p == NULL)
+		return -1;
+	*array = p;
+	*capacity = n;
+	return 0;
+}
+
+static const char *skipSpace(const char *p)
+{
+	while (isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+static const char *readToken(const char *p, char *out, size_t size)
+{
+	size_t n = 0;
+
+	p = skipSpace(p);
+	while (*p != '\0' && !isspace((unsigned char)*p) && *p != ':')
+	{
+		if (n + 1 < size)
+			out[n++] = *p;
+		p++;
+	}
+	out[n] = '\0';
+	return p;
+}
+
+/*
+	BO_ 2364540158 EEC1: 8 Vector__XXX
+*/
+static int parseMessage(struct parse_state *st, const char *p)
+{
+	struct dbc_message *m;
+	unsigned long id;
+	char *end;
+
+	id = strtoul(p, &end, 10);
+	if (end == p)
+		return -1;
+
+	// signals not assigned to a message are of no use for decoding
+	st->skipMessage = (id & DBC_INDEPENDENT_ID) != 0;
+	if (st->skipMessage)
+		return 0;
+
+	if (growArray((void **)&st->messages, &st->messageCapacity, st->messageCount,
+		sizeof(*m)) != 0)
+		return -1;
+	m = &st->messages[st->messageCount];
+	memset(m, 0, sizeof(*m));
+	m->id = (id & CAN_EFF_FLAG) ? (id & CAN_EFF_MASK) | CAN_EFF_FLAG : id & CAN_SFF_MASK;
+	m->mux = -1;
+
+	p = readToken(end, m->name, sizeof(m->name));
+	p = skipSpace(p);
+	if (*p != ':' || m->name[0] == '\0')
+		return -1;
+	m->dlc = strtoul(p + 1, NULL, 10);
+	st->messageCount++;
+	return 0;
+}
+
+/*
+	Turns the DBC start bit into the byte and shift of the 64-bit load.
+	Intel start bits are the LSB, Motorola ones the MSB in the sawtooth
+	numbering (bit 7 of byte 0 is the first bit on the bus).
+*/
+static int compileSignal(struct dbc_signal *s, uint32_t startBit, uint32_t length, int bigEndian)
+{
+	uint32_t pos, offset, last;
+
+	if (length < 1 || length > 64 || startBit > 511)
+		return -1;
+
+	if (bigEndian)
+	{
+		pos = (startBit / 8) * 8 + (7 - startBit % 8);	// MSB first linear
+		offset = pos % 8;
+		last = pos + length - 1;
+		s->flags |= DBC_SIGNAL_BIG_ENDIAN;
+		if (offset + length > 64)
+		{
+			s->flags |= DBC_SIGNAL_WIDE;
+			s->shift = offset + length - 64;	// bits taken from the 9th byte
+		}
+		else
+			s->shift = 64 - offset - length;
+	}
+	else
+	{
+		pos = startBit;
+		offset = pos % 8;
+		last = pos + length - 1;
+		s->shift = offset;
+		if (offset + length > 64)
+			s->flags |= DBC_SIGNAL_WIDE;
+	}
+
+	if (last > 511)
+		return -1;
+	s->byte = pos / 8;
+	s->length = length;
+	s->minLen = last / 8 + 1;
+	return 0;
+}
+
+/*
+	SG_ EngineSpeed : 24|16@1+ (0.125,0) [0|8031.875] "rpm" Vector__XXX
+	SG_ Mode M : 0|8@1+ (1,0) [0|3] "" Vector__XXX
+	SG_ Pressure m2 : 8|16@0- (0.1,0) [-3276.8|3276.7] "kPa" Vector__XXX
+*/
+static int parseSignal(struct parse_state *st, const char *p)
+{
+	struct parsed_signal *ps;
+	char token[DBC_NAME_MAX];
+	unsigned int startBit, length;
+	char order, sign;
+	double factor, offset;
+	int used = 0;
+
+	if (st->skipMessage)
+		return 0;
+	if (st->messageCount == 0)
+		return -1;
+	if (growArray((void **)&st->signals, &st->signalCapacity, st->signalCount,
+		sizeof(*ps)) != 0)
+		return -1;
+
+	ps = &st->signals[st->signalCount];
+	memset(ps, 0, sizeof(*ps));
+	ps->info.message = st->messageCount - 1;
+	ps->info.muxValue = -1;
+	ps->order = st->signalCount;
+
+	p = readToken(p, ps->info.name, sizeof(ps->info.name));
+	p = readToken(p, token, sizeof(token));
+	if (token[0] == 'M' && token[1] == '\0')
+		ps->isMux = 1;
+	else if (token[0] == 'm' && isdigit((unsigned char)token[1]))
+		ps->info.muxValue = strtol(token + 1, NULL, 10);
+	else if (token[0] != '\0')
+		return -1;
+	p = skipSpace(p);
+	if (*p != ':' || ps->info.name[0] == '\0')
+		return -1;
+
+	if (sscanf(p + 1, " %u|%u@%c%c (%lf,%lf)%n", &startBit, &length, &order, &sign,
+		&factor, &offset, &used) != 6 || (order != '0' && order != '1') ||
+		(sign != '+' && sign != '-'))
+		return -1;
+	p += 1 + used;
+
+	// the unit is the first quoted string after the range
+	const char *q = strchr(p, '"');
+	if (q != NULL)
+	{
+		size_t n = strcspn(q + 1, "\"");
+		if (n >= sizeof(ps->info.unit))
+			n = sizeof(ps->info.unit) - 1;
+		memcpy(ps->info.unit, q + 1, n);
+		ps->info.unit[n] = '\0';
+	}
+
+	ps->sig.factor = factor;
+	ps->sig.offset = offset;
+	if (sign == '-')
+		ps->sig.flags |= DBC_SIGNAL_SIGNED;
+	ps->info.startBit = startBit;
+	if (compileSignal(&ps->sig, startBit, length, order == '0') != 0)
+		return -1;
+
+	st->signalCount++;
+	return 0;
+}
+
+/*
+	SIG_VALTYPE_ 2364540158 Temperature : 1;
+*/
+static int parseValueType(struct parse_state *st, const char *p)
+{
+	char name[DBC_NAME_MAX];
+	unsigned long id;
+	char *end;
+	int type;
+
+	id = strtoul(p, &end, 10);
+	if (end == p)
+		return -1;
+	p = readToken(end, name, sizeof(name));
+	p = skipSpace(p);
+	if (*p != ':')
+		return -1;
+	type = atoi(p + 1);
+
+	uint32_t canId = (id & CAN_EFF_FLAG) ? (id & CAN_EFF_MASK) | CAN_EFF_FLAG : id & CAN_SFF_MASK;
+	for (uint32_t i = 0; i < st->signalCount; i++)
+	{
+		struct parsed_signal *ps = &st->signals[i];
+		if (st->messages[ps->info.message].id != canId || strcmp(ps->info.name, name) != 0)
+			continue;
+
+		if ((type == 1 && ps->sig.length != 32) || (type == 2 && ps->sig.length != 64))
+			return -1;
+		ps->sig.flags &= ~DBC_SIGNAL_SIGNED;
+		ps->sig.flags |= type == 1 ? DBC_SIGNAL_FLOAT : type == 2 ? DBC_SIGNAL_DOUBLE : 0;
+		return 0;
+	}
+	return 0;
+}
+
+static int compareParsed(const void *a, const void *b)
+{
+	const struct parsed_signal *x = a, *y = b;
+
+	if (x->info.message != y->info.message)
+		return x->info.message < y->info.message ? -1 : 1;
+	if (x->info.muxValue != y->info.muxValue)
+		return x->info.muxValue < y->info.muxValue ? -1 : 1;
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/*
+	Lays the parsed signals out per message and builds the id table.
+*/
+static int compile(struct dbc *db, struct parse_state *st)
+{
+	uint32_t groupCapacity = 0;
+
+	qsort(st->signals, st->signalCount, sizeof(*st->signals), compareParsed);
+
+	db->messages = st->messages;
+	db->messageCount = st->messageCount;
+	st->messages = NULL;
+	db->signalCount = st->signalCount;
+	db->signals = malloc((st->signalCount + 1) * sizeof(*db->signals));
+	db->info = malloc((st->signalCount + 1) * sizeof(*db->info));
+	if (db->signals == NULL || db->info == NULL)
+		return -1;
+
+	uint32_t i = 0;
+	for (uint32_t mi = 0; mi < db->messageCount; mi++)
+	{
+		struct dbc_message *m = &db->messages[mi];
+		uint32_t largest = 0;
+
+		m->first = i;
+		m->firstGroup = db->groupCount;
+		for (; i < st->signalCount && st->signals[i].info.message == mi; i++)
+		{
+			struct parsed_signal *ps = &st->signals[i];
+			db->signals[i] = ps->sig;
+			db->info[i] = ps->info;
+
+			if (ps->info.muxValue < 0)
+			{
+				m->count++;
+				if (ps->isMux)
+					m->mux = i;
+				continue;
+			}
+
+			struct dbc_mux_group *g = m->groupCount ? &db->groups[db->groupCount - 1] : NULL;
+			if (g == NULL || g->value != (uint32_t)ps->info.muxValue)
+			{
+				if (growArray((void **)&db->groups, &groupCapacity, db->groupCount,
+					sizeof(*g)) != 0)
+					return -1;
+				g = &db->groups[db->groupCount++];
+				g->value = ps->info.muxValue;
+				g->first = i;
+				g->count = 0;
+				m->groupCount++;
+			}
+			g->count++;
+			if (g->count > largest)
+				largest = g->count;
+		}
+
+		if (m->groupCount > 0 && m->mux < 0)
+		{
+			printf("DBC file %s: %s has multiplexed signals but no multiplexor\n",
+				st->path, m->name);
+			return -1;
+		}
+		if (m->count + largest > DBC_MAX_MESSAGE_SIGNALS)
+		{
+			printf("DBC file %s: %s has more than %d signals\n", st->path, m->name,
+				DBC_MAX_MESSAGE_SIGNALS);
+			return -1;
+		}
+	}
+
+	// at most half full
+	db->tableBits = 4;
+	while ((1u << db->tableBits) < db->messageCount * 2)
+		db->tableBits++;
+	db->slots = calloc(1u << db->tableBits, sizeof(*db->slots));
+	if (db->slots == NULL)
+		return -1;
+
+	uint32_t mask = (1u << db->tableBits) - 1;
+	for (uint32_t mi = 0; mi < db->messageCount; mi++)
+	{
+		uint32_t slot = (db->messages[mi].id * 0x9E3779B1u) >> (32 - db->tableBits);
+		while (db->slots[slot] != 0)
+		{
+			if (db->messages[db->slots[slot] - 1].id == db->messages[mi].id)
+			{
+				printf("DBC file %s: message id 0x%X defined twice\n", st->path,
+					db->messages[mi].id & CAN_EFF_MASK);
+				return -1;
+			}
+			slot = (slot + 1) & mask;
+		}
+		db->slots[slot] = mi + 1;
+	}
+	return 0;
+}
+
+int dbcLoad(struct dbc *db, const char *path)
+{
+	struct parse_state st;
+	char line[DBC_LINE_MAX];
+	FILE *fp = fopen(path, "r");
+	int ret = -1;
+
+	memset(db, 0, sizeof(*db));
+	memset(&st, 0, sizeof(st));
+	st.path = path;
+	if (fp == NULL)
+	{
+		printf("DBC file open failed: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		const char *p = skipSpace(line);
+		int err = 0;
+
+		st.line++;
+		if (strncmp(p, "BO_ ", 4) == 0)
+			err = parseMessage(&st, p + 4);
+		else if (strncmp(p, "SG_ ", 4) == 0)
+			err = parseSignal(&st, p + 4);
+		else if (strncmp(p, "SIG_VALTYPE_ ", 13) == 0)
+			err = parseValueType(&st, p + 13);
+		if (err != 0)
+		{
+			printf("DBC file %s:%d: cannot parse \"%.*s\"\n", path, st.line,
+				(int)strcspn(p, "\r\n"), p);
+			goto fail;
+		}
+	}
+
+	if (compile(db, &st) != 0)
+		goto fail;
+
+	printf("DBC: %u messages, %u signals loaded from %s\n", db->messageCount,
+		db->signalCount, path);
+	ret = 0;
+
+fail:
+	fclose(fp);
+	free(st.messages);
+	free(st.signals);
+	if (ret != 0)
+		dbcFree(db);
+	return ret;
+}
+
+void dbcFree(struct dbc *db)
+{
+	free(db->messages);
+	free(db->signals);
+	free(db->info);
+	free(db->groups);
+	free(db->slots);
+	memset(db, 0, sizeof(*db));
+}
+
+const struct dbc_message *dbcFindMessage(const struct dbc *db, uint32_t canId)
+{
+	uint32_t id = (canId & CAN_EFF_FLAG) ? canId & (CAN_EFF_FLAG | CAN_EFF_MASK) :
+		canId & CAN_SFF_MASK;
+	uint32_t mask = (1u << db->tableBits) - 1;
+	uint32_t slot = (id * 0x9E3779B1u) >> (32 - db->tableBits);
+
+	if (db->slots == NULL)
+		return NULL;
+	while (db->slots[slot] != 0)
+	{
+		const struct dbc_message *m = &db->messages[db->slots[slot] - 1];
+		if (m->id == id)
+			return m;
+		slot = (slot + 1) & mask;
+	}
+	return NULL;
+}
+
+/*
+	J1939: the message with canId's PGN and source address, at whatever
+	priority the DBC lists it. A TP transfer arrives with the TP.CM
+	priority, usually 7, not the one of the PGN it carries.
+*/
+const struct dbc_message *dbcFindPgn(const struct dbc *db, uint32_t canId)
+{
+	const struct dbc_message *m = dbcFindMessage(db, canId);
+
+	if (m != NULL || !(canId & CAN_EFF_FLAG))
+		return m;
+	for (uint32_t p = 0; p < 8 && m == NULL; p++)
+		m = dbcFindMessage(db, (canId & ~DBC_J1939_PRIORITY_MASK) | p << 26);
+	return m;
+}
+
+static inline uint64_t extractRaw(const struct dbc_signal *s, const uint8_t *buf)
+{
+	uint64_t le = loadLe64(buf + s->byte);
+	uint64_t be = __builtin_bswap64(le);
+	uint64_t mask = ~0ULL >> (64 - s->length);
+	uint64_t raw;
+
+	if (__builtin_expect(s->flags & DBC_SIGNAL_WIDE, 0))
+	{
+		uint64_t next = buf[s->byte + 8];
+		if (s->flags & DBC_SIGNAL_BIG_ENDIAN)
+			raw = (be << s->shift) | (next >> (8 - s->shift));
+		else
+			raw = (le >> s->shift) | (next << (64 - s->shift));
+		return raw & mask;
+	}
+
+	// both byte orders are loaded, the select compiles to a conditional move
+	raw = (s->flags & DBC_SIGNAL_BIG_ENDIAN) ? be : le;
+	return (raw >> s->shift) & mask;
+}
+
+static inline double physical(const struct dbc_signal *s, uint64_t raw)
+{
+	int bits = 64 - s->length;
+	double value;
+
+	if (__builtin_expect(s->flags & (DBC_SIGNAL_FLOAT | DBC_SIGNAL_DOUBLE), 0))
+	{
+		if (s->flags & DBC_SIGNAL_FLOAT)
+		{
+			uint32_t v32 = raw;
+			float f;
+			memcpy(&f, &v32, sizeof(f));
+			value = f;
+		}
+		else
+			memcpy(&value, &raw, sizeof(value));
+	}
+	else if (s->flags & DBC_SIGNAL_SIGNED)
+		value = (double)((int64_t)(raw << bits) >> bits);
+	else
+		value = (double)raw;
+	return value * s->factor + s->offset;
+}
+
+static inline int decodeRange(struct dbc *db, uint32_t first, uint32_t count,
+	const uint8_t *buf, uint8_t len, struct dbc_value *out)
+{
+	int n = 0;
+
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		const struct dbc_signal *s = &db->signals[i];
+		if (s->minLen > len)
+		{
+			db->stats.truncated++;
+			continue;
+		}
+		out[n].signal = i;
+		out[n].value = physical(s, extractRaw(s, buf));
+		n++;
+	}
+	return n;
+}
+
+/*
+	Decodes the signals of m present in the frame into out, which has
+	room for DBC_MAX_MESSAGE_SIGNALS values. Returns the count.
+*/
+int dbcDecode(struct dbc *db, const struct dbc_message *m, const uint8_t *data,
+	uint8_t len, struct dbc_value *out)
+{
+	// room for the 64-bit load at the last byte, and the 9th of a wide signal
+	uint8_t buf[CANFD_MAX_DLEN + 9];
+	int n;
+
+	if (len > CANFD_MAX_DLEN)
+		len = CANFD_MAX_DLEN;
+	memcpy(buf, data, len);
+	memset(buf + len, 0, 9);
+
+	n = decodeRange(db, m->first, m->count, buf, len, out);
+	if (m->groupCount > 0 && db->signals[m->mux].minLen <= len)
+	{
+		uint64_t value = extractRaw(&db->signals[m->mux], buf);
+		const struct dbc_mux_group *g = &db->groups[m->firstGroup];
+
+		for (uint32_t i = 0; i < m->groupCount; i++, g++)
+		{
+			if (g->value == value)
+			{
+				n += decodeRange(db, g->first, g->count, buf, len, out + n);
+				break;
+			}
+		}
+	}
+
+	db->stats.frames++;
+	db->stats.signals += n;
+	return n;
+}
+
+/*
+	Looks the message up first; returns -1 for ids the DBC does not know.
+*/
+int dbcDecodeFrame(struct dbc *db, uint32_t canId, const uint8_t *data, uint8_t len,
+	struct dbc_value *out)
+{
+	const struct dbc_message *m = dbcFindMessage(db, canId);
+
+	if (m == NULL)
+	{
+		db->stats.unknown++;
+		return -1;
+	}
+	return dbcDecode(db, m, data, len, out);
+}
+
+/*
+	Returns the signal index of message.signal, or -1.
+*/
+int dbcFindSignal(const struct dbc *db, const char *message, const char *signal)
+{
+	for (uint32_t i = 0; i < db->signalCount; i++)
+	{
+		if (strcmp(db->info[i].name, signal) == 0 &&
+			strcmp(db->messages[db->info[i].message].name, message) == 0)
+			return i;
+	}
+	return -1;
+}
+
+void dbcPrintStats(const struct dbc *db)
+{
+	printf("DBC summary: frames=%llu signals=%llu unknown ids=%llu truncated=%llu\n",
+		(unsigned long long)db->stats.frames, (unsigned long long)db->stats.signals,
+		(unsigned long long)db->stats.unknown, (unsigned long long)db->stats.truncated);
+}
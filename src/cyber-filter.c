@@ -0,0 +1,266 @@
+/*
+	CAN ID filters.
+	Rules come from a text file, one per line:
+
+		# iface  action  id[x][/mask]
+		can0     allow   0x0CF00400x/0x00FFFF00
+		can0     deny    0x18FEF100x
+		*        deny    0x7DF
+
+	An id ending in 'x' or above 0x7FF is extended; without a mask the
+	id has to match exactly. Rules for "*" are used for interfaces that
+	have no rules of their own.
+
+	Whatever the kernel can express is installed as CAN_RAW_FILTER on
+	the capture socket, so unwanted frames never reach userspace. Allow
+	plus deny lists would need OR and AND NOT at once; there the kernel
+	gets the allow list and the deny rules are applied in userspace.
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/can/raw.h>
+#include "include/cyber-filter.h"
+
+#ifndef CAN_RAW_JOIN_FILTERS
+#define CAN_RAW_JOIN_FILTERS		6	// linux 4.1
+#endif
+
+static struct filter_set sets[FILTER_MAX_SETS];
+static int setCount = 0;
+
+static struct filter_set *getSet(const char *iface)
+{
+	for (int i = 0; i < setCount; i++)
+	{
+		if (strcmp(sets[i].iface, iface) == 0)
+			return &sets[i];
+	}
+
+	if (setCount == FILTER_MAX_SETS)
+		return NULL;
+
+	struct filter_set *set = &sets[setCount++];
+	memset(set, 0, sizeof(*set));
+	snprintf(set->iface, sizeof(set->iface), "%s", iface);
+	return set;
+}
+
+static int parseId(const char *text, uint32_t *id, uint32_t *mask)
+{
+	char *end;
+	int ext = 0;
+
+	*id = strtoul(text, &end, 0);
+	if (end == text)
+		return -1;
+	if (*end == 'x' || *end == 'X')
+	{
+		ext = 1;
+		end++;
+	}
+	if (*id > CAN_SFF_MASK)
+		ext = 1;
+
+	*mask = ext ? CAN_EFF_MASK : CAN_SFF_MASK;
+	if (*end == '/')
+	{
+		text = end + 1;
+		*mask = strtoul(text, &end, 0);
+		if (end == text)
+			return -1;
+	}
+	if (*end != '\0' || *id > CAN_EFF_MASK)
+		return -1;
+
+	// the frame format is always compared, RTR never
+	*mask = (*mask & (ext ? CAN_EFF_MASK : CAN_SFF_MASK)) | CAN_EFF_FLAG;
+	*id = (*id & *mask) | (ext ? CAN_EFF_FLAG : 0);
+	return 0;
+}
+
+int filterLoad(const char *path)
+{
+	char line[FILTER_LINE_MAX];
+	int lineNo = 0;
+	int rules = 0;
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL)
+	{
+		printf("Filter file open failed: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char iface[IFNAMSIZ], action[8], idText[48];
+		struct filter_rule rule;
+
+		lineNo++;
+		char *p = line;
+		while (isspace((unsigned char)*p))
+			p++;
+		if (*p == '#' || *p == '\0')
+			continue;
+
+		memset(&rule, 0, sizeof(rule));
+		rule.line = lineNo;
+		if (sscanf(p, "%15s %7s %47s", iface, action, idText) != 3 ||
+			parseId(idText, &rule.id, &rule.mask) != 0)
+			goto bad;
+
+		if (strcmp(action, "allow") == 0)
+			rule.action = FILTER_ALLOW;
+		else if (strcmp(action, "deny") == 0)
+			rule.action = FILTER_DENY;
+		else
+			goto bad;
+
+		struct filter_set *set = getSet(iface);
+		if (set == NULL || set->count == FILTER_MAX_RULES)
+		{
+			printf("Filter file %s:%d: too many rules\n", path, lineNo);
+			fclose(fp);
+			return -1;
+		}
+		set->rules[set->count++] = rule;
+		if (rule.action == FILTER_ALLOW)
+			set->allows++;
+		else
+			set->denies++;
+		rules++;
+		continue;
+
+bad:
+		printf("Filter file %s:%d: expected \"iface allow|deny id[x][/mask]\"\n",
+			path, lineNo);
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+	printf("Filter: %d rules for %d interfaces loaded from %s\n", rules, setCount, path);
+	return 0;
+}
+
+struct filter_set *filterFind(const char *iface)
+{
+	struct filter_set *any = NULL;
+
+	for (int i = 0; i < setCount; i++)
+	{
+		if (strcmp(sets[i].iface, iface) == 0)
+			return &sets[i];
+		if (strcmp(sets[i].iface, "*") == 0)
+			any = &sets[i];
+	}
+	return any;
+}
+
+/*
+	Installs the kernel part of the set on sock. Returns 0 or -1 when
+	setsockopt() failed; filterCheck() stays correct either way.
+*/
+int filterApply(struct filter_set *set, int sock)
+{
+	struct can_filter kernel[FILTER_MAX_RULES];
+	int n = 0;
+	int join = 0;
+
+	if (set->allows > 0)
+	{
+		// OR of the allow rules; denies, if any, are left to userspace
+		for (int i = 0; i < set->count; i++)
+		{
+			if (set->rules[i].action != FILTER_ALLOW)
+				continue;
+			kernel[n].can_id = set->rules[i].id;
+			kernel[n].can_mask = set->rules[i].mask;
+			n++;
+		}
+		set->kernelExact = set->denies == 0;
+	}
+	else
+	{
+		// deny only: AND of inverted filters
+		for (int i = 0; i < set->count; i++)
+		{
+			kernel[n].can_id = set->rules[i].id | CAN_INV_FILTER;
+			kernel[n].can_mask = set->rules[i].mask;
+			n++;
+		}
+		join = n > 1;
+		set->kernelExact = 1;
+	}
+
+	if (join && setsockopt(sock, SOL_CAN_RAW, CAN_RAW_JOIN_FILTERS, &join, sizeof(join)) != 0)
+	{
+		printf("Filter %s: kernel cannot join filters, filtering in userspace\n", set->iface);
+		set->kernelExact = 0;
+		return 0;
+	}
+
+	if (setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, kernel, n * sizeof(kernel[0])) != 0)
+	{
+		printf("Filter %s: CAN_RAW_FILTER failed: %s\n", set->iface, strerror(errno));
+		set->kernelExact = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	Runs for every frame that reached userspace: counts the rule hits
+	and returns 1 when the frame passes the set.
+*/
+int filterCheck(struct filter_set *set, const struct canfd_frame *frame)
+{
+	uint32_t id = frame->can_id;
+	int allowed = set->allows == 0;
+	int denied = 0;
+
+	for (int i = 0; i < set->count; i++)
+	{
+		struct filter_rule *rule = &set->rules[i];
+		if ((id & rule->mask) != rule->id)
+			continue;
+
+		rule->hits++;
+		if (rule->action == FILTER_ALLOW)
+			allowed = 1;
+		else
+			denied = 1;
+	}
+
+	return allowed && !denied;
+}
+
+void filterPrintStats(void)
+{
+	for (int i = 0; i < setCount; i++)
+	{
+		struct filter_set *set = &sets[i];
+		printf("Filter %s: %d rules, %s\n", set->iface, set->count,
+			set->kernelExact ? "in kernel" : "deny rules in userspace");
+
+		for (int j = 0; j < set->count; j++)
+		{
+			struct filter_rule *rule = &set->rules[j];
+			int ext = (rule->id & CAN_EFF_FLAG) != 0;
+			// frames a kernel deny rule drops are never seen here
+			if (rule->action == FILTER_DENY && set->kernelExact)
+				printf("  line %d: deny  %X%s/%X hits in kernel\n", rule->line,
+					rule->id & CAN_EFF_MASK, ext ? "x" : "", rule->mask & CAN_EFF_MASK);
+			else
+				printf("  line %d: %s %X%s/%X hits=%llu\n", rule->line,
+					rule->action == FILTER_ALLOW ? "allow" : "deny ",
+					rule->id & CAN_EFF_MASK, ext ? "x" : "",
+					rule->mask & CAN_EFF_MASK, (unsigned long long)rule->hits);
+		}
+	}
+}
@@ -0,0 +1,380 @@
+/*
+	J1939 transport protocol reassembly (J1939-21 TP.CM / TP.DT).
+	Follows BAM and RTS/CTS transfers of every source address on every
+	channel as a passive listener and hands complete PGNs to a callback.
+	Sessions come from a pool allocated once by j1939Init(), nothing is
+	allocated per frame. Timeouts run on the frame clock and are checked
+	every J1939_SWEEP_MS. Runs on the log writer thread only.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/can.h>
+#include "include/cyber-j1939.h"
+
+static struct j1939_session *pool;
+static uint32_t poolSize;
+static uint16_t *freeList;		// session indexes
+static uint32_t freeCount;
+static uint16_t *activeList;		// session indexes, stats.active of them
+static uint16_t heads[J1939_MAX_CHANNELS * 256];	// (channel, sa) -> index + 1
+static struct j1939_stats stats;
+static uint64_t nextSweep;
+
+static j1939Callback callback;
+static void *callbackArg;
+
+static uint64_t toNs(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static struct j1939_session *findSession(int channel, uint8_t sa, uint8_t da)
+{
+	uint16_t i = heads[channel * 256 + sa];
+
+	while (i != 0)
+	{
+		struct j1939_session *s = &pool[i - 1];
+		if (s->da == da)
+			return s;
+		i = s->next;
+	}
+	return NULL;
+}
+
+static void releaseSession(struct j1939_session *s)
+{
+	uint16_t index = s - pool;
+	uint16_t *link = &heads[s->channel * 256 + s->sa];
+
+	while (*link != index + 1)
+		link = &pool[*link - 1].next;
+	*link = s->next;
+
+	// the last active session takes this one's place
+	uint16_t last = activeList[--stats.active];
+	activeList[s->active] = last;
+	pool[last].active = s->active;
+
+	freeList[freeCount++] = index;
+}
+
+static void startSession(uint64_t now, int channel, uint32_t canId, uint8_t da,
+	const uint8_t *data)
+{
+	uint8_t sa = canId & 0xFF;
+	uint16_t size = data[1] | data[2] << 8;
+	uint8_t packets = data[3];
+	struct j1939_session *s;
+
+	if (size < 9 || size > J1939_MAX_DATA || packets != (size + 6) / 7)
+	{
+		stats.invalid++;
+		return;
+	}
+
+	// a new announcement from the same sender ends the previous transfer
+	s = findSession(channel, sa, da);
+	if (s != NULL)
+	{
+		stats.aborted++;
+		releaseSession(s);
+	}
+	if (freeCount == 0)
+	{
+		stats.noSession++;
+		return;
+	}
+
+	uint16_t index = freeList[--freeCount];
+	s = &pool[index];
+	s->mode = data[0] == J1939_TP_BAM ? J1939_MODE_BAM : J1939_MODE_CMDT;
+	s->deadline = now + (uint64_t)(s->mode == J1939_MODE_BAM ? J1939_T1_MS : J1939_T3_MS) * 1000000;
+	s->pgn = data[5] | data[6] << 8 | (data[7] & 0x03) << 16;
+	s->size = size;
+	s->packets = packets;
+	s->received = 0;
+	s->channel = channel;
+	s->sa = sa;
+	s->da = da;
+	s->priority = (canId >> 26) & 0x07;
+	memset(s->seen, 0, sizeof(s->seen));
+
+	s->next = heads[channel * 256 + sa];
+	heads[channel * 256 + sa] = index + 1;
+	s->active = stats.active;
+	activeList[stats.active++] = index;
+	if (stats.active > stats.highWater)
+		stats.highWater = stats.active;
+	stats.started++;
+}
+
+static void controlFrame(uint64_t now, int channel, uint32_t canId, uint8_t len,
+	const uint8_t *data)
+{
+	uint8_t sa = canId & 0xFF;
+	uint8_t da = (canId >> 8) & 0xFF;
+	struct j1939_session *s;
+
+	if (len < 8)
+	{
+		stats.invalid++;
+		return;
+	}
+
+	switch (data[0])
+	{
+	case J1939_TP_BAM:
+		startSession(now, channel, canId, J1939_ADDRESS_GLOBAL, data);
+		break;
+	case J1939_TP_RTS:
+		startSession(now, channel, canId, da, data);
+		break;
+	case J1939_TP_CTS:
+		// sent by the receiver, so the originator is the destination
+		s = findSession(channel, da, sa);
+		if (s != NULL && s->mode == J1939_MODE_CMDT)
+			s->deadline = now + (uint64_t)(data[1] == 0 ? J1939_T4_MS : J1939_T2_MS) * 1000000;
+		break;
+	case J1939_TP_EOMA:
+		// complete transfers are gone already, so packets were missed here
+		s = findSession(channel, da, sa);
+		if (s != NULL)
+		{
+			stats.aborted++;
+			releaseSession(s);
+		}
+		break;
+	case J1939_TP_ABORT:
+		s = findSession(channel, sa, da);
+		if (s == NULL)
+			s = findSession(channel, da, sa);
+		if (s != NULL)
+		{
+			stats.aborted++;
+			releaseSession(s);
+		}
+		break;
+	}
+}
+
+static void dataFrame(const struct timespec *ts, uint64_t now, int channel, uint32_t canId,
+	uint8_t len, const uint8_t *data)
+{
+	uint8_t sa = canId & 0xFF;
+	uint8_t da = (canId >> 8) & 0xFF;
+	struct j1939_session *s = findSession(channel, sa, da);
+
+	if (s == NULL)
+	{
+		stats.orphans++;
+		return;
+	}
+
+	uint8_t seq = len > 0 ? data[0] : 0;
+	if (seq == 0 || seq > s->packets)
+	{
+		stats.invalid++;
+		return;
+	}
+
+	uint32_t offset = (seq - 1) * 7;
+	uint32_t n = s->size - offset < 7 ? s->size - offset : 7;
+	if (len < n + 1)
+	{
+		stats.invalid++;
+		return;
+	}
+	if (s->seen[(seq - 1) / 8] & (1 << ((seq - 1) % 8)))
+	{
+		stats.duplicates++;
+		return;
+	}
+
+	memcpy(s->data + offset, data + 1, n);
+	s->seen[(seq - 1) / 8] |= 1 << ((seq - 1) % 8);
+	s->deadline = now + (uint64_t)J1939_T1_MS * 1000000;
+	if (++s->received < s->packets)
+		return;
+
+	struct j1939_message msg = {
+		.ts = *ts,
+		.channel = channel,
+		.pgn = s->pgn,
+		.priority = s->priority,
+		.sa = s->sa,
+		.da = s->da,
+		.mode = s->mode,
+		.len = s->size,
+		.data = s->data,
+	};
+	stats.completed++;
+	stats.bytes += s->size;
+	if (callback != NULL)
+		callback(&msg, callbackArg);
+	releaseSession(s);
+}
+
+static void expire(uint64_t now)
+{
+	uint32_t i = 0;
+
+	// a released session is replaced by the last one, so i stays
+	while (i < stats.active)
+	{
+		struct j1939_session *s = &pool[activeList[i]];
+		if (now >= s->deadline)
+		{
+			stats.timeouts++;
+			releaseSession(s);
+		}
+		else
+			i++;
+	}
+	nextSweep = now + (uint64_t)J1939_SWEEP_MS * 1000000;
+}
+
+/*
+	sessions is the pool size, 0 for J1939_DEFAULT_SESSIONS.
+*/
+int j1939Init(uint32_t sessions, j1939Callback cb, void *arg)
+{
+	if (sessions == 0)
+		sessions = J1939_DEFAULT_SESSIONS;
+	if (sessions > 65535)
+	{
+		printf("Invalid J1939 session pool size: %u\n", sessions);
+		return -1;
+	}
+
+	j1939Free();
+	pool = malloc(sessions * sizeof(*pool));
+	freeList = malloc(sessions * sizeof(*freeList));
+	activeList = malloc(sessions * sizeof(*activeList));
+	if (pool == NULL || freeList == NULL || activeList == NULL)
+	{
+		printf("J1939 session pool allocation failed: %u sessions\n", sessions);
+		j1939Free();
+		return -1;
+	}
+
+	// touch the pool now rather than on the first transfers
+	memset(pool, 0, sessions * sizeof(*pool));
+	poolSize = sessions;
+	for (uint32_t i = 0; i < sessions; i++)
+		freeList[i] = sessions - 1 - i;
+	freeCount = sessions;
+	memset(heads, 0, sizeof(heads));
+	memset(&stats, 0, sizeof(stats));
+	nextSweep = 0;
+	callback = cb;
+	callbackArg = arg;
+	return 0;
+}
+
+/*
+	Returns 1 when the frame is a TP.CM or TP.DT frame, 0 for all other
+	frames. Complete PGNs are handed to the callback from here.
+*/
+int j1939Frame(const struct timespec *ts, int channel, uint32_t canId, uint8_t len,
+	const uint8_t *data)
+{
+	// EDP and DP are 0 for both TP PGNs
+	uint32_t pf = (canId >> 16) & 0x3FF;
+	uint64_t now;
+
+	if (!(canId & CAN_EFF_FLAG) || (canId & CAN_RTR_FLAG) ||
+		(pf != J1939_PF_TP_CM && pf != J1939_PF_TP_DT) ||
+		channel < 0 || channel >= J1939_MAX_CHANNELS || pool == NULL)
+		return 0;
+
+	now = toNs(ts);
+	stats.frames++;
+	if (pf == J1939_PF_TP_CM)
+		controlFrame(now, channel, canId, len, data);
+	else
+		dataFrame(ts, now, channel, canId, len, data);
+
+	if (now >= nextSweep)
+		expire(now);
+	return 1;
+}
+
+/*
+	Times out stalled transfers while no TP frames arrive; now has to
+	be on the clock of the frame timestamps.
+*/
+void j1939Tick(const struct timespec *now)
+{
+	uint64_t ns = toNs(now);
+
+	if (pool != NULL && ns >= nextSweep)
+		expire(ns);
+}
+
+/*
+	The 29-bit id a single frame of this PGN would have, for lookups in
+	a DBC. PDU1 PGNs carry the destination in PS.
+*/
+uint32_t j1939CanId(const struct j1939_message *msg)
+{
+	uint32_t id = CAN_EFF_FLAG | (uint32_t)msg->priority << 26 | msg->pgn << 8 | msg->sa;
+
+	if (((msg->pgn >> 8) & 0xFF) < 240)
+		id |= (uint32_t)msg->da << 8;
+	return id;
+}
+
+/*
+	"J1939 PGN FECA SA 00 DA FF BAM 20: 01 FF ..." for the log. size
+	J1939_TEXT_MAX always fits a whole message.
+*/
+int j1939FormatMessage(char *out, size_t size, const struct j1939_message *msg)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	int n = snprintf(out, size, "J1939 PGN %04X SA %02X DA %02X %s %u:", msg->pgn,
+		msg->sa, msg->da, msg->mode == J1939_MODE_BAM ? "BAM" : "CMDT", msg->len);
+
+	if (n < 0 || (size_t)n >= size)
+		return n;
+	for (uint16_t i = 0; i < msg->len && (size_t)n + 4 <= size; i++)
+	{
+		out[n++] = ' ';
+		out[n++] = hex[msg->data[i] >> 4];
+		out[n++] = hex[msg->data[i] & 0x0F];
+	}
+	out[n] = '\0';
+	return n;
+}
+
+void j1939GetStats(struct j1939_stats *out)
+{
+	*out = stats;
+}
+
+void j1939PrintStats(void)
+{
+	printf("J1939 TP summary: frames=%llu started=%llu completed=%llu bytes=%llu "
+		"timeouts=%llu aborted=%llu no-session=%llu invalid=%llu duplicates=%llu "
+		"orphans=%llu active=%u high-water=%u/%u\n",
+		(unsigned long long)stats.frames, (unsigned long long)stats.started,
+		(unsigned long long)stats.completed, (unsigned long long)stats.bytes,
+		(unsigned long long)stats.timeouts, (unsigned long long)stats.aborted,
+		(unsigned long long)stats.noSession, (unsigned long long)stats.invalid,
+		(unsigned long long)stats.duplicates, (unsigned long long)stats.orphans,
+		stats.active, stats.highWater, poolSize);
+}
+
+void j1939Free(void)
+{
+	free(pool);
+	free(freeList);
+	free(activeList);
+	pool = NULL;
+	freeList = NULL;
+	activeList = NULL;
+	poolSize = 0;
+	freeCount = 0;
+}
@@ -0,0 +1,280 @@
+/*
+	End-to-end capture latency, sampled.
+	The capture thread stamps 1 in N frames when it reads them and passes
+	a slot number through the ring record; the writer thread stamps the
+	frame once it is formatted and again when the log writer reports its
+	bytes handed to write(). Each side only touches its own counters, the
+	slot's busy flag is the one handover back, so there are no locks and
+	a frame that is not sampled costs one thread-local increment.
+	The per-stage histograms belong to the writer thread, which also
+	writes them out when asked (SIGUSR1 in canbus-app).
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include "include/cyber-latency.h"
+
+struct latency_sample {
+	uint64_t rxNs;
+	uint64_t readNs;
+	uint64_t formatNs;
+	uint64_t seq;			// log frame count including this frame
+	uint32_t busy;			// set by the capture thread, cleared by the writer
+};
+
+static const char *stageNames[LATENCY_STAGES] = { "socket", "queue", "flush", "total" };
+
+static struct latency_sample samples[LATENCY_SLOTS];
+static uint32_t sampleMask = LATENCY_SAMPLE_EVERY - 1;
+static char exportPath[LATENCY_PATH_MAX];
+static volatile sig_atomic_t exportRequested = 0;
+
+// capture thread
+static __thread uint32_t sampleCount;
+static uint32_t nextSlot;
+static uint64_t skipped;
+
+// writer thread
+static struct latency_stage stages[LATENCY_STAGES];
+static uint32_t pendingSlots[LATENCY_SLOTS];
+static uint32_t pendingHead;
+static uint32_t pendingTail;
+static uint64_t completed;
+static uint64_t unlogged;
+static uint32_t exports;
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int latencyInit(const char *path, uint32_t sampleEvery)
+{
+	uint32_t every = 1;
+
+	while (every < sampleEvery && every < (1u << 30))
+		every <<= 1;
+	sampleMask = every - 1;
+	snprintf(exportPath, sizeof(exportPath), "%s", path);
+
+	memset(samples, 0, sizeof(samples));
+	memset(stages, 0, sizeof(stages));
+	for (int i = 0; i < LATENCY_STAGES; i++)
+		stages[i].minUs = UINT32_MAX;
+	sampleCount = 0;
+	nextSlot = 0;
+	skipped = 0;
+	pendingHead = pendingTail = 0;
+	completed = unlogged = 0;
+	exports = 0;
+	return 0;
+}
+
+/*
+	Capture thread, before the record is committed to the ring: the
+	commit publishes the slot to the writer. Returns the slot + 1 for
+	the record, 0 when the frame is not sampled.
+*/
+uint32_t latencyRead(const struct timespec *rxTs)
+{
+	if ((sampleCount++ & sampleMask) != 0)
+		return 0;
+
+	struct latency_sample *s = &samples[nextSlot];
+	if (__atomic_load_n(&s->busy, __ATOMIC_ACQUIRE))
+	{
+		__atomic_store_n(&skipped, skipped + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	s->rxNs = (uint64_t)rxTs->tv_sec * 1000000000 + rxTs->tv_nsec;
+	s->readNs = nowNs();
+	s->busy = 1;
+
+	uint32_t slot = nextSlot;
+	nextSlot = (nextSlot + 1) & (LATENCY_SLOTS - 1);
+	return slot + 1;
+}
+
+/*
+	Writer thread, after the frame went to the log. seq is the log's
+	frame count including it, 0 when it was not logged.
+*/
+void latencyFormatted(uint32_t sample, uint64_t seq)
+{
+	struct latency_sample *s = &samples[sample - 1];
+
+	if (seq == 0)
+	{
+		unlogged++;
+		__atomic_store_n(&s->busy, 0, __ATOMIC_RELEASE);
+		return;
+	}
+	s->formatNs = nowNs();
+	s->seq = seq;
+	// at most LATENCY_SLOTS samples are busy, the queue cannot overflow
+	pendingSlots[pendingHead++ & (LATENCY_SLOTS - 1)] = sample - 1;
+}
+
+static void addStage(int stage, uint64_t from, uint64_t to)
+{
+	struct latency_stage *st = &stages[stage];
+	uint64_t us = to > from ? (to - from) / 1000 : 0;
+
+	if (us > UINT32_MAX)
+		us = UINT32_MAX;
+	st->count++;
+	st->sumUs += us;
+	if (us < st->minUs)
+		st->minUs = us;
+	if (us > st->maxUs)
+		st->maxUs = us;
+	st->buckets[timingBucket(us)]++;
+}
+
+/*
+	Writer thread, with logFileFlushedFrames(): completes the samples
+	whose frames are out.
+*/
+void latencyFlushed(uint64_t flushedFrames)
+{
+	uint64_t now = 0;
+
+	while (pendingTail != pendingHead)
+	{
+		struct latency_sample *s = &samples[pendingSlots[pendingTail & (LATENCY_SLOTS - 1)]];
+		if (s->seq > flushedFrames)
+			break;
+
+		if (now == 0)
+			now = nowNs();
+		addStage(LATENCY_STAGE_SOCKET, s->rxNs, s->readNs);
+		addStage(LATENCY_STAGE_QUEUE, s->readNs, s->formatNs);
+		addStage(LATENCY_STAGE_FLUSH, s->formatNs, now);
+		addStage(LATENCY_STAGE_TOTAL, s->rxNs, now);
+		completed++;
+		pendingTail++;
+		__atomic_store_n(&s->busy, 0, __ATOMIC_RELEASE);
+	}
+}
+
+// async-signal-safe
+void latencyRequestExport(void)
+{
+	exportRequested = 1;
+}
+
+/*
+	Writer thread, from its idle loop and every few thousand frames.
+*/
+void latencyTick(void)
+{
+	if (exportRequested)
+	{
+		exportRequested = 0;
+		latencyExport(exportPath);
+	}
+}
+
+// upper edge of the bucket holding the fraction q of the samples
+static uint32_t percentile(const struct latency_stage *st, double q)
+{
+	uint64_t rank = (uint64_t)ceil(q * st->count);
+	uint64_t seen = 0;
+
+	for (uint32_t b = 0; b < TIMING_BUCKETS; b++)
+	{
+		seen += st->buckets[b];
+		if (seen >= rank && seen > 0)
+		{
+			uint32_t upper = b + 1 < TIMING_BUCKETS ? timingBucketLow(b + 1) - 1 : st->maxUs;
+			return upper < st->maxUs ? upper : st->maxUs;
+		}
+	}
+	return st->maxUs;
+}
+
+/*
+	Writer thread. JSON, through a temporary file and rename:
+		{"time": unix s, "sample_every", "samples", "skipped", "pending",
+		 "stages": [{"stage", "count", "min_us", "mean_us", "max_us",
+			"p50_us", "p99_us", "p999_us", "buckets": [[low_us, count], ...]}]}
+*/
+int latencyExport(const char *path)
+{
+	char tmp[LATENCY_PATH_MAX + 8];
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (fp == NULL)
+	{
+		printf("Latency export open failed: %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+
+	fprintf(fp, "{\"time\":%lld,\"sample_every\":%u,\"samples\":%llu,\"skipped\":%llu,"
+		"\"pending\":%u,\"stages\":[", (long long)time(NULL), sampleMask + 1,
+		(unsigned long long)completed,
+		(unsigned long long)__atomic_load_n(&skipped, __ATOMIC_RELAXED),
+		pendingHead - pendingTail);
+	for (int i = 0; i < LATENCY_STAGES; i++)
+	{
+		const struct latency_stage *st = &stages[i];
+		int first = 1;
+
+		fprintf(fp, "%s\n{\"stage\":\"%s\",\"count\":%llu,\"min_us\":%u,\"mean_us\":%.1f,"
+			"\"max_us\":%u,\"p50_us\":%u,\"p99_us\":%u,\"p999_us\":%u,\"buckets\":[",
+			i ? "," : "", stageNames[i], (unsigned long long)st->count,
+			st->count ? st->minUs : 0, st->count ? (double)st->sumUs / st->count : 0,
+			st->maxUs, percentile(st, 0.5), percentile(st, 0.99), percentile(st, 0.999));
+		for (uint32_t b = 0; b < TIMING_BUCKETS; b++)
+		{
+			if (st->buckets[b] == 0)
+				continue;
+			fprintf(fp, "%s[%u,%u]", first ? "" : ",", timingBucketLow(b), st->buckets[b]);
+			first = 0;
+		}
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "]}\n");
+
+	if (fclose(fp) != 0 || rename(tmp, path) != 0)
+	{
+		printf("Latency export write failed: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	exports++;
+	return 0;
+}
+
+const struct latency_stage *latencyStage(int stage)
+{
+	return &stages[stage];
+}
+
+void latencyGetStats(struct latency_stats *out)
+{
+	out->samples = completed;
+	out->skipped = __atomic_load_n(&skipped, __ATOMIC_RELAXED);
+	out->unlogged = unlogged;
+	out->pending = pendingHead - pendingTail;
+	out->exports = exports;
+}
+
+void latencyPrintStats(void)
+{
+	printf("Latency summary: samples=%llu skipped=%llu exports=%u file=%s\n",
+		(unsigned long long)completed,
+		(unsigned long long)__atomic_load_n(&skipped, __ATOMIC_RELAXED), exports, exportPath);
+	for (int i = 0; i < LATENCY_STAGES; i++)
+	{
+		const struct latency_stage *st = &stages[i];
+		printf("  %-6s p50=%u us p99=%u us max=%u us\n", stageNames[i], percentile(st, 0.5),
+			percentile(st, 0.99), st->maxUs);
+	}
+}
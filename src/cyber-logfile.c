@@ -0,0 +1,637 @@
+/*
+	Group-commit log writer.
+	Output is collected in a 64 KiB block and written with one write()
+	when the block is full or the durability window expires. The segment
+	size is tracked here, so there is no fflush()/ftell() per frame.
+	Segments are text ASC, binary BLF or CDL, see log_config.format.
+
+	With LOG_OUTPUT_URING the segment is preallocated to the rotation
+	limit and 256 KiB blocks are submitted through io_uring from a few
+	rotating buffers, LOG_OUTPUT_DIRECT adds O_DIRECT. Direct writes must
+	be block aligned, so the unaligned tail of a block is carried over
+	into the next buffer and a durability flush writes it zero padded;
+	the next write overlaps that page and is issued with IOSQE_IO_DRAIN.
+	The segment is truncated to its real size on close.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/cyber-canbus.h"
+#include "include/cyber-logfile.h"
+#include "include/cyber-asc.h"
+#include "include/cyber-blf.h"
+#include "include/cyber-cdl.h"
+#include "include/cyber-segment.h"
+#include "include/cyber-uring.h"
+
+static int logfd = -1;
+static char fileName[64];
+static struct timespec ts_start;
+static int fileIndex = 0;
+
+static struct log_config config;
+static struct log_stats stats;
+static struct blf_writer blf;
+static struct cdl_writer cdl;
+
+static char writeBuffer[LOG_BLOCK_SIZE];
+static char *block = writeBuffer;
+static size_t blockSize = LOG_BLOCK_SIZE;
+static size_t blockUsed = 0;
+static uint64_t fileSize = 0;		// bytes in the segment, buffered included
+static int pending = 0;			// frames not yet handed to write()
+static uint64_t blockFrames = 0;	// frames complete in block, flushedFrames once written
+static struct timespec ts_pending;	// when the oldest of them was queued
+
+// io_uring output
+static struct uring uring;
+static char *uringBuffers[LOG_URING_BUFFERS];
+static int uringBusy[LOG_URING_BUFFERS];
+static int uringIndex = 0;		// buffer block points to
+static uint64_t blockOffset = 0;	// file offset of block[0]
+static size_t blockCounted = 0;		// leading bytes already in stats.bytes
+static int overlapPending = 0;		// last write was padded past the data
+
+static uint64_t msSince(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+		(now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int reapWrite(int wait)
+{
+	uint64_t index;
+	int res;
+	int ret = uringComplete(&uring, wait, &index, &res);
+
+	if (ret == 1)
+	{
+		uringBusy[index] = 0;
+		if (res < 0)
+			printf("Log file write failed: %s\n", strerror(-res));
+	}
+	return ret;
+}
+
+static void drainWrites(void)
+{
+	while (uring.inflight > 0 && reapWrite(1) >= 0)
+		;
+}
+
+/*
+	Submits the block and moves on to the next buffer. Without pad only
+	whole direct I/O pages go out and the tail waits for more data.
+*/
+static int submitBlock(int pad)
+{
+	size_t len = blockUsed;
+	size_t keep = 0;
+	size_t io = len;
+	int ret = 0;
+
+	if (config.output == LOG_OUTPUT_DIRECT)
+	{
+		keep = len % LOG_DIRECT_ALIGN;
+		if (pad && keep > 0)
+		{
+			io = len + LOG_DIRECT_ALIGN - keep;
+			memset(block + len, 0, io - len);
+		}
+		else
+		{
+			io = len - keep;
+		}
+	}
+	if (io == 0)
+		return 0;
+
+	if (uringWrite(&uring, logfd, block, io, blockOffset,
+		overlapPending ? IOSQE_IO_DRAIN : 0, uringIndex) != 0)
+	{
+		ret = -1;
+	}
+	else
+	{
+		uringBusy[uringIndex] = 1;
+		stats.writes++;
+		if (io >= len)
+			stats.flushedFrames = blockFrames;
+	}
+	stats.bytes += (io > len ? len : io) - blockCounted;
+	overlapPending = io > len;
+
+	int next = (uringIndex + 1) % LOG_URING_BUFFERS;
+	while (uringBusy[next] && reapWrite(1) >= 0)
+		;
+	memcpy(uringBuffers[next], block + len - keep, keep);
+	blockCounted = io > len ? keep : 0;
+	blockOffset += len - keep;
+	uringIndex = next;
+	block = uringBuffers[next];
+	blockUsed = keep;
+	return ret;
+}
+
+static int writeBlock(int pad)
+{
+	size_t done = 0;
+
+	if (config.output != LOG_OUTPUT_WRITE)
+		return submitBlock(pad);
+
+	while (done < blockUsed)
+	{
+		ssize_t n = write(logfd, block + done, blockUsed - done);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			printf("Log file write failed: %s\n", strerror(errno));
+			blockUsed = 0;
+			return -1;
+		}
+		done += n;
+		stats.writes++;
+	}
+
+	stats.bytes += blockUsed;
+	blockUsed = 0;
+	stats.flushedFrames = blockFrames;
+	return 0;
+}
+
+/*
+	BLF and CDL frames wait in the open container or block until the
+	writer hands it to appendBytes(); once it is empty every frame so
+	far is in block.
+*/
+static void countBlockFrames(void)
+{
+	if (config.format == LOG_FORMAT_BLF ? blf.used == 0 :
+		config.format == LOG_FORMAT_CDL ? cdl.used == 0 : 1)
+		blockFrames = stats.frames;
+}
+
+/*
+	Output sink of the BLF and CDL writers, compressed containers can be larger
+	than what is left of the block.
+*/
+static int appendBytes(const void *data, size_t len)
+{
+	const char *p = data;
+
+	while (len > 0)
+	{
+		size_t room = blockSize - blockUsed;
+		size_t n = len < room ? len : room;
+
+		memcpy(block + blockUsed, p, n);
+		blockUsed += n;
+		fileSize += n;
+		p += n;
+		len -= n;
+
+		if (blockUsed == blockSize && writeBlock(0) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void appendHeader(void)
+{
+	if (config.format == LOG_FORMAT_BLF)
+	{
+		uint8_t header[BLF_FILE_HEADER_SIZE];
+
+		blfWriterStart(&blf, &ts_start);
+		blfBuildHeader(&blf, BLF_FILE_HEADER_SIZE, header);
+		appendBytes(header, sizeof(header));
+		return;
+	}
+	if (config.format == LOG_FORMAT_CDL)
+	{
+		cdlWriterStart(&cdl, &ts_start);
+		return;
+	}
+
+	// keep the logFileInit() base so timestamps run on across segments
+	time_t base = ts_start.tv_sec;
+	blockUsed += snprintf(block + blockUsed, blockSize - blockUsed,
+		"date,%sbase hex timestamps absolute\nno interval events logged\n",
+		ctime(&base));
+	fileSize = blockUsed;
+}
+
+/*
+	The BLF statistics block is only known at the end, so the header is
+	rewritten in place whenever the segment is synced or closed.
+	Submitted blocks may still hold the old header, so they have to
+	complete first; an O_DIRECT descriptor cannot take the short write.
+*/
+static void updateHeader(void)
+{
+	uint8_t header[BLF_FILE_HEADER_SIZE];
+	int fd = logfd;
+
+	if (config.format != LOG_FORMAT_BLF)
+		return;
+
+	blfBuildHeader(&blf, fileSize, header);
+	if (config.output != LOG_OUTPUT_WRITE)
+	{
+		drainWrites();
+		if (blockOffset == 0 && blockUsed >= sizeof(header))
+			memcpy(block, header, sizeof(header));
+	}
+	if (config.output == LOG_OUTPUT_DIRECT)
+		fd = open(fileName, O_WRONLY | O_CLOEXEC);
+
+	if (pwrite(fd, header, sizeof(header), 0) != sizeof(header))
+		printf("BLF header update failed: %s\n", strerror(errno));
+	if (fd != logfd && fd >= 0)
+		close(fd);
+}
+
+static int openSegment(void)
+{
+	int ret = snprintf(fileName, sizeof(fileName), LOG_FILE_NAME_FORMAT, fileIndex++,
+		config.format == LOG_FORMAT_BLF ? "blf" :
+		config.format == LOG_FORMAT_CDL ? "cdl" : "asc");
+	if (ret < 0 || ret >= sizeof(fileName))
+	{
+		printf("Log file name generation failed\n");
+		return -1;
+	}
+
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	if (config.output == LOG_OUTPUT_DIRECT)
+		flags |= O_DIRECT;
+
+	logfd = open(fileName, flags, 0644);
+	if (logfd < 0 && config.output == LOG_OUTPUT_DIRECT && errno == EINVAL)
+	{
+		printf("O_DIRECT not supported here, using buffered io_uring writes\n");
+		config.output = LOG_OUTPUT_URING;
+		logfd = open(fileName, flags & ~O_DIRECT, 0644);
+	}
+	if (logfd < 0)
+	{
+		printf("Log file open failed: %s\n", fileName);
+		return -1;
+	}
+
+	if (config.output != LOG_OUTPUT_WRITE)
+	{
+		// the tail carried from the last segment was already written
+		blockOffset = 0;
+		blockUsed = 0;
+		blockCounted = 0;
+		overlapPending = 0;
+
+		// extents are allocated once instead of block by block
+		off_t size = ((off_t)config.sizeLimit + blockSize + LOG_DIRECT_ALIGN - 1) &
+			~(off_t)(LOG_DIRECT_ALIGN - 1);
+		if (fallocate(logfd, 0, 0, size) != 0 && errno != EOPNOTSUPP)
+			printf("Log file preallocation failed: %s\n", strerror(errno));
+	}
+
+	stats.segments++;
+	fileSize = 0;
+	appendHeader();
+	return 0;
+}
+
+static void closeSegment(int sync)
+{
+	if (logfd < 0)
+		return;
+
+	logFileFlush(0);
+	if (config.output != LOG_OUTPUT_WRITE)
+	{
+		drainWrites();
+		if (ftruncate(logfd, fileSize) != 0)
+			printf("Log file truncate failed: %s\n", strerror(errno));
+	}
+	updateHeader();
+	if (sync)
+	{
+		fsync(logfd);
+		stats.syncs++;
+	}
+	close(logfd);
+	logfd = -1;
+}
+
+/*
+	Only close and open happen here; compressing and moving the closed
+	segment is left to the segment worker.
+*/
+void rotateLogFile(void)
+{
+	char closed[sizeof(fileName)];
+	struct timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	memcpy(closed, fileName, sizeof(closed));
+	closeSegment(0);
+	if (openSegment() != 0)
+		exit(1);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	segmentSubmit(closed, (t1.tv_sec - t0.tv_sec) * 1000000 +
+		(t1.tv_nsec - t0.tv_nsec) / 1000);
+}
+
+void logFileDefaultConfig(struct log_config *cfg)
+{
+	cfg->format = LOG_FORMAT_ASC;
+	cfg->output = LOG_OUTPUT_WRITE;
+	cfg->flushIntervalMs = LOG_FLUSH_INTERVAL_MS;
+	cfg->flushBytes = 0;
+	cfg->sizeLimit = CAN_LOG_FILE_SIZE_LIMIT;
+	cfg->compressionLevel = BLF_COMPRESSION_LEVEL;
+}
+
+static int initUring(void)
+{
+	if (uringInit(&uring, LOG_URING_BUFFERS * 2) != 0)
+		return -1;
+
+	for (int i = 0; i < LOG_URING_BUFFERS; i++)
+	{
+		// O_DIRECT wants aligned memory as well as aligned offsets
+		if (posix_memalign((void **)&uringBuffers[i], LOG_DIRECT_ALIGN,
+			LOG_URING_BLOCK_SIZE) != 0)
+			return -1;
+		uringBusy[i] = 0;
+	}
+
+	uringIndex = 0;
+	block = uringBuffers[0];
+	blockSize = LOG_URING_BLOCK_SIZE;
+	return 0;
+}
+
+static void freeUring(void)
+{
+	for (int i = 0; i < LOG_URING_BUFFERS; i++)
+	{
+		free(uringBuffers[i]);
+		uringBuffers[i] = NULL;
+	}
+	if (uring.sqMap != NULL)
+		uringFree(&uring);
+	block = writeBuffer;
+	blockSize = LOG_BLOCK_SIZE;
+}
+
+int logFileInit(const struct log_config *cfg)
+{
+	config = *cfg;
+	if (config.output != LOG_OUTPUT_WRITE && initUring() != 0)
+	{
+		printf("io_uring output unavailable, using write()\n");
+		freeUring();
+		config.output = LOG_OUTPUT_WRITE;
+	}
+
+	if (config.flushBytes == 0 || config.flushBytes > blockSize - LOG_LINE_MAX)
+		config.flushBytes = blockSize - LOG_LINE_MAX;
+	memset(&stats, 0, sizeof(stats));
+	blockFrames = 0;
+	// segment names count from canlog_000 again, as stats.segments does
+	fileIndex = 0;
+
+	if (config.format == LOG_FORMAT_BLF &&
+		blfWriterInit(&blf, config.compressionLevel, appendBytes) != 0)
+		return -1;
+	if (config.format == LOG_FORMAT_CDL && cdlWriterInit(&cdl, appendBytes) != 0)
+		return -1;
+
+	// kernel receive timestamps are CLOCK_REALTIME, so is the base
+	clock_gettime(CLOCK_REALTIME, &ts_start);
+
+	if (openSegment() != 0)
+		return -1;
+
+	// the header goes out right away so an empty log is still valid
+	return logFileFlush(0);
+}
+
+/*
+	flags are the canfd_frame flags; CANFD_FDF marks an FD frame, dlc is
+	then the data length (up to 64).
+*/
+void logFileLogMessage(const struct timespec *ts, uint32_t id, const char *dir,
+	int channel, uint8_t flags, uint8_t dlc, const uint8_t *data)
+{
+	if (logfd < 0)
+		return;
+
+	if (!pending)
+	{
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts_pending);
+		pending = 1;
+	}
+
+	if (config.format == LOG_FORMAT_BLF)
+	{
+		// containers reach the block already compressed, so fileSize
+		// and the rotation limit count compressed bytes
+		int blfFlags = dir[0] == 'T' ? BLF_FRAME_TX : 0;
+		if (flags & CANFD_FDF)
+			blfFlags |= BLF_FRAME_FD | (flags & CANFD_BRS ? BLF_FRAME_BRS : 0) |
+				(flags & CANFD_ESI ? BLF_FRAME_ESI : 0);
+		blfAddCanFrame(&blf, ts, channel, id, blfFlags, dlc, data);
+	}
+	else if (config.format == LOG_FORMAT_CDL)
+	{
+		int cdlFlags = dir[0] == 'T' ? CDL_FRAME_TX : 0;
+		if (flags & CANFD_FDF)
+			cdlFlags |= CDL_FRAME_FD | (flags & CANFD_BRS ? CDL_FRAME_BRS : 0) |
+				(flags & CANFD_ESI ? CDL_FRAME_ESI : 0);
+		cdlAddFrame(&cdl, ts, channel, id, cdlFlags, dlc, data);
+	}
+	else
+	{
+		int len;
+		if (flags & CANFD_FDF)
+			len = ascFormatFdFrame(block + blockUsed, ts->tv_sec - ts_start.tv_sec,
+				ts->tv_nsec - ts_start.tv_nsec, channel, id, dir,
+				flags & CANFD_BRS, flags & CANFD_ESI, dlc, data);
+		else
+			len = ascFormatFrame(block + blockUsed, ts->tv_sec - ts_start.tv_sec,
+				ts->tv_nsec - ts_start.tv_nsec, channel, id, dir, dlc, data);
+		blockUsed += len;
+		fileSize += len;
+	}
+	stats.frames++;
+	countBlockFrames();
+
+	if (fileSize >= config.sizeLimit)
+		rotateLogFile();
+	else if (blockUsed >= config.flushBytes)
+		writeBlock(0);
+}
+
+/*
+	Free text event: an AppText object in BLF, a "//" comment line with
+	the timestamp in ASC. CDL has no text record, the text is dropped;
+	capture gaps go through logFileLogGap().
+*/
+void logFileLogText(const struct timespec *ts, const char *text)
+{
+	if (logfd < 0 || config.format == LOG_FORMAT_CDL)
+		return;
+
+	if (!pending)
+	{
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts_pending);
+		pending = 1;
+	}
+
+	if (config.format == LOG_FORMAT_BLF)
+	{
+		blfAddText(&blf, ts, text);
+		countBlockFrames();
+	}
+	else
+	{
+		char prefix[48];
+		int64_t sec = ts->tv_sec - ts_start.tv_sec;
+		long nsec = ts->tv_nsec - ts_start.tv_nsec;
+		if (nsec < 0)
+		{
+			sec--;
+			nsec += 1000000000;
+		}
+		int len = snprintf(prefix, sizeof(prefix), "// %lld.%06ld ", (long long)sec,
+			nsec / 1000);
+		appendBytes(prefix, len);
+		appendBytes(text, strlen(text));
+		appendBytes("\n", 1);
+	}
+
+	if (fileSize >= config.sizeLimit)
+		rotateLogFile();
+	else if (blockUsed >= config.flushBytes)
+		writeBlock(0);
+}
+
+/*
+	Capture gap marker: the frames of channel lost before ts to the socket
+	receive queue and to the capture ring. A gap record in CDL, text lines
+	in ASC and BLF.
+*/
+void logFileLogGap(const struct timespec *ts, int channel, uint32_t socketLost,
+	uint32_t ringLost)
+{
+	char text[96];
+
+	if (logfd < 0)
+		return;
+
+	if (config.format == LOG_FORMAT_CDL)
+	{
+		if (!pending)
+		{
+			clock_gettime(CLOCK_MONOTONIC_COARSE, &ts_pending);
+			pending = 1;
+		}
+		cdlAddGap(&cdl, ts, channel, socketLost, ringLost);
+		countBlockFrames();
+		if (fileSize >= config.sizeLimit)
+			rotateLogFile();
+		else if (blockUsed >= config.flushBytes)
+			writeBlock(0);
+		return;
+	}
+
+	if (socketLost != 0)
+	{
+		snprintf(text, sizeof(text), "CAN %d: %u frames lost, socket receive queue "
+			"overflow", channel, socketLost);
+		logFileLogText(ts, text);
+	}
+	if (ringLost != 0)
+	{
+		snprintf(text, sizeof(text), "CAN %d: %u frames lost, capture ring full",
+			channel, ringLost);
+		logFileLogText(ts, text);
+	}
+}
+
+/*
+	Called by the writer thread while it is idle, enforces the time part
+	of the durability window.
+*/
+void logFileTick(void)
+{
+	if (logfd >= 0 && pending && msSince(&ts_pending) >= config.flushIntervalMs)
+		logFileFlush(0);
+}
+
+int logFileFlush(int sync)
+{
+	int ret = 0;
+
+	if (logfd < 0)
+		return -1;
+
+	if (config.format == LOG_FORMAT_BLF && blfFlushContainer(&blf) != 0)
+		ret = -1;
+	if (config.format == LOG_FORMAT_CDL && cdlFlushBlock(&cdl) != 0)
+		ret = -1;
+	countBlockFrames();
+
+	if (blockUsed > blockCounted && writeBlock(1) != 0)
+		ret = -1;
+	pending = 0;
+	if (ret == 0)
+		stats.flushedFrames = stats.frames;
+
+	if (sync)
+	{
+		if (config.output != LOG_OUTPUT_WRITE)
+			drainWrites();
+		updateHeader();
+		if (fsync(logfd) != 0)
+			ret = -1;
+		stats.syncs++;
+	}
+
+	return ret;
+}
+
+void logFileGetStats(struct log_stats *out)
+{
+	*out = stats;
+}
+
+uint64_t logFileFlushedFrames(void)
+{
+	return stats.flushedFrames;
+}
+
+void logFileDeinit(void)
+{
+	int wasOpen = logfd >= 0;
+
+	closeSegment(1);
+	if (wasOpen)
+		segmentSubmit(fileName, 0);
+	if (config.format == LOG_FORMAT_BLF)
+		blfWriterFree(&blf);
+	if (config.format == LOG_FORMAT_CDL)
+		cdlWriterFree(&cdl);
+	if (config.output != LOG_OUTPUT_WRITE)
+		freeUring();
+}
@@ -0,0 +1,299 @@
+/*
+	Per-PGN and per-source-address traffic accounting.
+	The capture thread counts every frame into a fixed open-addressing
+	table keyed by (channel, pgn, sa): frames, bytes and the cycle time
+	since the last frame of the key. It is the only writer, so there are
+	no locks; a reporter thread closes an interval once per second by
+	advancing the epoch and reads the window the capture thread has just
+	left, then rewrites a small summary file. A capture thread that read
+	the epoch just before the switch may still count one frame into the
+	closed window, the per-window sequence count makes the reporter copy
+	it again then; a frame counted after the copy is lost from the
+	report, the totals still have it.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/can.h>
+#include "include/cyber-canbus.h"
+#include "include/cyber-pgnstat.h"
+#include "include/cyber-reporter.h"
+
+#if CAN_CHANNEL_MAX >= PGNSTAT_CHANNELS
+#error "CAN_CHANNEL_MAX does not fit the channel bits of the key"
+#endif
+
+static struct pgnstat_entry table[PGNSTAT_TABLE_SIZE];
+static uint32_t keyCount;
+static uint64_t overflow;		// frames of keys that found no slot
+static uint32_t epoch = 1;		// window epoch 0 = never used
+
+static struct reporter reporter;
+static char summaryPath[PGNSTAT_PATH_MAX];
+static uint32_t reportIntervalMs = PGNSTAT_INTERVAL_MS;
+static uint32_t snapshots;
+static struct pgnstat_row rows[PGNSTAT_MAX_KEYS];
+
+static uint32_t makeKey(int channel, uint32_t canId)
+{
+	if (!(canId & CAN_EFF_FLAG))
+		return PGNSTAT_KEY_USED | PGNSTAT_KEY_STANDARD | (uint32_t)channel << 27 |
+			(canId & CAN_SFF_MASK) << 8;
+
+	uint32_t pgn = (canId >> 8) & 0x3FFFF;
+	// PDU1: PS is the destination address, not part of the PGN
+	if (((pgn >> 8) & 0xFF) < 240)
+		pgn &= 0x3FF00;
+	return PGNSTAT_KEY_USED | (uint32_t)channel << 27 | pgn << 8 | (canId & 0xFF);
+}
+
+static struct pgnstat_entry *lookup(uint32_t key)
+{
+	uint32_t slot = (key * 0x9E3779B1u) >> (32 - PGNSTAT_TABLE_BITS);
+
+	for (int probe = 0; probe < PGNSTAT_TABLE_SIZE; probe++)
+	{
+		struct pgnstat_entry *e = &table[(slot + probe) & (PGNSTAT_TABLE_SIZE - 1)];
+		if (e->key == key)
+			return e;
+		if (e->key == 0)
+		{
+			if (keyCount == PGNSTAT_MAX_KEYS)
+				return NULL;
+			keyCount++;
+			// the reporter only looks at slots with a key
+			__atomic_store_n(&e->key, key, __ATOMIC_RELEASE);
+			return e;
+		}
+	}
+	return NULL;
+}
+
+int pgnStatInit(void)
+{
+	memset(table, 0, sizeof(table));
+	keyCount = 0;
+	overflow = 0;
+	epoch = 1;
+	snapshots = 0;
+	return 0;
+}
+
+/*
+	Capture thread only, channel is 0..CAN_CHANNEL_MAX.
+*/
+void pgnStatFrame(const struct timespec *ts, int channel, uint32_t canId, uint8_t len)
+{
+	struct pgnstat_entry *e = lookup(makeKey(channel, canId));
+	uint64_t now = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+
+	if (e == NULL)
+	{
+		__atomic_store_n(&overflow, overflow + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	uint32_t current = __atomic_load_n(&epoch, __ATOMIC_ACQUIRE);
+	struct pgnstat_window *w = &e->window[current & 1];
+	uint32_t seq = w->seq;
+
+	__atomic_store_n(&w->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if (w->epoch != current)
+	{
+		memset(&w->epoch, 0, sizeof(*w) - offsetof(struct pgnstat_window, epoch));
+		w->minUs = UINT32_MAX;
+		w->epoch = current;
+	}
+
+	w->frames++;
+	w->bytes += len;
+	if (e->lastNs != 0 && now > e->lastNs)
+	{
+		uint64_t us = (now - e->lastNs) / 1000;
+		if (us > UINT32_MAX)
+			us = UINT32_MAX;
+		w->cycles++;
+		w->sumUs += us;
+		w->sumSqUs += us * us;
+		if (us < w->minUs)
+			w->minUs = us;
+		if (us > w->maxUs)
+			w->maxUs = us;
+	}
+	__atomic_store_n(&w->seq, seq + 2, __ATOMIC_RELEASE);
+	e->lastNs = now;
+	__atomic_store_n(&e->totalFrames, e->totalFrames + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->totalBytes, e->totalBytes + len, __ATOMIC_RELAXED);
+}
+
+/*
+	Copies the window, again when the capture thread was in it meanwhile.
+	That only happens to a capture thread that read the old epoch, so
+	the retry ends after its one frame.
+*/
+static void copyWindow(const struct pgnstat_window *w, struct pgnstat_window *out)
+{
+	uint32_t seq;
+
+	do
+	{
+		seq = __atomic_load_n(&w->seq, __ATOMIC_ACQUIRE);
+		out->seq = seq;
+		out->epoch = __atomic_load_n(&w->epoch, __ATOMIC_RELAXED);
+		out->frames = __atomic_load_n(&w->frames, __ATOMIC_RELAXED);
+		out->bytes = __atomic_load_n(&w->bytes, __ATOMIC_RELAXED);
+		out->cycles = __atomic_load_n(&w->cycles, __ATOMIC_RELAXED);
+		out->minUs = __atomic_load_n(&w->minUs, __ATOMIC_RELAXED);
+		out->maxUs = __atomic_load_n(&w->maxUs, __ATOMIC_RELAXED);
+		out->sumUs = __atomic_load_n(&w->sumUs, __ATOMIC_RELAXED);
+		out->sumSqUs = __atomic_load_n(&w->sumSqUs, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || __atomic_load_n(&w->seq, __ATOMIC_RELAXED) != seq);
+}
+
+/*
+	Closes the current interval and returns its rows, one per key seen
+	so far; keys silent in the interval come with an empty window.
+*/
+uint32_t pgnStatSnapshot(struct pgnstat_row *out, uint32_t max)
+{
+	uint32_t closed = __atomic_load_n(&epoch, __ATOMIC_RELAXED);
+	uint32_t n = 0;
+
+	__atomic_store_n(&epoch, closed + 1, __ATOMIC_RELEASE);
+	snapshots++;
+
+	for (int i = 0; i < PGNSTAT_TABLE_SIZE && n < max; i++)
+	{
+		const struct pgnstat_entry *e = &table[i];
+		uint32_t key = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+		if (key == 0)
+			continue;
+
+		struct pgnstat_row *r = &out[n++];
+		r->channel = (key >> 27) & (PGNSTAT_CHANNELS - 1);
+		r->standard = (key & PGNSTAT_KEY_STANDARD) != 0;
+		r->pgn = (key >> 8) & 0x3FFFF;
+		r->sa = key & 0xFF;
+		copyWindow(&e->window[closed & 1], &r->window);
+		if (r->window.epoch != closed)
+			memset(&r->window, 0, sizeof(r->window));
+		r->totalFrames = __atomic_load_n(&e->totalFrames, __ATOMIC_RELAXED);
+		r->totalBytes = __atomic_load_n(&e->totalBytes, __ATOMIC_RELAXED);
+	}
+	return n;
+}
+
+static int compareFrames(const void *a, const void *b)
+{
+	const struct pgnstat_row *x = a;
+	const struct pgnstat_row *y = b;
+	return x->window.frames < y->window.frames ? 1 : x->window.frames > y->window.frames ? -1 : 0;
+}
+
+/*
+	Summary file, rewritten through a temporary file and rename() so
+	readers never see a partial one:
+		# pgnstat <time> interval_ms frames/s bytes/s keys overflow
+		<ch> <pgn> <sa> <frames/s> <bytes/s> <cycle min/avg/max ms> <jitter ms> <total>
+		# sa
+		<ch> <sa> <frames/s> <bytes/s> <pgns>
+	Rows are sorted by frames/s, standard frames show as S<id> with
+	sa --.
+*/
+static int writeSummary(uint32_t n, double seconds)
+{
+	static struct { uint32_t frames, bytes, pgns; } sources[PGNSTAT_CHANNELS][256];
+	char tmp[PGNSTAT_PATH_MAX + 8];
+	uint64_t frames = 0, bytes = 0;
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", summaryPath);
+	fp = fopen(tmp, "w");
+	if (fp == NULL)
+	{
+		printf("Accounting summary open failed: %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+
+	qsort(rows, n, sizeof(rows[0]), compareFrames);
+	memset(sources, 0, sizeof(sources));
+	for (uint32_t i = 0; i < n; i++)
+	{
+		frames += rows[i].window.frames;
+		bytes += rows[i].window.bytes;
+	}
+	fprintf(fp, "# pgnstat %lld %u %.0f %.0f %u %llu\n", (long long)time(NULL),
+		reportIntervalMs, frames / seconds, bytes / seconds, n,
+		(unsigned long long)__atomic_load_n(&overflow, __ATOMIC_RELAXED));
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		const struct pgnstat_row *r = &rows[i];
+		const struct pgnstat_window *w = &r->window;
+		double avg = w->cycles ? (double)w->sumUs / w->cycles : 0;
+		double var = w->cycles ? (double)w->sumSqUs / w->cycles - avg * avg : 0;
+
+		if (r->standard)
+			fprintf(fp, "%u S%03X -- ", r->channel, r->pgn);
+		else
+		{
+			fprintf(fp, "%u %05X %02X ", r->channel, r->pgn, r->sa);
+			sources[r->channel][r->sa].frames += w->frames;
+			sources[r->channel][r->sa].bytes += w->bytes;
+			sources[r->channel][r->sa].pgns++;
+		}
+		fprintf(fp, "%.0f %.0f %.3f %.3f %.3f %.3f %llu\n", w->frames / seconds,
+			w->bytes / seconds, w->cycles ? w->minUs / 1000.0 : 0, avg / 1000,
+			w->maxUs / 1000.0, var > 0 ? sqrt(var) / 1000 : 0,
+			(unsigned long long)r->totalFrames);
+	}
+
+	fprintf(fp, "# sa\n");
+	for (int ch = 0; ch < PGNSTAT_CHANNELS; ch++)
+	{
+		for (int sa = 0; sa < 256; sa++)
+		{
+			if (sources[ch][sa].pgns > 0)
+				fprintf(fp, "%d %02X %.0f %.0f %u\n", ch, sa,
+					sources[ch][sa].frames / seconds, sources[ch][sa].bytes / seconds,
+					sources[ch][sa].pgns);
+		}
+	}
+
+	if (fclose(fp) != 0 || rename(tmp, summaryPath) != 0)
+	{
+		printf("Accounting summary write failed: %s: %s\n", summaryPath, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void report(double seconds, void *arg)
+{
+	uint32_t n = pgnStatSnapshot(rows, PGNSTAT_MAX_KEYS);
+	writeSummary(n, seconds);
+}
+
+int pgnStatStart(const char *path, uint32_t intervalMs)
+{
+	snprintf(summaryPath, sizeof(summaryPath), "%s", path);
+	reportIntervalMs = intervalMs ? intervalMs : PGNSTAT_INTERVAL_MS;
+	return reporterStart(&reporter, "Accounting", reportIntervalMs, report, NULL);
+}
+
+void pgnStatStop(void)
+{
+	reporterStop(&reporter);
+}
+
+void pgnStatPrintStats(void)
+{
+	printf("Accounting summary: keys=%u overflow=%llu snapshots=%u file=%s\n", keyCount,
+		(unsigned long long)overflow, snapshots, summaryPath);
+}
@@ -0,0 +1,145 @@
+/*
+	Flight recorder.
+	A fixed-size circular file of frame records, memory mapped shared so
+	the last minutes of traffic survive a crash of the process. A file
+	left over from an earlier run is moved aside to <path>.prev first,
+	so a restart after a crash does not overwrite the evidence.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "include/cyber-recorder.h"
+
+static int mapFile(struct recorder *rec, int prot)
+{
+	rec->header = mmap(NULL, rec->mapLen, prot, MAP_SHARED | MAP_POPULATE, rec->fd, 0);
+	if (rec->header == MAP_FAILED)
+	{
+		printf("Recorder mmap failed: %s\n", strerror(errno));
+		rec->header = NULL;
+		return -1;
+	}
+	rec->records = (struct recorder_record *)((uint8_t *)rec->header + RECORDER_HEADER_SIZE);
+	return 0;
+}
+
+static int validHeader(const struct recorder_header *h, size_t fileSize)
+{
+	return memcmp(h->magic, RECORDER_MAGIC, sizeof(h->magic)) == 0 &&
+		h->version == RECORDER_VERSION &&
+		h->recordSize == sizeof(struct recorder_record) &&
+		h->capacity > 0 &&
+		RECORDER_HEADER_SIZE + h->capacity * sizeof(struct recorder_record) <= fileSize;
+}
+
+static void keepPrevious(const char *path)
+{
+	struct recorder_header h;
+	char prev[256];
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return;
+	ssize_t n = read(fd, &h, sizeof(h));
+	close(fd);
+	if (n != sizeof(h) || memcmp(h.magic, RECORDER_MAGIC, sizeof(h.magic)) != 0 || h.head == 0)
+		return;
+
+	snprintf(prev, sizeof(prev), "%s%s", path, RECORDER_PREV_SUFFIX);
+	if (rename(path, prev) == 0)
+		printf("Recorder: previous recording kept as %s\n", prev);
+}
+
+int recorderOpen(struct recorder *rec, const char *path, uint64_t capacity)
+{
+	struct timespec now;
+
+	memset(rec, 0, sizeof(*rec));
+	keepPrevious(path);
+
+	rec->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (rec->fd < 0)
+	{
+		printf("Recorder open failed: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	// allocate every block now, a full disk must not fault the capture thread
+	rec->capacity = capacity;
+	rec->mapLen = RECORDER_HEADER_SIZE + capacity * sizeof(struct recorder_record);
+	if (posix_fallocate(rec->fd, 0, rec->mapLen) != 0 ||
+		mapFile(rec, PROT_READ | PROT_WRITE) != 0)
+	{
+		printf("Recorder allocation failed: %s\n", path);
+		recorderClose(rec);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	memcpy(rec->header->magic, RECORDER_MAGIC, sizeof(rec->header->magic));
+	rec->header->version = RECORDER_VERSION;
+	rec->header->recordSize = sizeof(struct recorder_record);
+	rec->header->capacity = capacity;
+	rec->header->created = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	rec->header->head = 0;
+	recorderSync(rec, 1);
+	return 0;
+}
+
+/*
+	Read-only mapping of an existing recording, for the dump tool.
+*/
+int recorderMap(struct recorder *rec, const char *path)
+{
+	struct stat st;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (rec->fd < 0 || fstat(rec->fd, &st) != 0 || st.st_size < RECORDER_HEADER_SIZE)
+	{
+		printf("Recorder open failed: %s\n", path);
+		recorderClose(rec);
+		return -1;
+	}
+
+	rec->mapLen = st.st_size;
+	if (mapFile(rec, PROT_READ) != 0)
+	{
+		recorderClose(rec);
+		return -1;
+	}
+	if (!validHeader(rec->header, st.st_size))
+	{
+		printf("Not a flight recorder file: %s\n", path);
+		recorderClose(rec);
+		return -1;
+	}
+
+	rec->capacity = rec->header->capacity;
+	rec->head = __atomic_load_n(&rec->header->head, __ATOMIC_ACQUIRE);
+	return 0;
+}
+
+/*
+	Called from the log writer, never from the capture thread.
+*/
+void recorderSync(struct recorder *rec, int wait)
+{
+	if (rec->header != NULL)
+		msync(rec->header, rec->mapLen, wait ? MS_SYNC : MS_ASYNC);
+}
+
+void recorderClose(struct recorder *rec)
+{
+	if (rec->header != NULL)
+		munmap(rec->header, rec->mapLen);
+	if (rec->fd >= 0)
+		close(rec->fd);
+	memset(rec, 0, sizeof(*rec));
+	rec->fd = -1;
+}
@@ -0,0 +1,89 @@
+/*
+	Periodic reporter thread: calls back every interval on a monotonic
+	schedule and once more when stopped, so a stop never waits out the
+	interval.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include "include/cyber-reporter.h"
+
+static void *reporterThread(void *arg)
+{
+	struct reporter *r = arg;
+	struct timespec last;
+	struct timespec wake;
+	int stop = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	wake = last;
+	while (!stop)
+	{
+		wake.tv_nsec += (long)(r->intervalMs % 1000) * 1000000;
+		wake.tv_sec += r->intervalMs / 1000 + wake.tv_nsec / 1000000000;
+		wake.tv_nsec %= 1000000000;
+
+		pthread_mutex_lock(&r->lock);
+		while (!r->stopping &&
+			pthread_cond_timedwait(&r->cond, &r->lock, &wake) != ETIMEDOUT)
+			;
+		stop = r->stopping;
+		pthread_mutex_unlock(&r->lock);
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		double seconds = (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+		last = now;
+		r->cb(seconds > 0 ? seconds : 1, r->arg);
+	}
+	return NULL;
+}
+
+/*
+	name only goes into the error message.
+*/
+int reporterStart(struct reporter *r, const char *name, uint32_t intervalMs,
+	reporterCallback cb, void *arg)
+{
+	pthread_condattr_t attr;
+
+	r->running = 0;
+	r->stopping = 0;
+	r->intervalMs = intervalMs;
+	r->cb = cb;
+	r->arg = arg;
+
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&r->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	int ret = pthread_create(&r->thread, NULL, reporterThread, r);
+	if (ret != 0)
+	{
+		printf("%s reporter thread create failed, ret=%d\n", name, ret);
+		pthread_cond_destroy(&r->cond);
+		pthread_mutex_destroy(&r->lock);
+		return -1;
+	}
+	r->running = 1;
+	return 0;
+}
+
+void reporterStop(struct reporter *r)
+{
+	if (!r->running)
+		return;
+
+	pthread_mutex_lock(&r->lock);
+	r->stopping = 1;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+
+	pthread_join(r->thread, NULL);
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	r->running = 0;
+}
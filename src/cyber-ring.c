@@ -0,0 +1,50 @@
+/*
+	Preallocated SPSC ring between the capture and the log writer thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/cyber-ring.h"
+
+int ringInit(struct can_ring *ring, uint32_t slots)
+{
+	uint32_t size = 1;
+
+	if (slots == 0 || slots > (1u << 30))
+	{
+		printf("Invalid ring size: %u\n", slots);
+		return -1;
+	}
+
+	while (size < slots)
+		size <<= 1;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->slots = calloc(size, sizeof(struct can_record));
+	if (ring->slots == NULL)
+	{
+		printf("Ring allocation failed: %u slots\n", size);
+		return -1;
+	}
+	ring->mask = size - 1;
+
+	return 0;
+}
+
+void ringFree(struct can_ring *ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+void ringGetStats(struct can_ring *ring, struct ring_stats *stats)
+{
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	stats->size = ring->mask + 1;
+	stats->occupancy = (uint32_t)(head - tail);
+	stats->highWater = (uint32_t)__atomic_load_n(&ring->highWater, __ATOMIC_RELAXED);
+	stats->drops = __atomic_load_n(&ring->drops, __ATOMIC_RELAXED);
+}
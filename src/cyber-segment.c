@@ -0,0 +1,339 @@
+/*
+	Background segment worker.
+	The log writer only closes a full segment, opens the next one and
+	queues the closed file name here; compression, fsync and the move
+	into the upload directory happen on this thread.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+#include "include/cyber-segment.h"
+
+struct segment_job {
+	char path[SEGMENT_PATH_MAX];
+	uint64_t rotateUs;
+};
+
+static struct segment_job queue[SEGMENT_QUEUE_LEN];
+static uint32_t queueHead = 0;
+static uint32_t queueTail = 0;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t worker;
+static int workerRunning = 0;
+static int stopping = 0;
+static char uploadDir[SEGMENT_PATH_MAX];
+static int gzipLevel = SEGMENT_GZIP_LEVEL;
+static struct segment_stats stats;
+
+static uint64_t msSince(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+		(now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int writeAll(int fd, const uint8_t *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, data, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+	Streams src through deflate with a gzip wrapper into dst, returns
+	the compressed size or -1.
+*/
+static int64_t gzipFile(int src, int dst)
+{
+	static uint8_t in[SEGMENT_CHUNK_SIZE];
+	static uint8_t out[SEGMENT_CHUNK_SIZE];
+	z_stream zs;
+	int64_t total = 0;
+	int flush = Z_NO_FLUSH;
+	int ret = 0;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, gzipLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+
+	while (flush != Z_FINISH)
+	{
+		ssize_t n = read(src, in, sizeof(in));
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		flush = n == 0 ? Z_FINISH : Z_NO_FLUSH;
+		zs.next_in = in;
+		zs.avail_in = n;
+
+		do
+		{
+			zs.next_out = out;
+			zs.avail_out = sizeof(out);
+			ret = deflate(&zs, flush);
+			size_t have = sizeof(out) - zs.avail_out;
+			if (writeAll(dst, out, have) != 0)
+				goto fail;
+			total += have;
+		} while (zs.avail_out == 0);
+	}
+
+	deflateEnd(&zs);
+	return ret == Z_STREAM_END ? total : -1;
+
+fail:
+	deflateEnd(&zs);
+	return -1;
+}
+
+static void processSegment(const struct segment_job *job)
+{
+	char target[PATH_MAX];
+	char temp[PATH_MAX];
+	struct timespec t0;
+	struct stat st;
+	const char *name = strrchr(job->path, '/');
+	int64_t outSize;
+	int src = -1, dst = -1;
+
+	name = name ? name + 1 : job->path;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	if (stat(job->path, &st) != 0)
+	{
+		printf("Segment %s: stat failed: %s\n", job->path, strerror(errno));
+		goto fail;
+	}
+
+	if (gzipLevel == 0)
+	{
+		// rotation does not sync, make the data durable before the move
+		snprintf(target, sizeof(target), "%s/%s", uploadDir, name);
+		src = open(job->path, O_RDONLY | O_CLOEXEC);
+		if (src >= 0)
+		{
+			fsync(src);
+			close(src);
+			src = -1;
+		}
+		if (rename(job->path, target) != 0)
+		{
+			printf("Segment %s: move failed: %s\n", job->path, strerror(errno));
+			goto fail;
+		}
+		outSize = st.st_size;
+	}
+	else
+	{
+		// the dot file is ignored by the uploader until the rename
+		snprintf(target, sizeof(target), "%s/%s.gz", uploadDir, name);
+		snprintf(temp, sizeof(temp), "%s/.%s.gz.tmp", uploadDir, name);
+
+		src = open(job->path, O_RDONLY | O_CLOEXEC);
+		dst = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (src < 0 || dst < 0)
+		{
+			printf("Segment %s: open failed: %s\n", job->path, strerror(errno));
+			goto fail;
+		}
+		posix_fadvise(src, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+		outSize = gzipFile(src, dst);
+		if (outSize < 0 || fsync(dst) != 0 || rename(temp, target) != 0)
+		{
+			printf("Segment %s: compression failed: %s\n", job->path, strerror(errno));
+			unlink(temp);
+			goto fail;
+		}
+		close(src);
+		close(dst);
+		unlink(job->path);
+	}
+
+	pthread_mutex_lock(&queueLock);
+	stats.segments++;
+	stats.inBytes += st.st_size;
+	stats.outBytes += outSize;
+	pthread_mutex_unlock(&queueLock);
+
+	printf("Segment %s: rotation %llu us, %lld -> %lld bytes (ratio %.2f), %llu ms -> %s\n",
+		name, (unsigned long long)job->rotateUs, (long long)st.st_size, (long long)outSize,
+		outSize > 0 ? (double)st.st_size / outSize : 0.0,
+		(unsigned long long)msSince(&t0), target);
+	return;
+
+fail:
+	if (src >= 0)
+		close(src);
+	if (dst >= 0)
+		close(dst);
+	pthread_mutex_lock(&queueLock);
+	stats.failed++;
+	pthread_mutex_unlock(&queueLock);
+}
+
+static void *segmentWorker(void *arg)
+{
+	(void)arg;
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), SEGMENT_WORKER_NICE);
+
+	pthread_mutex_lock(&queueLock);
+	while (1)
+	{
+		while (queueHead == queueTail && !stopping)
+			pthread_cond_wait(&queueCond, &queueLock);
+		if (queueHead == queueTail)
+			break;
+
+		struct segment_job job = queue[queueTail % SEGMENT_QUEUE_LEN];
+		queueTail++;
+		pthread_mutex_unlock(&queueLock);
+
+		processSegment(&job);
+
+		pthread_mutex_lock(&queueLock);
+	}
+	pthread_mutex_unlock(&queueLock);
+	return NULL;
+}
+
+int segmentWorkerStart(const char *dir, int level)
+{
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+	{
+		printf("Upload directory create failed: %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	snprintf(uploadDir, sizeof(uploadDir), "%s", dir);
+	gzipLevel = level < 0 || level > 9 ? SEGMENT_GZIP_LEVEL : level;
+	memset(&stats, 0, sizeof(stats));
+	stopping = 0;
+
+	int ret = pthread_create(&worker, NULL, segmentWorker, NULL);
+	if (ret != 0)
+	{
+		printf("Segment worker thread create failed, ret=%d\n", ret);
+		return -1;
+	}
+	workerRunning = 1;
+	return 0;
+}
+
+/*
+	Called by the log writer right after rotation. Never blocks: when
+	the worker is that far behind the segment simply stays in place.
+*/
+int segmentSubmit(const char *path, uint64_t rotateUs)
+{
+	int ret = 0;
+
+	if (!workerRunning)
+		return 0;
+
+	pthread_mutex_lock(&queueLock);
+	if (rotateUs > stats.maxRotateUs)
+		stats.maxRotateUs = rotateUs;
+	if (queueHead - queueTail >= SEGMENT_QUEUE_LEN)
+	{
+		stats.failed++;
+		ret = -1;
+	}
+	else
+	{
+		struct segment_job *job = &queue[queueHead % SEGMENT_QUEUE_LEN];
+		snprintf(job->path, sizeof(job->path), "%s", path);
+		job->rotateUs = rotateUs;
+		queueHead++;
+		pthread_cond_signal(&queueCond);
+	}
+	pthread_mutex_unlock(&queueLock);
+
+	if (ret != 0)
+		printf("Segment queue full, %s left in place\n", path);
+	return ret;
+}
+
+/*
+	Event segments (cyber-trigger.c) go to the front of the queue, the
+	worker takes them before the log segments already waiting.
+*/
+int segmentSubmitEvent(const char *path)
+{
+	int ret = 0;
+
+	if (!workerRunning)
+		return 0;
+
+	pthread_mutex_lock(&queueLock);
+	if (queueHead - queueTail >= SEGMENT_QUEUE_LEN)
+	{
+		stats.failed++;
+		ret = -1;
+	}
+	else
+	{
+		queueTail--;
+		struct segment_job *job = &queue[queueTail % SEGMENT_QUEUE_LEN];
+		snprintf(job->path, sizeof(job->path), "%s", path);
+		job->rotateUs = 0;
+		pthread_cond_signal(&queueCond);
+	}
+	pthread_mutex_unlock(&queueLock);
+
+	if (ret != 0)
+		printf("Segment queue full, event %s left in place\n", path);
+	return ret;
+}
+
+/*
+	Drains the queue, so the last segment handed over by logFileDeinit()
+	is in the upload directory before the process exits.
+*/
+void segmentWorkerStop(void)
+{
+	if (!workerRunning)
+		return;
+
+	pthread_mutex_lock(&queueLock);
+	stopping = 1;
+	pthread_cond_signal(&queueCond);
+	pthread_mutex_unlock(&queueLock);
+
+	pthread_join(worker, NULL);
+	workerRunning = 0;
+}
+
+void segmentGetStats(struct segment_stats *out)
+{
+	pthread_mutex_lock(&queueLock);
+	*out = stats;
+	pthread_mutex_unlock(&queueLock);
+}
@@ -0,0 +1,459 @@
+/*
+	Signal time series writer and decoder, see cyber-sts.h for the
+	format. The writer runs on the log writer thread of canbus-app next
+	to the DBC decoder; its state is one fixed size series per signal
+	and one block, all allocated in stsWriterInit(). The decoder works
+	on a complete file in memory, sts-convert mmaps it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "include/cyber-sts.h"
+
+#define NO_WINDOW			0xFF
+
+struct bit_reader {
+	const uint8_t *p;
+	uint32_t pos;
+	uint32_t limit;
+};
+
+static void putLe32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t getLe32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint8_t *putVarint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static int getVarint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	const uint8_t *q = *p;
+	uint64_t value = 0;
+
+	for (int shift = 0; shift < 64 && q < end; shift += 7)
+	{
+		uint8_t b = *q++;
+		value |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+		{
+			*p = q;
+			*v = value;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// the low n bits of v, most significant first; bits past buf[bits / 8] are zero
+static void putBits(struct sts_series *s, uint64_t v, int n)
+{
+	while (n > 0)
+	{
+		int space = 8 - (s->bits & 7);
+		int take = n < space ? n : space;
+		uint8_t part = (v >> (n - take)) & ((1u << take) - 1);
+
+		if (space == 8)
+			s->buf[s->bits >> 3] = 0;
+		s->buf[s->bits >> 3] |= part << (space - take);
+		s->bits += take;
+		n -= take;
+	}
+}
+
+static int getBits(struct bit_reader *r, int n, uint64_t *v)
+{
+	uint64_t value = 0;
+
+	if (r->pos + n > r->limit)
+		return -1;
+	while (n > 0)
+	{
+		int avail = 8 - (r->pos & 7);
+		int take = n < avail ? n : avail;
+		uint8_t b = r->p[r->pos >> 3] >> (avail - take);
+
+		value = value << take | (b & ((1u << take) - 1));
+		r->pos += take;
+		n -= take;
+	}
+	*v = value;
+	return 0;
+}
+
+static int64_t signExtend(uint64_t v, int n)
+{
+	return (int64_t)(v << (64 - n)) >> (64 - n);
+}
+
+static int writeBlock(struct sts_writer *w)
+{
+	int ret;
+
+	if (w->used == 0)
+		return 0;
+
+	memcpy(w->block, STS_BLOCK_SIGNATURE, 4);
+	putLe32(w->block + 4, w->used);
+	putLe32(w->block + 8, w->chunks);
+	putLe32(w->block + 12, crc32(0, w->block + STS_BLOCK_HEADER_SIZE, w->used));
+	memset(w->block + STS_BLOCK_HEADER_SIZE + w->used, 0,
+		STS_BLOCK_SIZE - STS_BLOCK_HEADER_SIZE - w->used);
+	ret = w->out(w->block, STS_BLOCK_SIZE);
+
+	w->stats.blocks++;
+	w->stats.bytes += STS_BLOCK_SIZE;
+	w->stats.payload += w->used;
+	w->used = 0;
+	w->chunks = 0;
+	return ret;
+}
+
+static int closeChunk(struct sts_writer *w, uint32_t signal)
+{
+	struct sts_series *s = &w->series[signal];
+	uint8_t header[STS_CHUNK_HEADER_MAX];
+	size_t headerLen, bytes = (s->bits + 7) / 8;
+	int ret = 0;
+
+	if (s->count == 0)
+		return 0;
+
+	headerLen = putVarint(putVarint(putVarint(header, signal), s->count), s->bits) - header;
+	if (w->used + headerLen + bytes > STS_BLOCK_SIZE - STS_BLOCK_HEADER_SIZE)
+		ret = writeBlock(w);
+
+	uint8_t *p = w->block + STS_BLOCK_HEADER_SIZE + w->used;
+	memcpy(p, header, headerLen);
+	memcpy(p + headerLen, s->buf, bytes);
+	w->used += headerLen + bytes;
+	w->chunks++;
+	w->stats.chunks++;
+	s->count = 0;
+	return ret;
+}
+
+static int addSample(struct sts_writer *w, uint32_t signal, int64_t tick, uint64_t bits)
+{
+	struct sts_series *s = &w->series[signal];
+	int64_t dod = tick - s->lastTick - s->lastDelta;
+	int ret = 0;
+
+	if (s->count > 0 && (dod < INT32_MIN || dod > INT32_MAX || s->count == UINT16_MAX ||
+		s->bits + STS_SAMPLE_BITS_MAX > STS_CHUNK_BYTES * 8))
+		ret = closeChunk(w, signal);
+
+	if (s->count == 0)
+	{
+		s->bits = 0;
+		putBits(s, tick, 64);
+		putBits(s, bits, 64);
+		s->lastDelta = 0;
+		s->leading = NO_WINDOW;
+	}
+	else
+	{
+		if (dod == 0)
+			putBits(s, 0, 1);
+		else if (dod >= -64 && dod <= 63)
+			putBits(s, 0x2 << 7 | (dod & 0x7F), 9);
+		else if (dod >= -256 && dod <= 255)
+			putBits(s, 0x6 << 9 | (dod & 0x1FF), 12);
+		else if (dod >= -2048 && dod <= 2047)
+			putBits(s, 0xE << 12 | (dod & 0xFFF), 16);
+		else
+		{
+			putBits(s, 0xF, 4);
+			putBits(s, (uint32_t)dod, 32);
+		}
+		s->lastDelta = tick - s->lastTick;
+
+		uint64_t x = bits ^ s->lastBits;
+		if (x == 0)
+			putBits(s, 0, 1);
+		else
+		{
+			int leading = __builtin_clzll(x);
+			int trailing = __builtin_ctzll(x);
+			if (leading > 31)
+				leading = 31;
+
+			if (s->leading != NO_WINDOW && leading >= s->leading && trailing >= s->trailing)
+			{
+				putBits(s, 0x2, 2);
+				putBits(s, x >> s->trailing, 64 - s->leading - s->trailing);
+			}
+			else
+			{
+				int length = 64 - leading - trailing;
+				putBits(s, 0x3 << 11 | leading << 6 | (length & 0x3F), 13);
+				putBits(s, x >> trailing, length);
+				s->leading = leading;
+				s->trailing = trailing;
+			}
+		}
+	}
+
+	s->lastTick = tick;
+	s->lastBits = bits;
+	s->count++;
+	return ret;
+}
+
+int stsWriterInit(struct sts_writer *w, uint32_t signals, stsOutput out)
+{
+	memset(w, 0, sizeof(*w));
+	w->out = out;
+	w->signalCount = signals;
+	w->series = calloc(signals, sizeof(struct sts_series));
+	w->block = malloc(STS_BLOCK_SIZE);
+	if (w->series == NULL || w->block == NULL || signals == 0)
+	{
+		printf("Signal series allocation failed: %u signals\n", signals);
+		stsWriterFree(w);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+	values as dbcDecode() leaves them. Returns -1 when a block could not
+	be written; the samples are kept either way.
+*/
+int stsAdd(struct sts_writer *w, const struct timespec *ts, const struct dbc_value *values,
+	int count)
+{
+	int64_t tick = (int64_t)ts->tv_sec * (1000000000 / STS_TICK_NS) + ts->tv_nsec / STS_TICK_NS;
+	int ret = 0;
+
+	for (int k = 0; k < count; k++)
+	{
+		uint64_t bits;
+
+		if (values[k].signal >= w->signalCount)
+			continue;
+		memcpy(&bits, &values[k].value, sizeof(bits));
+		if (addSample(w, values[k].signal, tick, bits) != 0)
+			ret = -1;
+		w->stats.samples++;
+	}
+	return ret;
+}
+
+/*
+	Closes every chunk once per STS_FLUSH_INTERVAL_SEC, so slow signals
+	do not sit in memory for hours. now has to be on the frame clock.
+*/
+int stsTick(struct sts_writer *w, const struct timespec *now)
+{
+	int ret = 0;
+
+	if (now->tv_sec < w->flushAt)
+		return 0;
+	if (w->flushAt != 0)
+		ret = stsFlush(w);
+	w->flushAt = now->tv_sec + STS_FLUSH_INTERVAL_SEC;
+	return ret;
+}
+
+int stsFlush(struct sts_writer *w)
+{
+	int ret = 0;
+
+	for (uint32_t i = 0; i < w->signalCount; i++)
+	{
+		if (closeChunk(w, i) != 0)
+			ret = -1;
+	}
+	if (writeBlock(w) != 0)
+		ret = -1;
+	return ret;
+}
+
+void stsPrintStats(const struct sts_writer *w)
+{
+	const struct sts_stats *st = &w->stats;
+
+	printf("Signal series summary: samples=%llu chunks=%llu blocks=%llu bytes=%llu "
+		"(%.2f bytes/sample, %.0f%% of the blocks used)\n", (unsigned long long)st->samples,
+		(unsigned long long)st->chunks, (unsigned long long)st->blocks,
+		(unsigned long long)st->bytes, st->samples ? (double)st->bytes / st->samples : 0.0,
+		st->bytes ? 100.0 * st->payload / st->bytes : 0.0);
+}
+
+void stsWriterFree(struct sts_writer *w)
+{
+	free(w->series);
+	free(w->block);
+	w->series = NULL;
+	w->block = NULL;
+}
+
+static int decodeChunk(struct bit_reader *r, uint32_t signal, uint32_t count,
+	stsSampleCallback cb, void *arg, struct sts_decode_info *info)
+{
+	struct sts_sample sample = { .signal = signal };
+	uint64_t tick, bits, v;
+	int64_t delta = 0;
+	int leading = 0, trailing = 0;
+	int window = 0;
+
+	if (getBits(r, 64, &tick) != 0 || getBits(r, 64, &bits) != 0)
+		return STS_ERROR_CHUNK;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (i > 0)
+		{
+			int ones = 0;
+			int64_t dod = 0;
+
+			// 0, 10, 110, 1110 or 1111
+			while (ones < 4)
+			{
+				if (getBits(r, 1, &v) != 0)
+					return STS_ERROR_CHUNK;
+				if (v == 0)
+					break;
+				ones++;
+			}
+			if (ones > 0)
+			{
+				static const int widths[5] = { 0, 7, 9, 12, 32 };
+				if (getBits(r, widths[ones], &v) != 0)
+					return STS_ERROR_CHUNK;
+				dod = signExtend(v, widths[ones]);
+			}
+			delta += dod;
+			tick += delta;
+
+			if (getBits(r, 1, &v) != 0)
+				return STS_ERROR_CHUNK;
+			if (v != 0)
+			{
+				if (getBits(r, 1, &v) != 0)
+					return STS_ERROR_CHUNK;
+				if (v != 0)
+				{
+					if (getBits(r, 11, &v) != 0)
+						return STS_ERROR_CHUNK;
+					int length = v & 0x3F ? v & 0x3F : 64;
+					leading = v >> 6;
+					trailing = 64 - leading - length;
+					if (trailing < 0)
+						return STS_ERROR_CHUNK;
+					window = 1;
+				}
+				else if (!window)
+					return STS_ERROR_CHUNK;	// no window to reuse yet
+				if (getBits(r, 64 - leading - trailing, &v) != 0)
+					return STS_ERROR_CHUNK;
+				bits ^= v << trailing;
+			}
+		}
+
+		sample.tick = tick;
+		memcpy(&sample.value, &bits, sizeof(bits));
+		if (cb(&sample, arg) != 0)
+			return STS_ERROR_CALLBACK;
+		info->samples++;
+	}
+	return 0;
+}
+
+/*
+	Blocks with a bad header or checksum are counted in info->damaged and
+	skipped; the chunks of the others still decode.
+*/
+int stsDecode(const uint8_t *buf, size_t len, stsSampleCallback cb, void *arg,
+	struct sts_decode_info *info)
+{
+	size_t off;
+
+	memset(info, 0, sizeof(*info));
+	for (off = 0; off < len && info->error == 0; off += STS_BLOCK_SIZE)
+	{
+		if (len - off < STS_BLOCK_SIZE)
+		{
+			info->error = STS_ERROR_TRUNCATED;
+			break;
+		}
+
+		const uint8_t *h = buf + off;
+		uint32_t payloadLen = getLe32(h + 4);
+		uint32_t chunks = getLe32(h + 8);
+		if (memcmp(h, STS_BLOCK_SIGNATURE, 4) != 0 ||
+			payloadLen > STS_BLOCK_SIZE - STS_BLOCK_HEADER_SIZE ||
+			crc32(0, h + STS_BLOCK_HEADER_SIZE, payloadLen) != getLe32(h + 12))
+		{
+			info->damaged++;
+			continue;
+		}
+
+		const uint8_t *p = h + STS_BLOCK_HEADER_SIZE;
+		const uint8_t *end = p + payloadLen;
+		for (uint32_t c = 0; c < chunks && info->error == 0; c++)
+		{
+			uint64_t signal, count, bits;
+			if (getVarint(&p, end, &signal) != 0 || getVarint(&p, end, &count) != 0 ||
+				getVarint(&p, end, &bits) != 0 || count == 0 ||
+				bits > (uint64_t)(end - p) * 8)
+			{
+				info->error = STS_ERROR_CHUNK;
+				break;
+			}
+
+			struct bit_reader r = { p, 0, bits };
+			info->error = decodeChunk(&r, signal, count, cb, arg, info);
+			if (info->error == 0 && r.pos != bits)
+				info->error = STS_ERROR_CHUNK;
+			p += (bits + 7) / 8;
+			info->chunks++;
+		}
+		if (info->error == 0 && p != end)
+			info->error = STS_ERROR_CHUNK;
+		if (info->error != 0)
+			break;
+		info->blocks++;
+	}
+
+	if (info->error != 0)
+		info->errorOffset = off;
+	return info->error != 0 ? -1 : 0;
+}
+
+const char *stsErrorString(int error)
+{
+	switch (error)
+	{
+	case 0:
+		return "ok";
+	case STS_ERROR_TRUNCATED:
+		return "truncated block";
+	case STS_ERROR_CHUNK:
+		return "malformed chunk";
+	case STS_ERROR_CALLBACK:
+		return "stopped by callback";
+	default:
+		return "unknown error";
+	}
+}
@@ -0,0 +1,353 @@
+/*
+	Per-ID inter-arrival histograms and per-channel bus load.
+	The capture thread looks the (channel, id) up in a fixed table and
+	adds the gap since its last frame to a log-linear histogram, and the
+	worst case bus time of the frame, from a table built per channel at
+	start, to the channel. Nothing is allocated and every step is
+	constant time. A reporter thread writes all of it as JSON every
+	interval: histograms are cumulative since start, the bus load is the
+	one of the interval.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/can.h>
+#include "include/cyber-canbus.h"
+#include "include/cyber-timing.h"
+#include "include/cyber-reporter.h"
+
+#if CAN_CHANNEL_MAX >= TIMING_MAX_CHANNELS
+#error "TIMING_MAX_CHANNELS has no row for CAN_CHANNEL_MAX"
+#endif
+
+static struct timing_id ids[TIMING_MAX_IDS];
+static uint16_t slots[TIMING_TABLE_SIZE];	// index into ids + 1, 0 = free
+static uint32_t idCount;
+static uint64_t overflow;
+static struct timing_channel channels[TIMING_MAX_CHANNELS];
+static uint64_t reportedBusyNs[TIMING_MAX_CHANNELS];
+static uint64_t reportedFrames[TIMING_MAX_CHANNELS];
+
+static struct reporter reporter;
+static char snapshotPath[TIMING_PATH_MAX];
+static uint32_t snapshots;
+
+uint32_t timingBucket(uint32_t us)
+{
+	if (us < TIMING_SUB_BUCKETS)
+		return us;
+	if (us >= 1u << (TIMING_MAX_EXPONENT + 1))
+		return TIMING_BUCKETS - 1;
+
+	uint32_t e = 31 - __builtin_clz(us);
+	return (e - TIMING_SUB_BITS + 1) * TIMING_SUB_BUCKETS +
+		((us >> (e - TIMING_SUB_BITS)) & (TIMING_SUB_BUCKETS - 1));
+}
+
+uint32_t timingBucketLow(uint32_t bucket)
+{
+	if (bucket < TIMING_SUB_BUCKETS)
+		return bucket;
+
+	uint32_t e = bucket / TIMING_SUB_BUCKETS + TIMING_SUB_BITS - 1;
+	return (TIMING_SUB_BUCKETS + bucket % TIMING_SUB_BUCKETS) << (e - TIMING_SUB_BITS);
+}
+
+/*
+	Worst case bits: every fourth bit of the stuffed part a stuff bit.
+	Classic CAN stuffs SOF to CRC, 34 (standard) or 54 (extended) bits
+	plus the data, and adds 13 bits of CRC delimiter, ACK, EOF and
+	intermission. CAN FD stuffs up to the data dynamically, the stuff
+	count and CRC with a fixed bit every 4; with BRS everything from ESI
+	to the CRC delimiter runs at the data bitrate.
+*/
+static void buildFrameTimes(struct timing_channel *ch)
+{
+	double nominal = 1e9 / ch->bitrate;
+	double data = 1e9 / (ch->dbitrate ? ch->dbitrate : ch->bitrate);
+
+	for (int ext = 0; ext < 2; ext++)
+	{
+		for (int len = 0; len <= 64; len++)
+		{
+			int n = len > 8 ? 8 : len;
+			int stuffed = (ext ? 54 : 34) + 8 * n;
+			int bits = stuffed + 13 + (stuffed - 1) / 4;
+			ch->frameNs[TIMING_KIND_STANDARD + ext][len] = bits * nominal + 0.5;
+
+			int arbitration = ext ? 36 : 17;	// SOF to BRS
+			int payload = 5 + 8 * len;		// ESI, DLC, data
+			int stuff = (arbitration + payload - 1) / 4;
+			int arbStuff = (arbitration - 1) / 4;
+			int crc = len > 16 ? 21 : 17;
+			int tail = 4 + crc + (4 + crc + 3) / 4 + 1;	// stuff count, CRC, fixed stuff, delimiter
+			int nominalBits = arbitration + arbStuff + 12;	// + ACK, EOF, intermission
+			int dataBits = payload + stuff - arbStuff + tail;
+
+			ch->frameNs[TIMING_KIND_FD + ext][len] = (nominalBits + dataBits) * nominal + 0.5;
+			ch->frameNs[TIMING_KIND_FD_BRS + ext][len] = nominalBits * nominal +
+				dataBits * data + 0.5;
+		}
+	}
+}
+
+int timingInit(void)
+{
+	memset(ids, 0, sizeof(ids));
+	memset(slots, 0, sizeof(slots));
+	memset(channels, 0, sizeof(channels));
+	memset(reportedBusyNs, 0, sizeof(reportedBusyNs));
+	memset(reportedFrames, 0, sizeof(reportedFrames));
+	idCount = 0;
+	overflow = 0;
+	snapshots = 0;
+	return 0;
+}
+
+/*
+	Before the capture starts; channels without a bitrate get no load.
+*/
+void timingSetChannel(int channel, uint32_t bitrate, uint32_t dbitrate)
+{
+	struct timing_channel *ch = &channels[channel];
+
+	ch->bitrate = bitrate;
+	ch->dbitrate = dbitrate;
+	if (bitrate > 0)
+		buildFrameTimes(ch);
+}
+
+static int frameKind(uint32_t canId, uint8_t flags)
+{
+	int kind = canId & CAN_EFF_FLAG ? 1 : 0;
+
+	if (flags & CANFD_FDF)
+		kind += flags & CANFD_BRS ? TIMING_KIND_FD_BRS : TIMING_KIND_FD;
+	return kind;
+}
+
+uint32_t timingFrameNs(int channel, uint32_t canId, uint8_t flags, uint8_t len)
+{
+	const struct timing_channel *ch = &channels[channel];
+
+	// a remote frame has a DLC but no data field
+	if (canId & CAN_RTR_FLAG)
+		len = 0;
+	return ch->frameNs[frameKind(canId, flags)][len > 64 ? 64 : len];
+}
+
+static struct timing_id *lookup(int channel, uint32_t canId)
+{
+	uint32_t slot = ((canId ^ (uint32_t)channel << 29) * 0x9E3779B1u) >> (32 - TIMING_TABLE_BITS);
+
+	for (int probe = 0; probe < TIMING_TABLE_SIZE; probe++)
+	{
+		uint16_t *s = &slots[(slot + probe) & (TIMING_TABLE_SIZE - 1)];
+		if (*s == 0)
+		{
+			if (idCount == TIMING_MAX_IDS)
+				return NULL;
+			struct timing_id *e = &ids[idCount];
+			e->canId = canId;
+			e->channel = channel;
+			e->minUs = UINT32_MAX;
+			// the reporter walks ids up to idCount
+			__atomic_store_n(&e->used, 1, __ATOMIC_RELEASE);
+			__atomic_store_n(&idCount, idCount + 1, __ATOMIC_RELEASE);
+			*s = idCount;
+			return e;
+		}
+
+		struct timing_id *e = &ids[*s - 1];
+		if (e->canId == canId && e->channel == channel)
+			return e;
+	}
+	return NULL;
+}
+
+/*
+	Capture thread only, channel is 0..CAN_CHANNEL_MAX.
+*/
+void timingFrame(const struct timespec *ts, int channel, uint32_t canId, uint8_t flags,
+	uint8_t len)
+{
+	struct timing_channel *ch = &channels[channel];
+	uint64_t now = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+
+	ch->frames++;
+	ch->busyNs += timingFrameNs(channel, canId, flags, len);
+
+	struct timing_id *e = lookup(channel, canId & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK));
+	if (e == NULL)
+	{
+		overflow++;
+		return;
+	}
+
+	if (e->lastNs != 0 && now > e->lastNs)
+	{
+		uint64_t us = (now - e->lastNs) / 1000;
+		if (us > UINT32_MAX)
+			us = UINT32_MAX;
+		e->gaps++;
+		e->sumUs += us;
+		e->sumSqUs += us * us;
+		if (us < e->minUs)
+			e->minUs = us;
+		if (us > e->maxUs)
+			e->maxUs = us;
+		e->buckets[timingBucket(us)]++;
+	}
+	e->lastNs = now;
+	e->frames++;
+}
+
+const struct timing_id *timingFind(int channel, uint32_t canId)
+{
+	uint32_t n = __atomic_load_n(&idCount, __ATOMIC_ACQUIRE);
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (ids[i].channel == channel && ids[i].canId == canId)
+			return &ids[i];
+	}
+	return NULL;
+}
+
+uint64_t timingBusyNs(int channel)
+{
+	return channels[channel].busyNs;
+}
+
+// upper edge of the bucket holding the fraction q of the gaps
+static uint32_t percentile(const struct timing_id *e, uint64_t gaps, double q)
+{
+	uint64_t rank = (uint64_t)ceil(q * gaps);
+	uint64_t seen = 0;
+
+	for (uint32_t b = 0; b < TIMING_BUCKETS; b++)
+	{
+		seen += e->buckets[b];
+		if (seen >= rank && seen > 0)
+		{
+			uint32_t upper = b + 1 < TIMING_BUCKETS ? timingBucketLow(b + 1) - 1 : e->maxUs;
+			return upper < e->maxUs ? upper : e->maxUs;
+		}
+	}
+	return e->maxUs;
+}
+
+/*
+	Snapshot as JSON, written to a temporary file and renamed:
+		{"time": unix s, "interval_s", "sub_bits", "ids_dropped_frames",
+		 "channels": [{"channel", "bitrate", "dbitrate", "frames", "load"}],
+		 "ids": [{"channel", "id", "frames", "gaps", "min_us", "mean_us",
+			"max_us", "jitter_us", "p50_us", "p99_us", "p999_us",
+			"buckets": [[low_us, count], ...]}]}
+	load is the worst case bus time of the interval's frames over the
+	interval; buckets lists the non-empty ones, a bucket ends where the
+	next possible one starts (see timingBucketLow()).
+*/
+int timingWriteSnapshot(const char *path, double seconds)
+{
+	char tmp[TIMING_PATH_MAX + 8];
+	uint32_t n = __atomic_load_n(&idCount, __ATOMIC_ACQUIRE);
+	int first = 1;
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (fp == NULL)
+	{
+		printf("Timing snapshot open failed: %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+
+	fprintf(fp, "{\"time\":%lld,\"interval_s\":%.3f,\"sub_bits\":%d,\"ids_dropped_frames\":%llu,"
+		"\"channels\":[", (long long)time(NULL), seconds, TIMING_SUB_BITS,
+		(unsigned long long)overflow);
+	for (int c = 0; c < TIMING_MAX_CHANNELS; c++)
+	{
+		struct timing_channel *ch = &channels[c];
+		uint64_t busy = ch->busyNs;
+		uint64_t frames = ch->frames;
+
+		if (ch->bitrate == 0 && frames == 0)
+			continue;
+		fprintf(fp, "%s{\"channel\":%d,\"bitrate\":%u,\"dbitrate\":%u,\"frames\":%llu,"
+			"\"load\":%.4f}", first ? "" : ",", c, ch->bitrate, ch->dbitrate,
+			(unsigned long long)(frames - reportedFrames[c]),
+			(busy - reportedBusyNs[c]) / (seconds * 1e9));
+		reportedBusyNs[c] = busy;
+		reportedFrames[c] = frames;
+		first = 0;
+	}
+
+	fprintf(fp, "],\n\"ids\":[");
+	for (uint32_t i = 0; i < n; i++)
+	{
+		const struct timing_id *e = &ids[i];
+		uint64_t gaps = e->gaps;
+		double mean = gaps ? (double)e->sumUs / gaps : 0;
+		double var = gaps ? (double)e->sumSqUs / gaps - mean * mean : 0;
+
+		fprintf(fp, "%s\n{\"channel\":%u,\"id\":\"%X%s\",\"frames\":%llu,\"gaps\":%llu,"
+			"\"min_us\":%u,\"mean_us\":%.1f,\"max_us\":%u,\"jitter_us\":%.1f,"
+			"\"p50_us\":%u,\"p99_us\":%u,\"p999_us\":%u,\"buckets\":[", i ? "," : "",
+			e->channel, e->canId & CAN_EFF_MASK, e->canId & CAN_EFF_FLAG ? "x" : "",
+			(unsigned long long)e->frames, (unsigned long long)gaps,
+			gaps ? e->minUs : 0, mean, e->maxUs, var > 0 ? sqrt(var) : 0,
+			percentile(e, gaps, 0.5), percentile(e, gaps, 0.99), percentile(e, gaps, 0.999));
+		first = 1;
+		for (uint32_t b = 0; b < TIMING_BUCKETS; b++)
+		{
+			if (e->buckets[b] == 0)
+				continue;
+			fprintf(fp, "%s[%u,%u]", first ? "" : ",", timingBucketLow(b), e->buckets[b]);
+			first = 0;
+		}
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "]}\n");
+
+	if (fclose(fp) != 0 || rename(tmp, path) != 0)
+	{
+		printf("Timing snapshot write failed: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	snapshots++;
+	return 0;
+}
+
+static void report(double seconds, void *arg)
+{
+	timingWriteSnapshot(snapshotPath, seconds);
+}
+
+int timingStart(const char *path, uint32_t intervalMs)
+{
+	snprintf(snapshotPath, sizeof(snapshotPath), "%s", path);
+	return reporterStart(&reporter, "Timing", intervalMs ? intervalMs : TIMING_INTERVAL_MS,
+		report, NULL);
+}
+
+void timingStop(void)
+{
+	reporterStop(&reporter);
+}
+
+void timingGetStats(struct timing_stats *out)
+{
+	out->ids = idCount;
+	out->overflow = overflow;
+	out->snapshots = snapshots;
+}
+
+void timingPrintStats(void)
+{
+	printf("Timing summary: ids=%u overflow=%llu snapshots=%u file=%s\n", idCount,
+		(unsigned long long)overflow, snapshots, snapshotPath);
+}
@@ -0,0 +1,503 @@
+/*
+	Event-triggered capture windows.
+	Every captured frame goes into a preallocated history ring on the
+	log writer thread. When a rule fires, the pre-window is not copied:
+	an export cursor is set to the first frame of the pre-window and the
+	writer moves it forward a few frames per captured frame, writing
+	them into a CDL event segment until it passes the end of the
+	post-window. A trigger while an event runs only moves that end, and
+	a new event never starts behind the cursor, so overlapping windows
+	merge and no frame is written twice. Closed event segments go to the
+	front of the upload queue.
+	The accelerometer is polled on its own thread, which only hands the
+	trigger time to the writer.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "include/cyber-canbus.h"
+#include "include/cyber-trigger.h"
+#include "include/cyber-cdl.h"
+#include "include/cyber-segment.h"
+#include "include/libcommon/accelerometer.h"
+
+static struct trigger_frame *history;
+static uint64_t capacity;
+static uint64_t head;			// frames ever stored
+static uint64_t exportSeq;		// next frame to export, the ones below are done
+static uint64_t preNs;
+static uint64_t postNs;
+static struct trigger_rule rules[TRIGGER_MAX_RULES];
+static int ruleCount;
+static int signalRules;
+static struct trigger_rule *accelRule;
+static struct trigger_stats stats;
+
+// the running event
+static int active;
+static uint64_t endNs;
+static int eventFd = -1;
+static char eventDir[TRIGGER_PATH_MAX];
+static char eventPath[TRIGGER_PATH_MAX + 64];
+static struct cdl_writer cdl;
+
+static pthread_t accelThread;
+static int accelRunning;
+static int stopping;
+static pthread_mutex_t stopLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stopCond;
+static uint64_t accelPending;		// trigger time from the accelerometer thread, 0 = none
+
+static int eventOutput(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len > 0)
+	{
+		ssize_t n = write(eventFd, p, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void closeEvent(void)
+{
+	int ret = cdlFlushBlock(&cdl);
+
+	if (close(eventFd) != 0 || ret != 0)
+	{
+		printf("Event segment write failed: %s\n", eventPath);
+		stats.failed++;
+	}
+	else
+	{
+		stats.events++;
+		segmentSubmitEvent(eventPath);
+	}
+	eventFd = -1;
+	active = 0;
+}
+
+/*
+	Writes up to budget history frames into the event segment and closes
+	it once the cursor is past the post-window.
+*/
+static void exportFrames(uint64_t budget)
+{
+	while (active && budget-- > 0 && exportSeq < head)
+	{
+		if (head - exportSeq > capacity)
+		{
+			stats.lost += head - capacity - exportSeq;
+			exportSeq = head - capacity;
+		}
+
+		const struct trigger_frame *f = &history[exportSeq % capacity];
+		if (f->ns > endNs)
+		{
+			closeEvent();
+			break;
+		}
+
+		struct timespec ts = { f->ns / 1000000000, f->ns % 1000000000 };
+		int flags = 0;
+		if (f->flags & CANFD_FDF)
+			flags = CDL_FRAME_FD | (f->flags & CANFD_BRS ? CDL_FRAME_BRS : 0) |
+				(f->flags & CANFD_ESI ? CDL_FRAME_ESI : 0);
+		cdlAddFrame(&cdl, &ts, f->channel, f->canId, flags, f->len, f->data);
+		exportSeq++;
+		stats.frames++;
+	}
+}
+
+/*
+	First frame at or after ns that is still in the ring and has not
+	been exported. Frames are in capture order, which is time order
+	within a few microseconds across channels.
+*/
+static uint64_t findStart(uint64_t ns)
+{
+	uint64_t lo = head > capacity ? head - capacity : 0;
+	uint64_t hi = head;
+
+	if (lo < exportSeq)
+		lo = exportSeq;
+	while (lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (history[mid % capacity].ns < ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void trgFire(uint64_t ns, const char *reason)
+{
+	uint64_t start = ns > preNs ? ns - preNs : 0;
+
+	stats.triggers++;
+	if (active)
+	{
+		if (ns + postNs > endNs)
+			endNs = ns + postNs;
+		stats.merged++;
+		printf("Event trigger %s: merged into %s\n", reason, eventPath);
+		return;
+	}
+
+	time_t sec = ns / 1000000000;
+	struct tm tm;
+	gmtime_r(&sec, &tm);
+	snprintf(eventPath, sizeof(eventPath), "%s/event-%04d%02d%02d-%02d%02d%02d-%u.cdl",
+		eventDir, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+		tm.tm_sec, stats.events + stats.failed);
+	eventFd = open(eventPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	struct timespec ts = { start / 1000000000, start % 1000000000 };
+	if (eventFd < 0 || cdlWriterStart(&cdl, &ts) != 0)
+	{
+		printf("Event segment open failed: %s: %s\n", eventPath, strerror(errno));
+		if (eventFd >= 0)
+			close(eventFd);
+		eventFd = -1;
+		stats.failed++;
+		return;
+	}
+
+	exportSeq = findStart(start);
+	endNs = ns + postNs;
+	active = 1;
+	printf("Event trigger %s: %s\n", reason, eventPath);
+}
+
+static void checkAccel(void)
+{
+	uint64_t ns = __atomic_exchange_n(&accelPending, 0, __ATOMIC_ACQUIRE);
+
+	if (ns != 0)
+		trgFire(ns, accelRule->name);
+}
+
+/*
+	The dynamic part of the acceleration: the reading minus a gravity
+	vector tracked with a TRIGGER_ACCEL_GRAVITY_MS time constant.
+*/
+static void *accelPoll(void *arg)
+{
+	const double alpha = (double)TRIGGER_ACCEL_POLL_MS / TRIGGER_ACCEL_GRAVITY_MS;
+	double gx = 0, gy = 0, gz = 0;
+	int first = 1;
+	struct timespec wake;
+	int stop = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &wake);
+	while (!stop)
+	{
+		accelerometer_api_priv a;
+
+		if (accelerometer_read(&a) == 0)
+		{
+			if (first)
+			{
+				gx = a.x;
+				gy = a.y;
+				gz = a.z;
+				first = 0;
+			}
+			double dx = a.x - gx, dy = a.y - gy, dz = a.z - gz;
+			double g = sqrt(dx * dx + dy * dy + dz * dz) / TRIGGER_STANDARD_GRAVITY;
+			gx += alpha * dx;
+			gy += alpha * dy;
+			gz += alpha * dz;
+
+			if (g > accelRule->threshold && accelRule->armed)
+			{
+				struct timespec now;
+				clock_gettime(CLOCK_REALTIME, &now);
+				accelRule->armed = 0;
+				__atomic_store_n(&accelPending, (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec,
+					__ATOMIC_RELEASE);
+				printf("Accelerometer trigger: %.2f g\n", g);
+			}
+			else if (g <= accelRule->threshold)
+				accelRule->armed = 1;
+		}
+
+		wake.tv_nsec += TRIGGER_ACCEL_POLL_MS * 1000000;
+		wake.tv_sec += wake.tv_nsec / 1000000000;
+		wake.tv_nsec %= 1000000000;
+		pthread_mutex_lock(&stopLock);
+		while (!stopping && pthread_cond_timedwait(&stopCond, &stopLock, &wake) != ETIMEDOUT)
+			;
+		stop = stopping;
+		pthread_mutex_unlock(&stopLock);
+	}
+	return NULL;
+}
+
+/*
+	The history holds frames, not seconds: on a bus busier than frames
+	over preSec the pre-window is shorter.
+*/
+int trgInit(const char *dir, uint32_t preSec, uint32_t postSec, uint32_t frames)
+{
+	trgFree();
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+	{
+		printf("Event directory create failed: %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	snprintf(eventDir, sizeof(eventDir), "%s", dir);
+	preNs = (uint64_t)preSec * 1000000000;
+	postNs = (uint64_t)postSec * 1000000000;
+	capacity = frames ? frames : TRIGGER_DEFAULT_FRAMES;
+
+	history = malloc(capacity * sizeof(struct trigger_frame));
+	if (history == NULL || cdlWriterInit(&cdl, eventOutput) != 0)
+	{
+		printf("Event history allocation failed: %llu frames\n", (unsigned long long)capacity);
+		trgFree();
+		return -1;
+	}
+	// touch every page now, not on the first lap of the capture
+	memset(history, 0, capacity * sizeof(struct trigger_frame));
+
+	head = 0;
+	exportSeq = 0;
+	active = 0;
+	memset(&stats, 0, sizeof(stats));
+	return 0;
+}
+
+/*
+	"<name>><value>" or "<name><<value>"; name is accel or a signal find
+	resolves, e.g. EBC1.BrakePedalPosition>80.
+*/
+int trgAddRule(const char *text, triggerFindSignal find)
+{
+	const char *op = strpbrk(text, "<>~");
+	struct trigger_rule *r = &rules[ruleCount];
+	char *end;
+
+	if (ruleCount == TRIGGER_MAX_RULES || op == NULL || op == text ||
+		op - text >= TRIGGER_NAME_MAX)
+	{
+		printf("Invalid trigger: %s (at most %d of name>value, name<value or name~)\n", text,
+			TRIGGER_MAX_RULES);
+		return -1;
+	}
+
+	memset(r, 0, sizeof(*r));
+	memcpy(r->name, text, op - text);
+	if (*op == '~')
+	{
+		if (op[1] != '\0' || strcmp(r->name, "accel") == 0)
+		{
+			printf("Invalid trigger: %s (name~ takes no value, not for accel)\n", text);
+			return -1;
+		}
+		r->type = TRIGGER_RULE_CHANGE;
+	}
+	else
+	{
+		r->above = *op == '>';
+		r->armed = 1;
+		r->threshold = strtod(op + 1, &end);
+		if (end == op + 1 || *end != '\0')
+		{
+			printf("Invalid trigger threshold: %s\n", text);
+			return -1;
+		}
+	}
+
+	if (strcmp(r->name, "accel") == 0)
+	{
+		if (accelRule != NULL || !r->above)
+		{
+			printf("Invalid trigger: %s (one accel>g rule)\n", text);
+			return -1;
+		}
+		r->type = TRIGGER_RULE_ACCEL;
+		accelRule = r;
+	}
+	else
+	{
+		if (r->type != TRIGGER_RULE_CHANGE)
+			r->type = TRIGGER_RULE_SIGNAL;
+		r->signal = find != NULL ? find(r->name) : -1;
+		if (r->signal < 0)
+		{
+			printf("Unknown trigger signal: %s\n", r->name);
+			return -1;
+		}
+		signalRules++;
+	}
+	snprintf(r->name + strlen(r->name), TRIGGER_NAME_MAX - strlen(r->name), "%s", op);
+	ruleCount++;
+	return 0;
+}
+
+int trgStart(void)
+{
+	pthread_condattr_t attr;
+
+	if (accelRule == NULL)
+		return 0;
+	if (acc_init() != 0)
+	{
+		printf("Accelerometer init failed, accel trigger disabled\n");
+		return -1;
+	}
+
+	stopping = 0;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&stopCond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	int ret = pthread_create(&accelThread, NULL, accelPoll, NULL);
+	if (ret != 0)
+	{
+		printf("Accelerometer thread create failed, ret=%d\n", ret);
+		acc_deinit();
+		return -1;
+	}
+	accelRunning = 1;
+	return 0;
+}
+
+/*
+	Log writer thread, every frame taken from the capture ring.
+*/
+void trgFrame(const struct timespec *ts, int channel, const struct canfd_frame *frame)
+{
+	struct trigger_frame *f = &history[head % capacity];
+	uint8_t len = frame->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->len;
+
+	if (accelRule != NULL)
+		checkAccel();
+
+	f->ns = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+	f->canId = frame->can_id;
+	f->channel = channel;
+	f->flags = frame->flags;
+	f->len = len;
+	memcpy(f->data, frame->data, len);
+	head++;
+
+	if (active)
+		exportFrames(TRIGGER_DRAIN_BATCH);
+}
+
+/*
+	Decoded values of the frame about to go into the history, so the
+	frame that fires is part of the pre-window.
+*/
+void trgSignals(const struct timespec *ts, const struct dbc_value *values, int count)
+{
+	if (signalRules == 0)
+		return;
+
+	for (int k = 0; k < count; k++)
+	{
+		for (int i = 0; i < ruleCount; i++)
+		{
+			struct trigger_rule *r = &rules[i];
+			if (r->type == TRIGGER_RULE_ACCEL || (uint32_t)r->signal != values[k].signal)
+				continue;
+
+			double v = values[k].value;
+			if (r->type == TRIGGER_RULE_CHANGE)
+			{
+				if (r->armed && v != r->threshold)
+					trgFire((uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec, r->name);
+				r->armed = 1;
+				r->threshold = v;
+				continue;
+			}
+			int over = r->above ? v > r->threshold : v < r->threshold;
+			if (over && r->armed)
+			{
+				r->armed = 0;
+				trgFire((uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec, r->name);
+			}
+			else if (!over)
+				r->armed = 1;
+		}
+	}
+}
+
+/*
+	Idle loop of the log writer: catches up with the export and ends
+	the event when the bus went quiet after the post-window.
+*/
+void trgTick(const struct timespec *now)
+{
+	uint64_t ns = (uint64_t)now->tv_sec * 1000000000 + now->tv_nsec;
+
+	if (accelRule != NULL)
+		checkAccel();
+	exportFrames(capacity);
+	if (active && exportSeq == head && ns > endNs)
+		closeEvent();
+}
+
+/*
+	A running event is written up to the last frame captured.
+*/
+void trgStop(void)
+{
+	if (accelRunning)
+	{
+		pthread_mutex_lock(&stopLock);
+		stopping = 1;
+		pthread_cond_signal(&stopCond);
+		pthread_mutex_unlock(&stopLock);
+		pthread_join(accelThread, NULL);
+		pthread_cond_destroy(&stopCond);
+		acc_deinit();
+		accelRunning = 0;
+	}
+
+	exportFrames(capacity);
+	if (active)
+		closeEvent();
+}
+
+void trgGetStats(struct trigger_stats *out)
+{
+	*out = stats;
+}
+
+void trgPrintStats(void)
+{
+	printf("Event summary: triggers=%llu merged=%llu events=%u failed=%u frames=%llu lost=%llu\n",
+		(unsigned long long)stats.triggers, (unsigned long long)stats.merged, stats.events,
+		stats.failed, (unsigned long long)stats.frames, (unsigned long long)stats.lost);
+}
+
+void trgFree(void)
+{
+	free(history);
+	history = NULL;
+	cdlWriterFree(&cdl);
+	capacity = 0;
+	ruleCount = 0;
+	signalRules = 0;
+	accelRule = NULL;
+}
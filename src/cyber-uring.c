@@ -0,0 +1,172 @@
+/*
+	io_uring helpers for the log writer.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "include/cyber-uring.h"
+
+static int uringSetup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int fd, unsigned submit, unsigned minComplete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, submit, minComplete, flags, NULL, 0);
+}
+
+int uringInit(struct uring *u, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	u->fd = uringSetup(entries, &p);
+	if (u->fd < 0)
+	{
+		printf("io_uring setup failed: %s\n", strerror(errno));
+		return -1;
+	}
+	u->entries = p.sq_entries;
+
+	u->sqMapLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cqMapLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (u->cqMapLen > u->sqMapLen)
+			u->sqMapLen = u->cqMapLen;
+		u->cqMapLen = u->sqMapLen;
+	}
+
+	u->sqMap = mmap(NULL, u->sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		u->fd, IORING_OFF_SQ_RING);
+	if (u->sqMap == MAP_FAILED)
+		goto fail;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		u->cqMap = u->sqMap;
+	}
+	else
+	{
+		u->cqMap = mmap(NULL, u->cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			u->fd, IORING_OFF_CQ_RING);
+		if (u->cqMap == MAP_FAILED)
+			goto fail;
+	}
+
+	u->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto fail;
+
+	uint8_t *sq = u->sqMap;
+	uint8_t *cq = u->cqMap;
+	u->sqHead = (unsigned *)(sq + p.sq_off.head);
+	u->sqTail = (unsigned *)(sq + p.sq_off.tail);
+	u->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sqArray = (unsigned *)(sq + p.sq_off.array);
+	u->cqHead = (unsigned *)(cq + p.cq_off.head);
+	u->cqTail = (unsigned *)(cq + p.cq_off.tail);
+	u->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+
+fail:
+	printf("io_uring mmap failed: %s\n", strerror(errno));
+	if (u->sqMap == MAP_FAILED)
+		u->sqMap = NULL;
+	if (u->cqMap == MAP_FAILED)
+		u->cqMap = NULL;
+	if (u->sqes == MAP_FAILED)
+		u->sqes = NULL;
+	uringFree(u);
+	return -1;
+}
+
+/*
+	Queues one write and submits it right away. The buffer has to stay
+	untouched until its completion is reaped.
+*/
+int uringWrite(struct uring *u, int fd, const void *buf, size_t len, uint64_t offset,
+	int sqeFlags, uint64_t userData)
+{
+	unsigned tail = *u->sqTail;
+
+	if (u->inflight >= u->entries)
+		return -1;
+
+	unsigned index = tail & *u->sqMask;
+	struct io_uring_sqe *sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->flags = sqeFlags;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = userData;
+	u->sqArray[index] = index;
+	__atomic_store_n(u->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+	while (uringEnter(u->fd, 1, 0, 0) < 0)
+	{
+		if (errno != EINTR && errno != EAGAIN)
+		{
+			printf("io_uring submit failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	u->inflight++;
+	return 0;
+}
+
+/*
+	Pops one completion. Returns 1 with userData/res filled in, 0 when
+	nothing is complete (or nothing is in flight) and wait is not set.
+*/
+int uringComplete(struct uring *u, int wait, uint64_t *userData, int *res)
+{
+	while (u->inflight > 0)
+	{
+		unsigned head = *u->cqHead;
+		if (head != __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE))
+		{
+			struct io_uring_cqe *cqe = &u->cqes[head & *u->cqMask];
+			*userData = cqe->user_data;
+			*res = cqe->res;
+			__atomic_store_n(u->cqHead, head + 1, __ATOMIC_RELEASE);
+			u->inflight--;
+			return 1;
+		}
+
+		if (!wait)
+			return 0;
+		if (uringEnter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+		{
+			printf("io_uring wait failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void uringFree(struct uring *u)
+{
+	if (u->sqes != NULL)
+		munmap(u->sqes, u->sqesLen);
+	if (u->cqMap != NULL && u->cqMap != u->sqMap)
+		munmap(u->cqMap, u->cqMapLen);
+	if (u->sqMap != NULL)
+		munmap(u->sqMap, u->sqMapLen);
+	if (u->fd >= 0)
+		close(u->fd);
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+}
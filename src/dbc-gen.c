@@ -0,0 +1,420 @@
+/*
+	dbc-gen: turns a DBC file into C decoders, one function per message
+	with the shifts, masks and scaling of every signal as constants, and
+	a perfect hash from CAN id to decoder. Signal indexes and the order
+	of the values are the ones cyber-dbc.c produces for the same file.
+	usage: dbc-gen file.dbc out.c out.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/can.h>
+#include "include/cyber-dbc.h"
+
+#define GEN_EMPTY_ID			0xFFFFFFFFu	// CAN_ERR_FLAG set, never a message id
+#define GEN_HASH_TRIES			1000000
+
+static const struct dbc *db;
+
+static uint32_t hashSlot(uint32_t id, uint32_t mult, int bits)
+{
+	return (id * mult) >> (32 - bits);
+}
+
+/*
+	Finds a multiplier that maps every message id to its own slot.
+*/
+static int findPerfectHash(uint32_t *mult, int *bits)
+{
+	uint32_t seed = 0x9E3779B9u;
+
+	for (*bits = 1; (1u << *bits) < db->messageCount; (*bits)++)
+		;
+	for (; *bits <= 16; (*bits)++)
+	{
+		uint32_t size = 1u << *bits;
+		uint8_t *used = malloc(size);
+		if (used == NULL)
+			return -1;
+
+		for (int t = 0; t < GEN_HASH_TRIES; t++)
+		{
+			// xorshift candidates, always odd
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			uint32_t m = seed | 1;
+
+			memset(used, 0, size);
+			uint32_t i;
+			for (i = 0; i < db->messageCount; i++)
+			{
+				uint32_t s = hashSlot(db->messages[i].id, m, *bits);
+				if (used[s])
+					break;
+				used[s] = 1;
+			}
+			if (i == db->messageCount)
+			{
+				*mult = m;
+				free(used);
+				return 0;
+			}
+		}
+		free(used);
+	}
+	return -1;
+}
+
+static int isClassic(const struct dbc_message *m)
+{
+	for (uint32_t i = m->first; i < m->first + m->count; i++)
+	{
+		if (db->signals[i].minLen > 8)
+			return 0;
+	}
+	for (uint32_t g = m->firstGroup; g < m->firstGroup + m->groupCount; g++)
+	{
+		for (uint32_t i = db->groups[g].first; i < db->groups[g].first + db->groups[g].count; i++)
+		{
+			if (db->signals[i].minLen > 8)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+	Writes the raw value of signal i as an expression. Classic messages
+	read everything from the one frame word: Intel bit n is bit n of le,
+	Motorola linear bit n (MSB first) is bit 63 - n of be.
+*/
+static void emitRaw(FILE *fp, uint32_t i, int classic, int extend)
+{
+	const struct dbc_signal *s = &db->signals[i];
+	int big = s->flags & DBC_SIGNAL_BIG_ENDIAN;
+	int length = s->length;
+	char word[64];
+	int shift;
+
+	if (classic)
+	{
+		int start = db->info[i].startBit;
+		int pos = big ? (start / 8) * 8 + 7 - start % 8 : start;
+		shift = big ? 64 - pos - length : pos;
+		snprintf(word, sizeof(word), big ? "be" : "le");
+	}
+	else if (s->flags & DBC_SIGNAL_WIDE)
+	{
+		// spans 9 bytes, same as extractRaw() in cyber-dbc.c
+		uint64_t mask = ~0ULL >> (64 - length);
+		if (extend)
+			fprintf(fp, "(int64_t)(");
+		if (big)
+			fprintf(fp, "(((bswap64(loadLe64(buf + %u)) << %u) | (buf[%u] >> %u)) & 0x%llXull)",
+				s->byte, s->shift, s->byte + 8, 8 - s->shift, (unsigned long long)mask);
+		else
+			fprintf(fp, "(((loadLe64(buf + %u) >> %u) | ((uint64_t)buf[%u] << %u)) & 0x%llXull)",
+				s->byte, s->shift, s->byte + 8, 64 - s->shift, (unsigned long long)mask);
+		if (extend)
+			fprintf(fp, " << %d) >> %d", 64 - length, 64 - length);
+		return;
+	}
+	else
+	{
+		shift = s->shift;
+		snprintf(word, sizeof(word), big ? "bswap64(loadLe64(buf + %u))" : "loadLe64(buf + %u)",
+			s->byte);
+	}
+
+	if (extend)
+	{
+		// move the sign bit to bit 63, the arithmetic shift extends it
+		if (shift + length == 64)
+			fprintf(fp, "((int64_t)%s >> %d)", word, 64 - length);
+		else
+			fprintf(fp, "((int64_t)(%s << %d) >> %d)", word, 64 - shift - length, 64 - length);
+	}
+	else if (shift + length == 64)
+		fprintf(fp, "(%s >> %d)", word, shift);
+	else if (shift == 0)
+		fprintf(fp, "(%s & 0x%llXull)", word, (unsigned long long)(~0ULL >> (64 - length)));
+	else
+		fprintf(fp, "((%s >> %d) & 0x%llXull)", word, shift,
+			(unsigned long long)(~0ULL >> (64 - length)));
+}
+
+/*
+	Same arithmetic as physical() in cyber-dbc.c, so results are equal
+	bit for bit; "* 1" and "+ 0" are only left out where that is exact.
+*/
+static void emitSignal(FILE *fp, uint32_t i, int classic, const char *indent, int guarded)
+{
+	const struct dbc_signal *s = &db->signals[i];
+	int isFloat = s->flags & (DBC_SIGNAL_FLOAT | DBC_SIGNAL_DOUBLE);
+
+	if (guarded)
+	{
+		fprintf(fp, "%sif (len >= %u)\n%s{\n", indent, s->minLen, indent);
+		fprintf(fp, "%s\tout[n].signal = %u;\n%s\tout[n].value = ", indent, i, indent);
+	}
+	else
+		fprintf(fp, "%sout[n].signal = %u;\n%sout[n].value = ", indent, i, indent);
+
+	if (s->flags & DBC_SIGNAL_FLOAT)
+	{
+		fprintf(fp, "floatBits(");
+		emitRaw(fp, i, classic, 0);
+		fprintf(fp, ")");
+	}
+	else if (s->flags & DBC_SIGNAL_DOUBLE)
+	{
+		fprintf(fp, "doubleBits(");
+		emitRaw(fp, i, classic, 0);
+		fprintf(fp, ")");
+	}
+	else
+	{
+		fprintf(fp, "(double)");
+		emitRaw(fp, i, classic, (s->flags & DBC_SIGNAL_SIGNED) != 0);
+	}
+
+	if (isFloat || s->factor != 1)
+		fprintf(fp, " * %.17g", s->factor);
+	if (isFloat || s->offset != 0 || !(s->factor > 1e-300))
+		fprintf(fp, " + (%.17g)", s->offset);
+	fprintf(fp, ";\n%s%sn++;\n", indent, guarded ? "\t" : "");
+	if (guarded)
+		fprintf(fp, "%s}\n", indent);
+}
+
+static void emitRange(FILE *fp, uint32_t first, uint32_t count, int classic,
+	const char *indent, int guarded)
+{
+	for (uint32_t i = first; i < first + count; i++)
+		emitSignal(fp, i, classic, indent, guarded);
+}
+
+static int hasBigEndian(const struct dbc_message *m)
+{
+	uint32_t last = m->first + m->count;
+
+	if (m->groupCount > 0)
+		last = db->groups[m->firstGroup + m->groupCount - 1].first +
+			db->groups[m->firstGroup + m->groupCount - 1].count;
+	for (uint32_t i = m->first; i < last; i++)
+	{
+		if (db->signals[i].flags & DBC_SIGNAL_BIG_ENDIAN)
+			return 1;
+	}
+	return 0;
+}
+
+static uint8_t messageMinLen(const struct dbc_message *m)
+{
+	uint8_t len = 0;
+
+	for (uint32_t i = m->first; i < m->first + m->count; i++)
+		len = db->signals[i].minLen > len ? db->signals[i].minLen : len;
+	for (uint32_t g = m->firstGroup; g < m->firstGroup + m->groupCount; g++)
+	{
+		for (uint32_t i = db->groups[g].first; i < db->groups[g].first + db->groups[g].count; i++)
+			len = db->signals[i].minLen > len ? db->signals[i].minLen : len;
+	}
+	return len;
+}
+
+static void emitBody(FILE *fp, const struct dbc_message *m, int classic, const char *indent,
+	int guarded)
+{
+	char inner[16];
+
+	emitRange(fp, m->first, m->count, classic, indent, guarded);
+	if (m->groupCount == 0)
+		return;
+
+	if (guarded)
+		fprintf(fp, "%sif (len >= %u)\n", indent, db->signals[m->mux].minLen);
+	fprintf(fp, "%sswitch (", indent);
+	emitRaw(fp, m->mux, classic, 0);
+	fprintf(fp, ")\n%s{\n", indent);
+	snprintf(inner, sizeof(inner), "%s\t", indent);
+	for (uint32_t g = m->firstGroup; g < m->firstGroup + m->groupCount; g++)
+	{
+		fprintf(fp, "%scase %u:\n", indent, db->groups[g].value);
+		emitRange(fp, db->groups[g].first, db->groups[g].count, classic, inner, guarded);
+		fprintf(fp, "%sbreak;\n", inner);
+	}
+	fprintf(fp, "%s}\n", indent);
+}
+
+static void emitMessage(FILE *fp, uint32_t index)
+{
+	const struct dbc_message *m = &db->messages[index];
+	int classic = isClassic(m);
+	uint8_t minLen = messageMinLen(m);
+
+	fprintf(fp, "// %s, id 0x%X\n", m->name, m->id & CAN_EFF_MASK);
+	fprintf(fp, "static int decode%u(const uint8_t *data, uint8_t len, struct dbc_value *out)\n{\n",
+		index);
+	if (classic)
+		fprintf(fp, "\tuint64_t le = loadFrame(data, len);\n%s",
+			hasBigEndian(m) ? "\tuint64_t be = bswap64(le);\n" : "");
+	else
+		fprintf(fp, "\tuint8_t buf[CANFD_MAX_DLEN + 9];\n\n\tcopyFrame(buf, data, len);\n");
+	fprintf(fp, "\tint n = 0;\n\n");
+
+	fprintf(fp, "\tif (len >= %u)\n\t{\n", minLen);
+	emitBody(fp, m, classic, "\t\t", 0);
+	fprintf(fp, "\t\treturn n;\n\t}\n\n\t// short frame, only the signals inside it\n");
+	emitBody(fp, m, classic, "\t", 1);
+	fprintf(fp, "\treturn n;\n}\n\n");
+}
+
+static int writeSource(const char *path, const char *header, const char *dbcPath)
+{
+	const char *base = strrchr(header, '/');
+	uint32_t mult;
+	int bits;
+	FILE *fp;
+
+	if (findPerfectHash(&mult, &bits) != 0)
+	{
+		fprintf(stderr, "No perfect hash found for %u ids\n", db->messageCount);
+		return -1;
+	}
+
+	fp = fopen(path, "w");
+	if (fp == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+
+	fprintf(fp, "/*\n\tGenerated by dbc-gen from %s, do not edit.\n*/\n\n", dbcPath);
+	fprintf(fp, "#include <string.h>\n#include <linux/can.h>\n#include \"%s\"\n\n",
+		base != NULL ? base + 1 : header);
+	fprintf(fp, "#define HASH_MULT\t\t0x%08Xu\n#define HASH_BITS\t\t%d\n\n", mult, bits);
+	fprintf(fp,
+		"static inline uint64_t loadLe64(const uint8_t *p)\n{\n\tuint64_t v;\n"
+		"\tmemcpy(&v, p, sizeof(v));\n#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__\n"
+		"\tv = __builtin_bswap64(v);\n#endif\n\treturn v;\n}\n\n"
+		"static inline uint64_t bswap64(uint64_t v)\n{\n\treturn __builtin_bswap64(v);\n}\n\n"
+		"static inline uint64_t loadFrame(const uint8_t *data, uint8_t len)\n{\n"
+		"\tuint8_t buf[8] = { 0 };\n\n\tmemcpy(buf, data, len < 8 ? len : 8);\n"
+		"\treturn loadLe64(buf);\n}\n\n"
+		"static inline void copyFrame(uint8_t *buf, const uint8_t *data, uint8_t len)\n{\n"
+		"\tmemcpy(buf, data, len);\n\tmemset(buf + len, 0, CANFD_MAX_DLEN + 9 - len);\n}\n\n"
+		"static inline double floatBits(uint64_t raw)\n{\n\tuint32_t v32 = raw;\n\tfloat f;\n\n"
+		"\tmemcpy(&f, &v32, sizeof(f));\n\treturn f;\n}\n\n"
+		"static inline double doubleBits(uint64_t raw)\n{\n\tdouble d;\n\n"
+		"\tmemcpy(&d, &raw, sizeof(d));\n\treturn d;\n}\n\n");
+
+	for (uint32_t i = 0; i < db->messageCount; i++)
+		emitMessage(fp, i);
+
+	uint32_t size = 1u << bits;
+	uint32_t *slots = malloc(size * sizeof(*slots));
+	if (slots == NULL)
+	{
+		fclose(fp);
+		return -1;
+	}
+	for (uint32_t s = 0; s < size; s++)
+		slots[s] = GEN_EMPTY_ID;
+	for (uint32_t i = 0; i < db->messageCount; i++)
+		slots[hashSlot(db->messages[i].id, mult, bits)] = i;
+
+	fprintf(fp, "static const uint32_t ids[1 << HASH_BITS] = {\n");
+	for (uint32_t s = 0; s < size; s++)
+		fprintf(fp, "\t0x%08Xu,\n", slots[s] == GEN_EMPTY_ID ? GEN_EMPTY_ID :
+			db->messages[slots[s]].id);
+	fprintf(fp, "};\n\nstatic int (*const decoders[1 << HASH_BITS])(const uint8_t *, uint8_t,\n"
+		"\tstruct dbc_value *) = {\n");
+	for (uint32_t s = 0; s < size; s++)
+	{
+		if (slots[s] == GEN_EMPTY_ID)
+			fprintf(fp, "\tNULL,\n");
+		else
+			fprintf(fp, "\tdecode%u,\n", slots[s]);
+	}
+	fprintf(fp, "};\n\nconst char *const dbcGenSignalNames[DBC_GEN_SIGNALS] = {\n");
+	for (uint32_t i = 0; i < db->signalCount; i++)
+		fprintf(fp, "\t\"%s.%s\",\n", db->messages[db->info[i].message].name, db->info[i].name);
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp,
+		"int dbcGenDecode(uint32_t canId, const uint8_t *data, uint8_t len, struct dbc_value *out)\n"
+		"{\n"
+		"\tuint32_t id = (canId & CAN_EFF_FLAG) ? canId & (CAN_EFF_FLAG | CAN_EFF_MASK) :\n"
+		"\t\tcanId & CAN_SFF_MASK;\n"
+		"\tuint32_t slot = (id * HASH_MULT) >> (32 - HASH_BITS);\n\n"
+		"\tif (ids[slot] != id)\n\t\treturn -1;\n"
+		"\treturn decoders[slot](data, len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : len, out);\n"
+		"}\n\n"
+		"uint32_t dbcGenFindPgn(uint32_t canId)\n"
+		"{\n"
+		"\tuint32_t id = canId & (CAN_EFF_FLAG | CAN_EFF_MASK);\n\n"
+		"\tif (!(canId & CAN_EFF_FLAG))\n\t\treturn 0;\n"
+		"\tfor (uint32_t p = 0; p < 8; p++)\n\t{\n"
+		"\t\tuint32_t try = (id & ~DBC_J1939_PRIORITY_MASK) | p << 26;\n"
+		"\t\tif (ids[(try * HASH_MULT) >> (32 - HASH_BITS)] == try)\n\t\t\treturn try;\n"
+		"\t}\n"
+		"\treturn 0;\n"
+		"}\n");
+
+	free(slots);
+	return fclose(fp) == 0 ? 0 : -1;
+}
+
+static int writeHeader(const char *path, const char *dbcPath)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (fp == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+
+	fprintf(fp, "/*\n\tGenerated by dbc-gen from %s, do not edit.\n*/\n\n", dbcPath);
+	fprintf(fp, "#ifndef DBC_DECODE_H\n#define DBC_DECODE_H\n\n#include <stdint.h>\n"
+		"#include \"cyber-dbc.h\"\n\n");
+	fprintf(fp, "#define DBC_GEN_MESSAGES\t\t%u\n#define DBC_GEN_SIGNALS\t\t\t%u\n\n",
+		db->messageCount, db->signalCount);
+	fprintf(fp, "// \"Message.Signal\" by signal index\n"
+		"extern const char *const dbcGenSignalNames[DBC_GEN_SIGNALS];\n\n"
+		"/*\n\tDecodes a frame into out (room for DBC_MAX_MESSAGE_SIGNALS values),\n"
+		"\treturns the value count or -1 for ids not in the DBC.\n*/\n"
+		"int dbcGenDecode(uint32_t canId, const uint8_t *data, uint8_t len, struct dbc_value *out);\n\n"
+		"// J1939: the DBC id with canId's PGN and source address at any priority, 0 if none\n"
+		"uint32_t dbcGenFindPgn(uint32_t canId);\n\n"
+		"#endif // DBC_DECODE_H\n");
+	return fclose(fp) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct dbc parsed;
+
+	if (argc != 4)
+	{
+		fprintf(stderr, "usage: %s file.dbc out.c out.h\n", argv[0]);
+		return 1;
+	}
+
+	if (dbcLoad(&parsed, argv[1]) != 0 || parsed.messageCount == 0)
+		return 1;
+	db = &parsed;
+
+	if (writeHeader(argv[3], argv[1]) != 0 || writeSource(argv[2], argv[3], argv[1]) != 0)
+	{
+		remove(argv[2]);
+		remove(argv[3]);
+		return 1;
+	}
+
+	dbcFree(&parsed);
+	return 0;
+}
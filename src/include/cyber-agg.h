@@ -0,0 +1,59 @@
+#ifndef CYBER_AGG_H
+#define CYBER_AGG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "cyber-dbc.h"
+
+#define AGG_MAX_WINDOWS			4
+#define AGG_DEFAULT_WINDOWS		"1,10,60"	// seconds
+#define AGG_RECORD_SIGNATURE		"AGG1"
+#define AGG_RECORD_HEADER_SIZE		24
+#define AGG_ENTRY_SIZE			24
+
+/*
+	Upload record of one closed window, little endian:
+		"AGG1", window length in ms (u32), window start in unix us (u64),
+		entry count (u32), reserved (u32)
+	and per signal that had samples in the window:
+		signal index (u32, as in dbc.signals), sample count (u32),
+		min, max, mean, last (float32 each)
+*/
+
+/*
+	One window length, struct of arrays over all signals so a roll-up is
+	one contiguous loop per field. Empty slots hold min = +inf and
+	max = -inf, which makes folding branch free; last keeps the last
+	value ever seen.
+*/
+struct agg_window {
+	uint32_t lengthMs;
+	uint64_t start;			// ns, aligned to lengthMs
+	uint64_t end;
+	double *min;
+	double *max;
+	double *sum;
+	double *last;
+	uint32_t *count;
+};
+
+struct agg_stats {
+	uint64_t samples;
+	uint64_t records;
+	uint64_t bytes;			// record bytes handed to the output
+	uint64_t rollups;
+	uint64_t rollupNs;		// time spent folding windows
+};
+
+typedef int (*aggOutput)(const void *data, size_t len);
+
+int aggInit(uint32_t signals, const char *windows, aggOutput out);
+void aggUpdate(const struct timespec *ts, const struct dbc_value *values, int count);
+void aggTick(const struct timespec *now);
+void aggFlush(void);
+void aggGetStats(struct agg_stats *stats);
+void aggPrintStats(void);
+void aggFree(void);
+
+#endif // CYBER_AGG_H
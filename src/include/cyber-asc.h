@@ -0,0 +1,13 @@
+#ifndef CYBER_ASC_H
+#define CYBER_ASC_H
+
+#include <stdint.h>
+
+#define ASC_LINE_MAX			320	// a 64 byte CANFD record needs ~260
+
+int ascFormatFrame(char *out, int64_t sec, long nsec, int channel, uint32_t id,
+	const char *dir, uint8_t dlc, const uint8_t *data);
+int ascFormatFdFrame(char *out, int64_t sec, long nsec, int channel, uint32_t id,
+	const char *dir, int brs, int esi, uint8_t len, const uint8_t *data);
+
+#endif // CYBER_ASC_H
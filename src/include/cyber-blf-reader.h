@@ -0,0 +1,79 @@
+#ifndef CYBER_BLF_READER_H
+#define CYBER_BLF_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "cyber-blf.h"
+
+#define BLF_READER_THREADS		4
+#define BLF_READER_WINDOW		8	// containers inflated ahead per thread
+#define BLF_REORDER_WINDOW		4096	// frames held back for time ordering
+
+struct blf_frame {
+	uint64_t ns;			// since the file start time
+	uint64_t seq;			// position in the file, breaks ties
+	int channel;			// 1-based, as in the file
+	uint32_t canId;			// linux/can.h id, CAN_EFF_FLAG/CAN_RTR_FLAG set
+	int flags;			// BLF_FRAME_* of cyber-blf.h
+	uint8_t len;
+	uint8_t data[64];
+};
+
+struct blf_chunk {
+	const uint8_t *src;		// points into the mapping
+	uint32_t srcLen;
+	uint32_t len;			// uncompressed length
+	int method;
+	uint8_t *buf;			// inflated data, NULL for stored chunks
+	int state;
+};
+
+struct blf_reader_stats {
+	uint64_t objects;
+	uint64_t frames;
+	uint64_t skipped;		// bytes skipped to resync on a bad object
+	uint32_t containers;
+	uint64_t uncompressed;
+};
+
+struct blf_reader {
+	int fd;
+	const uint8_t *map;
+	size_t mapLen;
+	struct timespec start;		// file start time (CLOCK_REALTIME)
+
+	struct blf_chunk *chunks;
+	uint32_t chunkCount;
+	uint32_t chunkCapacity;
+
+	// inflate pool
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t nextJob;
+	uint32_t consumed;
+	uint32_t window;
+	int stop;
+
+	// object walker
+	uint8_t *carry;
+	size_t carryLen;
+	size_t carryNeed;
+	size_t carrySize;
+	uint64_t seq;
+
+	// reorder heap
+	struct blf_frame *heap;
+	size_t heapLen;
+
+	struct blf_reader_stats stats;
+};
+
+typedef int (*blfFrameCallback)(const struct blf_frame *frame, void *arg);
+
+int blfReaderOpen(struct blf_reader *r, const char *path);
+int blfReaderRun(struct blf_reader *r, int threads, blfFrameCallback cb, void *arg);
+void blfReaderClose(struct blf_reader *r);
+
+#endif // CYBER_BLF_READER_H
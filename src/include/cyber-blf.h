@@ -0,0 +1,82 @@
+#ifndef CYBER_BLF_H
+#define CYBER_BLF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+	Vector BLF (binary logging format) definitions. All fields are little
+	endian; objects start with "LOBJ" and are padded to obj_size % 4.
+*/
+#define BLF_FILE_SIGNATURE		"LOGG"
+#define BLF_OBJ_SIGNATURE		"LOBJ"
+#define BLF_FILE_HEADER_SIZE		144
+#define BLF_OBJ_HEADER_BASE_SIZE	16
+#define BLF_OBJ_HEADER_V1_SIZE		32
+#define BLF_OBJ_HEADER_V2_SIZE		40
+#define BLF_CONTAINER_HEADER_SIZE	(BLF_OBJ_HEADER_BASE_SIZE + 16)
+#define BLF_CONTAINER_SIZE		(128 * 1024)	// uncompressed bytes
+#define BLF_COMPRESSION_LEVEL		6
+
+#define BLF_OBJ_CAN_MESSAGE		1
+#define BLF_OBJ_CAN_ERROR_EXT		73
+#define BLF_OBJ_LOG_CONTAINER		10
+#define BLF_OBJ_APP_TEXT		65
+#define BLF_OBJ_CAN_MESSAGE2		86
+#define BLF_OBJ_CAN_FD_MESSAGE		100
+#define BLF_OBJ_CAN_FD_MESSAGE_64	101
+
+#define BLF_OBJ_FLAG_TIME_TEN_MICS	0x00000001
+#define BLF_OBJ_FLAG_TIME_ONE_NANS	0x00000002
+
+#define BLF_CAN_MSG_FLAG_TX		0x01
+#define BLF_CAN_MSG_FLAG_RTR		0x80
+#define BLF_CAN_ID_EXTENDED		0x80000000
+
+#define BLF_CANFD_FLAG_EDL		0x1000
+#define BLF_CANFD_FLAG_BRS		0x2000
+#define BLF_CANFD_FLAG_ESI		0x4000
+
+#define BLF_COMPRESSION_NONE		0
+#define BLF_COMPRESSION_ZLIB		2
+
+// flags of blfAddCanFrame()
+#define BLF_FRAME_TX			0x01
+#define BLF_FRAME_FD			0x02
+#define BLF_FRAME_BRS			0x04
+#define BLF_FRAME_ESI			0x08
+
+typedef int (*blfOutput)(const void *data, size_t len);
+
+/*
+	Frames are collected as uncompressed objects in container, every full
+	BLF_CONTAINER_SIZE is deflated into one LOG_CONTAINER and handed to out.
+*/
+struct blf_writer {
+	blfOutput out;
+	int level;
+
+	uint8_t *container;
+	size_t used;
+	uint8_t *zbuf;
+	size_t zbufSize;
+
+	// statistics for the file header, reset per segment
+	struct timespec start;		// header start time, whole milliseconds
+	struct timespec last;
+	uint64_t uncompressedSize;
+	uint32_t objectCount;
+};
+
+int blfWriterInit(struct blf_writer *w, int level, blfOutput out);
+void blfWriterStart(struct blf_writer *w, const struct timespec *start);
+int blfAddCanFrame(struct blf_writer *w, const struct timespec *ts, int channel,
+	uint32_t canId, int flags, uint8_t len, const uint8_t *data);
+int blfAddText(struct blf_writer *w, const struct timespec *ts, const char *text);
+int blfFlushContainer(struct blf_writer *w);
+void blfBuildHeader(const struct blf_writer *w, uint64_t fileSize,
+	uint8_t header[BLF_FILE_HEADER_SIZE]);
+void blfWriterFree(struct blf_writer *w);
+
+#endif // CYBER_BLF_H
@@ -1,14 +1,30 @@
 #ifndef CYBER_CANBUS_H
 #define CYBER_CANBUS_H
 
-#define _POSIX_C_SOURCE 200809L
 #include <time.h>
 #include <unistd.h>
 #include "libcommon/can.h"
 
+#ifndef CANFD_FDF
+#define CANFD_FDF			0x04	// linux 6.2, set by capture for older kernels
+#endif
+
 #define CAN_INTERFACE			"can1"
+#define CAN_MAX_CHANNELS		5
+#define CAN_CHANNEL_MAX			7	// highest ASC/BLF channel number, sizes per-channel tables
 #define CAN_BITRATE			500000
+#define CAN_FD_DBITRATE			2000000
+#define CAN_FD_TXQUEUELEN		1000
 #define CAN_READ_TIMEOUT_ERR_CODE	0x9001000a
 #define CAN_LOG_FILE_SIZE_LIMIT		(1 * 1024 * 1024) // 1 MB
+#define LOG_WRITER_IDLE_US		1000
+#define LOG_WRITER_TICK_RECORDS		4096
+
+struct canbus_channel {
+	char iface[IFNAMSIZ];
+	int bitrate;
+	int dbitrate;			// CAN FD data phase, 0 = classic CAN
+	int channel;			// ASC/BLF channel number, 1-based
+};
 
 #endif // CYBER_CANBUS_H
\ No newline at end of file
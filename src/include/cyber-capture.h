@@ -0,0 +1,50 @@
+#ifndef CYBER_CAPTURE_H
+#define CYBER_CAPTURE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <linux/can.h>
+
+#define CAPTURE_MAX_CHANNELS		5	// can0..can4
+#define CAPTURE_BATCH_SIZE		64	// frames per recvmmsg() call
+#define CAPTURE_POLL_TIMEOUT_MS		1000
+#define CAPTURE_RCVBUF_SIZE		(1 * 1024 * 1024)
+#define CAPTURE_STATS_INTERVAL_SEC	10
+
+struct capture_stats {
+	uint64_t frames;		// frames handed to the callback
+	uint64_t batches;		// recvmmsg() calls that returned frames
+	uint64_t polls;			// idle epoll waits, only in the -1 total
+	uint64_t ifDrops;		// interface rx_dropped since captureOpen()
+	uint64_t socketDrops;		// lost to a full socket receive queue (SO_RXQ_OVFL)
+	uint64_t kernelFiltered;	// received by the interface, kept out by CAN_RAW_FILTER
+	uint64_t userFiltered;		// dropped by the userspace filter check
+	uint64_t hwStamps;		// frames stamped by the controller (captureSetHwStamps)
+	uint64_t swStamps;		// frames stamped by the kernel on receive
+	uint64_t userStamps;		// frames without a kernel stamp
+};
+
+/*
+	ts is the kernel receive time (CLOCK_REALTIME), not the time the
+	callback runs. Frames of all channels are delivered in ts order.
+*/
+typedef void (*captureCallback)(const struct canfd_frame *frame, int channel,
+	const struct timespec *ts);
+
+/*
+	dropped frames were lost to a full socket receive queue right before
+	the frame stamped ts.
+*/
+typedef void (*captureDropCallback)(int channel, uint32_t dropped, const struct timespec *ts);
+
+int captureOpen(const char *iface, int channel);
+void captureSetHwStamps(int on);
+void captureSetDropCallback(captureDropCallback cb);
+int captureRun(captureCallback cb);
+void captureStop(void);
+int captureChannelCount(void);
+void captureGetStats(int index, struct capture_stats *stats);
+void capturePrintStats(void);
+void captureClose(void);
+
+#endif // CYBER_CAPTURE_H
@@ -0,0 +1,121 @@
+#ifndef CYBER_CDL_H
+#define CYBER_CDL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+	Compact delta log (CDL). A 32 byte file header is followed by blocks
+	of a 16 byte header ("CDLB", payload length, frame count, crc32 of
+	the payload) and the records. All fields are little endian.
+
+	Each record starts with a tag byte. The first frame of a (channel, id)
+	in a segment defines it in the dictionary (CDL_TAG_NEW: channel and id
+	as varints), later frames refer to it by its dictionary index (varint).
+	Then follow the zigzag varint timestamp delta in ticks, the length and
+	flags when they differ from the last frame of that id, and the payload
+	XORed with the last one of that id: a byte mask of the non-zero XOR
+	bytes (one byte up to 8 data bytes, a varint above) and those bytes.
+	Dictionary and XOR state run across blocks, so decoding stops at the
+	first block that fails its checksum.
+
+	A record with the tag CDL_TAG_GAP is no frame but the capture gap
+	marker: channel, timestamp delta, then the frames lost to the socket
+	receive queue and to the capture ring as varints. The block frame
+	count counts it as a record.
+*/
+#define CDL_FILE_SIGNATURE		"CDL1"
+#define CDL_BLOCK_SIGNATURE		"CDLB"
+#define CDL_VERSION			1
+#define CDL_FILE_HEADER_SIZE		32
+#define CDL_BLOCK_HEADER_SIZE		16
+#define CDL_BLOCK_SIZE			(32 * 1024)	// payload bytes per block
+#define CDL_RECORD_MAX			128
+#define CDL_TICK_NS			1000		// timestamp resolution, as ASC
+#define CDL_MAX_IDS			2048
+#define CDL_TABLE_BITS			12
+#define CDL_TABLE_SIZE			(1 << CDL_TABLE_BITS)
+
+#define CDL_TAG_NEW			0x80	// dictionary definition follows
+#define CDL_TAG_LEN			0x40	// length byte follows
+#define CDL_TAG_FLAGS			0x20	// flags byte follows
+#define CDL_TAG_SAME			0x10	// payload unchanged, no mask
+#define CDL_TAG_RAW			0x08	// dictionary full: channel, id, len, flags, data
+#define CDL_TAG_GAP			0x04	// whole tag: channel, delta, socket lost, ring lost
+
+// flags of cdlAddFrame(), same bits as BLF_FRAME_*
+#define CDL_FRAME_TX			0x01
+#define CDL_FRAME_FD			0x02
+#define CDL_FRAME_BRS			0x04
+#define CDL_FRAME_ESI			0x08
+#define CDL_FRAME_GAP			0x80	// decoded gap record, never written as flags
+
+// cdl_decode_info.error
+#define CDL_ERROR_HEADER		1
+#define CDL_ERROR_TRUNCATED		2
+#define CDL_ERROR_CHECKSUM		3
+#define CDL_ERROR_RECORD		4
+#define CDL_ERROR_CALLBACK		5
+
+typedef int (*cdlOutput)(const void *data, size_t len);
+
+struct cdl_entry {
+	uint32_t id;
+	uint8_t channel;
+	uint8_t len;
+	uint8_t flags;
+	uint8_t data[64];
+};
+
+struct cdl_writer {
+	cdlOutput out;
+	uint8_t *block;			// block header + payload
+	size_t used;
+	uint32_t frames;
+
+	// per segment
+	struct timespec start;
+	int64_t lastTick;
+	struct cdl_entry *entries;
+	uint16_t slots[CDL_TABLE_SIZE];	// entry index + 1, 0 = free
+	uint32_t count;
+};
+
+struct cdl_frame {
+	int64_t ns;			// since the file start time
+	int channel;
+	uint32_t canId;			// linux/can.h id, CAN_EFF_FLAG/CAN_RTR_FLAG set
+	int flags;			// CDL_FRAME_*
+	uint8_t len;
+	uint8_t data[64];
+	uint32_t socketLost;		// CDL_FRAME_GAP: frames lost before ns
+	uint32_t ringLost;
+};
+
+struct cdl_decode_info {
+	struct timespec start;
+	uint32_t tickNs;
+	uint64_t frames;
+	uint64_t gaps;
+	uint32_t blocks;
+	int error;			// 0, or the reason decoding stopped early
+	size_t errorOffset;
+};
+
+typedef int (*cdlFrameCallback)(const struct cdl_frame *frame, void *arg);
+
+int cdlWriterInit(struct cdl_writer *w, cdlOutput out);
+int cdlWriterStart(struct cdl_writer *w, const struct timespec *start);
+int cdlAddFrame(struct cdl_writer *w, const struct timespec *ts, int channel,
+	uint32_t canId, int flags, uint8_t len, const uint8_t *data);
+int cdlAddGap(struct cdl_writer *w, const struct timespec *ts, int channel,
+	uint32_t socketLost, uint32_t ringLost);
+int cdlFlushBlock(struct cdl_writer *w);
+void cdlWriterFree(struct cdl_writer *w);
+
+int cdlDecode(const uint8_t *buf, size_t len, cdlFrameCallback cb, void *arg,
+	struct cdl_decode_info *info);
+const char *cdlErrorString(int error);
+
+#endif // CYBER_CDL_H
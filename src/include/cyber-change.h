@@ -0,0 +1,42 @@
+#ifndef CYBER_CHANGE_H
+#define CYBER_CHANGE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define CHANGE_MAX_IDS			2048
+#define CHANGE_TABLE_BITS		12
+#define CHANGE_TABLE_SIZE		(1 << CHANGE_TABLE_BITS)	// half full at most
+#define CHANGE_HEARTBEAT_MS		1000
+
+/*
+	Last payload seen for one (channel, id). Classic payloads are kept
+	as they are, FD payloads longer than 8 bytes as a 64-bit hash.
+*/
+struct change_entry {
+	uint32_t id;
+	uint8_t channel;		// 0 = free slot
+	uint8_t len;
+	uint8_t flags;
+	uint8_t reserved;
+	uint64_t payload;
+	uint64_t lastWritten;		// ns, frame timestamp
+	uint32_t seen;
+	uint32_t written;
+};
+
+struct change_stats {
+	uint64_t frames;
+	uint64_t written;
+	uint64_t heartbeats;		// written although unchanged
+	uint64_t overflow;		// frames of ids that found no slot, all written
+	uint32_t ids;
+};
+
+void changeInit(uint32_t heartbeatMs);
+int changeCheck(const struct timespec *ts, int channel, uint32_t id, uint8_t flags,
+	uint8_t len, const uint8_t *data);
+void changeGetStats(struct change_stats *stats);
+void changePrintStats(void);
+
+#endif // CYBER_CHANGE_H
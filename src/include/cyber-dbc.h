@@ -0,0 +1,104 @@
+#ifndef CYBER_DBC_H
+#define CYBER_DBC_H
+
+#include <stdint.h>
+
+#define DBC_NAME_MAX			64
+#define DBC_UNIT_MAX			16
+#define DBC_LINE_MAX			1024
+#define DBC_MAX_MESSAGE_SIGNALS		512	// values one dbcDecode() call can return
+
+#define DBC_J1939_PRIORITY_MASK		0x1C000000u	// can id bits 26-28
+
+#define DBC_SIGNAL_BIG_ENDIAN		0x01	// @0, Motorola
+#define DBC_SIGNAL_SIGNED		0x02	// @x-
+#define DBC_SIGNAL_FLOAT		0x04	// SIG_VALTYPE_ 1
+#define DBC_SIGNAL_DOUBLE		0x08	// SIG_VALTYPE_ 2
+#define DBC_SIGNAL_WIDE			0x10	// spans 9 bytes, needs a second load
+
+/*
+	Compiled decode record, all a decode needs and nothing else. The
+	value is read as one 64-bit word at byte (little endian for Intel,
+	big endian for Motorola signals) shifted right by shift; names live
+	in dbc_signal_info at the same index.
+*/
+struct dbc_signal {
+	double factor;
+	double offset;
+	uint8_t byte;			// first byte of the 64-bit load
+	uint8_t shift;
+	uint8_t length;			// bits, 1..64
+	uint8_t flags;			// DBC_SIGNAL_*
+	uint8_t minLen;			// frame bytes the signal needs
+};
+
+struct dbc_signal_info {
+	char name[DBC_NAME_MAX];
+	char unit[DBC_UNIT_MAX];
+	uint32_t message;		// index into dbc.messages
+	int32_t muxValue;		// -1 = always present
+	uint16_t startBit;		// as written in the DBC
+};
+
+/*
+	A message's signals are one range of dbc.signals: the ones present
+	in every frame first (the multiplexor among them), then one range
+	per multiplexor value in dbc.groups.
+*/
+struct dbc_mux_group {
+	uint32_t value;
+	uint32_t first;
+	uint32_t count;
+};
+
+struct dbc_message {
+	uint32_t id;			// linux/can.h id, CAN_EFF_FLAG for extended
+	uint8_t dlc;
+	char name[DBC_NAME_MAX];
+	uint32_t first;			// plain signals
+	uint32_t count;
+	int32_t mux;			// multiplexor signal index, -1 = none
+	uint32_t firstGroup;
+	uint32_t groupCount;
+};
+
+struct dbc_value {
+	uint32_t signal;		// index into dbc.signals / dbc.info
+	double value;			// physical: raw * factor + offset
+};
+
+struct dbc_stats {
+	uint64_t frames;		// frames of known messages
+	uint64_t unknown;		// frames of ids not in the DBC
+	uint64_t signals;		// values produced
+	uint64_t truncated;		// signals skipped, frame shorter than the signal
+};
+
+struct dbc {
+	struct dbc_message *messages;
+	uint32_t messageCount;
+	struct dbc_signal *signals;
+	struct dbc_signal_info *info;
+	uint32_t signalCount;
+	struct dbc_mux_group *groups;
+	uint32_t groupCount;
+
+	// id -> message index + 1, open addressing, 0 = free
+	uint32_t *slots;
+	int tableBits;
+
+	struct dbc_stats stats;
+};
+
+int dbcLoad(struct dbc *db, const char *path);
+void dbcFree(struct dbc *db);
+const struct dbc_message *dbcFindMessage(const struct dbc *db, uint32_t canId);
+const struct dbc_message *dbcFindPgn(const struct dbc *db, uint32_t canId);
+int dbcDecode(struct dbc *db, const struct dbc_message *m, const uint8_t *data,
+	uint8_t len, struct dbc_value *out);
+int dbcDecodeFrame(struct dbc *db, uint32_t canId, const uint8_t *data, uint8_t len,
+	struct dbc_value *out);
+int dbcFindSignal(const struct dbc *db, const char *message, const char *signal);
+void dbcPrintStats(const struct dbc *db);
+
+#endif // CYBER_DBC_H
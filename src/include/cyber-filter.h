@@ -0,0 +1,42 @@
+#ifndef CYBER_FILTER_H
+#define CYBER_FILTER_H
+
+#include <stdint.h>
+#include <net/if.h>
+#include <linux/can.h>
+
+#define FILTER_MAX_RULES		64	// per interface
+#define FILTER_MAX_SETS			8
+#define FILTER_LINE_MAX			128
+
+#define FILTER_ALLOW			0
+#define FILTER_DENY			1
+
+struct filter_rule {
+	int action;			// FILTER_ALLOW or FILTER_DENY
+	uint32_t id;			// with CAN_EFF_FLAG for extended ids
+	uint32_t mask;			// CAN_EFF_FLAG always set, std and ext never mix
+	int line;			// in the configuration file
+	uint64_t hits;			// frames seen in userspace matching the rule
+};
+
+/*
+	A frame passes when there are no allow rules or it matches one of
+	them, and it matches no deny rule.
+*/
+struct filter_set {
+	char iface[IFNAMSIZ];		// "*" applies to every interface
+	struct filter_rule rules[FILTER_MAX_RULES];
+	int count;
+	int allows;
+	int denies;
+	int kernelExact;		// the kernel filter alone gives the answer
+};
+
+int filterLoad(const char *path);
+struct filter_set *filterFind(const char *iface);
+int filterApply(struct filter_set *set, int sock);
+int filterCheck(struct filter_set *set, const struct canfd_frame *frame);
+void filterPrintStats(void);
+
+#endif // CYBER_FILTER_H
@@ -0,0 +1,98 @@
+#ifndef CYBER_J1939_H
+#define CYBER_J1939_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define J1939_PF_TP_CM			0xEC	// TP.CM, PGN 0xEC00
+#define J1939_PF_TP_DT			0xEB	// TP.DT, PGN 0xEB00
+#define J1939_TP_RTS			16
+#define J1939_TP_CTS			17
+#define J1939_TP_EOMA			19	// end of message acknowledge
+#define J1939_TP_BAM			32
+#define J1939_TP_ABORT			255
+
+#define J1939_ADDRESS_GLOBAL		0xFF	// BAM destination
+#define J1939_MAX_CHANNELS		8
+#define J1939_MAX_PACKETS		255
+#define J1939_MAX_DATA			(J1939_MAX_PACKETS * 7)	// 1785
+#define J1939_DEFAULT_SESSIONS		256
+#define J1939_TEXT_MAX			(J1939_MAX_DATA * 3 + 64)
+
+// SAE J1939-21 receiver timeouts
+#define J1939_T1_MS			750	// between data packets
+#define J1939_T2_MS			1250	// after CTS
+#define J1939_T3_MS			1250	// after RTS, until CTS
+#define J1939_T4_MS			1050	// after a hold CTS (0 packets)
+#define J1939_SWEEP_MS			50
+
+#define J1939_MODE_BAM			0
+#define J1939_MODE_CMDT			1	// RTS/CTS
+
+/*
+	One reassembled PGN. data points into the session buffer and is
+	only valid during the callback.
+*/
+struct j1939_message {
+	struct timespec ts;		// last data packet
+	int channel;
+	uint32_t pgn;
+	uint8_t priority;		// of the TP.CM frame
+	uint8_t sa;
+	uint8_t da;			// J1939_ADDRESS_GLOBAL for BAM
+	uint8_t mode;			// J1939_MODE_*
+	uint16_t len;
+	const uint8_t *data;
+};
+
+/*
+	Reassembly state of one transfer, taken from a pool preallocated by
+	j1939Init(). Received packets are tracked in a bitmap, so a packet
+	resent after a CTS is stored once.
+*/
+struct j1939_session {
+	uint64_t deadline;		// ns, frame clock
+	uint32_t pgn;
+	uint16_t size;
+	uint16_t next;			// chain of the same (channel, sa), index + 1
+	uint16_t active;		// position in the active list
+	uint8_t packets;
+	uint8_t received;
+	uint8_t channel;
+	uint8_t sa;
+	uint8_t da;
+	uint8_t priority;
+	uint8_t mode;
+	uint8_t seen[32];		// packet n is bit n - 1
+	uint8_t data[J1939_MAX_DATA];
+};
+
+struct j1939_stats {
+	uint64_t frames;		// TP.CM and TP.DT frames
+	uint64_t started;
+	uint64_t completed;
+	uint64_t bytes;			// in completed messages
+	uint64_t timeouts;
+	uint64_t aborted;		// TP.CM abort, or a new RTS/BAM replacing one
+	uint64_t noSession;		// pool exhausted, transfer not tracked
+	uint64_t invalid;		// bad size/packet count, sequence out of range
+	uint64_t duplicates;
+	uint64_t orphans;		// TP.DT without a session
+	uint32_t active;
+	uint32_t highWater;
+};
+
+typedef void (*j1939Callback)(const struct j1939_message *msg, void *arg);
+
+int j1939Init(uint32_t sessions, j1939Callback cb, void *arg);
+int j1939Frame(const struct timespec *ts, int channel, uint32_t canId, uint8_t len,
+	const uint8_t *data);
+void j1939Tick(const struct timespec *now);
+uint32_t j1939CanId(const struct j1939_message *msg);
+int j1939FormatMessage(char *out, size_t size, const struct j1939_message *msg);
+void j1939GetStats(struct j1939_stats *stats);
+void j1939PrintStats(void);
+void j1939Free(void);
+
+#endif // CYBER_J1939_H
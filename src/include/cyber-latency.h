@@ -0,0 +1,52 @@
+#ifndef CYBER_LATENCY_H
+#define CYBER_LATENCY_H
+
+#include <stdint.h>
+#include <time.h>
+#include "cyber-timing.h"
+
+#define LATENCY_SAMPLE_EVERY		64	// 1 in N frames, a power of two
+#define LATENCY_SLOTS			4096	// samples between capture and flush
+#define LATENCY_PATH_MAX		256
+
+/*
+	A sampled frame is stamped four times: kernel receive (the capture
+	timestamp), read by the capture thread, formatted into the log by the
+	writer thread and its bytes handed to write() or io_uring. All stamps
+	are CLOCK_REALTIME; a controller clock that is off gives 0 us.
+*/
+#define LATENCY_STAGE_SOCKET		0	// receive -> read
+#define LATENCY_STAGE_QUEUE		1	// read -> formatted: ring, decoding, format
+#define LATENCY_STAGE_FLUSH		2	// formatted -> handed to write()
+#define LATENCY_STAGE_TOTAL		3	// receive -> handed to write()
+#define LATENCY_STAGES			4
+
+// us, in the log-linear buckets of cyber-timing.h
+struct latency_stage {
+	uint64_t count;
+	uint64_t sumUs;
+	uint32_t minUs;
+	uint32_t maxUs;
+	uint32_t buckets[TIMING_BUCKETS];
+};
+
+struct latency_stats {
+	uint64_t samples;		// completed, in the histograms
+	uint64_t skipped;		// no free slot when the frame was read
+	uint64_t unlogged;		// not logged (change-only), not counted
+	uint32_t pending;		// formatted, waiting for the write
+	uint32_t exports;
+};
+
+int latencyInit(const char *path, uint32_t sampleEvery);
+uint32_t latencyRead(const struct timespec *rxTs);
+void latencyFormatted(uint32_t sample, uint64_t seq);
+void latencyFlushed(uint64_t flushedFrames);
+void latencyRequestExport(void);
+void latencyTick(void);
+int latencyExport(const char *path);
+const struct latency_stage *latencyStage(int stage);
+void latencyGetStats(struct latency_stats *stats);
+void latencyPrintStats(void);
+
+#endif // CYBER_LATENCY_H
@@ -0,0 +1,60 @@
+#ifndef CYBER_LOGFILE_H
+#define CYBER_LOGFILE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define LOG_BLOCK_SIZE			(64 * 1024)	// one write() per block
+#define LOG_LINE_MAX			320	// ASC_LINE_MAX
+#define LOG_FLUSH_INTERVAL_MS		1000
+#define LOG_FILE_NAME_FORMAT		"canlog_%03d.%s"
+
+#define LOG_FORMAT_ASC			0
+#define LOG_FORMAT_BLF			1
+#define LOG_FORMAT_CDL			2	// compact delta log, cyber-cdl.h
+
+#define LOG_OUTPUT_WRITE		0	// write() from one static block
+#define LOG_OUTPUT_URING		1	// io_uring into a preallocated segment
+#define LOG_OUTPUT_DIRECT		2	// io_uring with O_DIRECT
+
+#define LOG_URING_BLOCK_SIZE		(256 * 1024)
+#define LOG_URING_BUFFERS		4	// blocks in flight
+#define LOG_DIRECT_ALIGN		4096
+
+/*
+	Durability window: buffered lines reach the file at the latest
+	flushIntervalMs after the first of them was queued, or as soon as
+	flushBytes are pending, whichever comes first.
+*/
+struct log_config {
+	int format;			// LOG_FORMAT_*
+	int output;			// LOG_OUTPUT_*
+	int compressionLevel;		// zlib level of BLF containers
+	uint32_t flushIntervalMs;
+	uint32_t flushBytes;		// 0 = when the block is full
+	uint32_t sizeLimit;		// rotate once a segment reaches this size on disk
+};
+
+struct log_stats {
+	uint64_t frames;
+	uint64_t flushedFrames;		// of those, handed to write() or io_uring
+	uint64_t bytes;
+	uint64_t writes;		// write() calls or io_uring submissions
+	uint64_t syncs;			// fsync() calls
+	uint32_t segments;
+};
+
+void logFileDefaultConfig(struct log_config *cfg);
+int logFileInit(const struct log_config *cfg);
+void logFileLogMessage(const struct timespec *ts, uint32_t id, const char *dir,
+	int channel, uint8_t flags, uint8_t dlc, const uint8_t *data);
+void logFileLogText(const struct timespec *ts, const char *text);
+void logFileLogGap(const struct timespec *ts, int channel, uint32_t socketLost,
+	uint32_t ringLost);
+void logFileTick(void);
+int logFileFlush(int sync);
+void logFileGetStats(struct log_stats *stats);
+uint64_t logFileFlushedFrames(void);
+void logFileDeinit(void);
+
+#endif // CYBER_LOGFILE_H
@@ -0,0 +1,66 @@
+#ifndef CYBER_PGNSTAT_H
+#define CYBER_PGNSTAT_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define PGNSTAT_MAX_KEYS		1024
+#define PGNSTAT_TABLE_BITS		11
+#define PGNSTAT_TABLE_SIZE		(1 << PGNSTAT_TABLE_BITS)	// half full at most
+#define PGNSTAT_INTERVAL_MS		1000
+#define PGNSTAT_PATH_MAX		256
+#define PGNSTAT_CHANNELS		8	// 3 bits of the key
+
+// key = used | standard | channel | pgn (or 11-bit id) | sa
+#define PGNSTAT_KEY_USED		0x80000000u
+#define PGNSTAT_KEY_STANDARD		0x40000000u
+
+/*
+	One reporting interval of one key. The capture thread fills
+	window[epoch & 1] while the reporter reads the other one; seq is odd
+	while the capture thread updates the window, a reporter copy that
+	saw it change is retried.
+*/
+struct pgnstat_window {
+	uint32_t seq;
+	uint32_t epoch;
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t cycles;		// gaps measured, frames - 1 at most
+	uint32_t minUs;
+	uint32_t maxUs;
+	uint64_t sumUs;
+	uint64_t sumSqUs;		// us^2, for the jitter
+};
+
+struct pgnstat_entry {
+	uint32_t key;			// 0 = free slot
+	uint32_t reserved;
+	uint64_t lastNs;
+	uint64_t totalFrames;
+	uint64_t totalBytes;
+	struct pgnstat_window window[2];
+};
+
+/*
+	Snapshot of one (channel, pgn, sa). Standard frames are accounted by
+	their 11-bit id in pgn, without a source address.
+*/
+struct pgnstat_row {
+	uint8_t channel;
+	uint8_t sa;
+	uint8_t standard;
+	uint32_t pgn;
+	struct pgnstat_window window;	// the interval just closed
+	uint64_t totalFrames;
+	uint64_t totalBytes;
+};
+
+int pgnStatInit(void);
+void pgnStatFrame(const struct timespec *ts, int channel, uint32_t canId, uint8_t len);
+uint32_t pgnStatSnapshot(struct pgnstat_row *rows, uint32_t max);
+int pgnStatStart(const char *path, uint32_t intervalMs);
+void pgnStatStop(void);
+void pgnStatPrintStats(void);
+
+#endif // CYBER_PGNSTAT_H
@@ -0,0 +1,82 @@
+#ifndef CYBER_RECORDER_H
+#define CYBER_RECORDER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <linux/can.h>
+
+#define RECORDER_MAGIC			"CANFREC1"
+#define RECORDER_VERSION		1
+#define RECORDER_HEADER_SIZE		4096
+#define RECORDER_DEFAULT_RECORDS	262144	// ~70 s of a loaded 500 kbit/s bus
+#define RECORDER_PREV_SUFFIX		".prev"
+
+/*
+	Fixed-width record, one per frame. seq is the running frame number;
+	a slot only counts when its seq matches the position it is read for.
+*/
+struct recorder_record {
+	uint64_t seq;
+	uint64_t ns;			// CLOCK_REALTIME
+	uint32_t canId;			// with CAN_EFF_FLAG/CAN_RTR_FLAG
+	uint8_t channel;
+	uint8_t flags;			// canfd_frame flags (CANFD_BRS, CANFD_ESI)
+	uint8_t len;
+	uint8_t reserved;
+	uint8_t data[CANFD_MAX_DLEN];
+};
+
+/*
+	First page of the file. head is the number of records committed so
+	far; it is stored after the record it covers, so every record below
+	head is complete even if the process dies mid-write.
+*/
+struct recorder_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint64_t capacity;
+	uint64_t created;		// CLOCK_REALTIME ns
+	uint64_t head __attribute__((aligned(64)));
+};
+
+struct recorder {
+	int fd;
+	struct recorder_header *header;
+	struct recorder_record *records;
+	uint64_t capacity;
+	uint64_t head;			// writer's copy of header->head
+	size_t mapLen;
+};
+
+int recorderOpen(struct recorder *rec, const char *path, uint64_t capacity);
+int recorderMap(struct recorder *rec, const char *path);
+void recorderSync(struct recorder *rec, int wait);
+void recorderClose(struct recorder *rec);
+
+/*
+	Called for every captured frame: plain stores into the shared
+	mapping, no system call. The kernel keeps the pages if the process
+	is killed; recorderSync() pushes them to storage.
+*/
+static inline void recorderWrite(struct recorder *rec, const struct timespec *ts,
+	int channel, const struct canfd_frame *frame)
+{
+	uint64_t seq = rec->head;
+	struct recorder_record *r = &rec->records[seq % rec->capacity];
+	uint8_t len = frame->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->len;
+
+	r->seq = seq;
+	r->ns = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+	r->canId = frame->can_id;
+	r->channel = channel;
+	r->flags = frame->flags;
+	r->len = len;
+	memcpy(r->data, frame->data, len);
+
+	rec->head = seq + 1;
+	__atomic_store_n(&rec->header->head, seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif // CYBER_RECORDER_H
@@ -0,0 +1,28 @@
+#ifndef CYBER_REPORTER_H
+#define CYBER_REPORTER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+	seconds is the monotonic time since the last call or the start; the
+	last, partial interval is reported on the way out of reporterStop().
+*/
+typedef void (*reporterCallback)(double seconds, void *arg);
+
+struct reporter {
+	pthread_t thread;
+	int running;
+	int stopping;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t intervalMs;
+	reporterCallback cb;
+	void *arg;
+};
+
+int reporterStart(struct reporter *r, const char *name, uint32_t intervalMs,
+	reporterCallback cb, void *arg);
+void reporterStop(struct reporter *r);
+
+#endif // CYBER_REPORTER_H
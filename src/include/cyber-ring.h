@@ -0,0 +1,107 @@
+#ifndef CYBER_RING_H
+#define CYBER_RING_H
+
+#include <stdint.h>
+#include <time.h>
+#include <linux/can.h>
+
+#define RING_DEFAULT_SLOTS		32768	// ~4 s of a loaded 1 Mbit/s bus
+#define RING_CACHE_LINE			64
+
+/*
+	A record with RING_CHANNEL_GAP set in channel is no frame but a gap
+	marker: frames of that channel were lost right before ts, frame.can_id
+	to the socket receive queue and the uint32_t at frame.data to a full
+	ring.
+*/
+#define RING_CHANNEL_GAP		0x10000
+
+struct can_record {
+	struct timespec ts;		// kernel receive time
+	int channel;
+	uint32_t sample;		// latency sample + 1, 0 = none (was padding)
+	struct canfd_frame frame;
+};
+
+/*
+	Single-producer/single-consumer ring. The capture thread is the only
+	writer of head, the log writer thread the only writer of tail, so no
+	locks are needed; each index lives on its own cache line.
+*/
+struct can_ring {
+	struct can_record *slots;
+	uint32_t mask;
+
+	uint64_t head __attribute__((aligned(RING_CACHE_LINE)));
+	uint64_t cachedTail;
+	uint64_t highWater;
+	uint64_t drops;
+
+	uint64_t tail __attribute__((aligned(RING_CACHE_LINE)));
+	uint64_t cachedHead;
+};
+
+struct ring_stats {
+	uint32_t size;
+	uint32_t occupancy;
+	uint32_t highWater;
+	uint64_t drops;			// records lost because the ring was full
+};
+
+int ringInit(struct can_ring *ring, uint32_t slots);
+void ringFree(struct can_ring *ring);
+void ringGetStats(struct can_ring *ring, struct ring_stats *stats);
+
+/*
+	Producer side: fill the slot returned by ringReserve() and publish it
+	with ringCommit(). NULL means the ring is full and the record is lost.
+*/
+static inline struct can_record *ringReserve(struct can_ring *ring)
+{
+	if (ring->head - ring->cachedTail > ring->mask)
+	{
+		ring->cachedTail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (ring->head - ring->cachedTail > ring->mask)
+		{
+			__atomic_store_n(&ring->drops, ring->drops + 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+	}
+	return &ring->slots[ring->head & ring->mask];
+}
+
+static inline void ringCommit(struct can_ring *ring)
+{
+	// only re-read the consumer's tail when the cached one hints at a new peak
+	uint64_t used = ring->head + 1 - ring->cachedTail;
+	if (used > ring->highWater)
+	{
+		ring->cachedTail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		used = ring->head + 1 - ring->cachedTail;
+		if (used > ring->highWater)
+			__atomic_store_n(&ring->highWater, used, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+	Consumer side: ringPeek() returns the oldest record or NULL when the
+	ring is empty, ringRelease() hands the slot back to the producer.
+*/
+static inline struct can_record *ringPeek(struct can_ring *ring)
+{
+	if (ring->tail == ring->cachedHead)
+	{
+		ring->cachedHead = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (ring->tail == ring->cachedHead)
+			return NULL;
+	}
+	return &ring->slots[ring->tail & ring->mask];
+}
+
+static inline void ringRelease(struct can_ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+#endif // CYBER_RING_H
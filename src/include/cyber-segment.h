@@ -0,0 +1,33 @@
+#ifndef CYBER_SEGMENT_H
+#define CYBER_SEGMENT_H
+
+#include <stdint.h>
+
+#define SEGMENT_QUEUE_LEN		8	// closed segments waiting for the worker
+#define SEGMENT_GZIP_LEVEL		6
+#define SEGMENT_CHUNK_SIZE		(64 * 1024)
+#define SEGMENT_WORKER_NICE		10	// keep compression behind capture
+#define SEGMENT_PATH_MAX		256
+
+struct segment_stats {
+	uint32_t segments;		// segments moved to the upload directory
+	uint32_t failed;		// left in place, queue full or I/O error
+	uint64_t inBytes;
+	uint64_t outBytes;
+	uint64_t maxRotateUs;		// slowest rotation seen by the writer
+};
+
+/*
+	Closed log segments are handed to a background worker which gzips
+	them (level 0 moves them as they are) into a temporary file in
+	uploadDir, syncs it and renames it into place, so the uploader never
+	sees a partial file. Without a started worker segmentSubmit() does
+	nothing and segments stay where they were written.
+*/
+int segmentWorkerStart(const char *uploadDir, int level);
+int segmentSubmit(const char *path, uint64_t rotateUs);
+int segmentSubmitEvent(const char *path);
+void segmentWorkerStop(void);
+void segmentGetStats(struct segment_stats *stats);
+
+#endif // CYBER_SEGMENT_H
@@ -0,0 +1,108 @@
+#ifndef CYBER_STS_H
+#define CYBER_STS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "cyber-dbc.h"
+
+/*
+	Signal time series (STS), a Gorilla style stream of decoded values.
+	Every signal fills its own chunk of at most STS_CHUNK_BYTES; a full
+	chunk is copied into the current block. Blocks are exactly
+	STS_BLOCK_SIZE bytes: a 16 byte header ("STSB", payload length,
+	chunk count, crc32 of the payload, little endian), the chunks and
+	zero padding. Chunks carry no state from earlier ones, so a damaged
+	block loses only its own samples.
+
+	Chunk: signal index, sample count and bit length as varints, then a
+	bit stream, most significant bit first:
+		first sample: time in unix ms (64 bits), value (64 bit double)
+		time, delta of delta in ms against the previous delta:
+			0				0
+			10 + 7 bits			-64..63
+			110 + 9 bits			-256..255
+			1110 + 12 bits			-2048..2047
+			1111 + 32 bits			int32
+		value, XOR with the previous one:
+			0				same value
+			10 + meaningful bits		inside the previous leading/trailing zero window
+			11 + 5 bits leading zeros + 6 bits length (0 = 64) + meaningful bits
+	A sample whose delta of delta does not fit 32 bits starts a new chunk.
+*/
+#define STS_BLOCK_SIGNATURE		"STSB"
+#define STS_BLOCK_SIZE			4096
+#define STS_BLOCK_HEADER_SIZE		16
+#define STS_CHUNK_BYTES			256	// bit stream bytes per chunk
+#define STS_CHUNK_HEADER_MAX		15	// three varints
+#define STS_SAMPLE_BITS_MAX		113	// 4 + 32 time bits, 2 + 5 + 6 + 64 value bits
+#define STS_TICK_NS			1000000	// ms: cycle jitter mostly stays inside one tick
+#define STS_FLUSH_INTERVAL_SEC		60	// partial chunks go out at least this often
+
+// sts_decode_info.error
+#define STS_ERROR_TRUNCATED		1
+#define STS_ERROR_CHUNK			2
+#define STS_ERROR_CALLBACK		3
+
+typedef int (*stsOutput)(const void *data, size_t len);
+
+struct sts_series {
+	int64_t lastTick;
+	int64_t lastDelta;
+	uint64_t lastBits;		// previous value as a double bit pattern
+	uint8_t leading;		// XOR window of the last stored value
+	uint8_t trailing;
+	uint16_t count;			// samples in the chunk, 0 = no chunk open
+	uint16_t bits;			// bits used in buf
+	uint8_t buf[STS_CHUNK_BYTES];
+};
+
+struct sts_stats {
+	uint64_t samples;
+	uint64_t chunks;
+	uint64_t blocks;
+	uint64_t bytes;			// block bytes handed to the output
+	uint64_t payload;		// chunk bytes in those blocks
+};
+
+struct sts_writer {
+	stsOutput out;
+	uint32_t signalCount;
+	struct sts_series *series;
+	uint8_t *block;
+	size_t used;			// payload bytes
+	uint32_t chunks;
+	time_t flushAt;			// frame clock second of the next stsTick() flush
+	struct sts_stats stats;
+};
+
+struct sts_sample {
+	uint32_t signal;
+	int64_t tick;			// unix ms
+	double value;
+};
+
+struct sts_decode_info {
+	uint64_t samples;
+	uint32_t chunks;
+	uint32_t blocks;
+	uint32_t damaged;		// blocks skipped on a bad header or checksum
+	int error;			// 0, or the reason decoding stopped early
+	size_t errorOffset;
+};
+
+typedef int (*stsSampleCallback)(const struct sts_sample *sample, void *arg);
+
+int stsWriterInit(struct sts_writer *w, uint32_t signals, stsOutput out);
+int stsAdd(struct sts_writer *w, const struct timespec *ts, const struct dbc_value *values,
+	int count);
+int stsTick(struct sts_writer *w, const struct timespec *now);
+int stsFlush(struct sts_writer *w);
+void stsPrintStats(const struct sts_writer *w);
+void stsWriterFree(struct sts_writer *w);
+
+int stsDecode(const uint8_t *buf, size_t len, stsSampleCallback cb, void *arg,
+	struct sts_decode_info *info);
+const char *stsErrorString(int error);
+
+#endif // CYBER_STS_H
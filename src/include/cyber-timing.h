@@ -0,0 +1,84 @@
+#ifndef CYBER_TIMING_H
+#define CYBER_TIMING_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define TIMING_MAX_IDS			512
+#define TIMING_TABLE_BITS		10
+#define TIMING_TABLE_SIZE		(1 << TIMING_TABLE_BITS)	// half full at most
+#define TIMING_MAX_CHANNELS		8
+#define TIMING_INTERVAL_MS		10000
+#define TIMING_PATH_MAX			256
+
+/*
+	Log-linear inter-arrival buckets in us: exact below 16 us, then 16
+	buckets per power of two, so a bucket is at most 1/16 wide relative
+	to its value. Gaps from 2^24 us (16.8 s) up share the last bucket.
+*/
+#define TIMING_SUB_BITS			4
+#define TIMING_SUB_BUCKETS		(1 << TIMING_SUB_BITS)
+#define TIMING_MAX_EXPONENT		23
+#define TIMING_BUCKETS			((TIMING_MAX_EXPONENT - TIMING_SUB_BITS + 2) * TIMING_SUB_BUCKETS)
+
+/*
+	One (channel, id). Written by the capture thread only; counters
+	only grow, so the reporter reads them without locks and a snapshot
+	is at most a few frames off between fields.
+*/
+struct timing_id {
+	uint32_t canId;			// with CAN_EFF_FLAG, 0 = free
+	uint8_t channel;
+	uint8_t used;
+	uint16_t reserved;
+	uint64_t lastNs;
+	uint64_t frames;
+	uint64_t gaps;			// histogram samples
+	uint64_t sumUs;
+	uint64_t sumSqUs;
+	uint32_t minUs;
+	uint32_t maxUs;
+	uint32_t buckets[TIMING_BUCKETS];
+};
+
+/*
+	Worst case bus time per frame, indexed by kind and length: bit
+	counts with the most stuff bits a frame of that length can carry,
+	at the nominal and (CAN FD with BRS) data bitrate.
+*/
+#define TIMING_KIND_STANDARD		0
+#define TIMING_KIND_EXTENDED		1
+#define TIMING_KIND_FD			2	// + extended
+#define TIMING_KIND_FD_BRS		4	// + extended
+#define TIMING_KINDS			6
+
+struct timing_channel {
+	uint32_t bitrate;		// 0 = not configured, no load
+	uint32_t dbitrate;
+	uint32_t frameNs[TIMING_KINDS][65];
+	uint64_t frames;
+	uint64_t busyNs;		// sum of frameNs of all frames
+};
+
+struct timing_stats {
+	uint32_t ids;
+	uint64_t overflow;		// frames of ids that found no slot
+	uint32_t snapshots;
+};
+
+int timingInit(void);
+void timingSetChannel(int channel, uint32_t bitrate, uint32_t dbitrate);
+uint32_t timingFrameNs(int channel, uint32_t canId, uint8_t flags, uint8_t len);
+void timingFrame(const struct timespec *ts, int channel, uint32_t canId, uint8_t flags,
+	uint8_t len);
+uint32_t timingBucket(uint32_t us);
+uint32_t timingBucketLow(uint32_t bucket);
+const struct timing_id *timingFind(int channel, uint32_t canId);
+uint64_t timingBusyNs(int channel);
+int timingWriteSnapshot(const char *path, double seconds);
+int timingStart(const char *path, uint32_t intervalMs);
+void timingStop(void);
+void timingGetStats(struct timing_stats *stats);
+void timingPrintStats(void);
+
+#endif // CYBER_TIMING_H
@@ -0,0 +1,75 @@
+#ifndef CYBER_TRIGGER_H
+#define CYBER_TRIGGER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <linux/can.h>
+#include "cyber-dbc.h"
+
+#define TRIGGER_DEFAULT_PRE_SEC		30
+#define TRIGGER_DEFAULT_POST_SEC	30
+#define TRIGGER_DEFAULT_FRAMES		131072	// ~30 s of a loaded 500 kbit/s bus, 10 MB
+#define TRIGGER_MAX_RULES		8
+#define TRIGGER_NAME_MAX		96
+#define TRIGGER_PATH_MAX		256
+#define TRIGGER_DRAIN_BATCH		64	// history frames exported per captured frame
+#define TRIGGER_ACCEL_POLL_MS		10
+#define TRIGGER_ACCEL_GRAVITY_MS	1000	// time constant of the gravity estimate
+#define TRIGGER_STANDARD_GRAVITY	9.80665
+
+#define TRIGGER_RULE_SIGNAL		0
+#define TRIGGER_RULE_ACCEL		1
+#define TRIGGER_RULE_CHANGE		2
+
+/*
+	A rule fires when its value crosses the threshold and is re-armed
+	when the value is back on the other side; a change rule fires every
+	time the decoded value differs from the one before, e.g. a new DTC
+	in DM1 while the previous one stays active. "accel" is the magnitude
+	of the accelerometer reading minus a slowly tracked gravity vector,
+	in g.
+*/
+struct trigger_rule {
+	int type;			// TRIGGER_RULE_*
+	int signal;			// index into dbc.signals
+	int above;			// 1: fires on > threshold, 0: on <
+	int armed;			// change rules: a previous value was seen
+	double threshold;		// change rules: the previous value
+	char name[TRIGGER_NAME_MAX];
+};
+
+// history record, one per captured frame
+struct trigger_frame {
+	uint64_t ns;			// frame timestamp, CLOCK_REALTIME
+	uint32_t canId;
+	uint8_t channel;
+	uint8_t flags;			// canfd_frame flags, CANFD_FDF for CAN FD
+	uint8_t len;
+	uint8_t reserved;
+	uint8_t data[CANFD_MAX_DLEN];
+};
+
+struct trigger_stats {
+	uint64_t triggers;		// rules that fired
+	uint64_t merged;		// of those, extended an event already running
+	uint32_t events;		// event segments written
+	uint32_t failed;		// event segments that could not be written
+	uint64_t frames;		// frames exported into event segments
+	uint64_t lost;			// frames overwritten before they were exported
+};
+
+typedef int (*triggerFindSignal)(const char *name);
+
+int trgInit(const char *dir, uint32_t preSec, uint32_t postSec, uint32_t frames);
+int trgAddRule(const char *rule, triggerFindSignal find);
+int trgStart(void);
+void trgFrame(const struct timespec *ts, int channel, const struct canfd_frame *frame);
+void trgSignals(const struct timespec *ts, const struct dbc_value *values, int count);
+void trgFire(uint64_t ns, const char *reason);
+void trgTick(const struct timespec *now);
+void trgStop(void);
+void trgGetStats(struct trigger_stats *stats);
+void trgPrintStats(void);
+void trgFree(void);
+
+#endif // CYBER_TRIGGER_H
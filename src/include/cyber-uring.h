@@ -0,0 +1,41 @@
+#ifndef CYBER_URING_H
+#define CYBER_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*
+	Minimal io_uring wrapper on the raw syscalls, the target sysroot has
+	no liburing. One submitter thread, completions reaped by the same
+	thread.
+*/
+struct uring {
+	int fd;
+	void *sqMap;
+	size_t sqMapLen;
+	void *cqMap;
+	size_t cqMapLen;
+	struct io_uring_sqe *sqes;
+	size_t sqesLen;
+
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_cqe *cqes;
+
+	unsigned entries;
+	unsigned inflight;
+};
+
+int uringInit(struct uring *u, unsigned entries);
+int uringWrite(struct uring *u, int fd, const void *buf, size_t len, uint64_t offset,
+	int sqeFlags, uint64_t userData);
+int uringComplete(struct uring *u, int wait, uint64_t *userData, int *res);
+void uringFree(struct uring *u);
+
+#endif // CYBER_URING_H
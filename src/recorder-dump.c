@@ -0,0 +1,104 @@
+/*
+	recorder-dump: writes the committed records of a flight recorder
+	file as ASC, oldest first.
+	usage: recorder-dump [-o out.asc] canrec.bin
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/cyber-canbus.h"
+#include "include/cyber-recorder.h"
+#include "include/cyber-asc.h"
+
+#define DUMP_OUTPUT_BUFFER		(1 * 1024 * 1024)
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-o out.asc] recorder-file\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct recorder rec;
+	const char *outPath = NULL;
+	FILE *out = stdout;
+	uint64_t invalid = 0;
+	uint64_t dumped = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o':
+			outPath = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (recorderMap(&rec, argv[optind]) != 0)
+		return 1;
+
+	if (outPath != NULL && (out = fopen(outPath, "w")) == NULL)
+	{
+		perror(outPath);
+		recorderClose(&rec);
+		return 1;
+	}
+	setvbuf(out, NULL, _IOFBF, DUMP_OUTPUT_BUFFER);
+
+	// the slot at head may be half overwritten, so it is never dumped
+	uint64_t first = rec.head >= rec.capacity ? rec.head - rec.capacity + 1 : 0;
+	uint64_t base = 0;
+
+	for (uint64_t seq = first; seq < rec.head; seq++)
+	{
+		const struct recorder_record *r = &rec.records[seq % rec.capacity];
+		char line[ASC_LINE_MAX];
+
+		if (r->seq != seq)
+		{
+			invalid++;
+			continue;
+		}
+
+		if (dumped == 0)
+		{
+			time_t start = r->ns / 1000000000;
+			base = (uint64_t)start * 1000000000;
+			fprintf(out, "date,%sbase hex timestamps absolute\nno interval events logged\n",
+				ctime(&start));
+		}
+
+		uint64_t ns = r->ns - base;
+		int len;
+		if (r->flags & CANFD_FDF)
+			len = ascFormatFdFrame(line, ns / 1000000000, ns % 1000000000, r->channel,
+				r->canId, "Rx", r->flags & CANFD_BRS, r->flags & CANFD_ESI, r->len, r->data);
+		else
+			len = ascFormatFrame(line, ns / 1000000000, ns % 1000000000, r->channel,
+				r->canId, "Rx", r->len, r->data);
+		fwrite(line, 1, len, out);
+		dumped++;
+	}
+
+	int status = fclose(out) == 0 ? 0 : 1;
+	fprintf(stderr, "Dumped %llu records (seq %llu..%llu), %llu invalid, capacity %llu\n",
+		(unsigned long long)dumped, (unsigned long long)first,
+		(unsigned long long)(rec.head ? rec.head - 1 : 0), (unsigned long long)invalid,
+		(unsigned long long)rec.capacity);
+
+	recorderClose(&rec);
+	return status;
+}
@@ -0,0 +1,147 @@
+/*
+	sts-convert: turn a signal time series file (canbus-app -S) into
+	text, one sample per line: "<unix time> <signal> <value>". With the
+	DBC canbus-app decoded with, signals are printed as message.signal,
+	otherwise by index. Samples come chunk by chunk, in time order
+	within a signal.
+	usage: sts-convert [-d file.dbc] [-o out.txt] input.sts
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "include/cyber-sts.h"
+
+#define CONVERT_OUTPUT_BUFFER		(1 * 1024 * 1024)
+
+struct convert_state {
+	FILE *out;
+	const struct dbc *db;		// NULL: signals by index
+	uint64_t bytes;
+};
+
+static int writeSample(const struct sts_sample *s, void *arg)
+{
+	struct convert_state *c = arg;
+	int len;
+
+	if (c->db != NULL && s->signal < c->db->signalCount)
+	{
+		const struct dbc_signal_info *info = &c->db->info[s->signal];
+		len = fprintf(c->out, "%lld.%03lld %s.%s %.17g\n", (long long)(s->tick / 1000),
+			(long long)(s->tick % 1000), c->db->messages[info->message].name, info->name,
+			s->value);
+	}
+	else
+		len = fprintf(c->out, "%lld.%03lld %u %.17g\n", (long long)(s->tick / 1000),
+			(long long)(s->tick % 1000), s->signal, s->value);
+
+	if (len < 0)
+		return -1;
+	c->bytes += len;
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d file.dbc] [-o out.txt] input.sts\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sts_decode_info info;
+	struct convert_state state = { .out = stdout };
+	struct dbc db = { 0 };
+	struct stat st;
+	const char *outPath = NULL;
+	const char *dbcPath = NULL;
+	const uint8_t *map;
+	int status = 0;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "d:o:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'd':
+			dbcPath = optarg;
+			break;
+		case 'o':
+			outPath = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if (dbcPath != NULL)
+	{
+		if (dbcLoad(&db, dbcPath) != 0)
+			return 1;
+		state.db = &db;
+	}
+
+	fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		perror(argv[optind]);
+		dbcFree(&db);
+		return 1;
+	}
+	if (st.st_size < STS_BLOCK_SIZE)
+	{
+		fprintf(stderr, "%s: not a signal time series file\n", argv[optind]);
+		close(fd);
+		dbcFree(&db);
+		return 1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		perror("mmap");
+		dbcFree(&db);
+		return 1;
+	}
+	madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+	if (outPath != NULL && (state.out = fopen(outPath, "w")) == NULL)
+	{
+		perror(outPath);
+		munmap((void *)map, st.st_size);
+		dbcFree(&db);
+		return 1;
+	}
+	setvbuf(state.out, NULL, _IOFBF, CONVERT_OUTPUT_BUFFER);
+
+	if (stsDecode(map, st.st_size, writeSample, &state, &info) != 0)
+	{
+		fprintf(stderr, "%s: %s at offset %zu\n", argv[optind],
+			stsErrorString(info.error), info.errorOffset);
+		status = 1;
+	}
+	if (info.damaged != 0)
+	{
+		fprintf(stderr, "%s: %u damaged blocks skipped\n", argv[optind], info.damaged);
+		status = 1;
+	}
+	if (fclose(state.out) != 0)
+		status = 1;
+
+	fprintf(stderr, "%llu samples in %u chunks, %u blocks, %lld bytes -> %llu bytes text (%.1fx)\n",
+		(unsigned long long)info.samples, info.chunks, info.blocks, (long long)st.st_size,
+		(unsigned long long)state.bytes, st.st_size ? (double)state.bytes / st.st_size : 0);
+
+	munmap((void *)map, st.st_size);
+	dbcFree(&db);
+	return status;
+}